@@ -0,0 +1,554 @@
+"""Command line interface to the LZ4 frame format.
+
+Run as ``python -m lz4``. Files are compressed to, and decompressed from, the
+LZ4 frame format with the same settings as `lz4.frame.LZ4FrameCompressor`, so
+that files written here and from Python can be exchanged freely. ``-b`` runs a
+benchmark on the given files instead, reporting the compression ratio and
+speeds for a range of compression levels.
+
+With ``-T`` set to more than one thread, compression splits the input into
+blocks which are compressed in parallel, which requires independent blocks.
+Decompression can only run in parallel over separate frames, such as those of
+concatenated files; a single frame is decompressed on one thread.
+
+Frames compressed with a dictionary (``-D``) are assembled here from
+`lz4.block` compressed blocks, and decompressed the same way, since the frame
+bindings take no dictionary.
+
+"""
+
+import argparse
+import collections
+import mmap
+import os
+import re
+import struct
+import sys
+import time
+from concurrent.futures import ThreadPoolExecutor
+
+import lz4
+import lz4.block
+import lz4.frame
+from lz4.xxhash import XXH32, xxh32
+
+
+_FRAME_MAGIC = 0x184D2204
+_SKIPPABLE_MAGIC = 0x184D2A50
+_SKIPPABLE_MASK = 0xFFFFFFF0
+_FILTER_MAGIC = 0x184D2A5E
+_FILTER_TAGS = (b'DLTA', b'SHUF')
+_UNCOMPRESSED_BLOCK = 0x80000000
+
+_FLG_VERSION = 0x40
+_FLG_INDEPENDENT = 0x20
+_FLG_BLOCK_CHECKSUM = 0x10
+_FLG_CONTENT_SIZE = 0x08
+_FLG_CONTENT_CHECKSUM = 0x04
+_FLG_DICT_ID = 0x01
+
+# Dictionaries, like the history of linked blocks, are limited to 64 kB.
+_HISTORY_SIZE = 64 * 1024
+
+# Maximum block sizes by block size ID, as stored in the BD byte.
+_BLOCK_SIZES = {
+    lz4.frame.BLOCKSIZE_MAX64KB: 64 * 1024,
+    lz4.frame.BLOCKSIZE_MAX256KB: 256 * 1024,
+    lz4.frame.BLOCKSIZE_MAX1MB: 1024 * 1024,
+    lz4.frame.BLOCKSIZE_MAX4MB: 4 * 1024 * 1024,
+}
+
+_BLOCK_SIZE_NAMES = {
+    '4': lz4.frame.BLOCKSIZE_MAX64KB,
+    '64KB': lz4.frame.BLOCKSIZE_MAX64KB,
+    '5': lz4.frame.BLOCKSIZE_MAX256KB,
+    '256KB': lz4.frame.BLOCKSIZE_MAX256KB,
+    '6': lz4.frame.BLOCKSIZE_MAX1MB,
+    '1MB': lz4.frame.BLOCKSIZE_MAX1MB,
+    '7': lz4.frame.BLOCKSIZE_MAX4MB,
+    '4MB': lz4.frame.BLOCKSIZE_MAX4MB,
+}
+
+_HC_LEVEL_MIN = 3
+
+_READ_SIZE = 1024 * 1024
+
+_U32 = struct.Struct('<I')
+
+_SUFFIX = '.lz4'
+
+
+class _Error(Exception):
+    pass
+
+
+def _header_size(flg):
+    size = 7
+    if flg & _FLG_CONTENT_SIZE:
+        size += 8
+    if flg & _FLG_DICT_ID:
+        size += 4
+    return size
+
+
+def _block_size(args):
+    return _BLOCK_SIZES.get(args.block_size, 64 * 1024)
+
+
+def _parallel(args, dictionary):
+    return args.threads > 1 or dictionary is not None
+
+
+def _frame_options(args):
+    return dict(
+        block_size=args.block_size,
+        block_linked=not args.independent,
+        compression_level=args.level,
+        content_checksum=args.content_checksum,
+        block_checksum=args.block_checksum,
+        favor_decompression_speed=args.favor_decompression_speed,
+        filter=args.filter,
+        itemsize=args.itemsize,
+    )
+
+
+# Frames assembled from blocks
+
+
+def _frame_header(args):
+    flg = _FLG_VERSION | _FLG_INDEPENDENT
+    if args.block_checksum:
+        flg |= _FLG_BLOCK_CHECKSUM
+    if args.content_checksum:
+        flg |= _FLG_CONTENT_CHECKSUM
+    block_size_id = args.block_size
+    if block_size_id not in _BLOCK_SIZES:
+        block_size_id = lz4.frame.BLOCKSIZE_MAX64KB
+    descriptor = bytes([flg, block_size_id << 4])
+    checksum = (xxh32(descriptor) >> 8) & 0xFF
+    return _U32.pack(_FRAME_MAGIC) + descriptor + bytes([checksum])
+
+
+def _compress_block(chunk, args, dictionary):
+    if args.level >= _HC_LEVEL_MIN:
+        compressed = lz4.block.compress(
+            chunk,
+            mode='high_compression',
+            compression=args.level,
+            store_size=False,
+            dict=dictionary,
+            favor_decompression_speed=args.favor_decompression_speed,
+        )
+    else:
+        compressed = lz4.block.compress(chunk, store_size=False,
+                                        dict=dictionary)
+    if len(compressed) < len(chunk):
+        parts = [_U32.pack(len(compressed)), compressed]
+    else:
+        compressed = bytes(chunk)
+        parts = [_U32.pack(len(compressed) | _UNCOMPRESSED_BLOCK), compressed]
+    if args.block_checksum:
+        parts.append(_U32.pack(xxh32(compressed)))
+    return b''.join(parts)
+
+
+def _write_frame(chunks, write, args, dictionary):
+    # Blocks are compressed independently and in parallel, keeping at most
+    # two per thread in flight so that memory use is bounded.
+    write(_frame_header(args))
+    checksum = XXH32() if args.content_checksum else None
+    pending = collections.deque()
+    with ThreadPoolExecutor(max_workers=args.threads) as executor:
+        for chunk in chunks:
+            if checksum is not None:
+                checksum.update(chunk)
+            pending.append(
+                executor.submit(_compress_block, chunk, args, dictionary)
+            )
+            if len(pending) >= 2 * args.threads:
+                write(pending.popleft().result())
+        while pending:
+            write(pending.popleft().result())
+    write(_U32.pack(0))
+    if checksum is not None:
+        write(_U32.pack(checksum.intdigest()))
+
+
+def _frames(data):
+    # Split concatenated frames into units that can be decompressed on their
+    # own: each frame together with any filter header before it. Other
+    # skippable frames are dropped.
+    units = []
+    start = pos = 0
+    size = len(data)
+    while pos < size:
+        if size - pos < 8:
+            raise _Error('truncated frame')
+        magic = _U32.unpack_from(data, pos)[0]
+        if magic & _SKIPPABLE_MASK == _SKIPPABLE_MAGIC:
+            length = _U32.unpack_from(data, pos + 4)[0]
+            end = pos + 8 + length
+            if end > size:
+                raise _Error('truncated skippable frame')
+            if not (magic == _FILTER_MAGIC and
+                    bytes(data[pos + 8:pos + 12]) in _FILTER_TAGS):
+                start = end
+            pos = end
+            continue
+        if magic != _FRAME_MAGIC:
+            raise _Error('not an LZ4 frame')
+        flg = data[pos + 4]
+        pos += _header_size(flg)
+        block_checksum = 4 if flg & _FLG_BLOCK_CHECKSUM else 0
+        while True:
+            if pos + 4 > size:
+                raise _Error('truncated frame')
+            block = _U32.unpack_from(data, pos)[0]
+            pos += 4
+            if block == 0:
+                break
+            pos += (block & ~_UNCOMPRESSED_BLOCK) + block_checksum
+        if flg & _FLG_CONTENT_CHECKSUM:
+            pos += 4
+        if pos > size:
+            raise _Error('truncated frame')
+        units.append((start, pos))
+        start = pos
+    return units
+
+
+def _decompress_frame(data, dictionary):
+    # Decompress one frame block by block, with the dictionary as the history
+    # of the first block, or of every block if they are independent.
+    if _U32.unpack_from(data, 0)[0] != _FRAME_MAGIC:
+        raise _Error('filtered frames cannot be used with a dictionary')
+    flg = data[4]
+    max_block = _BLOCK_SIZES.get((data[5] >> 4) & 0x7)
+    if max_block is None:
+        raise _Error('invalid block size in frame header')
+    pos = _header_size(flg)
+    history = dictionary
+    checksum = XXH32() if flg & _FLG_CONTENT_CHECKSUM else None
+    out = []
+    while True:
+        block = _U32.unpack_from(data, pos)[0]
+        pos += 4
+        if block == 0:
+            break
+        length = block & ~_UNCOMPRESSED_BLOCK
+        compressed = data[pos:pos + length]
+        pos += length
+        if flg & _FLG_BLOCK_CHECKSUM:
+            if _U32.unpack_from(data, pos)[0] != xxh32(compressed):
+                raise _Error('block checksum mismatch')
+            pos += 4
+        if block & _UNCOMPRESSED_BLOCK:
+            decompressed = bytes(compressed)
+        else:
+            decompressed = lz4.block.decompress(
+                compressed, uncompressed_size=max_block, dict=history
+            )
+        if not flg & _FLG_INDEPENDENT:
+            history = (history + decompressed)[-_HISTORY_SIZE:]
+        if checksum is not None:
+            checksum.update(decompressed)
+        out.append(decompressed)
+    if checksum is not None:
+        if _U32.unpack_from(data, pos)[0] != checksum.intdigest():
+            raise _Error('content checksum mismatch')
+    return b''.join(out)
+
+
+def _decompress_frames(data, write, args, dictionary):
+    view = memoryview(data)
+    if dictionary is None:
+        def decompress(unit):
+            return lz4.frame.decompress(unit)
+    else:
+        def decompress(unit):
+            return _decompress_frame(unit, dictionary)
+    pending = collections.deque()
+    with ThreadPoolExecutor(max_workers=args.threads) as executor:
+        for start, end in _frames(view):
+            pending.append(executor.submit(decompress, view[start:end]))
+            if len(pending) >= 2 * args.threads:
+                write(pending.popleft().result())
+        while pending:
+            write(pending.popleft().result())
+
+
+# Streams
+
+
+def _chunks(source, size):
+    while True:
+        chunk = source.read(size)
+        if not chunk:
+            return
+        yield chunk
+
+
+def _compress_stream(source, write, args, dictionary):
+    if _parallel(args, dictionary):
+        _write_frame(_chunks(source, _block_size(args)), write, args,
+                     dictionary)
+        return
+    compressor = lz4.frame.LZ4FrameCompressor(**_frame_options(args))
+    write(compressor.begin())
+    for chunk in _chunks(source, _READ_SIZE):
+        write(compressor.compress(chunk))
+    write(compressor.flush())
+
+
+def _decompress_stream(source, write, args, dictionary):
+    if _parallel(args, dictionary):
+        # Frame boundaries are only known once the blocks have been walked,
+        # so the whole input is needed: mapped if it's a file, read if not.
+        # The map is unmapped once the last view of it is released, which
+        # may be after an exception's traceback is gone.
+        try:
+            data = mmap.mmap(source.fileno(), 0, access=mmap.ACCESS_READ)
+        except (AttributeError, OSError, ValueError):
+            data = source.read()
+        _decompress_frames(data, write, args, dictionary)
+        return
+    decompressor = lz4.frame.LZ4FrameDecompressor()
+    in_frame = False
+    for chunk in _chunks(source, _READ_SIZE):
+        while chunk:
+            write(decompressor.decompress(chunk))
+            in_frame = not decompressor.eof
+            if in_frame:
+                break
+            chunk = decompressor.unused_data
+    if in_frame:
+        raise _Error('truncated frame')
+
+
+# Whole buffers, for the benchmark
+
+
+def _compress_buffer(data, args, dictionary):
+    if not _parallel(args, dictionary):
+        return lz4.frame.compress(data, **_frame_options(args))
+    view = memoryview(data)
+    size = _block_size(args)
+    chunks = (view[i:i + size] for i in range(0, len(view), size))
+    out = []
+    _write_frame(chunks, out.append, args, dictionary)
+    return b''.join(out)
+
+
+def _decompress_buffer(data, args, dictionary):
+    if not _parallel(args, dictionary):
+        return lz4.frame.decompress(data)
+    out = []
+    _decompress_frames(data, out.append, args, dictionary)
+    return b''.join(out)
+
+
+def _timed(function, min_time):
+    # Repeat the call until at least min_time seconds have passed, returning
+    # the last result and the mean time per call.
+    runs = 0
+    start = time.perf_counter()
+    while True:
+        result = function()
+        runs += 1
+        elapsed = time.perf_counter() - start
+        if elapsed >= min_time:
+            return result, elapsed / runs
+
+
+def _benchmark(args, dictionary, out):
+    levels = range(args.level, max(args.level, args.end_level) + 1)
+    out.write('{:<24} {:>5} {:>12} {:>8} {:>12} {:>12}\n'.format(
+        'file', 'level', 'compressed', 'ratio', 'comp MB/s', 'decomp MB/s'))
+    for filename in args.files:
+        with open(filename, 'rb') as source:
+            data = source.read()
+        name = os.path.basename(filename)
+        for level in levels:
+            args.level = level
+            compressed, compress_time = _timed(
+                lambda: _compress_buffer(data, args, dictionary),
+                args.bench_time,
+            )
+            decompressed, decompress_time = _timed(
+                lambda: _decompress_buffer(compressed, args, dictionary),
+                args.bench_time,
+            )
+            if decompressed != data:
+                raise _Error('{}: round trip mismatch at level {}'.format(
+                    filename, level))
+            out.write('{:<24} {:>5} {:>12} {:>8.3f} {:>12.1f} {:>12.1f}\n'
+                      .format(name[:24], level, len(compressed),
+                              len(data) / max(len(compressed), 1),
+                              len(data) / compress_time / 1e6,
+                              len(data) / decompress_time / 1e6))
+            out.flush()
+
+
+# Command line
+
+
+def _output_name(filename, decompress):
+    if not decompress:
+        return filename + _SUFFIX
+    if filename.endswith(_SUFFIX):
+        return filename[:-len(_SUFFIX)]
+    raise _Error('{}: unknown suffix, use -o or -c'.format(filename))
+
+
+def _process(filename, output, args, dictionary):
+    stdout = sys.stdout.buffer
+    if output == '-' and not args.decompress and not args.force \
+       and stdout.isatty():
+        raise _Error('refusing to write compressed data to a terminal, '
+                     'use -f to force')
+    if output != '-' and not args.force and os.path.exists(output):
+        raise _Error('{}: already exists, use -f to overwrite'.format(output))
+    if filename == '-':
+        source = sys.stdin.buffer
+    else:
+        source = open(filename, 'rb')
+    try:
+        target = stdout if output == '-' else open(output, 'wb')
+        try:
+            if args.decompress:
+                _decompress_stream(source, target.write, args, dictionary)
+            else:
+                _compress_stream(source, target.write, args, dictionary)
+        finally:
+            if target is stdout:
+                target.flush()
+            else:
+                target.close()
+    finally:
+        if source is not sys.stdin.buffer:
+            source.close()
+    if args.remove and filename != '-':
+        os.remove(filename)
+
+
+def _parser():
+    parser = argparse.ArgumentParser(
+        prog='python -m lz4',
+        description='Compress or decompress files in the LZ4 frame format.',
+        epilog='Compression levels may also be given as -0 to -16.',
+    )
+    parser.add_argument('files', nargs='*', default=['-'], metavar='FILE',
+                        help="input files, '-' for standard input (default)")
+    action = parser.add_mutually_exclusive_group()
+    action.add_argument('-z', '--compress', action='store_true',
+                        help='compress (default)')
+    action.add_argument('-d', '--decompress', action='store_true',
+                        help='decompress')
+    action.add_argument('-b', '--benchmark', action='store_true',
+                        help='benchmark compression levels on the files')
+    parser.add_argument('-c', '--stdout', action='store_true',
+                        help='write to standard output')
+    parser.add_argument('-o', '--output', metavar='FILE',
+                        help='write to FILE, for a single input')
+    parser.add_argument('-f', '--force', action='store_true',
+                        help='overwrite existing files')
+    parser.add_argument('--rm', dest='remove', action='store_true',
+                        help='remove input files once processed')
+    parser.add_argument('-l', '--level', type=int,
+                        default=lz4.frame.COMPRESSIONLEVEL_MIN,
+                        help='compression level (default %(default)s)')
+    parser.add_argument('-T', '--threads', type=int, default=1,
+                        help='worker threads, 0 for one per CPU '
+                        '(default %(default)s)')
+    parser.add_argument('-B', '--block-size', default='0',
+                        choices=['0'] + sorted(_BLOCK_SIZE_NAMES),
+                        help='maximum block size: 4 or 64KB, 5 or 256KB, '
+                        '6 or 1MB, 7 or 4MB (default 64KB)')
+    parser.add_argument('--independent', action='store_true',
+                        help='compress blocks independently, implied by -T '
+                        'and -D')
+    parser.add_argument('--content-checksum', action='store_true',
+                        help='add a checksum of the content')
+    parser.add_argument('--block-checksum', action='store_true',
+                        help='add a checksum to each block')
+    parser.add_argument('--favor-decompression-speed', action='store_true',
+                        help='trade compression ratio for decompression '
+                        'speed at high levels')
+    parser.add_argument('--filter', choices=['delta', 'delta_of_delta',
+                                             'xor'],
+                        help='encode items before compression')
+    parser.add_argument('--itemsize', type=int, default=0,
+                        help='item size in bytes for --filter')
+    parser.add_argument('-D', '--dict', dest='dictionary', metavar='FILE',
+                        help='compress or decompress with a dictionary')
+    parser.add_argument('-e', '--end-level', type=int, default=-1,
+                        metavar='LEVEL',
+                        help='benchmark levels from -l up to LEVEL')
+    parser.add_argument('--bench-time', type=float, default=1.0,
+                        metavar='SECONDS',
+                        help='minimum time spent on each measurement '
+                        '(default %(default)s)')
+    parser.add_argument('-V', '--version', action='version',
+                        version='python-lz4 {} (LZ4 library {})'.format(
+                            lz4.VERSION, lz4.library_version_string()))
+    return parser
+
+
+def main(argv=None):
+    """Run the command line interface with the arguments ``argv``, or those
+    of the process, and return the exit status.
+
+    """
+    if argv is None:
+        argv = sys.argv[1:]
+    argv = [
+        '--level=' + arg[1:] if re.match(r'^-\d+$', arg) else arg
+        for arg in argv
+    ]
+    parser = _parser()
+    args = parser.parse_args(argv)
+
+    args.block_size = _BLOCK_SIZE_NAMES.get(args.block_size,
+                                            lz4.frame.BLOCKSIZE_DEFAULT)
+    if args.threads == 0:
+        args.threads = os.cpu_count() or 1
+    if args.threads < 1:
+        parser.error('the number of threads must not be negative')
+    if args.output is not None and len(args.files) > 1:
+        parser.error('-o can only be used with a single input file')
+    if args.filter is not None and args.itemsize < 1:
+        parser.error('--filter requires --itemsize')
+
+    try:
+        dictionary = None
+        if args.dictionary is not None:
+            with open(args.dictionary, 'rb') as source:
+                dictionary = source.read()[-_HISTORY_SIZE:]
+        if (args.filter is not None and
+                _parallel(args, dictionary) and not args.decompress):
+            raise _Error('--filter cannot be combined with -T or -D')
+
+        if args.benchmark:
+            if args.files == ['-']:
+                raise _Error('the benchmark needs input files')
+            _benchmark(args, dictionary, sys.stdout)
+            return 0
+
+        for filename in args.files:
+            if args.stdout:
+                output = '-'
+            elif args.output is not None:
+                output = args.output
+            elif filename == '-':
+                output = '-'
+            else:
+                output = _output_name(filename, args.decompress)
+            _process(filename, output, args, dictionary)
+    except (_Error, OSError, RuntimeError, ValueError) as e:
+        sys.stderr.write('{}: error: {}\n'.format(parser.prog, e))
+        return 1
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
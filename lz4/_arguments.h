@@ -0,0 +1,460 @@
+/*
+ * Copyright (c) 2024, the python-lz4 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* Argument parsing for METH_FASTCALL entry points.
+ *
+ * PyArg_ParseTupleAndKeywords needs the arguments packed in a tuple and a
+ * dict, which costs more than compressing a small message. The private
+ * _PyArg_Parser API used by Argument Clinic isn't available to extensions, so
+ * parse_fastcall_args provides the same calling convention as
+ * PyArg_ParseTupleAndKeywords for the vectorcall arguments, supporting the
+ * subset of format units used in this package:
+ *
+ *   y*  bytes-like object, into a Py_buffer
+ *   z*  like y*, but also accepts str (UTF-8 encoded) and None (empty buffer)
+ *   s   str, into a UTF-8 const char *
+ *   z   like s, but also accepts None, into NULL
+ *   p   truth value, into an int
+ *   i   int, into an int
+ *   I   int, into an unsigned int, without overflow checking
+ *   k   int, into an unsigned long, without overflow checking
+ *   n   int, into a Py_ssize_t
+ *   O   any object, into a borrowed PyObject *
+ *   |   the remaining arguments are optional
+ *
+ * Optional arguments that are not passed are left untouched. On failure, any
+ * Py_buffer acquired so far is released and 0 is returned with an exception
+ * set. */
+
+#ifndef PYTHON_LZ4_ARGUMENTS_H
+#define PYTHON_LZ4_ARGUMENTS_H
+
+#include <Python.h>
+#include <stdarg.h>
+#include <string.h>
+#include <limits.h>
+
+#define FASTCALL_ARGS_MAX 16
+
+/* Cast for the METH_FASTCALL | METH_KEYWORDS entries of PyMethodDef tables. */
+#define FASTCALL_FUNCTION(function) ((PyCFunction) (void (*) (void)) (function))
+
+static int
+parse_fastcall_int (PyObject * value, const char * fname, const char * name,
+                    long * result)
+{
+  if (PyFloat_Check (value))
+    {
+      PyErr_Format (PyExc_TypeError,
+                    "%s() argument '%s' must be int, not float",
+                    fname, name);
+      return 0;
+    }
+
+  *result = PyLong_AsLong (value);
+  if (*result == -1 && PyErr_Occurred ())
+    {
+      return 0;
+    }
+
+  return 1;
+}
+
+static int
+parse_fastcall_string (PyObject * value, const char * fname, const char * name,
+                       const char ** string)
+{
+  Py_ssize_t size;
+
+  if (!PyUnicode_Check (value))
+    {
+      PyErr_Format (PyExc_TypeError,
+                    "%s() argument '%s' must be str, not %.50s",
+                    fname, name, Py_TYPE (value)->tp_name);
+      return 0;
+    }
+
+  *string = PyUnicode_AsUTF8AndSize (value, &size);
+  if (*string == NULL)
+    {
+      return 0;
+    }
+
+  if (strlen (*string) != (size_t) size)
+    {
+      PyErr_SetString (PyExc_ValueError, "embedded null character");
+      return 0;
+    }
+
+  return 1;
+}
+
+static int
+parse_fastcall_args (PyObject * const * args, Py_ssize_t nargs,
+                     PyObject * kwnames, const char * fname,
+                     const char * format, char ** kwlist, ...)
+{
+  PyObject * values[FASTCALL_ARGS_MAX];
+  Py_buffer * buffers[FASTCALL_ARGS_MAX];
+  Py_ssize_t nbuffers = 0;
+  Py_ssize_t nparams = 0;
+  Py_ssize_t nrequired = -1;
+  Py_ssize_t nkwargs;
+  Py_ssize_t i, j;
+  const char * f;
+  va_list va;
+
+  for (f = format; *f; f++)
+    {
+      if (*f == '|')
+        {
+          nrequired = nparams;
+        }
+      else if (*f != '*')
+        {
+          if (nparams == FASTCALL_ARGS_MAX)
+            {
+              PyErr_Format (PyExc_SystemError,
+                            "%s(): too many arguments in format", fname);
+              return 0;
+            }
+          values[nparams++] = NULL;
+        }
+    }
+
+  if (nrequired < 0)
+    {
+      nrequired = nparams;
+    }
+
+  if (nargs > nparams)
+    {
+      PyErr_Format (PyExc_TypeError,
+                    "%s() takes at most %zd argument%s (%zd given)",
+                    fname, nparams, nparams == 1 ? "" : "s", nargs);
+      return 0;
+    }
+
+  for (i = 0; i < nargs; i++)
+    {
+      values[i] = args[i];
+    }
+
+  nkwargs = (kwnames == NULL) ? 0 : PyTuple_GET_SIZE (kwnames);
+  for (j = 0; j < nkwargs; j++)
+    {
+      PyObject * key = PyTuple_GET_ITEM (kwnames, j);
+
+      for (i = 0; i < nparams; i++)
+        {
+          if (PyUnicode_CompareWithASCIIString (key, kwlist[i]) == 0)
+            {
+              break;
+            }
+        }
+
+      if (i == nparams)
+        {
+          PyErr_Format (PyExc_TypeError,
+                        "'%U' is an invalid keyword argument for %s()",
+                        key, fname);
+          return 0;
+        }
+
+      if (values[i] != NULL)
+        {
+          PyErr_Format (PyExc_TypeError,
+                        "argument for %s() given by name ('%s') and position (%zd)",
+                        fname, kwlist[i], i + 1);
+          return 0;
+        }
+
+      values[i] = args[nargs + j];
+    }
+
+  for (i = 0; i < nrequired; i++)
+    {
+      if (values[i] == NULL)
+        {
+          PyErr_Format (PyExc_TypeError,
+                        "%s() missing required argument '%s' (pos %zd)",
+                        fname, kwlist[i], i + 1);
+          return 0;
+        }
+    }
+
+  va_start (va, kwlist);
+
+  for (f = format, i = 0; *f; f++)
+    {
+      PyObject * value;
+      const char * name;
+      long number;
+
+      if (*f == '|')
+        {
+          continue;
+        }
+
+      value = values[i];
+      name = kwlist[i];
+      i++;
+
+      switch (*f)
+        {
+        case 'z':
+          if (f[1] != '*')
+            {
+              const char ** string = va_arg (va, const char **);
+
+              if (value == NULL)
+                {
+                  break;
+                }
+
+              if (value == Py_None)
+                {
+                  *string = NULL;
+                }
+              else if (!parse_fastcall_string (value, fname, name, string))
+                {
+                  goto failure;
+                }
+              break;
+            }
+          /* Fall through */
+        case 'y':
+          {
+            Py_buffer * view = va_arg (va, Py_buffer *);
+            char unit = *f;
+
+            /* Skip the '*' of the format unit. */
+            f++;
+
+            if (value == NULL)
+              {
+                break;
+              }
+
+            if (unit == 'z' && value == Py_None)
+              {
+                PyBuffer_FillInfo (view, NULL, NULL, 0, 1, 0);
+              }
+            else if (unit == 'z' && PyUnicode_Check (value))
+              {
+                Py_ssize_t size;
+                const char * utf8 = PyUnicode_AsUTF8AndSize (value, &size);
+
+                if (utf8 == NULL)
+                  {
+                    goto failure;
+                  }
+                PyBuffer_FillInfo (view, value, (void *) utf8, size, 1, 0);
+              }
+            else if (PyObject_GetBuffer (value, view, PyBUF_SIMPLE) != 0)
+              {
+                goto failure;
+              }
+
+            buffers[nbuffers++] = view;
+            break;
+          }
+
+        case 's':
+          {
+            const char ** string = va_arg (va, const char **);
+
+            if (value == NULL)
+              {
+                break;
+              }
+
+            if (!parse_fastcall_string (value, fname, name, string))
+              {
+                goto failure;
+              }
+            break;
+          }
+
+        case 'p':
+          {
+            int * flag = va_arg (va, int *);
+            int truth;
+
+            if (value == NULL)
+              {
+                break;
+              }
+
+            truth = PyObject_IsTrue (value);
+            if (truth < 0)
+              {
+                goto failure;
+              }
+            *flag = truth;
+            break;
+          }
+
+        case 'i':
+          {
+            int * integer = va_arg (va, int *);
+
+            if (value == NULL)
+              {
+                break;
+              }
+
+            if (!parse_fastcall_int (value, fname, name, &number))
+              {
+                goto failure;
+              }
+
+            if (number > INT_MAX)
+              {
+                PyErr_SetString (PyExc_OverflowError,
+                                 "signed integer is greater than maximum");
+                goto failure;
+              }
+
+            if (number < INT_MIN)
+              {
+                PyErr_SetString (PyExc_OverflowError,
+                                 "signed integer is less than minimum");
+                goto failure;
+              }
+
+            *integer = (int) number;
+            break;
+          }
+
+        case 'I':
+        case 'k':
+          {
+            unsigned long mask;
+            char unit = *f;
+            void * destination = (unit == 'I')
+              ? (void *) va_arg (va, unsigned int *)
+              : (void *) va_arg (va, unsigned long *);
+
+            if (value == NULL)
+              {
+                break;
+              }
+
+            if (!PyLong_Check (value))
+              {
+                PyErr_Format (PyExc_TypeError,
+                              "%s() argument '%s' must be int, not %.50s",
+                              fname, name, Py_TYPE (value)->tp_name);
+                goto failure;
+              }
+
+            mask = PyLong_AsUnsignedLongMask (value);
+            if (mask == (unsigned long) -1 && PyErr_Occurred ())
+              {
+                goto failure;
+              }
+
+            if (unit == 'I')
+              {
+                *(unsigned int *) destination = (unsigned int) mask;
+              }
+            else
+              {
+                *(unsigned long *) destination = mask;
+              }
+            break;
+          }
+
+        case 'n':
+          {
+            Py_ssize_t * size = va_arg (va, Py_ssize_t *);
+            PyObject * index;
+
+            if (value == NULL)
+              {
+                break;
+              }
+
+            if (PyFloat_Check (value))
+              {
+                PyErr_Format (PyExc_TypeError,
+                              "%s() argument '%s' must be int, not float",
+                              fname, name);
+                goto failure;
+              }
+
+            index = PyNumber_Index (value);
+            if (index == NULL)
+              {
+                goto failure;
+              }
+            *size = PyLong_AsSsize_t (index);
+            Py_DECREF (index);
+            if (*size == -1 && PyErr_Occurred ())
+              {
+                goto failure;
+              }
+            break;
+          }
+
+        case 'O':
+          {
+            PyObject ** object = va_arg (va, PyObject **);
+
+            if (value != NULL)
+              {
+                *object = value;
+              }
+            break;
+          }
+
+        default:
+          PyErr_Format (PyExc_SystemError,
+                        "%s(): bad format unit '%c'", fname, *f);
+          goto failure;
+        }
+    }
+
+  va_end (va);
+  return 1;
+
+failure:
+  va_end (va);
+  for (j = 0; j < nbuffers; j++)
+    {
+      PyBuffer_Release (buffers[j]);
+    }
+  return 0;
+}
+
+#endif /* PYTHON_LZ4_ARGUMENTS_H */
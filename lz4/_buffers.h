@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2024, the python-lz4 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* Buffer lists for the scatter-gather entry points.
+ *
+ * get_buffer_list accepts either a single buffer-compatible object, or a list
+ * or tuple of them, and acquires a Py_buffer for each, so that the data can be
+ * processed in place without joining it first. The buffers are held until
+ * release_buffer_list is called, which makes it safe to use them with the GIL
+ * released. */
+
+#ifndef PYTHON_LZ4_BUFFERS_H
+#define PYTHON_LZ4_BUFFERS_H
+
+#include <Python.h>
+
+struct buffer_list
+{
+  Py_buffer * views;
+  Py_ssize_t count;
+  /* Sum of the lengths of all the buffers. */
+  size_t total;
+  /* Storage for views when a single buffer is passed. */
+  Py_buffer single;
+};
+
+static inline void
+release_buffer_list (struct buffer_list * list)
+{
+  Py_ssize_t i;
+
+  for (i = 0; i < list->count; i++)
+    {
+      PyBuffer_Release (&list->views[i]);
+    }
+
+  if (list->views != &list->single)
+    {
+      PyMem_Free (list->views);
+    }
+
+  list->views = NULL;
+  list->count = 0;
+  list->total = 0;
+}
+
+/* Moves the buffers held by source to destination, leaving source empty. */
+static inline void
+move_buffer_list (struct buffer_list * destination, struct buffer_list * source)
+{
+  *destination = *source;
+  if (source->views == &source->single)
+    {
+      destination->views = &destination->single;
+    }
+
+  source->views = NULL;
+  source->count = 0;
+  source->total = 0;
+}
+
+/* Acquires the buffers of object into list, with flags being PyBUF_SIMPLE for
+ * read-only or PyBUF_WRITABLE for writable buffers. Returns 0 on success, or -1
+ * with an exception set. */
+static inline int
+get_buffer_list (PyObject * object, int flags, const char * fname,
+                 const char * name, struct buffer_list * list)
+{
+  Py_ssize_t count;
+  Py_ssize_t i;
+
+  list->views = NULL;
+  list->count = 0;
+  list->total = 0;
+
+  if (PyObject_CheckBuffer (object))
+    {
+      if (PyObject_GetBuffer (object, &list->single, flags) != 0)
+        {
+          return -1;
+        }
+      list->views = &list->single;
+      list->count = 1;
+      list->total = (size_t) list->single.len;
+      return 0;
+    }
+
+  if (!PyList_Check (object) && !PyTuple_Check (object))
+    {
+      PyErr_Format (PyExc_TypeError,
+                    "%s() argument '%s' must be a bytes-like object or a list or tuple of them, not %.50s",
+                    fname, name, Py_TYPE (object)->tp_name);
+      return -1;
+    }
+
+  /* Take a copy of the items, as a list could be changed by the conversions
+   * below. */
+  object = PySequence_Tuple (object);
+  if (object == NULL)
+    {
+      return -1;
+    }
+
+  count = PyTuple_GET_SIZE (object);
+  list->views = PyMem_Malloc ((count > 0 ? count : 1) * sizeof (Py_buffer));
+  if (list->views == NULL)
+    {
+      Py_DECREF (object);
+      PyErr_NoMemory ();
+      return -1;
+    }
+
+  for (i = 0; i < count; i++)
+    {
+      PyObject * item = PyTuple_GET_ITEM (object, i);
+
+      if (PyObject_GetBuffer (item, &list->views[i], flags) != 0)
+        {
+          Py_DECREF (object);
+          release_buffer_list (list);
+          return -1;
+        }
+      list->count++;
+      list->total += (size_t) list->views[i].len;
+    }
+
+  Py_DECREF (object);
+  return 0;
+}
+
+/* Copies the contents of the buffers in list to destination, which must have
+ * room for list->total bytes. Safe to call with the GIL released. */
+static inline void
+gather_buffer_list (const struct buffer_list * list, char * destination)
+{
+  Py_ssize_t i;
+
+  for (i = 0; i < list->count; i++)
+    {
+      memcpy (destination, list->views[i].buf, (size_t) list->views[i].len);
+      destination += list->views[i].len;
+    }
+}
+
+/* Copies size bytes from source into the buffers in list, in order. Safe to
+ * call with the GIL released. */
+static inline void
+scatter_buffer_list (const struct buffer_list * list, const char * source,
+                     size_t size)
+{
+  Py_ssize_t i;
+
+  for (i = 0; i < list->count && size > 0; i++)
+    {
+      size_t length = (size_t) list->views[i].len;
+
+      if (length > size)
+        {
+          length = size;
+        }
+      memcpy (list->views[i].buf, source, length);
+      source += length;
+      size -= length;
+    }
+}
+
+#endif /* PYTHON_LZ4_BUFFERS_H */
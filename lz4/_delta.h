@@ -0,0 +1,433 @@
+/*
+ * Copyright (c) 2024, the python-lz4 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* Delta filters for arrays of little endian integers.
+ *
+ * The delta filter replaces each item by its difference from the previous
+ * one, which turns steadily increasing values such as timestamps into runs of
+ * the same small number. The delta of delta filter goes one step further, and
+ * the XOR filter stores the bits that changed from the previous item, which
+ * suits slowly changing floating point values. The first item is taken
+ * relative to zero.
+ *
+ * Carries only move towards the high bytes of an item, so the low bytes of a
+ * result are known as soon as the low bytes of the input are. This lets both
+ * directions write out exactly as many bytes as they're given, even when an
+ * item is split between calls: the bytes of an incomplete item are remembered
+ * in the state, and the item is finished once the rest of it arrives. */
+
+#ifndef PYTHON_LZ4_DELTA_H
+#define PYTHON_LZ4_DELTA_H
+
+#include <Python.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "_buffers.h"
+
+typedef enum
+{
+  DELTA_NONE = 0,
+  DELTA_PLAIN = 1,
+  DELTA_OF_DELTA = 2,
+  DELTA_XOR = 3
+} delta_e;
+
+struct delta_state
+{
+  delta_e kind;
+  size_t itemsize;
+  /* The previous item, and for DELTA_OF_DELTA the previous difference, both
+   * as unencoded values. */
+  uint64_t previous;
+  uint64_t previous_delta;
+  /* Input bytes of an item split between calls. */
+  unsigned char partial[8];
+  size_t partial_size;
+};
+
+/* Sets up state for the filter named name ("delta", "delta_of_delta" or
+ * "xor"), or for no filter if name is NULL. Returns 0 on success, or -1 with
+ * an exception set if the arguments are invalid. */
+static int
+init_delta_state (struct delta_state * state, const char * name,
+                  int itemsize)
+{
+  memset (state, 0, sizeof * state);
+
+  if (name == NULL)
+    {
+      return 0;
+    }
+
+  if (strcmp (name, "delta") == 0)
+    {
+      state->kind = DELTA_PLAIN;
+    }
+  else if (strcmp (name, "delta_of_delta") == 0)
+    {
+      state->kind = DELTA_OF_DELTA;
+    }
+  else if (strcmp (name, "xor") == 0)
+    {
+      state->kind = DELTA_XOR;
+    }
+  else
+    {
+      PyErr_Format (PyExc_ValueError,
+                    "filter must be 'delta', 'delta_of_delta' or 'xor', got '%s'",
+                    name);
+      return -1;
+    }
+
+  if (itemsize != 1 && itemsize != 2 && itemsize != 4 && itemsize != 8)
+    {
+      PyErr_Format (PyExc_ValueError,
+                    "itemsize must be 1, 2, 4 or 8 with a filter, got %d",
+                    itemsize);
+      return -1;
+    }
+
+  state->itemsize = (size_t) itemsize;
+  return 0;
+}
+
+/* Returns the name init_delta_state takes for kind, or NULL for DELTA_NONE. */
+static inline const char *
+delta_name (delta_e kind)
+{
+  switch (kind)
+    {
+    case DELTA_PLAIN:
+      return "delta";
+    case DELTA_OF_DELTA:
+      return "delta_of_delta";
+    case DELTA_XOR:
+      return "xor";
+    default:
+      return NULL;
+    }
+}
+
+static inline uint64_t
+delta_load (const unsigned char * src, size_t size)
+{
+  uint64_t x = 0;
+  size_t i;
+
+  for (i = size; i > 0; i--)
+    {
+      x = (x << 8) | src[i - 1];
+    }
+  return x;
+}
+
+static inline void
+delta_store (unsigned char * dst, uint64_t x, size_t size)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    {
+      dst[i] = (unsigned char) (x >> (8 * i));
+    }
+}
+
+/* Encodes or decodes one item, updating the state only if commit is set. The
+ * high bytes of an incomplete item are zero, which leaves its low bytes
+ * right. */
+static inline uint64_t
+delta_step (struct delta_state * state, uint64_t x, int decode, int commit)
+{
+  uint64_t value, delta, result;
+
+  switch (state->kind)
+    {
+    case DELTA_XOR:
+      result = x ^ state->previous;
+      value = decode ? result : x;
+      delta = 0;
+      break;
+    case DELTA_OF_DELTA:
+      if (decode)
+        {
+          delta = state->previous_delta + x;
+          value = state->previous + delta;
+          result = value;
+        }
+      else
+        {
+          delta = x - state->previous;
+          value = x;
+          result = delta - state->previous_delta;
+        }
+      break;
+    default:
+      result = decode ? state->previous + x : x - state->previous;
+      value = decode ? result : x;
+      delta = 0;
+      break;
+    }
+
+  if (commit)
+    {
+      state->previous = value;
+      state->previous_delta = delta;
+    }
+  return result;
+}
+
+/* The loops for whole items, one per item size, so that the compiler can
+ * vectorise the encoding loops. Items are little endian. */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define DELTA_NATIVE_LE 0
+#else
+#define DELTA_NATIVE_LE 1
+#endif
+
+#define DELTA_LOOPS(bits)                                               \
+  static void                                                           \
+  delta_encode_##bits (struct delta_state * state,                      \
+                       const unsigned char * src, unsigned char * dst,  \
+                       size_t count)                                    \
+  {                                                                     \
+    uint##bits##_t previous = (uint##bits##_t) state->previous;         \
+    uint##bits##_t previous_delta = (uint##bits##_t) state->previous_delta; \
+    uint##bits##_t x, delta;                                            \
+    delta_e kind = state->kind;                                         \
+    size_t i;                                                           \
+                                                                        \
+    for (i = 0; i < count; i++)                                         \
+      {                                                                 \
+        if (DELTA_NATIVE_LE)                                            \
+          {                                                             \
+            memcpy (&x, src + i * sizeof x, sizeof x);                  \
+          }                                                             \
+        else                                                            \
+          {                                                             \
+            x = (uint##bits##_t) delta_load (src + i * sizeof x, sizeof x); \
+          }                                                             \
+        delta = (uint##bits##_t) (x - previous);                        \
+        if (kind == DELTA_XOR)                                          \
+          {                                                             \
+            delta = x ^ previous;                                       \
+          }                                                             \
+        else if (kind == DELTA_OF_DELTA)                                \
+          {                                                             \
+            uint##bits##_t result = (uint##bits##_t) (delta - previous_delta); \
+            previous_delta = delta;                                     \
+            delta = result;                                             \
+          }                                                             \
+        previous = x;                                                   \
+        if (DELTA_NATIVE_LE)                                            \
+          {                                                             \
+            memcpy (dst + i * sizeof x, &delta, sizeof x);              \
+          }                                                             \
+        else                                                            \
+          {                                                             \
+            delta_store (dst + i * sizeof x, delta, sizeof x);          \
+          }                                                             \
+      }                                                                 \
+                                                                        \
+    state->previous = previous;                                         \
+    state->previous_delta = previous_delta;                             \
+  }                                                                     \
+                                                                        \
+  static void                                                           \
+  delta_decode_##bits (struct delta_state * state,                      \
+                       const unsigned char * src, unsigned char * dst,  \
+                       size_t count)                                    \
+  {                                                                     \
+    uint##bits##_t previous = (uint##bits##_t) state->previous;         \
+    uint##bits##_t previous_delta = (uint##bits##_t) state->previous_delta; \
+    uint##bits##_t x;                                                   \
+    delta_e kind = state->kind;                                         \
+    size_t i;                                                           \
+                                                                        \
+    for (i = 0; i < count; i++)                                         \
+      {                                                                 \
+        if (DELTA_NATIVE_LE)                                            \
+          {                                                             \
+            memcpy (&x, src + i * sizeof x, sizeof x);                  \
+          }                                                             \
+        else                                                            \
+          {                                                             \
+            x = (uint##bits##_t) delta_load (src + i * sizeof x, sizeof x); \
+          }                                                             \
+        if (kind == DELTA_XOR)                                          \
+          {                                                             \
+            previous ^= x;                                              \
+          }                                                             \
+        else if (kind == DELTA_OF_DELTA)                                \
+          {                                                             \
+            previous_delta = (uint##bits##_t) (previous_delta + x);     \
+            previous = (uint##bits##_t) (previous + previous_delta);    \
+          }                                                             \
+        else                                                            \
+          {                                                             \
+            previous = (uint##bits##_t) (previous + x);                 \
+          }                                                             \
+        if (DELTA_NATIVE_LE)                                            \
+          {                                                             \
+            memcpy (dst + i * sizeof x, &previous, sizeof x);           \
+          }                                                             \
+        else                                                            \
+          {                                                             \
+            delta_store (dst + i * sizeof x, previous, sizeof x);       \
+          }                                                             \
+      }                                                                 \
+                                                                        \
+    state->previous = previous;                                         \
+    state->previous_delta = previous_delta;                             \
+  }
+
+DELTA_LOOPS(8)
+DELTA_LOOPS(16)
+DELTA_LOOPS(32)
+DELTA_LOOPS(64)
+
+#undef DELTA_LOOPS
+
+static void
+delta_items (struct delta_state * state, const unsigned char * src,
+             unsigned char * dst, size_t count, int decode)
+{
+  switch (state->itemsize)
+    {
+    case 1:
+      (decode ? delta_decode_8 : delta_encode_8) (state, src, dst, count);
+      break;
+    case 2:
+      (decode ? delta_decode_16 : delta_encode_16) (state, src, dst, count);
+      break;
+    case 4:
+      (decode ? delta_decode_32 : delta_encode_32) (state, src, dst, count);
+      break;
+    default:
+      (decode ? delta_decode_64 : delta_encode_64) (state, src, dst, count);
+      break;
+    }
+}
+
+/* Encodes, or decodes, size bytes from src into dst. dst may be src, but the
+ * buffers must not otherwise overlap. Safe to call with the GIL released. */
+static void
+apply_delta (struct delta_state * state, const char * source, char * destination,
+             size_t size, int decode)
+{
+  const unsigned char * src = (const unsigned char *) source;
+  unsigned char * dst = (unsigned char *) destination;
+  size_t itemsize = state->itemsize;
+  size_t start, length, count;
+  uint64_t mask;
+
+  if (state->kind == DELTA_NONE)
+    {
+      if (dst != src)
+        {
+          memcpy (dst, src, size);
+        }
+      return;
+    }
+
+  mask = itemsize == 8 ? ~(uint64_t) 0 : (((uint64_t) 1 << (8 * itemsize)) - 1);
+
+  /* Finish an item left incomplete by the last call. Its first bytes have
+     been written out already. */
+  if (state->partial_size > 0)
+    {
+      start = state->partial_size;
+      length = itemsize - start < size ? itemsize - start : size;
+      memcpy (state->partial + start, src, length);
+      state->partial_size += length;
+      if (state->partial_size == itemsize)
+        {
+          uint64_t x = delta_load (state->partial, itemsize);
+          uint64_t result = delta_step (state, x, decode, 1) & mask;
+          unsigned char out[8];
+
+          delta_store (out, result, itemsize);
+          memcpy (dst, out + start, length);
+          state->previous &= mask;
+          state->previous_delta &= mask;
+          state->partial_size = 0;
+        }
+      else
+        {
+          uint64_t x = delta_load (state->partial, state->partial_size);
+          unsigned char out[8];
+
+          delta_store (out, delta_step (state, x, decode, 0), itemsize);
+          memcpy (dst, out + start, length);
+        }
+      src += length;
+      dst += length;
+      size -= length;
+    }
+
+  count = size / itemsize;
+  delta_items (state, src, dst, count, decode);
+
+  /* Start an item that's completed by the next call. */
+  length = size - count * itemsize;
+  if (length > 0)
+    {
+      unsigned char out[8];
+
+      src += count * itemsize;
+      dst += count * itemsize;
+      memcpy (state->partial, src, length);
+      state->partial_size = length;
+      delta_store (out,
+                   delta_step (state, delta_load (state->partial, length),
+                               decode, 0),
+                   itemsize);
+      memcpy (dst, out, length);
+    }
+}
+
+/* Encodes the buffers in list one after the other into dst, which must hold
+ * list->total bytes. Safe to call with the GIL released. */
+static void
+encode_buffer_list (struct delta_state * state, const struct buffer_list * list,
+                    char * dst)
+{
+  Py_ssize_t i;
+
+  for (i = 0; i < list->count; i++)
+    {
+      apply_delta (state, list->views[i].buf, dst, (size_t) list->views[i].len, 0);
+      dst += list->views[i].len;
+    }
+}
+
+#endif /* PYTHON_LZ4_DELTA_H */
@@ -0,0 +1,420 @@
+/*
+ * Copyright (c) 2024, the python-lz4 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* Shuffle filters for arrays of fixed size items.
+ *
+ * The byte shuffle stores the first byte of every item, then the second byte
+ * of every item, and so on. For numeric arrays, where neighbouring items have
+ * similar high bytes, this turns the data into long runs LZ4 can match. The
+ * bit shuffle goes further and stores each bit of the items in turn.
+ *
+ * Bytes at the end of the data that don't make up a whole item are stored
+ * unchanged, as are the items that don't make up a group of eight for the bit
+ * shuffle. All the functions other than get_shuffle are safe to call with the
+ * GIL released. */
+
+#ifndef PYTHON_LZ4_SHUFFLE_H
+#define PYTHON_LZ4_SHUFFLE_H
+
+#include <Python.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SHUFFLE_SSE2
+#include <emmintrin.h>
+#endif
+
+/* The largest item size accepted by the shuffle arguments. */
+#define SHUFFLE_ITEMSIZE_MAX 256
+
+#ifdef SHUFFLE_SSE2
+/* Shuffles 16 items of itemsize bytes, for itemsize a power of two up to 16,
+ * writing the bytes of each position stride bytes apart. Each round splits
+ * the even and odd bytes of pairs of vectors, and after log2(itemsize) rounds
+ * vector j holds byte j of every item. */
+static inline void
+shuffle_sse2_16 (const char * src, char * dst, size_t itemsize, size_t stride)
+{
+  __m128i v[16], even[8], odd[8];
+  const __m128i low = _mm_set1_epi16 (0x00ff);
+  size_t i, k, round;
+
+  for (i = 0; i < itemsize; i++)
+    {
+      v[i] = _mm_loadu_si128 ((const __m128i *) (src + 16 * i));
+    }
+
+  for (round = 1; round < itemsize; round <<= 1)
+    {
+      for (k = 0; k < itemsize / 2; k++)
+        {
+          even[k] = _mm_packus_epi16 (_mm_and_si128 (v[2 * k], low),
+                                      _mm_and_si128 (v[2 * k + 1], low));
+          odd[k] = _mm_packus_epi16 (_mm_srli_epi16 (v[2 * k], 8),
+                                     _mm_srli_epi16 (v[2 * k + 1], 8));
+        }
+      for (k = 0; k < itemsize / 2; k++)
+        {
+          v[k] = even[k];
+          v[itemsize / 2 + k] = odd[k];
+        }
+    }
+
+  for (i = 0; i < itemsize; i++)
+    {
+      _mm_storeu_si128 ((__m128i *) (dst + stride * i), v[i]);
+    }
+}
+
+/* The inverse of shuffle_sse2_16, interleaving the vectors back together. */
+static inline void
+unshuffle_sse2_16 (const char * src, char * dst, size_t itemsize, size_t stride)
+{
+  __m128i v[16], pairs[16];
+  size_t i, k, round;
+
+  for (i = 0; i < itemsize; i++)
+    {
+      v[i] = _mm_loadu_si128 ((const __m128i *) (src + stride * i));
+    }
+
+  for (round = 1; round < itemsize; round <<= 1)
+    {
+      for (k = 0; k < itemsize / 2; k++)
+        {
+          pairs[2 * k] = _mm_unpacklo_epi8 (v[k], v[itemsize / 2 + k]);
+          pairs[2 * k + 1] = _mm_unpackhi_epi8 (v[k], v[itemsize / 2 + k]);
+        }
+      for (k = 0; k < itemsize; k++)
+        {
+          v[k] = pairs[k];
+        }
+    }
+
+  for (i = 0; i < itemsize; i++)
+    {
+      _mm_storeu_si128 ((__m128i *) (dst + 16 * i), v[i]);
+    }
+}
+#endif
+
+static inline int
+shuffle_vectorized (size_t itemsize)
+{
+#ifdef SHUFFLE_SSE2
+  return itemsize == 2 || itemsize == 4 || itemsize == 8 || itemsize == 16;
+#else
+  (void) itemsize;
+  return 0;
+#endif
+}
+
+/* Byte shuffles size bytes of items of itemsize bytes from src to dst. The
+ * buffers must not overlap. */
+static void
+shuffle_bytes (const char * src, char * dst, size_t size, size_t itemsize)
+{
+  size_t count = itemsize > 1 ? size / itemsize : 0;
+  size_t i = 0, j;
+
+#ifdef SHUFFLE_SSE2
+  if (shuffle_vectorized (itemsize))
+    {
+      for (; i + 16 <= count; i += 16)
+        {
+          shuffle_sse2_16 (src + i * itemsize, dst + i, itemsize, count);
+        }
+    }
+#endif
+
+  for (; i < count; i++)
+    {
+      for (j = 0; j < itemsize; j++)
+        {
+          dst[j * count + i] = src[i * itemsize + j];
+        }
+    }
+
+  memcpy (dst + count * itemsize, src + count * itemsize,
+          size - count * itemsize);
+}
+
+/* The inverse of shuffle_bytes. */
+static void
+unshuffle_bytes (const char * src, char * dst, size_t size, size_t itemsize)
+{
+  size_t count = itemsize > 1 ? size / itemsize : 0;
+  size_t i = 0, j;
+
+#ifdef SHUFFLE_SSE2
+  if (shuffle_vectorized (itemsize))
+    {
+      for (; i + 16 <= count; i += 16)
+        {
+          unshuffle_sse2_16 (src + i, dst + i * itemsize, itemsize, count);
+        }
+    }
+#endif
+
+  for (; i < count; i++)
+    {
+      for (j = 0; j < itemsize; j++)
+        {
+          dst[i * itemsize + j] = src[j * count + i];
+        }
+    }
+
+  memcpy (dst + count * itemsize, src + count * itemsize,
+          size - count * itemsize);
+}
+
+/* Transposes the bits of size bytes, a multiple of 8, so that dst holds bit 0
+ * of every byte, then bit 1, and so on, each packed 8 bits to a byte. */
+static void
+transpose_bits (const unsigned char * src, unsigned char * dst, size_t size)
+{
+  size_t planes = size / 8;
+  size_t i = 0;
+  int bit, k;
+
+#ifdef SHUFFLE_SSE2
+  /* movemask collects the top bit of 16 bytes at once, and adding each byte
+     to itself moves the next bit up. */
+  for (; i + 16 <= size; i += 16)
+    {
+      __m128i x = _mm_loadu_si128 ((const __m128i *) (src + i));
+      for (bit = 7; bit >= 0; bit--)
+        {
+          int mask = _mm_movemask_epi8 (x);
+          dst[bit * planes + i / 8] = (unsigned char) mask;
+          dst[bit * planes + i / 8 + 1] = (unsigned char) (mask >> 8);
+          x = _mm_add_epi8 (x, x);
+        }
+    }
+#endif
+
+  for (; i < size; i += 8)
+    {
+      for (bit = 0; bit < 8; bit++)
+        {
+          unsigned char byte = 0;
+          for (k = 0; k < 8; k++)
+            {
+              byte |= ((src[i + k] >> bit) & 1) << k;
+            }
+          dst[bit * planes + i / 8] = byte;
+        }
+    }
+}
+
+/* The inverse of transpose_bits. */
+static void
+untranspose_bits (const unsigned char * src, unsigned char * dst, size_t size)
+{
+  size_t planes = size / 8;
+  size_t i = 0;
+  int bit, k;
+
+#ifdef SHUFFLE_SSE2
+  const __m128i select = _mm_set_epi8 ((char) 0x80, 0x40, 0x20, 0x10,
+                                       0x08, 0x04, 0x02, 0x01,
+                                       (char) 0x80, 0x40, 0x20, 0x10,
+                                       0x08, 0x04, 0x02, 0x01);
+  for (; i + 16 <= size; i += 16)
+    {
+      __m128i out = _mm_setzero_si128 ();
+      for (bit = 0; bit < 8; bit++)
+        {
+          /* Spread the two plane bytes for these 16 bytes over the low and
+             high halves, and keep the bit for each byte's position. */
+          __m128i spread =
+            _mm_unpacklo_epi64 (_mm_set1_epi8 ((char) src[bit * planes + i / 8]),
+                                _mm_set1_epi8 ((char) src[bit * planes + i / 8 + 1]));
+          __m128i set = _mm_cmpeq_epi8 (_mm_and_si128 (spread, select), select);
+          out = _mm_or_si128 (out, _mm_and_si128 (set, _mm_set1_epi8 ((char) (1 << bit))));
+        }
+      _mm_storeu_si128 ((__m128i *) (dst + i), out);
+    }
+#endif
+
+  for (; i < size; i += 8)
+    {
+      for (k = 0; k < 8; k++)
+        {
+          unsigned char byte = 0;
+          for (bit = 0; bit < 8; bit++)
+            {
+              byte |= ((src[bit * planes + i / 8] >> k) & 1) << bit;
+            }
+          dst[i + k] = byte;
+        }
+    }
+}
+
+/* Bit shuffles size bytes of items of itemsize bytes from src to dst. This is
+ * a byte shuffle followed by a transpose of the bits of each of the resulting
+ * runs. scratch must hold size bytes. None of the buffers may overlap. */
+static void
+bitshuffle_bytes (const char * src, char * dst, char * scratch, size_t size,
+                  size_t itemsize)
+{
+  size_t count = (size / itemsize) & ~(size_t) 7;
+  size_t j;
+
+  shuffle_bytes (src, scratch, count * itemsize, itemsize);
+  for (j = 0; j < itemsize; j++)
+    {
+      transpose_bits ((const unsigned char *) scratch + j * count,
+                      (unsigned char *) dst + j * count, count);
+    }
+  memcpy (dst + count * itemsize, src + count * itemsize,
+          size - count * itemsize);
+}
+
+/* The inverse of bitshuffle_bytes. */
+static void
+unbitshuffle_bytes (const char * src, char * dst, char * scratch, size_t size,
+                    size_t itemsize)
+{
+  size_t count = (size / itemsize) & ~(size_t) 7;
+  size_t j;
+
+  for (j = 0; j < itemsize; j++)
+    {
+      untranspose_bits ((const unsigned char *) src + j * count,
+                        (unsigned char *) scratch + j * count, count);
+    }
+  unshuffle_bytes (scratch, dst, count * itemsize, itemsize);
+  memcpy (dst + count * itemsize, src + count * itemsize,
+          size - count * itemsize);
+}
+
+/* Applies the selected filter to size bytes, in units of unit bytes, with
+ * scratch holding unit bytes when bitshuffle is set. */
+static void
+apply_shuffle (const char * src, char * dst, char * scratch, size_t size,
+               size_t unit, size_t itemsize, int bitshuffle)
+{
+  size_t offset, length;
+
+  for (offset = 0; offset < size; offset += unit)
+    {
+      length = size - offset < unit ? size - offset : unit;
+      if (bitshuffle)
+        {
+          bitshuffle_bytes (src + offset, dst + offset, scratch, length,
+                            itemsize);
+        }
+      else
+        {
+          shuffle_bytes (src + offset, dst + offset, length, itemsize);
+        }
+    }
+}
+
+/* The inverse of apply_shuffle. */
+static void
+apply_unshuffle (const char * src, char * dst, char * scratch, size_t size,
+                 size_t unit, size_t itemsize, int bitshuffle)
+{
+  size_t offset, length;
+
+  for (offset = 0; offset < size; offset += unit)
+    {
+      length = size - offset < unit ? size - offset : unit;
+      if (bitshuffle)
+        {
+          unbitshuffle_bytes (src + offset, dst + offset, scratch, length,
+                              itemsize);
+        }
+      else
+        {
+          unshuffle_bytes (src + offset, dst + offset, length, itemsize);
+        }
+    }
+}
+
+/* Checks the shuffle, bitshuffle and itemsize arguments, and sets
+ * shuffle_itemsize to the item size to shuffle, or to 0 if no shuffle was
+ * selected. shuffle is either True, to shuffle items of itemsize bytes, or
+ * the item size itself, which must then agree with itemsize if that's given
+ * too. A bit shuffle defaults to single bytes. Returns 0 on success, or -1
+ * with an exception set. */
+static int
+get_shuffle (int shuffle, int bitshuffle, int itemsize,
+             size_t * shuffle_itemsize)
+{
+  if (shuffle < 0 || shuffle > SHUFFLE_ITEMSIZE_MAX)
+    {
+      PyErr_Format (PyExc_ValueError,
+                    "shuffle must be between 0 and %d, got %d",
+                    SHUFFLE_ITEMSIZE_MAX, shuffle);
+      return -1;
+    }
+
+  if (shuffle > 1 && itemsize > 0 && shuffle != itemsize)
+    {
+      PyErr_Format (PyExc_ValueError,
+                    "shuffle is %d but itemsize is %d", shuffle, itemsize);
+      return -1;
+    }
+
+  if (shuffle == 1 && itemsize > 0)
+    {
+      shuffle = itemsize;
+    }
+  else if (shuffle == 0 && bitshuffle && itemsize > 0)
+    {
+      shuffle = itemsize;
+    }
+
+  if (shuffle > SHUFFLE_ITEMSIZE_MAX)
+    {
+      PyErr_Format (PyExc_ValueError,
+                    "itemsize must be between 1 and %d to shuffle, got %d",
+                    SHUFFLE_ITEMSIZE_MAX, shuffle);
+      return -1;
+    }
+
+  if (bitshuffle)
+    {
+      *shuffle_itemsize = shuffle > 0 ? (size_t) shuffle : 1;
+    }
+  else
+    {
+      *shuffle_itemsize = shuffle > 1 ? (size_t) shuffle : 0;
+    }
+  return 0;
+}
+
+#endif /* PYTHON_LZ4_SHUFFLE_H */
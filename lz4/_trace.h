@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2024, the python-lz4 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* Static tracepoints for perf, bpftrace and SystemTap.
+ *
+ * When built with PYLZ4_USDT defined, which setup.py does when the PYLZ4_USDT
+ * environment variable is set to 1 and <sys/sdt.h> is available, the TRACE
+ * macros place USDT probes of the python_lz4 provider. An unattached probe is
+ * a single nop instruction, with its arguments left in registers or memory for
+ * the tracer to read. Otherwise the macros expand to nothing.
+ *
+ * The compression and decompression entry points fire a <name>__entry probe
+ * once their arguments are checked, carrying the input size and, where it
+ * applies, the compression level, and a <name>__return probe with the size of
+ * the output, or a negative value on failure, once the GIL is taken back.
+ * frame__decompress__grow fires when a new output segment is added. With the
+ * GIL released through TRACE_BEGIN_ALLOW_THREADS and TRACE_END_ALLOW_THREADS,
+ * gil__release fires once the GIL is released, gil__acquire when it is
+ * requested back, and gil__acquired once it is held again. For example, with
+ * bpftrace:
+ *
+ *   usdt:lz4/frame/_frame*.so:python_lz4:gil__acquire { @t[tid] = nsecs; }
+ *   usdt:lz4/frame/_frame*.so:python_lz4:gil__acquired /@t[tid]/ {
+ *     @gil_wait_ns = hist(nsecs - @t[tid]); delete(@t[tid]);
+ *   } */
+
+#ifndef PYTHON_LZ4_TRACE_H
+#define PYTHON_LZ4_TRACE_H
+
+#include <Python.h>
+
+#if defined(PYLZ4_USDT)
+
+#include <sys/sdt.h>
+
+#define TRACE0(name) DTRACE_PROBE (python_lz4, name)
+#define TRACE1(name, a) DTRACE_PROBE1 (python_lz4, name, a)
+#define TRACE2(name, a, b) DTRACE_PROBE2 (python_lz4, name, a, b)
+#define TRACE3(name, a, b, c) DTRACE_PROBE3 (python_lz4, name, a, b, c)
+
+#else
+
+#define TRACE0(name) do { } while (0)
+#define TRACE1(name, a) do { } while (0)
+#define TRACE2(name, a, b) do { } while (0)
+#define TRACE3(name, a, b, c) do { } while (0)
+
+#endif /* PYLZ4_USDT */
+
+#define TRACE_BEGIN_ALLOW_THREADS                       \
+  Py_BEGIN_ALLOW_THREADS                                \
+  TRACE0 (gil__release);
+
+#define TRACE_END_ALLOW_THREADS                         \
+  TRACE0 (gil__acquire);                                \
+  Py_END_ALLOW_THREADS                                  \
+  TRACE0 (gil__acquired);
+
+#endif /* PYTHON_LZ4_TRACE_H */
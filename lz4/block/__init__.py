@@ -1 +1,6 @@
-from ._block import compress, decompress, LZ4BlockError  # noqa: F401
+from ._block import (  # noqa: F401
+    compress,
+    decompress,
+    decompress_into,
+    LZ4BlockError
+)
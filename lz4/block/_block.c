@@ -42,6 +42,12 @@
 #include <lz4.h>
 #include <lz4hc.h>
 
+#include "../_arguments.h"
+#include "../_buffers.h"
+#include "../_shuffle.h"
+#include "../_delta.h"
+#include "../_trace.h"
+
 #ifndef Py_UNUSED /* This is already defined for Python 3.4 onwards */
 #ifdef __GNUC__
 #define Py_UNUSED(name) _unused_ ## name __attribute__((unused))
@@ -81,6 +87,88 @@ load_le32 (const char *c)
 
 static const size_t hdr_size = sizeof (uint32_t);
 
+/* With store_size, a block compressed with filters records them after the
+ * size, which then has its top bit set so that other decoders fail on it
+ * rather than returning the filtered data. The record is the shuffle (0 for
+ * none, 1 for a byte shuffle, 2 for a bit shuffle), the delta_e value of the
+ * delta filter, and the item sizes of the shuffle, less one, and of the delta
+ * filter, or zero for no filter. */
+#define FILTERED_SIZE_FLAG 0x80000000U
+
+static const size_t filter_hdr_size = 4;
+
+static void
+store_filter_header (char *c, size_t itemsize, int bitshuffle,
+                     const struct delta_state *delta)
+{
+  c[0] = itemsize ? (bitshuffle ? 2 : 1) : 0;
+  c[1] = (char) delta->kind;
+  c[2] = itemsize ? (char) (itemsize - 1) : 0;
+  c[3] = (char) delta->itemsize;
+}
+
+/* Reads the filters recorded in a block into itemsize, bitshuffle and delta,
+ * which hold the filters passed to decompress. If any were passed, they must
+ * be the recorded ones. Returns 0 on success, or -1 with an exception set. */
+static int
+load_filter_header (const char *c, size_t *itemsize, int *bitshuffle,
+                    struct delta_state *delta)
+{
+  const uint8_t *d = (const uint8_t *) c;
+  size_t recorded_itemsize = d[0] ? (size_t) d[2] + 1 : 0;
+  int recorded_bitshuffle = d[0] == 2;
+  struct delta_state recorded;
+
+  memset (&recorded, 0, sizeof recorded);
+  recorded.kind = (delta_e) d[1];
+  recorded.itemsize = d[1] ? d[3] : 0;
+
+  if (d[0] > 2 || d[1] > DELTA_XOR || (d[0] == 0 && d[1] == 0)
+      || (d[0] == 0 && d[2] != 0)
+      || (d[1] == 0 && d[3] != 0)
+      || (d[1] != 0 && d[3] != 1 && d[3] != 2 && d[3] != 4 && d[3] != 8))
+    {
+      PyErr_SetString (PyExc_ValueError, "Invalid filter header");
+      return -1;
+    }
+
+  if ((*itemsize || delta->kind != DELTA_NONE)
+      && (*itemsize != recorded_itemsize
+          || (*itemsize && *bitshuffle != recorded_bitshuffle)
+          || delta->kind != recorded.kind
+          || delta->itemsize != recorded.itemsize))
+    {
+      PyErr_SetString (PyExc_ValueError,
+                       "filter arguments don't match the filters recorded in the block");
+      return -1;
+    }
+
+  *itemsize = recorded_itemsize;
+  *bitshuffle = recorded_bitshuffle;
+  *delta = recorded;
+  return 0;
+}
+
+#if defined (__GNUC__)
+/* LZ4_decompress_safe_partial_usingDict was introduced in LZ4 1.9.4. Declare
+ * it as a weak symbol, so that it is NULL if an older system library is
+ * used. */
+__attribute__ ((weak)) int
+LZ4_decompress_safe_partial_usingDict (const char* src, char* dst,
+                                       int compressedSize,
+                                       int targetOutputSize, int maxOutputSize,
+                                       const char* dictStart, int dictSize);
+#endif
+
+/* LZ4_favorDecompressionSpeed was introduced in LZ4 1.8.2 and is only
+ * declared by lz4hc.h under LZ4_HC_STATIC_LINKING_ONLY. With GCC it is a weak
+ * symbol, NULL if an older system library is used. */
+#if defined (__GNUC__)
+__attribute__ ((weak))
+#endif
+void
+LZ4_favorDecompressionSpeed (LZ4_streamHC_t* LZ4_streamHCPtr, int favor);
+
 typedef enum
 {
   DEFAULT,
@@ -90,9 +178,74 @@ typedef enum
 
 static PyObject * LZ4BlockError;
 
+/* Interned mode strings, so that the usual mode arguments, which are interned
+ * string literals, are resolved by a pointer comparison. */
+static PyObject * mode_default;
+static PyObject * mode_fast;
+static PyObject * mode_high_compression;
+
+static int
+get_compression_type (PyObject * py_mode, compression_type * comp)
+{
+  const char * mode;
+
+  if (py_mode == NULL || py_mode == mode_default)
+    {
+      *comp = DEFAULT;
+      return 0;
+    }
+  else if (py_mode == mode_fast)
+    {
+      *comp = FAST;
+      return 0;
+    }
+  else if (py_mode == mode_high_compression)
+    {
+      *comp = HIGH_COMPRESSION;
+      return 0;
+    }
+
+  if (!PyUnicode_Check (py_mode))
+    {
+      PyErr_Format (PyExc_TypeError,
+                    "compress() argument 'mode' must be str, not %.50s",
+                    Py_TYPE (py_mode)->tp_name);
+      return -1;
+    }
+
+  mode = PyUnicode_AsUTF8 (py_mode);
+  if (mode == NULL)
+    {
+      return -1;
+    }
+
+  if (!strncmp (mode, "default", sizeof ("default")))
+    {
+      *comp = DEFAULT;
+    }
+  else if (!strncmp (mode, "fast", sizeof ("fast")))
+    {
+      *comp = FAST;
+    }
+  else if (!strncmp (mode, "high_compression", sizeof ("high_compression")))
+    {
+      *comp = HIGH_COMPRESSION;
+    }
+  else
+    {
+      PyErr_Format (PyExc_ValueError,
+                    "Invalid mode argument: %s. Must be one of: standard, fast, high_compression",
+                    mode);
+      return -1;
+    }
+
+  return 0;
+}
+
 static inline int
 lz4_compress_generic (int comp, char* source, char* dest, int source_size, int dest_size,
-                      char* dict, int dict_size, int acceleration, int compression)
+                      char* dict, int dict_size, int acceleration, int compression,
+                      int favor_dec_speed)
 {
   if (comp != HIGH_COMPRESSION)
     {
@@ -116,6 +269,12 @@ lz4_compress_generic (int comp, char* source, char* dest, int source_size, int d
         {
           LZ4_loadDictHC (&lz4_state, dict, dict_size);
         }
+      /* Set after loading the dictionary, which reinitializes the stream
+         keeping only the compression level. */
+      if (favor_dec_speed)
+        {
+          LZ4_favorDecompressionSpeed (&lz4_state, 1);
+        }
       return LZ4_compress_HC_continue (&lz4_state, source, dest, source_size, dest_size);
     }
 }
@@ -125,9 +284,10 @@ lz4_compress_generic (int comp, char* source, char* dest, int source_size, int d
 #endif
 
 static PyObject *
-compress (PyObject * Py_UNUSED (self), PyObject * args, PyObject * kwargs)
+compress (PyObject * Py_UNUSED (self), PyObject * const * args,
+          Py_ssize_t nargs, PyObject * kwnames)
 {
-  const char *mode = "default";
+  PyObject *py_mode = NULL;
   size_t dest_size, total_size;
   int acceleration = 1;
   int compression = 9;
@@ -136,9 +296,21 @@ compress (PyObject * Py_UNUSED (self), PyObject * args, PyObject * kwargs)
   char *dest, *dest_start;
   compression_type comp;
   int output_size;
-  Py_buffer source;
+  PyObject *py_source;
+  struct buffer_list source;
+  char *source_start;
+  char *gathered = NULL;
+  char *shuffled = NULL;
+  size_t scratch_size;
   int source_size;
   int return_bytearray = 0;
+  int favor_dec_speed = 0;
+  int shuffle = 0;
+  int bitshuffle = 0;
+  size_t itemsize;
+  const char *filter = NULL;
+  int filter_itemsize = 0;
+  struct delta_state delta;
   Py_buffer dict = {0};
   static char *argnames[] = {
     "source",
@@ -148,20 +320,41 @@ compress (PyObject * Py_UNUSED (self), PyObject * args, PyObject * kwargs)
     "compression",
     "return_bytearray",
     "dict",
+    "favor_decompression_speed",
+    "shuffle",
+    "bitshuffle",
+    "filter",
+    "itemsize",
     NULL
   };
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwargs, "y*|spiipz*", argnames,
-                                    &source,
-                                    &mode, &store_size, &acceleration, &compression,
-                                    &return_bytearray, &dict))
+  if (!parse_fastcall_args (args, nargs, kwnames, "compress",
+                            "O|Opiipz*pipzi", argnames,
+                            &py_source,
+                            &py_mode, &store_size, &acceleration, &compression,
+                            &return_bytearray, &dict, &favor_dec_speed,
+                            &shuffle, &bitshuffle, &filter, &filter_itemsize))
     {
       return NULL;
     }
 
-  if (source.len > INT_MAX)
+  if (get_shuffle (shuffle, bitshuffle, filter_itemsize, &itemsize) < 0
+      || init_delta_state (&delta, filter, filter_itemsize) < 0)
     {
-      PyBuffer_Release(&source);
+      PyBuffer_Release(&dict);
+      return NULL;
+    }
+
+  if (get_buffer_list (py_source, PyBUF_SIMPLE, "compress", "source",
+                       &source) < 0)
+    {
+      PyBuffer_Release(&dict);
+      return NULL;
+    }
+
+  if (source.total > INT_MAX)
+    {
+      release_buffer_list(&source);
       PyBuffer_Release(&dict);
       PyErr_Format(PyExc_OverflowError,
                    "Input too large for LZ4 API");
@@ -170,35 +363,42 @@ compress (PyObject * Py_UNUSED (self), PyObject * args, PyObject * kwargs)
 
   if (dict.len > INT_MAX)
     {
-      PyBuffer_Release(&source);
+      release_buffer_list(&source);
       PyBuffer_Release(&dict);
       PyErr_Format(PyExc_OverflowError,
                    "Dictionary too large for LZ4 API");
       return NULL;
     }
 
-  source_size = (int) source.len;
+  source_size = (int) source.total;
 
-  if (!strncmp (mode, "default", sizeof ("default")))
+  if (get_compression_type (py_mode, &comp) < 0)
     {
-      comp = DEFAULT;
-    }
-  else if (!strncmp (mode, "fast", sizeof ("fast")))
-    {
-      comp = FAST;
+      release_buffer_list(&source);
+      PyBuffer_Release(&dict);
+      return NULL;
     }
-  else if (!strncmp (mode, "high_compression", sizeof ("high_compression")))
+
+  if (comp != HIGH_COMPRESSION)
     {
-      comp = HIGH_COMPRESSION;
+      /* Only the HC optimal parser honours this setting. */
+      favor_dec_speed = 0;
     }
-  else
+
+  if (favor_dec_speed)
     {
-      PyBuffer_Release(&source);
-      PyBuffer_Release(&dict);
-      PyErr_Format (PyExc_ValueError,
-                    "Invalid mode argument: %s. Must be one of: standard, fast, high_compression",
-                    mode);
-      return NULL;
+#if defined (__GNUC__)
+      if (LZ4_versionNumber () < 10802 || !LZ4_favorDecompressionSpeed)
+#else
+      if (LZ4_versionNumber () < 10802)
+#endif
+        {
+          release_buffer_list(&source);
+          PyBuffer_Release(&dict);
+          PyErr_SetString (PyExc_RuntimeError,
+                           "favor_decompression_speed specified but not supported by LZ4 library version");
+          return NULL;
+        }
     }
 
   dest_size = LZ4_compressBound (source_size);
@@ -206,21 +406,78 @@ compress (PyObject * Py_UNUSED (self), PyObject * args, PyObject * kwargs)
   if (store_size)
     {
       total_size = dest_size + hdr_size;
+      if (itemsize || delta.kind != DELTA_NONE)
+        {
+          total_size += filter_hdr_size;
+        }
     }
   else
     {
       total_size = dest_size;
     }
 
-  dest = PyMem_Malloc (total_size * sizeof * dest);
+  /* The block format needs the source to be contiguous, so a list of buffers
+     is gathered after the destination buffer, with the GIL released below.
+     With a delta filter, the source is encoded there instead of being copied.
+     The shuffled source, and the bit shuffle's scratch space, follow it. */
+  scratch_size = 0;
+  if (source.count != 1 || delta.kind != DELTA_NONE)
+    {
+      scratch_size += source.total;
+    }
+  if (itemsize)
+    {
+      scratch_size += source.total * (bitshuffle ? 2 : 1);
+    }
+
+  dest = PyMem_Malloc ((total_size + scratch_size) * sizeof * dest);
   if (dest == NULL)
     {
+      release_buffer_list(&source);
+      PyBuffer_Release(&dict);
       return PyErr_NoMemory();
     }
 
-  Py_BEGIN_ALLOW_THREADS
+  if (source.count == 1 && delta.kind == DELTA_NONE)
+    {
+      source_start = source.views[0].buf;
+      shuffled = dest + total_size;
+    }
+  else
+    {
+      gathered = dest + total_size;
+      source_start = gathered;
+      shuffled = gathered + source.total;
+    }
 
-  if (store_size)
+  TRACE3 (block__compress__entry, source_size, (int) comp,
+          comp == HIGH_COMPRESSION ? compression : acceleration);
+
+  TRACE_BEGIN_ALLOW_THREADS
+
+  if (delta.kind != DELTA_NONE)
+    {
+      encode_buffer_list (&delta, &source, gathered);
+    }
+  else if (gathered != NULL)
+    {
+      gather_buffer_list (&source, gathered);
+    }
+
+  if (itemsize)
+    {
+      apply_shuffle (source_start, shuffled, shuffled + source.total,
+                     source.total, source.total, itemsize, bitshuffle);
+      source_start = shuffled;
+    }
+
+  if (store_size && (itemsize || delta.kind != DELTA_NONE))
+    {
+      store_le32 (dest, (uint32_t) source_size | FILTERED_SIZE_FLAG);
+      store_filter_header (dest + hdr_size, itemsize, bitshuffle, &delta);
+      dest_start = dest + hdr_size + filter_hdr_size;
+    }
+  else if (store_size)
     {
       store_le32 (dest, source_size);
       dest_start = dest + hdr_size;
@@ -230,13 +487,15 @@ compress (PyObject * Py_UNUSED (self), PyObject * args, PyObject * kwargs)
       dest_start = dest;
     }
 
-  output_size = lz4_compress_generic (comp, source.buf, dest_start, source_size,
+  output_size = lz4_compress_generic (comp, source_start, dest_start, source_size,
                                       (int) dest_size, dict.buf, (int) dict.len,
-                                      acceleration, compression);
+                                      acceleration, compression, favor_dec_speed);
 
-  Py_END_ALLOW_THREADS
+  TRACE_END_ALLOW_THREADS
 
-  PyBuffer_Release(&source);
+  TRACE1 (block__compress__return, output_size > 0 ? output_size : -1);
+
+  release_buffer_list(&source);
   PyBuffer_Release(&dict);
 
   if (output_size <= 0)
@@ -246,10 +505,7 @@ compress (PyObject * Py_UNUSED (self), PyObject * args, PyObject * kwargs)
       return NULL;
     }
 
-  if (store_size)
-    {
-      output_size += (int) hdr_size;
-    }
+  output_size += (int) (dest_start - dest);
 
   if (return_bytearray)
     {
@@ -271,7 +527,8 @@ compress (PyObject * Py_UNUSED (self), PyObject * args, PyObject * kwargs)
 }
 
 static PyObject *
-decompress (PyObject * Py_UNUSED (self), PyObject * args, PyObject * kwargs)
+decompress (PyObject * Py_UNUSED (self), PyObject * const * args,
+            Py_ssize_t nargs, PyObject * kwnames)
 {
   Py_buffer source;
   const char * source_start;
@@ -281,23 +538,46 @@ decompress (PyObject * Py_UNUSED (self), PyObject * args, PyObject * kwargs)
   int output_size;
   size_t dest_size;
   int uncompressed_size = -1;
+  int max_length = -1;
+  int partial = 0;
   int return_bytearray = 0;
+  int shuffle = 0;
+  int bitshuffle = 0;
+  size_t itemsize;
+  const char *filter = NULL;
+  int filter_itemsize = 0;
+  struct delta_state delta;
   Py_buffer dict = {0};
   static char *argnames[] = {
     "source",
     "uncompressed_size",
     "return_bytearray",
     "dict",
+    "max_length",
+    "shuffle",
+    "bitshuffle",
+    "filter",
+    "itemsize",
     NULL
   };
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwargs, "y*|ipz*", argnames,
-                                    &source, &uncompressed_size,
-                                    &return_bytearray, &dict))
+  if (!parse_fastcall_args (args, nargs, kwnames, "decompress",
+                            "y*|ipz*iipzi", argnames,
+                            &source, &uncompressed_size,
+                            &return_bytearray, &dict, &max_length,
+                            &shuffle, &bitshuffle, &filter, &filter_itemsize))
     {
       return NULL;
     }
 
+  if (get_shuffle (shuffle, bitshuffle, filter_itemsize, &itemsize) < 0
+      || init_delta_state (&delta, filter, filter_itemsize) < 0)
+    {
+      PyBuffer_Release(&source);
+      PyBuffer_Release(&dict);
+      return NULL;
+    }
+
   if (source.len > INT_MAX)
     {
       PyBuffer_Release(&source);
@@ -335,6 +615,35 @@ decompress (PyObject * Py_UNUSED (self), PyObject * args, PyObject * kwargs)
       dest_size = load_le32 (source_start);
       source_start += hdr_size;
       source_size -= hdr_size;
+
+      if (dest_size & FILTERED_SIZE_FLAG)
+        {
+          if (source_size < filter_hdr_size)
+            {
+              PyBuffer_Release(&source);
+              PyBuffer_Release(&dict);
+              PyErr_SetString (PyExc_ValueError, "Input source data size too small");
+              return NULL;
+            }
+          if (load_filter_header (source_start, &itemsize, &bitshuffle,
+                                  &delta) < 0)
+            {
+              PyBuffer_Release(&source);
+              PyBuffer_Release(&dict);
+              return NULL;
+            }
+          dest_size &= ~FILTERED_SIZE_FLAG;
+          source_start += filter_hdr_size;
+          source_size -= filter_hdr_size;
+        }
+      else if (itemsize || delta.kind != DELTA_NONE)
+        {
+          PyBuffer_Release(&source);
+          PyBuffer_Release(&dict);
+          PyErr_SetString (PyExc_ValueError,
+                           "filter arguments don't match the filters recorded in the block");
+          return NULL;
+        }
     }
 
   if (dest_size > INT_MAX)
@@ -346,19 +655,71 @@ decompress (PyObject * Py_UNUSED (self), PyObject * args, PyObject * kwargs)
       return NULL;
     }
 
-  dest = PyMem_Malloc (dest_size * sizeof * dest);
+  /* If only a prefix of the uncompressed data is requested, size the
+     destination buffer for that prefix only, and stop decoding once it has
+     been produced. */
+  if (max_length >= 0 && (size_t) max_length < dest_size)
+    {
+      if (itemsize)
+        {
+          PyBuffer_Release(&source);
+          PyBuffer_Release(&dict);
+          PyErr_SetString (PyExc_ValueError,
+                           "max_length can't be used with shuffle or bitshuffle");
+          return NULL;
+        }
+
+      dest_size = (size_t) max_length;
+      partial = 1;
+
+      if (dict.len > 0 && (LZ4_versionNumber () < 10904
+#if defined (__GNUC__)
+                           || !LZ4_decompress_safe_partial_usingDict
+#endif
+                           ))
+        {
+          PyBuffer_Release(&source);
+          PyBuffer_Release(&dict);
+          PyErr_SetString (PyExc_RuntimeError,
+                           "max_length with dict specified but not supported by LZ4 library version");
+          return NULL;
+        }
+    }
+
+  /* The bit shuffle needs scratch space as large as the output. */
+  dest = PyMem_Malloc ((bitshuffle ? 2 * dest_size : dest_size) * sizeof * dest);
   if (dest == NULL)
     {
       return PyErr_NoMemory();
     }
 
-  Py_BEGIN_ALLOW_THREADS
+  TRACE2 (block__decompress__entry, source_size, (int) dest_size);
 
-  output_size =
-    LZ4_decompress_safe_usingDict (source_start, dest, source_size, (int) dest_size,
-                                   dict.buf, (int) dict.len);
+  TRACE_BEGIN_ALLOW_THREADS
 
-  Py_END_ALLOW_THREADS
+  if (!partial)
+    {
+      output_size =
+        LZ4_decompress_safe_usingDict (source_start, dest, source_size, (int) dest_size,
+                                       dict.buf, (int) dict.len);
+    }
+  else if (dict.len > 0)
+    {
+      output_size =
+        LZ4_decompress_safe_partial_usingDict (source_start, dest, source_size,
+                                               (int) dest_size, (int) dest_size,
+                                               dict.buf, (int) dict.len);
+    }
+  else
+    {
+      output_size =
+        LZ4_decompress_safe_partial (source_start, dest, source_size,
+                                     (int) dest_size, (int) dest_size);
+    }
+
+  TRACE_END_ALLOW_THREADS
+
+  TRACE1 (block__decompress__return, output_size >= 0 ? output_size : -1);
 
   PyBuffer_Release(&source);
   PyBuffer_Release(&dict);
@@ -380,7 +741,40 @@ decompress (PyObject * Py_UNUSED (self), PyObject * args, PyObject * kwargs)
       return NULL;
     }
 
-  if (return_bytearray)
+  if (itemsize || delta.kind != DELTA_NONE)
+    {
+      /* The filters are undone straight into the returned object, in place
+         of the copy made otherwise. */
+      char *output;
+
+      if (return_bytearray)
+        {
+          py_dest = PyByteArray_FromStringAndSize (NULL, (Py_ssize_t) output_size);
+          output = py_dest ? PyByteArray_AS_STRING (py_dest) : NULL;
+        }
+      else
+        {
+          py_dest = PyBytes_FromStringAndSize (NULL, (Py_ssize_t) output_size);
+          output = py_dest ? PyBytes_AS_STRING (py_dest) : NULL;
+        }
+
+      if (output != NULL)
+        {
+          TRACE_BEGIN_ALLOW_THREADS
+          if (itemsize)
+            {
+              apply_unshuffle (dest, output, dest + dest_size, output_size,
+                               output_size, itemsize, bitshuffle);
+              apply_delta (&delta, output, output, output_size, 1);
+            }
+          else
+            {
+              apply_delta (&delta, dest, output, output_size, 1);
+            }
+          TRACE_END_ALLOW_THREADS
+        }
+    }
+  else if (return_bytearray)
     {
       py_dest = PyByteArray_FromStringAndSize (dest, (Py_ssize_t) output_size);
     }
@@ -399,13 +793,191 @@ decompress (PyObject * Py_UNUSED (self), PyObject * args, PyObject * kwargs)
   return py_dest;
 }
 
+static PyObject *
+decompress_into (PyObject * Py_UNUSED (self), PyObject * const * args,
+                 Py_ssize_t nargs, PyObject * kwnames)
+{
+  Py_buffer source;
+  const char * source_start;
+  size_t source_size;
+  PyObject *py_destination;
+  struct buffer_list destination;
+  char *dest;
+  char *scratch = NULL;
+  int output_size;
+  size_t dest_size;
+  int uncompressed_size = -1;
+  Py_buffer dict = {0};
+  static char *argnames[] = {
+    "source",
+    "destination",
+    "uncompressed_size",
+    "dict",
+    NULL
+  };
+
+  if (!parse_fastcall_args (args, nargs, kwnames, "decompress_into",
+                            "y*O|iz*", argnames,
+                            &source, &py_destination, &uncompressed_size,
+                            &dict))
+    {
+      return NULL;
+    }
+
+  if (source.len > INT_MAX)
+    {
+      PyBuffer_Release(&source);
+      PyBuffer_Release(&dict);
+      PyErr_Format(PyExc_OverflowError,
+                   "Input too large for LZ4 API");
+      return NULL;
+    }
+
+  if (dict.len > INT_MAX)
+    {
+      PyBuffer_Release(&source);
+      PyBuffer_Release(&dict);
+      PyErr_Format(PyExc_OverflowError,
+                   "Dictionary too large for LZ4 API");
+      return NULL;
+    }
+
+  if (get_buffer_list (py_destination, PyBUF_WRITABLE, "decompress_into",
+                       "destination", &destination) < 0)
+    {
+      PyBuffer_Release(&source);
+      PyBuffer_Release(&dict);
+      return NULL;
+    }
+
+  source_start = (const char *) source.buf;
+  source_size = (int) source.len;
+
+  if (uncompressed_size >= 0)
+    {
+      dest_size = uncompressed_size;
+      if (dest_size > destination.total)
+        {
+          dest_size = destination.total;
+        }
+    }
+  else
+    {
+      if (source_size < hdr_size)
+        {
+          release_buffer_list(&destination);
+          PyBuffer_Release(&source);
+          PyBuffer_Release(&dict);
+          PyErr_SetString (PyExc_ValueError, "Input source data size too small");
+          return NULL;
+        }
+      dest_size = load_le32 (source_start);
+      source_start += hdr_size;
+      source_size -= hdr_size;
+
+      if (dest_size & FILTERED_SIZE_FLAG)
+        {
+          release_buffer_list(&destination);
+          PyBuffer_Release(&source);
+          PyBuffer_Release(&dict);
+          PyErr_SetString (PyExc_ValueError,
+                           "The block was compressed with a filter, which only decompress undoes");
+          return NULL;
+        }
+
+      if (dest_size > destination.total)
+        {
+          PyErr_Format (PyExc_ValueError,
+                        "Destination too small: %zu bytes needed, %zu bytes available",
+                        dest_size, destination.total);
+          release_buffer_list(&destination);
+          PyBuffer_Release(&source);
+          PyBuffer_Release(&dict);
+          return NULL;
+        }
+    }
+
+  if (dest_size > INT_MAX)
+    {
+      release_buffer_list(&destination);
+      PyBuffer_Release(&source);
+      PyBuffer_Release(&dict);
+      PyErr_Format (PyExc_ValueError, "Invalid size: 0x%zu",
+                    dest_size);
+      return NULL;
+    }
+
+  /* The block format needs the output to be contiguous, so unless the first
+     destination buffer can hold all of it, decompress to a temporary buffer
+     and scatter from there. */
+  if (destination.count > 0 && (size_t) destination.views[0].len >= dest_size)
+    {
+      dest = destination.views[0].buf;
+    }
+  else
+    {
+      scratch = PyMem_Malloc (dest_size > 0 ? dest_size : 1);
+      if (scratch == NULL)
+        {
+          release_buffer_list(&destination);
+          PyBuffer_Release(&source);
+          PyBuffer_Release(&dict);
+          return PyErr_NoMemory();
+        }
+      dest = scratch;
+    }
+
+  TRACE2 (block__decompress_into__entry, source_size, (int) dest_size);
+
+  TRACE_BEGIN_ALLOW_THREADS
+
+  output_size =
+    LZ4_decompress_safe_usingDict (source_start, dest, source_size, (int) dest_size,
+                                   dict.buf, (int) dict.len);
+
+  if (scratch != NULL && output_size > 0)
+    {
+      scatter_buffer_list (&destination, scratch, (size_t) output_size);
+    }
+
+  TRACE_END_ALLOW_THREADS
+
+  TRACE1 (block__decompress_into__return,
+          output_size >= 0 ? output_size : -1);
+
+  PyMem_Free (scratch);
+  release_buffer_list(&destination);
+  PyBuffer_Release(&source);
+  PyBuffer_Release(&dict);
+
+  if (output_size < 0)
+    {
+      PyErr_Format (LZ4BlockError,
+                    "Decompression failed: corrupt input or insufficient space in destination buffer. Error code: %u",
+                    -output_size);
+      return NULL;
+    }
+  else if (((size_t)output_size != dest_size) && (uncompressed_size < 0))
+    {
+      PyErr_Format (LZ4BlockError,
+                    "Decompressor wrote %u bytes, but %zu bytes expected from header",
+                    output_size, dest_size);
+      return NULL;
+    }
+
+  return PyLong_FromLong (output_size);
+}
+
 PyDoc_STRVAR(compress__doc,
              "compress(source, mode='default', acceleration=1, compression=0, return_bytearray=False)\n\n" \
              "Compress source, returning the compressed data as a string.\n" \
              "Raises an exception if any error occurs.\n"               \
              "\n"                                                       \
              "Args:\n"                                                  \
-             "    source (str, bytes or buffer-compatible object): Data to compress\n" \
+             "    source (str, bytes or buffer-compatible object): Data to compress.\n" \
+             "        This may also be a list or tuple of buffer-compatible objects,\n" \
+             "        in which case the result is the same as compressing them\n" \
+             "        joined together.\n"                               \
              "\n"                                                       \
              "Keyword Args:\n"                                          \
              "    mode (str): If ``'default'`` or unspecified use the default LZ4\n" \
@@ -429,11 +1001,41 @@ PyDoc_STRVAR(compress__doc,
              "        return a bytearray object.\n\n"                   \
              "    dict (str, bytes or buffer-compatible object): If specified, perform\n" \
              "        compression using this initial dictionary.\n"     \
+             "    favor_decompression_speed (bool): If ``True``, the high compression\n" \
+             "        parser favors decompression speed over compression ratio. Only\n" \
+             "        has an effect when mode is ``'high_compression'`` and\n" \
+             "        compression is ``10`` or greater. Default is ``False``.\n" \
+             "    shuffle (bool or int): If ``True``, the source is treated as an\n" \
+             "        array of items of ``itemsize`` bytes, such as ``8`` for float64\n" \
+             "        values, and byte shuffled before compression: the first bytes\n" \
+             "        of all the items are stored first, then the second bytes, and\n" \
+             "        so on. This usually compresses numeric arrays much better. An\n" \
+             "        integer greater than ``1`` gives the item size directly. With\n" \
+             "        ``store_size``, the shuffle is recorded in the block and undone\n" \
+             "        by `decompress`, and other decoders fail on the block. Without\n" \
+             "        it, the same value must be passed to `decompress`. Default is\n" \
+             "        ``0``.\n"                                         \
+             "    bitshuffle (bool): If ``True``, the bits of the items are shuffled\n" \
+             "        rather than their bytes. The item size is ``1`` if neither\n" \
+             "        ``shuffle`` nor ``itemsize`` sets it. Default is ``False``.\n" \
+             "    filter (str): If specified, the source is treated as an array of\n" \
+             "        little endian integers of ``itemsize`` bytes, and each item\n" \
+             "        is stored relative to the previous one before compression.\n" \
+             "        ``'delta'`` stores the difference, which suits steadily\n" \
+             "        increasing values such as timestamps, ``'delta_of_delta'``\n" \
+             "        the change in the difference, and ``'xor'`` the bits that\n" \
+             "        changed, which suits slowly changing floating point values.\n" \
+             "        This is applied before any shuffle, and recorded in the block\n" \
+             "        with ``store_size`` like the shuffle. Default is ``None``.\n" \
+             "    itemsize (int): The item size for ``filter``: ``1``, ``2``,\n" \
+             "        ``4`` or ``8``, and for ``shuffle``.\n"          \
              "Returns:\n"                                               \
              "    bytes or bytearray: Compressed data.\n");
 
 PyDoc_STRVAR(decompress__doc,
-             "decompress(source, uncompressed_size=-1, return_bytearray=False)\n\n" \
+             "decompress(source, uncompressed_size=-1, return_bytearray=False, dict=None,\n" \
+             "           max_length=-1, shuffle=0, bitshuffle=False, filter=None,\n" \
+             "           itemsize=0)\n\n"                              \
              "Decompress source, returning the uncompressed data as a string.\n" \
              "Raises an exception if any error occurs.\n"               \
              "\n"                                                       \
@@ -454,13 +1056,61 @@ PyDoc_STRVAR(decompress__doc,
              "        return a bytearray object.\n\n" \
              "    dict (str, bytes or buffer-compatible object): If specified, perform\n" \
              "        decompression using this initial dictionary.\n"   \
+             "    max_length (int): If non-negative, at most ``max_length`` bytes of\n" \
+             "        uncompressed data are decoded and returned. Decoding stops once\n" \
+             "        that many bytes have been produced, and only ``max_length``\n" \
+             "        bytes are allocated for the output. This is useful for reading\n" \
+             "        a header from the start of a large block. Default is ``-1``.\n" \
+             "    shuffle (bool or int): The ``shuffle`` value the data was compressed\n" \
+             "        with, if it wasn't recorded in the block. Can't be combined with\n" \
+             "        ``max_length``. Default is ``0``.\n"             \
+             "    bitshuffle (bool): The ``bitshuffle`` value the data was compressed\n" \
+             "        with. Default is ``False``.\n"                   \
+             "    filter (str): The ``filter`` value the data was compressed with,\n" \
+             "        if it wasn't recorded in the block. Default is ``None``.\n" \
+             "    itemsize (int): The ``itemsize`` value the data was compressed\n" \
+             "        with, if it wasn't recorded in the block.\n"     \
              "\n"                                                       \
              "Returns:\n"                                               \
              "    bytes or bytearray: Decompressed data.\n"             \
              "\n"                                                       \
              "Raises:\n"                                                \
              "    LZ4BlockError: raised if the call to the LZ4 library fails. This can be\n" \
-             "        caused by `uncompressed_size` being too small, or invalid data.\n");
+             "        caused by `uncompressed_size` being too small, or invalid data.\n" \
+             "    ValueError: raised if the filter arguments don't match the filter\n" \
+             "        recorded in the block.\n");
+
+PyDoc_STRVAR(decompress_into__doc,
+             "decompress_into(source, destination, uncompressed_size=-1, dict=None)\n\n" \
+             "Decompress source into a writable buffer, or a list or tuple of\n" \
+             "writable buffers, returning the number of bytes written. When a list\n" \
+             "of buffers is given, the uncompressed data is written across them in\n" \
+             "order, filling each buffer before moving on to the next.\n" \
+             "Raises an exception if any error occurs.\n"               \
+             "\n"                                                       \
+             "Args:\n"                                                  \
+             "    source (str, bytes or buffer-compatible object): Data to decompress.\n" \
+             "    destination (buffer-compatible object, or list or tuple of them):\n" \
+             "        Writable buffers to decompress into.\n"           \
+             "\n"                                                       \
+             "Keyword Args:\n"                                          \
+             "    uncompressed_size (int): If not specified or negative, the uncompressed\n" \
+             "        data size is read from the start of the source block, and\n" \
+             "        ``ValueError`` is raised if the destination is too small to\n" \
+             "        hold it. If specified, it is assumed that the full source data\n" \
+             "        is compressed data, and it's considered to be a maximum\n" \
+             "        possible size for the uncompressed data.\n"       \
+             "    dict (str, bytes or buffer-compatible object): If specified, perform\n" \
+             "        decompression using this initial dictionary.\n"   \
+             "\n"                                                       \
+             "Returns:\n"                                               \
+             "    int: Number of bytes written to the destination.\n"   \
+             "\n"                                                       \
+             "Raises:\n"                                                \
+             "    LZ4BlockError: raised if the call to the LZ4 library fails. This can be\n" \
+             "        caused by the destination being too small, or invalid data.\n" \
+             "    ValueError: raised if the block records a filter, which only\n" \
+             "        `decompress` undoes.\n");
 
 PyDoc_STRVAR(lz4block__doc,
              "A Python wrapper for the LZ4 block protocol"
@@ -469,16 +1119,22 @@ PyDoc_STRVAR(lz4block__doc,
 static PyMethodDef module_methods[] = {
   {
     "compress",
-    (PyCFunction) compress,
-    METH_VARARGS | METH_KEYWORDS,
+    FASTCALL_FUNCTION (compress),
+    METH_FASTCALL | METH_KEYWORDS,
     compress__doc
   },
   {
     "decompress",
-    (PyCFunction) decompress,
-    METH_VARARGS | METH_KEYWORDS,
+    FASTCALL_FUNCTION (decompress),
+    METH_FASTCALL | METH_KEYWORDS,
     decompress__doc
   },
+  {
+    "decompress_into",
+    FASTCALL_FUNCTION (decompress_into),
+    METH_FASTCALL | METH_KEYWORDS,
+    decompress_into__doc
+  },
   {
     /* Sentinel */
     NULL,
@@ -510,6 +1166,14 @@ PyInit__block(void)
   PyModule_AddIntConstant (module, "HC_LEVEL_OPT_MIN", LZ4HC_CLEVEL_OPT_MIN);
   PyModule_AddIntConstant (module, "HC_LEVEL_MAX", LZ4HC_CLEVEL_MAX);
 
+  mode_default = PyUnicode_InternFromString ("default");
+  mode_fast = PyUnicode_InternFromString ("fast");
+  mode_high_compression = PyUnicode_InternFromString ("high_compression");
+  if (mode_default == NULL || mode_fast == NULL || mode_high_compression == NULL)
+    {
+      return NULL;
+    }
+
   LZ4BlockError = PyErr_NewExceptionWithDoc("_block.LZ4BlockError", "Call to LZ4 library failed.", NULL, NULL);
   if (LZ4BlockError == NULL)
     {
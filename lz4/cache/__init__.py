@@ -0,0 +1,6 @@
+from ._cache import (  # noqa: F401
+    CompressedCache,
+    __doc__ as _doc
+)
+
+__doc__ = _doc
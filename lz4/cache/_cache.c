@@ -0,0 +1,1481 @@
+/*
+ * Copyright (c) 2024, the python-lz4 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* A cache of LZ4 compressed values, held outside of the Python heap.
+ *
+ * Each entry is a single item holding its header, a copy of the key and the
+ * compressed value. Keys are restricted to str, bytes and int objects, which
+ * are stored as their encoded bytes, so that the cache holds no references to
+ * Python objects and no Python code runs while it is being modified.
+ *
+ * Items are allocated from 1 MiB pages split into slots of a size class, with
+ * classes growing by a factor of 1.25. Pages are kept on a list per class
+ * while they have free slots, and returned to the system once empty, except
+ * for the last one of a class. Items larger than a quarter of a page are
+ * allocated individually.
+ *
+ * Entries are found through a chained hash table, and kept on a list ordered
+ * from the most to the least recently used. The capacity bounds the bytes
+ * taken by the items, and entries are evicted from the tail of the list to
+ * make room for new ones. */
+
+#if defined(_WIN32) && defined(_MSC_VER)
+#define inline __inline
+#elif defined(__SUNPRO_C) || defined(__hpux) || defined(_AIX)
+#define inline
+#endif
+
+#include <Python.h>
+#include <pythread.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <lz4.h>
+
+#include "../_arguments.h"
+
+#if defined(_WIN32) && defined(_MSC_VER) && _MSC_VER < 1600
+/* MSVC 2008 and earlier lacks stdint.h */
+typedef signed __int8 int8_t;
+typedef signed __int16 int16_t;
+typedef signed __int32 int32_t;
+typedef signed __int64 int64_t;
+typedef unsigned __int8 uint8_t;
+typedef unsigned __int16 uint16_t;
+typedef unsigned __int32 uint32_t;
+typedef unsigned __int64 uint64_t;
+
+#if !defined(UINT32_MAX)
+#define UINT32_MAX 0xffffffff
+#endif
+
+#else
+/* Not MSVC, or MSVC 2010 or higher */
+#include <stdint.h>
+#endif /* _WIN32 && _MSC_VER && _MSC_VER < 1600 */
+
+/**************************************
+ * LZ4 version-compatibility wrappers *
+ **************************************/
+#if defined (__GNUC__)
+/* Declare weak symbols on the functions provided by recent versions of the
+ * library, which are NULL if the (old version of the) library does not define
+ * them. */
+
+/* Function introduced in LZ4 >= 1.8.2 */
+__attribute__ ((weak)) void
+LZ4_resetStream_fast (LZ4_stream_t* streamPtr);
+
+/* Function introduced in LZ4 >= 1.8.2 */
+__attribute__ ((weak)) void
+LZ4_attach_dictionary (LZ4_stream_t* workingStream,
+                       const LZ4_stream_t* dictionaryStream);
+
+#else
+/* Assuming the bundled LZ4 library sources are always used, so meet the
+ * LZ4 minimal version requirements.
+ */
+
+/* Only declared by lz4.h under LZ4_STATIC_LINKING_ONLY. */
+void
+LZ4_attach_dictionary (LZ4_stream_t* workingStream,
+                       const LZ4_stream_t* dictionaryStream);
+#endif
+
+#define LZ4_VERSION_NUMBER_1_8_2 10802
+
+static inline int has_attach_dictionary (void)
+{
+#if defined (__GNUC__)
+  if (!LZ4_resetStream_fast || !LZ4_attach_dictionary)
+    {
+      return 0;
+    }
+#endif
+  return LZ4_versionNumber () >= LZ4_VERSION_NUMBER_1_8_2;
+}
+
+/*****************
+ * Slab allocator *
+ *****************/
+#define SLAB_PAGE_SIZE (1024 * 1024)
+#define SLAB_ITEM_MIN 96
+#define SLAB_ITEM_MAX (SLAB_PAGE_SIZE / 4)
+#define SLAB_CLASSES_MAX 48
+#define SLAB_ALIGN(size) (((size) + 7) & ~((size_t) 7))
+#define SLAB_PAGE_HEADER ((sizeof (struct slab_page) + 63) & ~((size_t) 63))
+
+/* The dictionary is limited to the window of the LZ4 block format. */
+#define DICT_SIZE_MAX (64 * 1024)
+
+#define INITIAL_BUCKET_BITS 6
+
+struct slab_page
+{
+  struct slab_page *prev;	/* Pages of the class with free slots */
+  struct slab_page *next;
+  void *free;			/* Slots freed since the page was allocated */
+  uint32_t used;		/* Slots in use */
+  uint32_t bump;		/* Slots handed out from the start of the page */
+  uint32_t capacity;
+  uint32_t size_class;
+};
+
+/* Item sizes of the size classes, set up when the module is loaded. */
+static size_t slab_sizes[SLAB_CLASSES_MAX];
+static int slab_classes;
+
+enum key_tag
+{
+  KEY_BYTES = 1,
+  KEY_STR,
+  KEY_INT
+};
+
+struct entry
+{
+  Py_hash_t hash;
+  struct entry *chain;		/* Next entry in the same bucket */
+  struct entry *newer;		/* Recency list */
+  struct entry *older;
+  struct slab_page *page;	/* NULL for items allocated individually */
+  size_t item_size;		/* Bytes taken by the item */
+  uint32_t key_size;
+  uint32_t value_size;
+  uint32_t stored_size;
+  uint8_t key_tag;
+  uint8_t raw;			/* Value stored uncompressed */
+  uint8_t referenced;		/* Used since last seen by the clock policy */
+};
+
+/* The key is stored right after the header, followed by the value. */
+#define ENTRY_KEY(e) ((char *) ((e) + 1))
+#define ENTRY_DATA(e) (ENTRY_KEY (e) + (e)->key_size)
+
+struct cache_key
+{
+  Py_hash_t hash;
+  int tag;
+  const char *data;
+  Py_ssize_t size;
+  char buffer[8];
+};
+
+typedef struct
+{
+  PyObject_HEAD
+  struct entry **buckets;
+  int bucket_bits;
+  size_t count;
+  struct entry *newest;
+  struct entry *oldest;
+  struct slab_page *partial[SLAB_CLASSES_MAX];
+  size_t capacity;
+  size_t used;			/* Bytes taken by the items */
+  size_t memory;		/* Bytes allocated for pages and large items */
+  unsigned long long nbytes;
+  unsigned long long compressed_nbytes;
+  unsigned long long hits;
+  unsigned long long misses;
+  unsigned long long evictions;
+  int clock;
+  int acceleration;
+  LZ4_stream_t *stream;
+  LZ4_stream_t *dict_stream;
+  char *dict;
+  int dict_size;
+  char *scratch;
+  PyThread_type_lock lock;
+  unsigned long owner;
+} cache_t;
+
+static void
+slab_init_classes (void)
+{
+  size_t size = SLAB_ITEM_MIN;
+
+  slab_classes = 0;
+  while (slab_classes < SLAB_CLASSES_MAX - 1 && size < SLAB_ITEM_MAX)
+    {
+      slab_sizes[slab_classes++] = size;
+      size = SLAB_ALIGN (size + size / 4);
+    }
+  slab_sizes[slab_classes++] = SLAB_ITEM_MAX;
+}
+
+/* Returns the smallest size class holding items of size bytes. */
+static int
+slab_class (size_t size)
+{
+  int low = 0;
+  int high = slab_classes - 1;
+
+  while (low < high)
+    {
+      int middle = (low + high) / 2;
+
+      if (slab_sizes[middle] < size)
+        {
+          low = middle + 1;
+        }
+      else
+        {
+          high = middle;
+        }
+    }
+  return low;
+}
+
+/* Returns the bytes an item of size bytes takes once allocated. */
+static size_t
+item_cost (size_t size)
+{
+  if (size > SLAB_ITEM_MAX)
+    {
+      return size;
+    }
+  return slab_sizes[slab_class (size)];
+}
+
+static void
+page_link (cache_t * self, struct slab_page *page)
+{
+  struct slab_page **head = &self->partial[page->size_class];
+
+  page->prev = NULL;
+  page->next = *head;
+  if (*head != NULL)
+    {
+      (*head)->prev = page;
+    }
+  *head = page;
+}
+
+static void
+page_unlink (cache_t * self, struct slab_page *page)
+{
+  if (page->prev != NULL)
+    {
+      page->prev->next = page->next;
+    }
+  else
+    {
+      self->partial[page->size_class] = page->next;
+    }
+  if (page->next != NULL)
+    {
+      page->next->prev = page->prev;
+    }
+  page->prev = page->next = NULL;
+}
+
+/* Allocates an item of size bytes, returning NULL when out of memory. */
+static struct entry *
+slab_alloc (cache_t * self, size_t size)
+{
+  struct slab_page *page;
+  struct entry *e;
+  int size_class;
+
+  if (size > SLAB_ITEM_MAX)
+    {
+      e = PyMem_RawMalloc (size);
+      if (e == NULL)
+        {
+          return NULL;
+        }
+      e->page = NULL;
+      e->item_size = size;
+      self->memory += size;
+      self->used += size;
+      return e;
+    }
+
+  size_class = slab_class (size);
+  page = self->partial[size_class];
+  if (page == NULL)
+    {
+      page = PyMem_RawMalloc (SLAB_PAGE_SIZE);
+      if (page == NULL)
+        {
+          return NULL;
+        }
+      page->free = NULL;
+      page->used = 0;
+      page->bump = 0;
+      page->capacity =
+        (uint32_t) ((SLAB_PAGE_SIZE - SLAB_PAGE_HEADER) / slab_sizes[size_class]);
+      page->size_class = (uint32_t) size_class;
+      page_link (self, page);
+      self->memory += SLAB_PAGE_SIZE;
+    }
+
+  if (page->free != NULL)
+    {
+      e = page->free;
+      page->free = *(void **) e;
+    }
+  else
+    {
+      e = (struct entry *) ((char *) page + SLAB_PAGE_HEADER +
+                            page->bump * slab_sizes[size_class]);
+      page->bump++;
+    }
+
+  page->used++;
+  if (page->used == page->capacity)
+    {
+      page_unlink (self, page);
+    }
+
+  e->page = page;
+  e->item_size = slab_sizes[size_class];
+  self->used += e->item_size;
+  return e;
+}
+
+static void
+slab_free (cache_t * self, struct entry *e)
+{
+  struct slab_page *page = e->page;
+
+  self->used -= e->item_size;
+  if (page == NULL)
+    {
+      self->memory -= e->item_size;
+      PyMem_RawFree (e);
+      return;
+    }
+
+  if (page->used == page->capacity)
+    {
+      page_link (self, page);
+    }
+  *(void **) e = page->free;
+  page->free = e;
+  page->used--;
+
+  /* Keep one empty page per class, so that an item repeatedly allocated and
+   * freed doesn't allocate a page each time. */
+  if (page->used == 0 && (page->prev != NULL || page->next != NULL))
+    {
+      page_unlink (self, page);
+      PyMem_RawFree (page);
+      self->memory -= SLAB_PAGE_SIZE;
+    }
+}
+
+/* Releases the empty pages left once all the items are freed. */
+static void
+slab_release_pages (cache_t * self)
+{
+  int i;
+
+  for (i = 0; i < SLAB_CLASSES_MAX; i++)
+    {
+      while (self->partial[i] != NULL)
+        {
+          struct slab_page *page = self->partial[i];
+
+          page_unlink (self, page);
+          PyMem_RawFree (page);
+          self->memory -= SLAB_PAGE_SIZE;
+        }
+    }
+}
+
+/**************
+ * Hash table *
+ **************/
+static inline size_t
+bucket_index (Py_hash_t hash, int bits)
+{
+  /* Fibonacci hashing, as small ints are their own hash. */
+  size_t h = (size_t) hash * (size_t) 0x9E3779B97F4A7C15ULL;
+
+  return h >> (sizeof (size_t) * CHAR_BIT - bits);
+}
+
+/* Returns the link pointing to the entry for the key, which points to NULL
+ * if there is none. */
+static struct entry **
+table_find (cache_t * self, const struct cache_key *key)
+{
+  struct entry **link = &self->buckets[bucket_index (key->hash,
+                                                     self->bucket_bits)];
+
+  for (; *link != NULL; link = &(*link)->chain)
+    {
+      struct entry *e = *link;
+
+      if (e->hash == key->hash && e->key_tag == key->tag &&
+          e->key_size == (uint32_t) key->size &&
+          memcmp (ENTRY_KEY (e), key->data, (size_t) key->size) == 0)
+        {
+          break;
+        }
+    }
+  return link;
+}
+
+static int
+table_grow (cache_t * self)
+{
+  int bits = self->bucket_bits + 1;
+  struct entry **buckets;
+  struct entry *e;
+
+  buckets = PyMem_RawCalloc ((size_t) 1 << bits, sizeof (struct entry *));
+  if (buckets == NULL)
+    {
+      return -1;
+    }
+
+  for (e = self->newest; e != NULL; e = e->older)
+    {
+      struct entry **link = &buckets[bucket_index (e->hash, bits)];
+
+      e->chain = *link;
+      *link = e;
+    }
+
+  PyMem_RawFree (self->buckets);
+  self->buckets = buckets;
+  self->bucket_bits = bits;
+  self->memory += sizeof (struct entry *) << (bits - 1);
+  return 0;
+}
+
+static void
+list_unlink (cache_t * self, struct entry *e)
+{
+  if (e->newer != NULL)
+    {
+      e->newer->older = e->older;
+    }
+  else
+    {
+      self->newest = e->older;
+    }
+  if (e->older != NULL)
+    {
+      e->older->newer = e->newer;
+    }
+  else
+    {
+      self->oldest = e->newer;
+    }
+}
+
+static void
+list_push (cache_t * self, struct entry *e)
+{
+  e->newer = NULL;
+  e->older = self->newest;
+  if (self->newest != NULL)
+    {
+      self->newest->newer = e;
+    }
+  else
+    {
+      self->oldest = e;
+    }
+  self->newest = e;
+}
+
+/* Removes the entry that link points to. */
+static void
+entry_remove (cache_t * self, struct entry **link)
+{
+  struct entry *e = *link;
+
+  *link = e->chain;
+  list_unlink (self, e);
+  self->count--;
+  self->nbytes -= e->value_size;
+  self->compressed_nbytes -= e->stored_size;
+  slab_free (self, e);
+}
+
+/* Evicts the least recently used entry. With the clock policy, entries used
+ * since they were last seen get a second chance instead. */
+static void
+evict_one (cache_t * self)
+{
+  struct entry *e = self->oldest;
+  struct entry **link;
+
+  while (self->clock && e->referenced)
+    {
+      e->referenced = 0;
+      list_unlink (self, e);
+      list_push (self, e);
+      e = self->oldest;
+    }
+
+  link = &self->buckets[bucket_index (e->hash, self->bucket_bits)];
+  while (*link != e)
+    {
+      link = &(*link)->chain;
+    }
+  entry_remove (self, link);
+  self->evictions++;
+}
+
+static void
+cache_clear_entries (cache_t * self)
+{
+  while (self->newest != NULL)
+    {
+      struct entry *e = self->newest;
+
+      list_unlink (self, e);
+      slab_free (self, e);
+    }
+  slab_release_pages (self);
+  if (self->buckets != NULL)
+    {
+      memset (self->buckets, 0,
+              sizeof (struct entry *) << self->bucket_bits);
+    }
+  self->count = 0;
+  self->nbytes = 0;
+  self->compressed_nbytes = 0;
+}
+
+/*******************
+ * Key conversions *
+ *******************/
+static int
+get_key (PyObject * object, struct cache_key *key)
+{
+  if (PyBytes_CheckExact (object))
+    {
+      key->tag = KEY_BYTES;
+      key->data = PyBytes_AS_STRING (object);
+      key->size = PyBytes_GET_SIZE (object);
+    }
+  else if (PyUnicode_CheckExact (object))
+    {
+      key->tag = KEY_STR;
+      key->data = PyUnicode_AsUTF8AndSize (object, &key->size);
+      if (key->data == NULL)
+        {
+          return -1;
+        }
+    }
+  else if (PyLong_CheckExact (object))
+    {
+      int overflow;
+      long long value = PyLong_AsLongLongAndOverflow (object, &overflow);
+      int i;
+
+      if (overflow)
+        {
+          PyErr_SetString (PyExc_OverflowError,
+                           "int keys must fit in 64 bits");
+          return -1;
+        }
+      if (value == -1 && PyErr_Occurred ())
+        {
+          return -1;
+        }
+      for (i = 0; i < 8; i++)
+        {
+          key->buffer[i] = (char) (((unsigned long long) value) >> (8 * i));
+        }
+      key->tag = KEY_INT;
+      key->data = key->buffer;
+      key->size = 8;
+    }
+  else
+    {
+      PyErr_Format (PyExc_TypeError,
+                    "keys must be str, bytes or int, not %.50s",
+                    Py_TYPE (object)->tp_name);
+      return -1;
+    }
+
+  if ((size_t) key->size > UINT32_MAX)
+    {
+      PyErr_SetString (PyExc_OverflowError, "key too large");
+      return -1;
+    }
+
+  /* Cached by str and bytes objects, and computed without running Python
+   * code for all three types. */
+  key->hash = PyObject_Hash (object);
+  if (key->hash == -1)
+    {
+      return -1;
+    }
+  return 0;
+}
+
+/***********
+ * Locking *
+ ***********/
+static int
+cache_enter (cache_t * self)
+{
+  if (!PyThread_acquire_lock (self->lock, 0))
+    {
+      if (self->owner == PyThread_get_thread_ident ())
+        {
+          PyErr_SetString (PyExc_RuntimeError,
+                           "reentrant call inside compressed cache");
+          return -1;
+        }
+      Py_BEGIN_ALLOW_THREADS
+      PyThread_acquire_lock (self->lock, 1);
+      Py_END_ALLOW_THREADS
+    }
+  self->owner = PyThread_get_thread_ident ();
+  return 0;
+}
+
+static void
+cache_leave (cache_t * self)
+{
+  self->owner = 0;
+  PyThread_release_lock (self->lock);
+}
+
+/*****************************
+ * Compression of the values *
+ *****************************/
+static int
+cache_compress (cache_t * self, const char *source, char *dest, int source_size,
+                int dest_size)
+{
+  if (has_attach_dictionary ())
+    {
+      LZ4_resetStream_fast (self->stream);
+      if (self->dict_stream != NULL)
+        {
+          LZ4_attach_dictionary (self->stream, self->dict_stream);
+        }
+      return LZ4_compress_fast_continue (self->stream, source, dest,
+                                         source_size, dest_size,
+                                         self->acceleration);
+    }
+
+  if (self->dict != NULL)
+    {
+      LZ4_loadDict (self->stream, self->dict, self->dict_size);
+      return LZ4_compress_fast_continue (self->stream, source, dest,
+                                         source_size, dest_size,
+                                         self->acceleration);
+    }
+
+  return LZ4_compress_fast_extState (self->stream, source, dest, source_size,
+                                     dest_size, self->acceleration);
+}
+
+static int
+cache_decompress (cache_t * self, const struct entry *e, char *dest)
+{
+  int result;
+
+  if (e->raw)
+    {
+      memcpy (dest, ENTRY_DATA (e), e->value_size);
+      return 0;
+    }
+
+  if (self->dict != NULL)
+    {
+      result = LZ4_decompress_safe_usingDict (ENTRY_DATA (e), dest,
+                                              (int) e->stored_size,
+                                              (int) e->value_size,
+                                              self->dict, self->dict_size);
+    }
+  else
+    {
+      result = LZ4_decompress_safe (ENTRY_DATA (e), dest,
+                                    (int) e->stored_size,
+                                    (int) e->value_size);
+    }
+
+  if (result != (int) e->value_size)
+    {
+      PyErr_SetString (PyExc_RuntimeError,
+                       "Decompression of a cached value failed");
+      return -1;
+    }
+  return 0;
+}
+
+/* Stores the value, replacing any value of the key. Returns 1 if stored, 0
+ * if the value can't fit in the cache, and -1 with an exception set. */
+static int
+cache_put (cache_t * self, const struct cache_key *key, const Py_buffer * value)
+{
+  size_t header = sizeof (struct entry) + (size_t) key->size;
+  int bound;
+  int stored;
+  int raw = 0;
+  struct entry *large = NULL;
+  struct entry *e;
+  struct entry **link;
+  char *dest;
+  size_t size;
+  size_t cost;
+
+  if (value->len > LZ4_MAX_INPUT_SIZE)
+    {
+      PyErr_Format (PyExc_OverflowError,
+                    "Input too large for LZ4 API");
+      return -1;
+    }
+
+  /* Small values are compressed into the scratch buffer, and large ones
+   * straight into an item of the worst case size, shrunk afterwards. */
+  bound = LZ4_compressBound ((int) value->len);
+  if (header + (size_t) bound <= SLAB_ITEM_MAX)
+    {
+      if (self->scratch == NULL)
+        {
+          self->scratch = PyMem_RawMalloc (SLAB_ITEM_MAX);
+          if (self->scratch == NULL)
+            {
+              PyErr_NoMemory ();
+              return -1;
+            }
+        }
+      dest = self->scratch;
+    }
+  else
+    {
+      large = PyMem_RawMalloc (header + (size_t) bound);
+      if (large == NULL)
+        {
+          PyErr_NoMemory ();
+          return -1;
+        }
+      dest = (char *) large + header;
+    }
+
+  stored = cache_compress (self, value->buf, dest, (int) value->len, bound);
+  if (stored <= 0 || stored >= value->len)
+    {
+      /* Incompressible, stored as is. */
+      raw = 1;
+      stored = (int) value->len;
+      if (large != NULL)
+        {
+          memcpy (dest, value->buf, (size_t) value->len);
+        }
+    }
+
+  size = header + (size_t) stored;
+  cost = item_cost (size);
+
+  link = table_find (self, key);
+  if (*link != NULL)
+    {
+      entry_remove (self, link);
+    }
+
+  if (cost > self->capacity)
+    {
+      PyMem_RawFree (large);
+      return 0;
+    }
+
+  while (self->used + cost > self->capacity)
+    {
+      evict_one (self);
+    }
+
+  if (size > SLAB_ITEM_MAX)
+    {
+      e = PyMem_RawRealloc (large, size);
+      if (e == NULL)
+        {
+          e = large;
+        }
+      e->page = NULL;
+      e->item_size = size;
+      self->memory += size;
+      self->used += size;
+    }
+  else
+    {
+      e = slab_alloc (self, size);
+      if (e == NULL)
+        {
+          PyMem_RawFree (large);
+          PyErr_NoMemory ();
+          return -1;
+        }
+      e->key_size = (uint32_t) key->size;
+      memcpy (ENTRY_DATA (e), raw ? (const char *) value->buf : dest,
+              (size_t) stored);
+      PyMem_RawFree (large);
+    }
+
+  e->hash = key->hash;
+  e->key_tag = (uint8_t) key->tag;
+  e->key_size = (uint32_t) key->size;
+  memcpy (ENTRY_KEY (e), key->data, (size_t) key->size);
+  e->value_size = (uint32_t) value->len;
+  e->stored_size = (uint32_t) stored;
+  e->raw = (uint8_t) raw;
+  e->referenced = 0;
+
+  link = &self->buckets[bucket_index (e->hash, self->bucket_bits)];
+  e->chain = *link;
+  *link = e;
+  list_push (self, e);
+  self->count++;
+  self->nbytes += e->value_size;
+  self->compressed_nbytes += e->stored_size;
+
+  /* On failure, the table stays usable, only with longer chains. */
+  if (self->count > ((size_t) 1 << self->bucket_bits))
+    {
+      table_grow (self);
+    }
+  return 1;
+}
+
+/*******************
+ * CompressedCache *
+ *******************/
+static PyObject *
+compressed_cache_new (PyTypeObject * type, PyObject * args, PyObject * kwds)
+{
+  cache_t *self;
+  Py_ssize_t capacity;
+  Py_buffer dict = { NULL, NULL };
+  const char *policy = "lru";
+  int acceleration = 1;
+  static char *kwlist[] = { "capacity", "dict", "policy", "acceleration",
+                            NULL };
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "n|z*si:CompressedCache",
+                                    kwlist, &capacity, &dict, &policy,
+                                    &acceleration))
+    {
+      return NULL;
+    }
+
+  if (capacity <= 0)
+    {
+      PyErr_SetString (PyExc_ValueError, "capacity must be positive");
+      goto error;
+    }
+
+  if (strcmp (policy, "lru") != 0 && strcmp (policy, "clock") != 0)
+    {
+      PyErr_Format (PyExc_ValueError,
+                    "policy must be 'lru' or 'clock', not '%s'", policy);
+      goto error;
+    }
+
+  self = (cache_t *) type->tp_alloc (type, 0);
+  if (self == NULL)
+    {
+      goto error;
+    }
+
+  self->capacity = (size_t) capacity;
+  self->clock = strcmp (policy, "clock") == 0;
+  self->acceleration = acceleration;
+  self->bucket_bits = INITIAL_BUCKET_BITS;
+  self->buckets = PyMem_RawCalloc ((size_t) 1 << INITIAL_BUCKET_BITS,
+                                   sizeof (struct entry *));
+  self->memory = sizeof (struct entry *) << INITIAL_BUCKET_BITS;
+  self->stream = LZ4_createStream ();
+  self->lock = PyThread_allocate_lock ();
+  if (self->buckets == NULL || self->stream == NULL || self->lock == NULL)
+    {
+      Py_DECREF (self);
+      PyErr_NoMemory ();
+      goto error;
+    }
+
+  if (dict.buf != NULL && dict.len > 0)
+    {
+      /* Only the last 64 kB of the dictionary are used. */
+      Py_ssize_t size = dict.len < DICT_SIZE_MAX ? dict.len : DICT_SIZE_MAX;
+
+      self->dict = PyMem_RawMalloc ((size_t) size);
+      self->dict_stream = LZ4_createStream ();
+      if (self->dict == NULL || self->dict_stream == NULL)
+        {
+          Py_DECREF (self);
+          PyErr_NoMemory ();
+          goto error;
+        }
+      memcpy (self->dict, (const char *) dict.buf + dict.len - size,
+              (size_t) size);
+      self->dict_size = (int) size;
+      LZ4_loadDict (self->dict_stream, self->dict, self->dict_size);
+    }
+
+  if (dict.buf != NULL)
+    {
+      PyBuffer_Release (&dict);
+    }
+  return (PyObject *) self;
+
+error:
+  if (dict.buf != NULL)
+    {
+      PyBuffer_Release (&dict);
+    }
+  return NULL;
+}
+
+static void
+compressed_cache_dealloc (cache_t * self)
+{
+  PyTypeObject *type = Py_TYPE (self);
+
+  cache_clear_entries (self);
+  PyMem_RawFree (self->buckets);
+  PyMem_RawFree (self->scratch);
+  PyMem_RawFree (self->dict);
+  if (self->stream != NULL)
+    {
+      LZ4_freeStream (self->stream);
+    }
+  if (self->dict_stream != NULL)
+    {
+      LZ4_freeStream (self->dict_stream);
+    }
+  if (self->lock != NULL)
+    {
+      PyThread_free_lock (self->lock);
+    }
+  type->tp_free ((PyObject *) self);
+  Py_DECREF (type);
+}
+
+/* Looks up the key, returning the entry or NULL if missing, and records the
+ * hit or miss. */
+static struct entry *
+cache_lookup (cache_t * self, const struct cache_key *key)
+{
+  struct entry *e = *table_find (self, key);
+
+  if (e == NULL)
+    {
+      self->misses++;
+      return NULL;
+    }
+
+  self->hits++;
+  if (self->clock)
+    {
+      e->referenced = 1;
+    }
+  else if (e != self->newest)
+    {
+      list_unlink (self, e);
+      list_push (self, e);
+    }
+  return e;
+}
+
+/* Returns the value of the key as bytes, NULL without an exception set if it
+ * is missing, or NULL with an exception set. */
+static PyObject *
+cache_get_bytes (cache_t * self, PyObject * key_object)
+{
+  struct cache_key key;
+  struct entry *e;
+  PyObject *result = NULL;
+
+  if (get_key (key_object, &key) != 0 || cache_enter (self) != 0)
+    {
+      return NULL;
+    }
+
+  e = cache_lookup (self, &key);
+  if (e != NULL)
+    {
+      result = PyBytes_FromStringAndSize (NULL, e->value_size);
+      if (result != NULL &&
+          cache_decompress (self, e, PyBytes_AS_STRING (result)) != 0)
+        {
+          Py_CLEAR (result);
+        }
+    }
+
+  cache_leave (self);
+  return result;
+}
+
+static PyObject *
+compressed_cache_put (cache_t * self, PyObject * const * args,
+                      Py_ssize_t nargs, PyObject * kwnames)
+{
+  PyObject *key_object;
+  Py_buffer value;
+  struct cache_key key;
+  int result = -1;
+  static char *kwlist[] = { "key", "value", NULL };
+
+  if (!parse_fastcall_args (args, nargs, kwnames, "put", "Oy*", kwlist,
+                            &key_object, &value))
+    {
+      return NULL;
+    }
+
+  if (get_key (key_object, &key) == 0 && cache_enter (self) == 0)
+    {
+      result = cache_put (self, &key, &value);
+      cache_leave (self);
+    }
+
+  PyBuffer_Release (&value);
+  if (result < 0)
+    {
+      return NULL;
+    }
+  return PyBool_FromLong (result);
+}
+
+static PyObject *
+compressed_cache_get (cache_t * self, PyObject * const * args,
+                      Py_ssize_t nargs, PyObject * kwnames)
+{
+  PyObject *key_object;
+  PyObject *default_value = Py_None;
+  PyObject *result;
+  static char *kwlist[] = { "key", "default", NULL };
+
+  if (!parse_fastcall_args (args, nargs, kwnames, "get", "O|O", kwlist,
+                            &key_object, &default_value))
+    {
+      return NULL;
+    }
+
+  result = cache_get_bytes (self, key_object);
+  if (result == NULL && !PyErr_Occurred ())
+    {
+      Py_INCREF (default_value);
+      return default_value;
+    }
+  return result;
+}
+
+static PyObject *
+compressed_cache_get_into (cache_t * self, PyObject * const * args,
+                           Py_ssize_t nargs, PyObject * kwnames)
+{
+  PyObject *key_object;
+  PyObject *destination;
+  Py_buffer buffer;
+  struct cache_key key;
+  struct entry *e;
+  PyObject *result = NULL;
+  static char *kwlist[] = { "key", "destination", NULL };
+
+  if (!parse_fastcall_args (args, nargs, kwnames, "get_into", "OO", kwlist,
+                            &key_object, &destination))
+    {
+      return NULL;
+    }
+
+  if (get_key (key_object, &key) != 0)
+    {
+      return NULL;
+    }
+
+  if (PyObject_GetBuffer (destination, &buffer, PyBUF_WRITABLE) != 0)
+    {
+      return NULL;
+    }
+
+  if (cache_enter (self) != 0)
+    {
+      PyBuffer_Release (&buffer);
+      return NULL;
+    }
+
+  e = *table_find (self, &key);
+  if (e != NULL && (size_t) buffer.len < e->value_size)
+    {
+      PyErr_Format (PyExc_ValueError,
+                    "destination buffer too small: %u bytes needed, %zd given",
+                    (unsigned int) e->value_size, buffer.len);
+    }
+  else
+    {
+      e = cache_lookup (self, &key);
+      if (e == NULL)
+        {
+          Py_INCREF (Py_None);
+          result = Py_None;
+        }
+      else if (cache_decompress (self, e, buffer.buf) == 0)
+        {
+          result = PyLong_FromUnsignedLong (e->value_size);
+        }
+    }
+
+  cache_leave (self);
+  PyBuffer_Release (&buffer);
+  return result;
+}
+
+static PyObject *
+compressed_cache_clear (cache_t * self, PyObject * Py_UNUSED (ignored))
+{
+  if (cache_enter (self) != 0)
+    {
+      return NULL;
+    }
+  cache_clear_entries (self);
+  cache_leave (self);
+  Py_RETURN_NONE;
+}
+
+static Py_ssize_t
+compressed_cache_length (cache_t * self)
+{
+  return (Py_ssize_t) self->count;
+}
+
+static PyObject *
+compressed_cache_subscript (cache_t * self, PyObject * key)
+{
+  PyObject *result = cache_get_bytes (self, key);
+
+  if (result == NULL && !PyErr_Occurred ())
+    {
+      PyErr_SetObject (PyExc_KeyError, key);
+    }
+  return result;
+}
+
+static int
+compressed_cache_ass_subscript (cache_t * self, PyObject * key_object,
+                                PyObject * value_object)
+{
+  struct cache_key key;
+  struct entry **link;
+  Py_buffer value;
+  int result = -1;
+
+  if (get_key (key_object, &key) != 0)
+    {
+      return -1;
+    }
+
+  if (value_object == NULL)
+    {
+      if (cache_enter (self) != 0)
+        {
+          return -1;
+        }
+      link = table_find (self, &key);
+      if (*link != NULL)
+        {
+          entry_remove (self, link);
+          result = 0;
+        }
+      cache_leave (self);
+      if (result != 0)
+        {
+          PyErr_SetObject (PyExc_KeyError, key_object);
+        }
+      return result;
+    }
+
+  if (PyObject_GetBuffer (value_object, &value, PyBUF_SIMPLE) != 0)
+    {
+      return -1;
+    }
+  if (cache_enter (self) == 0)
+    {
+      result = cache_put (self, &key, &value);
+      cache_leave (self);
+    }
+  PyBuffer_Release (&value);
+  return result < 0 ? -1 : 0;
+}
+
+static int
+compressed_cache_contains (cache_t * self, PyObject * key_object)
+{
+  struct cache_key key;
+  int result;
+
+  if (get_key (key_object, &key) != 0 || cache_enter (self) != 0)
+    {
+      return -1;
+    }
+  result = *table_find (self, &key) != NULL;
+  cache_leave (self);
+  return result;
+}
+
+#define CACHE_COUNTER_GETTER(name)                                      \
+  static PyObject *                                                     \
+  compressed_cache_get_##name (cache_t * self, void * Py_UNUSED (closure)) \
+  {                                                                     \
+    unsigned long long value;                                           \
+                                                                        \
+    if (cache_enter (self) != 0)                                        \
+      {                                                                 \
+        return NULL;                                                    \
+      }                                                                 \
+    value = (unsigned long long) self->name;                            \
+    cache_leave (self);                                                 \
+    return PyLong_FromUnsignedLongLong (value);                         \
+  }
+
+CACHE_COUNTER_GETTER (capacity)
+CACHE_COUNTER_GETTER (hits)
+CACHE_COUNTER_GETTER (misses)
+CACHE_COUNTER_GETTER (evictions)
+CACHE_COUNTER_GETTER (nbytes)
+CACHE_COUNTER_GETTER (compressed_nbytes)
+CACHE_COUNTER_GETTER (used)
+CACHE_COUNTER_GETTER (memory)
+
+static PyObject *
+compressed_cache_get_hit_ratio (cache_t * self, void * Py_UNUSED (closure))
+{
+  double ratio = 0.0;
+
+  if (cache_enter (self) != 0)
+    {
+      return NULL;
+    }
+  if (self->hits + self->misses > 0)
+    {
+      ratio = (double) self->hits / (double) (self->hits + self->misses);
+    }
+  cache_leave (self);
+  return PyFloat_FromDouble (ratio);
+}
+
+static PyObject *
+compressed_cache_get_compression_ratio (cache_t * self,
+                                        void * Py_UNUSED (closure))
+{
+  double ratio = 0.0;
+
+  if (cache_enter (self) != 0)
+    {
+      return NULL;
+    }
+  if (self->compressed_nbytes > 0)
+    {
+      ratio = (double) self->nbytes / (double) self->compressed_nbytes;
+    }
+  cache_leave (self);
+  return PyFloat_FromDouble (ratio);
+}
+
+PyDoc_STRVAR (put__doc,
+              "put(key, value)\n"                                                       \
+              "\n"                                                                      \
+              "Compresses value and stores it under key, replacing any previous\n"     \
+              "value, and evicting entries as needed to stay within the capacity.\n"    \
+              "Values which don't compress are stored as they are.\n"                   \
+              "\n"                                                                      \
+              "Args:\n"                                                                 \
+              "    key (str, bytes or int): The key. Integers must fit in 64 bits.\n"   \
+              "    value (bytes-like object): The value.\n"                             \
+              "\n"                                                                      \
+              "Returns:\n"                                                              \
+              "    bool: False if the value is too large for the cache, in which case\n"\
+              "    any previous value of the key is removed.\n");
+
+PyDoc_STRVAR (get__doc,
+              "get(key, default=None)\n"                                                \
+              "\n"                                                                      \
+              "Returns the value of key, decompressed, or default if it isn't cached.\n"\
+              "\n"                                                                      \
+              "Args:\n"                                                                 \
+              "    key (str, bytes or int): The key.\n"                                 \
+              "    default: The value returned if the key isn't cached.\n"              \
+              "\n"                                                                      \
+              "Returns:\n"                                                              \
+              "    bytes: The value.\n");
+
+PyDoc_STRVAR (get_into__doc,
+              "get_into(key, destination)\n"                                            \
+              "\n"                                                                      \
+              "Decompresses the value of key into the start of destination, without\n"  \
+              "allocating a bytes object.\n"                                            \
+              "\n"                                                                      \
+              "Args:\n"                                                                 \
+              "    key (str, bytes or int): The key.\n"                                 \
+              "    destination (writable bytes-like object): Where the value is\n"      \
+              "        written.\n"                                                      \
+              "\n"                                                                      \
+              "Returns:\n"                                                              \
+              "    int or None: The size of the value, or None if the key isn't\n"      \
+              "    cached.\n"                                                           \
+              "\n"                                                                      \
+              "Raises:\n"                                                               \
+              "    ValueError: If destination is too small for the value.\n");
+
+PyDoc_STRVAR (clear__doc,
+              "clear()\n"                                                               \
+              "\n"                                                                      \
+              "Removes all the entries and returns their memory to the system. The\n"   \
+              "hit, miss and eviction counters are kept.\n");
+
+static PyMethodDef compressed_cache_methods[] = {
+  {
+    "put", FASTCALL_FUNCTION (compressed_cache_put),
+    METH_FASTCALL | METH_KEYWORDS, put__doc
+  },
+  {
+    "get", FASTCALL_FUNCTION (compressed_cache_get),
+    METH_FASTCALL | METH_KEYWORDS, get__doc
+  },
+  {
+    "get_into", FASTCALL_FUNCTION (compressed_cache_get_into),
+    METH_FASTCALL | METH_KEYWORDS, get_into__doc
+  },
+  {
+    "clear", (PyCFunction) compressed_cache_clear,
+    METH_NOARGS, clear__doc
+  },
+  {NULL, NULL, 0, NULL}		/* Sentinel */
+};
+
+static PyGetSetDef compressed_cache_getset[] = {
+  {"capacity", (getter) compressed_cache_get_capacity, NULL,
+   "The maximum number of bytes taken by the entries.", NULL},
+  {"hits", (getter) compressed_cache_get_hits, NULL,
+   "The number of lookups which found their key.", NULL},
+  {"misses", (getter) compressed_cache_get_misses, NULL,
+   "The number of lookups which didn't find their key.", NULL},
+  {"evictions", (getter) compressed_cache_get_evictions, NULL,
+   "The number of entries evicted to make room for others.", NULL},
+  {"nbytes", (getter) compressed_cache_get_nbytes, NULL,
+   "The total size of the cached values.", NULL},
+  {"compressed_nbytes", (getter) compressed_cache_get_compressed_nbytes, NULL,
+   "The total size of the cached values, as stored.", NULL},
+  {"used", (getter) compressed_cache_get_used, NULL,
+   "The number of bytes taken by the entries, counted against the capacity.",
+   NULL},
+  {"memory", (getter) compressed_cache_get_memory, NULL,
+   "The number of bytes allocated by the cache for the entries and the\n"
+   "hash table.", NULL},
+  {"hit_ratio", (getter) compressed_cache_get_hit_ratio, NULL,
+   "The fraction of lookups which found their key, or 0.0 before any.", NULL},
+  {"compression_ratio", (getter) compressed_cache_get_compression_ratio, NULL,
+   "nbytes divided by compressed_nbytes, or 0.0 when empty.", NULL},
+  {NULL, NULL, NULL, NULL, NULL}	/* Sentinel */
+};
+
+PyDoc_STRVAR (compressed_cache__doc,
+              "CompressedCache(capacity, dict=None, policy='lru', acceleration=1)\n"  \
+              "\n"                                                                      \
+              "A mapping from keys to LZ4 compressed values, held outside of the\n"     \
+              "Python heap, which evicts entries to keep within capacity bytes.\n"      \
+              "\n"                                                                      \
+              "Keys must be str, bytes or int objects, and values bytes-like\n"         \
+              "objects. Lookups return the values decompressed as bytes.\n"             \
+              "\n"                                                                      \
+              "Args:\n"                                                                 \
+              "    capacity (int): The maximum number of bytes taken by the entries,\n" \
+              "        including their keys and bookkeeping.\n"                          \
+              "    dict (bytes-like object): A dictionary compressing all the values,\n"\
+              "        of which the last 64 kB are used. Values sharing content with\n" \
+              "        it, such as small records of the same format, compress better.\n"\
+              "    policy (str): 'lru' evicts the least recently used entry. 'clock'\n" \
+              "        evicts the oldest entry not used since it was last considered\n" \
+              "        for eviction, which makes lookups cheaper.\n"                    \
+              "    acceleration (int): The acceleration of lz4.block.compress.\n");
+
+static PyType_Slot compressed_cache_slots[] = {
+  {Py_tp_doc, (void *) compressed_cache__doc},
+  {Py_tp_new, compressed_cache_new},
+  {Py_tp_dealloc, compressed_cache_dealloc},
+  {Py_tp_methods, compressed_cache_methods},
+  {Py_tp_getset, compressed_cache_getset},
+  {Py_mp_length, compressed_cache_length},
+  {Py_mp_subscript, compressed_cache_subscript},
+  {Py_mp_ass_subscript, compressed_cache_ass_subscript},
+  {Py_sq_contains, compressed_cache_contains},
+  {0, NULL}
+};
+
+static PyType_Spec compressed_cache_spec = {
+  "lz4.cache._cache.CompressedCache",
+  sizeof (cache_t),
+  0,
+  Py_TPFLAGS_DEFAULT,
+  compressed_cache_slots
+};
+
+PyDoc_STRVAR (lz4cache__doc,
+              "A compressed in-memory cache using LZ4"
+              );
+
+static struct PyModuleDef moduledef =
+{
+  PyModuleDef_HEAD_INIT,
+  "_cache",
+  lz4cache__doc,
+  -1,
+  NULL
+};
+
+PyMODINIT_FUNC
+PyInit__cache(void)
+{
+  PyObject *module = PyModule_Create (&moduledef);
+  PyObject *cache_type;
+
+  if (module == NULL)
+    return NULL;
+
+  slab_init_classes ();
+
+  cache_type = PyType_FromSpec (&compressed_cache_spec);
+  if (cache_type == NULL || PyModule_AddObject (module, "CompressedCache", cache_type) != 0)
+    {
+      Py_XDECREF (cache_type);
+      Py_DECREF (module);
+      return NULL;
+    }
+
+  #ifdef Py_GIL_DISABLED
+    PyUnstable_Module_SetGIL(module, Py_MOD_GIL_NOT_USED);
+  #endif
+
+  return module;
+}
@@ -10,10 +10,19 @@ from ._frame import (  # noqa: F401
     compress_begin,
     compress_chunk,
     compress_flush,
+    set_sink,
     create_decompression_context,
     reset_decompression_context,
+    get_filter_header,
     decompress_chunk,
+    decode_filter as _decode_filter,
+    save_filter_state as _save_filter_state,
+    load_filter_state as _load_filter_state,
+    decompress_into,
     get_frame_info,
+    FrameReader as _FrameReader,
+    set_allocator,
+    get_allocator,
     BLOCKSIZE_DEFAULT as _BLOCKSIZE_DEFAULT,
     BLOCKSIZE_MAX64KB as _BLOCKSIZE_MAX64KB,
     BLOCKSIZE_MAX256KB as _BLOCKSIZE_MAX256KB,
@@ -101,7 +110,9 @@ compression level available.
 class LZ4FrameCompressor(object):
     """Create a LZ4 frame compressor object.
 
-    This object can be used to compress data incrementally.
+    This object can be used to compress data incrementally. The shuffle
+    filters of `lz4.frame.compress`, which are applied to whole blocks, aren't
+    available here.
 
     Args:
         block_size (int): Specifies the maximum blocksize to use.
@@ -143,12 +154,35 @@ class LZ4FrameCompressor(object):
             functionality is only supported if the underlying LZ4 library has
             version >= 1.8.0. Attempting to set this value to ``True`` with a
             version of LZ4 < 1.8.0 will cause a ``RuntimeError`` to be raised.
+        favor_decompression_speed (bool): If ``True``, the high compression
+            parser favors decompression speed over compression ratio. Only
+            has an effect for ``compression_level`` of 10 or above. The
+            default is ``False``.
         auto_flush (bool): When ``False``, the LZ4 library may buffer data
             until a block is full. When ``True`` no buffering occurs, and
             partially full blocks may be returned. The default is ``False``.
         return_bytearray (bool): When ``False`` a ``bytes`` object is returned
             from the calls to methods of this class. When ``True`` a
             ``bytearray`` object will be returned. The default is ``False``.
+        sink (int, buffer-compatible object or callable): If specified, the
+            compressed data is passed to this file descriptor, writable
+            buffer or callable rather than being returned, and the methods
+            of this class return the number of compressed bytes produced
+            instead. The data is collected in a native buffer and passed on
+            in large writes, or after every call if ``auto_flush`` is
+            ``True``. See `lz4.frame.set_sink` for details. The default is
+            ``None``.
+        sink_buffer_size (int): The amount of compressed data collected
+            before it's passed to ``sink``. The default is 256 kB.
+        filter (str): If specified, the data is treated as an array of little
+            endian integers of ``itemsize`` bytes, and each item is stored
+            relative to the previous one: ``'delta'`` stores the difference,
+            ``'delta_of_delta'`` the change in the difference, and ``'xor'``
+            the bits that changed. The filter is recorded ahead of the frame
+            and undone by `lz4.frame.decompress`, `LZ4FrameDecompressor` and
+            `LZ4FrameFile`. The default is ``None``.
+        itemsize (int): The item size for ``filter``: ``1``, ``2``, ``4`` or
+            ``8``. The default is ``0``.
 
     """
 
@@ -159,7 +193,12 @@ class LZ4FrameCompressor(object):
                  content_checksum=False,
                  block_checksum=False,
                  auto_flush=False,
-                 return_bytearray=False):
+                 return_bytearray=False,
+                 favor_decompression_speed=False,
+                 sink=None,
+                 sink_buffer_size=256 * 1024,
+                 filter=None,
+                 itemsize=0):
         self.block_size = block_size
         self.block_linked = block_linked
         self.compression_level = compression_level
@@ -172,6 +211,11 @@ class LZ4FrameCompressor(object):
         self.block_checksum = block_checksum
         self.auto_flush = auto_flush
         self.return_bytearray = return_bytearray
+        self.favor_decompression_speed = favor_decompression_speed
+        self.sink = sink
+        self.sink_buffer_size = sink_buffer_size
+        self.filter = filter
+        self.itemsize = itemsize
         self._context = None
         self._started = False
 
@@ -187,6 +231,11 @@ class LZ4FrameCompressor(object):
         self.block_checksum = None
         self.auto_flush = None
         self.return_bytearray = None
+        self.favor_decompression_speed = None
+        self.sink = None
+        self.sink_buffer_size = None
+        self.filter = None
+        self.itemsize = None
         self._context = None
         self._started = False
 
@@ -204,12 +253,15 @@ class LZ4FrameCompressor(object):
                 during decompression. Default is 0 (no size stored).
 
         Returns:
-            bytes or bytearray: frame header data
+            bytes or bytearray: frame header data, or its size if ``sink`` was
+            specified.
 
         """
 
         if self._started is False:
             self._context = create_compression_context()
+            if self.sink is not None:
+                set_sink(self._context, self.sink, self.sink_buffer_size)
             result = compress_begin(
                 self._context,
                 block_size=self.block_size,
@@ -219,7 +271,10 @@ class LZ4FrameCompressor(object):
                 block_checksum=self.block_checksum,
                 auto_flush=self.auto_flush,
                 return_bytearray=self.return_bytearray,
+                favor_decompression_speed=self.favor_decompression_speed,
                 source_size=source_size,
+                filter=self.filter,
+                itemsize=self.itemsize,
             )
             self._started = True
             return result
@@ -228,7 +283,7 @@ class LZ4FrameCompressor(object):
                 "LZ4FrameCompressor.begin() called after already initialized"
             )
 
-    def compress(self, data):  # noqa: F811
+    def compress(self, data, stable_src=False):  # noqa: F811
         """Compresses data and returns it.
 
         This compresses ``data`` (a ``bytes`` object), returning a bytes or
@@ -243,10 +298,22 @@ class LZ4FrameCompressor(object):
         `compress_begin()`.
 
         Args:
-            data (str, bytes or buffer-compatible object): data to compress
+            data (str, bytes or buffer-compatible object): data to compress.
+                This may also be a list or tuple of buffer-compatible
+                objects, which are compressed as if joined together.
+
+        Keyword Args:
+            stable_src (bool): If ``True``, the compressor references ``data``
+                directly rather than copying it internally, saving a copy per
+                call. ``data`` must not be modified until the 64 kB of data
+                following it have been compressed, which without
+                ``auto_flush`` happens a whole block at a time, or until
+                `flush()` is called. It has no effect for a list of buffers.
+                See `lz4.frame.compress_chunk`. The default is ``False``.
 
         Returns:
-            bytes or bytearray: compressed data
+            bytes or bytearray: compressed data, or its size if ``sink`` was
+            specified.
 
         """
         if self._context is None:
@@ -255,9 +322,10 @@ class LZ4FrameCompressor(object):
         if self._started is False:
             raise RuntimeError('compress called before compress_begin()')
 
+        # Arguments are passed positionally, which is the fastest path
+        # through the argument parsing of the C functions.
         result = compress_chunk(
-            self._context, data,
-            return_bytearray=self.return_bytearray
+            self._context, data, self.return_bytearray, stable_src
         )
 
         return result
@@ -271,8 +339,12 @@ class LZ4FrameCompressor(object):
         The LZ4FrameCompressor instance may be reused after this method has
         been called to create a new frame of compressed data.
 
+        If ``sink`` was specified, all the compressed data collected for it
+        is passed to it.
+
         Returns:
-            bytes or bytearray: compressed data and frame footer.
+            bytes or bytearray: compressed data and frame footer, or their
+            size if ``sink`` was specified.
 
         """
         result = compress_flush(
@@ -321,6 +393,10 @@ class LZ4FrameDecompressor(object):
     For a more convenient way of decompressing an entire compressed frame at
     once, see `lz4.frame.decompress()`.
 
+    A delta filter recorded ahead of a frame is undone. Frames compressed with
+    a shuffle filter can only be decompressed by `lz4.frame.decompress()`,
+    and raise a ``RuntimeError``.
+
     Args:
         return_bytearray (bool): When ``False`` a bytes object is returned from
             the calls to methods of this class. When ``True`` a bytearray
@@ -344,6 +420,8 @@ class LZ4FrameDecompressor(object):
         self.unused_data = None
         self._unconsumed_data = b''
         self._return_bytearray = return_bytearray
+        self._at_start = True
+        self._filter = None
 
     def __enter__(self):
         # All necessary initialization is done in __init__
@@ -356,6 +434,7 @@ class LZ4FrameDecompressor(object):
         self.unused_data = None
         self._unconsumed_data = None
         self._return_bytearray = None
+        self._filter = None
 
     def reset(self):
         """Reset the decompressor state.
@@ -368,6 +447,8 @@ class LZ4FrameDecompressor(object):
         self.needs_input = True
         self.unused_data = None
         self._unconsumed_data = b''
+        self._at_start = True
+        self._filter = None
 
     def decompress(self, data, max_length=-1):  # noqa: F811
         """Decompresses part or all of an LZ4 frame of compressed data.
@@ -411,11 +492,24 @@ class LZ4FrameDecompressor(object):
         if self._unconsumed_data:
             data = self._unconsumed_data + data
 
+        while self._at_start:
+            # A frame compressed with a filter starts with headers recording
+            # it, which may be split across calls. Frames compressed with a
+            # shuffle filter raise a RuntimeError here.
+            header = get_filter_header(data)
+            if header == 0:
+                self._unconsumed_data = data
+                self.needs_input = True
+                return bytearray() if self._return_bytearray else b''
+            if header is None:
+                self._at_start = False
+            else:
+                header_size, self._filter = header
+                data = data[header_size:]
+
         decompressed, bytes_read, eoframe = decompress_chunk(
-            self._context,
-            data,
-            max_length=max_length,
-            return_bytearray=self._return_bytearray,
+            self._context, data, max_length, self._return_bytearray,
+            self._filter
         )
 
         if bytes_read < len(data):
@@ -430,6 +524,9 @@ class LZ4FrameDecompressor(object):
             self.unused_data = None
 
         self.eof = eoframe
+        if eoframe:
+            self._at_start = True
+            self._filter = None
 
         return decompressed
 
@@ -449,6 +546,9 @@ class LZ4FrameFile(_compression.BaseStream):
     Note that LZ4FFile provides a *binary* file interface - data read is
     returned as bytes, and data to be written must be given as bytes.
 
+    Frames compressed with a shuffle filter by `lz4.frame.compress` can only
+    be decompressed by that function, and raise a ``RuntimeError`` when read.
+
     When opening a file for writing, the settings used by the compressor can be
     specified. The underlying compressor object is
     `lz4.frame.LZ4FrameCompressor`. See the docstrings for that class for
@@ -485,6 +585,8 @@ class LZ4FrameFile(_compression.BaseStream):
             `lz4.frame.LZ4FrameCompressor`.
         auto_flush (bool): Compressor setting. See
             `lz4.frame.LZ4FrameCompressor`.
+        favor_decompression_speed (bool): Compressor setting. See
+            `lz4.frame.LZ4FrameCompressor`.
 
     """
 
@@ -496,7 +598,8 @@ class LZ4FrameFile(_compression.BaseStream):
                  block_checksum=False,
                  auto_flush=False,
                  return_bytearray=False,
-                 source_size=0):
+                 source_size=0,
+                 favor_decompression_speed=False):
 
         self._fp = None
         self._closefp = False
@@ -506,15 +609,6 @@ class LZ4FrameFile(_compression.BaseStream):
             mode_code = _MODE_READ
         elif mode in ('w', 'wb', 'a', 'ab', 'x', 'xb'):
             mode_code = _MODE_WRITE
-            self._compressor = LZ4FrameCompressor(
-                block_size=block_size,
-                block_linked=block_linked,
-                compression_level=compression_level,
-                content_checksum=content_checksum,
-                block_checksum=block_checksum,
-                auto_flush=auto_flush,
-                return_bytearray=return_bytearray,
-            )
             self._pos = 0
         else:
             raise ValueError('Invalid mode: {!r}'.format(mode))
@@ -539,12 +633,25 @@ class LZ4FrameFile(_compression.BaseStream):
             )
 
         if self._mode == _MODE_READ:
-            raw = _compression.DecompressReader(self._fp, LZ4FrameDecompressor)
-            self._buffer = io.BufferedReader(raw)
+            # The reader decompresses, buffers and splits lines natively.
+            self._buffer = _FrameReader(self._fp)
 
         if self._mode == _MODE_WRITE:
+            # The compressed data is collected by the compressor and written
+            # to the file in large pieces, rather than once per write() call.
+            self._compressor = LZ4FrameCompressor(
+                block_size=block_size,
+                block_linked=block_linked,
+                compression_level=compression_level,
+                content_checksum=content_checksum,
+                block_checksum=block_checksum,
+                auto_flush=auto_flush,
+                return_bytearray=return_bytearray,
+                favor_decompression_speed=favor_decompression_speed,
+                sink=self._fp.write,
+            )
             self._source_size = source_size
-            self._fp.write(self._compressor.begin(source_size=source_size))
+            self._compressor.begin(source_size=source_size)
 
     def close(self):
         """Flush and close the file.
@@ -570,6 +677,15 @@ class LZ4FrameFile(_compression.BaseStream):
                 self._closefp = False
                 self._mode = _MODE_CLOSED
 
+    def _check_can_read(self):
+        # Called for every read, so the common case is checked directly
+        if self._mode != _MODE_READ:
+            super()._check_can_read()
+
+    def _check_can_write(self):
+        if self._mode != _MODE_WRITE:
+            super()._check_can_write()
+
     @property
     def closed(self):
         """Returns ``True`` if this file is closed.
@@ -632,20 +748,11 @@ class LZ4FrameFile(_compression.BaseStream):
 
         """
         self._check_can_read()
-        # Relies on the undocumented fact that BufferedReader.peek() always
-        # returns at least one byte (except at EOF)
         return self._buffer.peek(size)
 
     def readall(self):
-        chunks = bytearray()
-
-        while True:
-            data = self.read(io.DEFAULT_BUFFER_SIZE)
-            chunks += data
-            if not data:
-                break
-
-        return bytes(chunks)
+        self._check_can_read()
+        return self._buffer.read()
 
     def read(self, size=-1):
         """Read up to ``size`` uncompressed bytes from the file.
@@ -662,11 +769,22 @@ class LZ4FrameFile(_compression.BaseStream):
 
         """
         self._check_can_read()
-
-        if size < 0 and sys.version_info >= (3, 10):
-            return self.readall()
         return self._buffer.read(size)
 
+    def readinto(self, b):
+        """Read uncompressed bytes into ``b``.
+
+        Args:
+            b (writable buffer-compatible object): The buffer to fill.
+
+        Returns:
+            int: The number of bytes read, which is less than the size of
+            ``b`` only at ``EOF``.
+
+        """
+        self._check_can_read()
+        return self._buffer.readinto(b)
+
     def read1(self, size=-1):
         """Read up to ``size`` uncompressed bytes.
 
@@ -709,13 +827,23 @@ class LZ4FrameFile(_compression.BaseStream):
         self._check_can_read()
         return self._buffer.readline(size)
 
+    def __iter__(self):
+        # Lines are split by the reader itself in __next__, rather than
+        # through readline().
+        self._check_can_read()
+        return self
+
+    def __next__(self):
+        self._check_can_read()
+        return next(self._buffer)
+
     def write(self, data):
         """Write a bytes object to the file.
 
         Returns the number of uncompressed bytes written, which is
         always the length of data in bytes. Note that due to buffering,
-        the file on disk may not reflect the data written until close()
-        is called.
+        the file on disk may not reflect the data written until flush() or
+        close() is called, unless ``auto_flush`` is ``True``.
 
         Args:
             data(bytes): uncompressed data to compress and write to the file
@@ -734,11 +862,9 @@ class LZ4FrameFile(_compression.BaseStream):
         self._check_can_write()
 
         if not self._compressor.started():
-            header = self._compressor.begin(source_size=self._source_size)
-            self._fp.write(header)
+            self._compressor.begin(source_size=self._source_size)
 
-        compressed = self._compressor.compress(data)
-        self._fp.write(compressed)
+        self._compressor.compress(data)
         self._pos += length
         return length
 
@@ -749,7 +875,7 @@ class LZ4FrameFile(_compression.BaseStream):
         to be used normally after flushing.
         """
         if self.writable() and self._compressor.has_context():
-            self._fp.write(self._compressor.flush())
+            self._compressor.flush()
         self._fp.flush()
 
     def seek(self, offset, whence=io.SEEK_SET):
@@ -807,7 +933,8 @@ def open(filename, mode="rb",
          block_checksum=False,
          auto_flush=False,
          return_bytearray=False,
-         source_size=0):
+         source_size=0,
+         favor_decompression_speed=False):
     """Open an LZ4Frame-compressed file in binary or text mode.
 
     ``filename`` can be either an actual file name (given as a str, bytes, or
@@ -858,6 +985,8 @@ def open(filename, mode="rb",
             `lz4.frame.LZ4FrameCompressor`.
         auto_flush (bool): Compressor setting. See
             `lz4.frame.LZ4FrameCompressor`.
+        favor_decompression_speed (bool): Compressor setting. See
+            `lz4.frame.LZ4FrameCompressor`.
 
     """
     if 't' in mode:
@@ -886,6 +1015,7 @@ def open(filename, mode="rb",
         auto_flush=auto_flush,
         return_bytearray=return_bytearray,
         source_size=source_size,
+        favor_decompression_speed=favor_decompression_speed,
     )
 
     if 't' in mode:
@@ -37,219 +37,577 @@
 
 #include <Python.h>
 
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 #include <lz4.h> /* Needed for LZ4_VERSION_NUMBER only. */
+#define LZ4F_STATIC_LINKING_ONLY /* Needed for LZ4F_CustomMem. */
 #include <lz4frame.h>
 
+#include "../_arguments.h"
+#include "../_buffers.h"
+#include "../_shuffle.h"
+#include "../_delta.h"
+#include "../_trace.h"
+
+/* The result of an LZ4F call as a tracepoint argument, -1 on error. */
+#define TRACE_RESULT(result) \
+  (LZ4F_isError (result) ? (long long) -1 : (long long) (result))
+
 static const char * compression_context_capsule_name = "_frame.LZ4F_cctx";
 static const char * decompression_context_capsule_name = "_frame.LZ4F_dctx";
 
-struct compression_context
+/*************
+ * Allocator *
+ *************/
+typedef enum
 {
-  LZ4F_cctx * context;
-  LZ4F_preferences_t preferences;
-};
+  ALLOCATOR_DEFAULT,
+  ALLOCATOR_PYTHON
+} allocator_e;
+
+/* Allocator used for the LZ4F contexts created from now on. Contexts keep
+ * the allocator they were created with until they are freed. */
+static allocator_e allocator = ALLOCATOR_DEFAULT;
+
+#if LZ4_VERSION_NUMBER >= 10904
+#define HAVE_LZ4F_CUSTOM_MEM 1
+
+#if defined (__GNUC__)
+/* The *_advanced functions were introduced in LZ4 1.9.4. Declare them as weak
+ * symbols, so that they are NULL if an older system library is used. */
+__attribute__ ((weak)) LZ4F_cctx *
+LZ4F_createCompressionContext_advanced (LZ4F_CustomMem customMem,
+                                        unsigned version);
+__attribute__ ((weak)) LZ4F_dctx *
+LZ4F_createDecompressionContext_advanced (LZ4F_CustomMem customMem,
+                                          unsigned version);
+__attribute__ ((weak)) size_t
+LZ4F_compressFrame_usingCDict (LZ4F_cctx * cctx,
+                               void * dst, size_t dstCapacity,
+                               const void * src, size_t srcSize,
+                               const LZ4F_CDict * cdict,
+                               const LZ4F_preferences_t * preferencesPtr);
+#endif
+
+/* The raw domain allocators are thread-safe and may be called without holding
+ * the GIL, which LZ4F does. They are also traced by tracemalloc. */
+static void *
+pymem_alloc (void * Py_UNUSED (opaque), size_t size)
+{
+  return PyMem_RawMalloc (size);
+}
+
+static void *
+pymem_calloc (void * Py_UNUSED (opaque), size_t size)
+{
+  return PyMem_RawCalloc (1, size);
+}
 
-/*****************************
-* create_compression_context *
-******************************/
 static void
-destroy_compression_context (PyObject * py_context)
+pymem_free (void * Py_UNUSED (opaque), void * address)
 {
-#ifndef PyCapsule_Type
-  struct compression_context *context =
-    PyCapsule_GetPointer (py_context, compression_context_capsule_name);
-#else
-  /* Compatibility with 2.6 via capsulethunk. */
-  struct compression_context *context =  py_context;
+  PyMem_RawFree (address);
+}
+
+static const LZ4F_CustomMem pymem_custom_mem =
+  { pymem_alloc, pymem_calloc, pymem_free, NULL };
 #endif
-  Py_BEGIN_ALLOW_THREADS
-  LZ4F_freeCompressionContext (context->context);
-  Py_END_ALLOW_THREADS
 
-  PyMem_Free (context);
+static int
+custom_mem_supported (void)
+{
+#ifdef HAVE_LZ4F_CUSTOM_MEM
+#if defined (__GNUC__)
+  if (!LZ4F_createCompressionContext_advanced ||
+      !LZ4F_createDecompressionContext_advanced ||
+      !LZ4F_compressFrame_usingCDict)
+    {
+      return 0;
+    }
+#endif
+  return LZ4_versionNumber () >= 10904;
+#else
+  return 0;
+#endif
 }
 
-static PyObject *
-create_compression_context (PyObject * Py_UNUSED (self))
+static LZ4F_errorCode_t
+new_compression_context (LZ4F_cctx ** context, allocator_e alloc)
 {
-  struct compression_context * context;
-  LZ4F_errorCode_t result;
-
-  context =
-    (struct compression_context *)
-    PyMem_Malloc (sizeof (struct compression_context));
+#ifdef HAVE_LZ4F_CUSTOM_MEM
+  if (alloc == ALLOCATOR_PYTHON)
+    {
+      *context = LZ4F_createCompressionContext_advanced (pymem_custom_mem,
+                                                         LZ4F_VERSION);
+      if (*context == NULL)
+        {
+          return (LZ4F_errorCode_t) -LZ4F_ERROR_allocation_failed;
+        }
+      return 0;
+    }
+#endif
+  return LZ4F_createCompressionContext (context, LZ4F_VERSION);
+}
 
-  if (!context)
+static LZ4F_errorCode_t
+new_decompression_context (LZ4F_dctx ** context, allocator_e alloc)
+{
+#ifdef HAVE_LZ4F_CUSTOM_MEM
+  if (alloc == ALLOCATOR_PYTHON)
     {
-      return PyErr_NoMemory ();
+      *context = LZ4F_createDecompressionContext_advanced (pymem_custom_mem,
+                                                           LZ4F_VERSION);
+      if (*context == NULL)
+        {
+          return (LZ4F_errorCode_t) -LZ4F_ERROR_allocation_failed;
+        }
+      return 0;
     }
+#endif
+  return LZ4F_createDecompressionContext (context, LZ4F_VERSION);
+}
 
-  Py_BEGIN_ALLOW_THREADS
+static PyObject *
+set_allocator (PyObject * Py_UNUSED (self), PyObject * args,
+               PyObject * keywds)
+{
+  const char * name;
+  static char *kwlist[] = { "allocator",
+                            NULL
+                          };
 
-  result =
-    LZ4F_createCompressionContext (&context->context,
-                                   LZ4F_VERSION);
-  Py_END_ALLOW_THREADS
+  if (!PyArg_ParseTupleAndKeywords (args, keywds, "s", kwlist,
+                                    &name))
+    {
+      return NULL;
+    }
 
-  if (LZ4F_isError (result))
+  if (!strncmp (name, "default", sizeof ("default")))
     {
-      LZ4F_freeCompressionContext (context->context);
-      PyMem_Free (context);
-      PyErr_Format (PyExc_RuntimeError,
-                    "LZ4F_createCompressionContext failed with code: %s",
-                    LZ4F_getErrorName (result));
+      allocator = ALLOCATOR_DEFAULT;
+    }
+  else if (!strncmp (name, "python", sizeof ("python")))
+    {
+      if (!custom_mem_supported ())
+        {
+          PyErr_SetString (PyExc_RuntimeError,
+                           "python allocator specified but not supported by LZ4 library version");
+          return NULL;
+        }
+      allocator = ALLOCATOR_PYTHON;
+    }
+  else
+    {
+      PyErr_Format (PyExc_ValueError,
+                    "Invalid allocator argument: %s. Must be one of: default, python",
+                    name);
       return NULL;
     }
 
-  return PyCapsule_New (context, compression_context_capsule_name,
-                        destroy_compression_context);
+  Py_RETURN_NONE;
 }
 
-/************
- * compress *
- ************/
 static PyObject *
-compress (PyObject * Py_UNUSED (self), PyObject * args,
-          PyObject * keywds)
+get_allocator (PyObject * Py_UNUSED (self), PyObject * Py_UNUSED (args))
 {
-  Py_buffer source;
-  Py_ssize_t source_size;
-  int store_size = 1;
-  int return_bytearray = 0;
-  int content_checksum = 0;
-  int block_checksum = 0;
-  int block_linked = 1;
+  if (allocator == ALLOCATOR_PYTHON)
+    {
+      return PyUnicode_FromString ("python");
+    }
+  return PyUnicode_FromString ("default");
+}
+
+/********
+ * Sink *
+ ********/
+typedef enum
+{
+  SINK_NONE,
+  SINK_FD,
+  SINK_BUFFER,
+  SINK_CALLABLE
+} sink_e;
+
+#define SINK_BUFFER_SIZE_DEFAULT (256 * (1 << 10))
+
+#ifdef _WIN32
+#define sink_write(fd, buffer, size)                                    \
+  _write ((fd), (buffer), (unsigned int) ((size) > INT_MAX ? INT_MAX : (size)))
+#else
+#define sink_write(fd, buffer, size)                                    \
+  write ((fd), (buffer), (size) > PY_SSIZE_T_MAX ? PY_SSIZE_T_MAX : (size))
+#endif
+
+/* A source passed to compress_chunk with stable_src=True, held until LZ4F can
+ * no longer reference it. */
+struct stable_source
+{
+  struct buffer_list source;
+  /* Stream position just past the end of the source. */
+  unsigned long long end;
+  struct stable_source * next;
+};
+
+struct compression_context
+{
+  LZ4F_cctx * context;
   LZ4F_preferences_t preferences;
-  size_t destination_size;
-  size_t compressed_size;
-  PyObject *py_destination;
-  char *destination;
+  /* Output buffer reused by compress_begin, compress_chunk and compress_flush.
+   * It's sized at compress_begin to hold the output for a whole block, and
+   * grown if a larger chunk is passed in. */
+  char * buffer;
+  size_t buffer_size;
+  /* Sources of compress_chunk calls made with stable_src=True, oldest first,
+   * which LZ4F may reference as the dictionary of later blocks. consumed is
+   * the number of bytes passed to LZ4F since compress_begin, and block_start
+   * the position at which LZ4F started collecting its current block. */
+  struct stable_source * stable_sources;
+  struct stable_source * stable_sources_last;
+  unsigned long long consumed;
+  unsigned long long block_start;
+  /* Destination set by set_sink. With a sink, output accumulates in pending,
+   * and is written out once sink_buffer_size bytes are held. For a buffer
+   * sink, pending is the buffer itself and is never written out. */
+  sink_e sink;
+  int sink_fd;
+  PyObject * sink_callable;
+  Py_buffer sink_view;
+  char * pending;
+  size_t pending_size;
+  size_t pending_capacity;
+  size_t sink_buffer_size;
+  /* Set while output is being passed to the sink, which may call back into
+   * Python. */
+  int sink_busy;
+  /* Small chunks passed to compress_chunk while autoFlush is disabled, held
+   * back until STAGING_BUFFER_SIZE bytes are collected so they reach LZ4F in
+   * a single update. Allocated on first use. */
+  char * staging;
+  size_t staging_size;
+  /* The delta filter selected by compress_begin, and a buffer of
+   * FILTER_BUFFER_SIZE bytes the chunks are encoded into, allocated on first
+   * use. */
+  struct delta_state delta;
+  char * filter_buffer;
+};
 
-  static char *kwlist[] = { "data",
-                            "compression_level",
-                            "block_size",
-                            "content_checksum",
-                            "block_checksum",
-                            "block_linked",
-                            "store_size",
-                            "return_bytearray",
-                            NULL
-                          };
+#define FILTER_BUFFER_SIZE (64 * 1024)
 
+/* Chunks smaller than STAGING_INPUT_MAX are collected in the staging buffer,
+ * which holds up to STAGING_BUFFER_SIZE bytes. */
+#define STAGING_INPUT_MAX (4 * 1024)
+#define STAGING_BUFFER_SIZE (64 * 1024)
 
-  memset (&preferences, 0, sizeof preferences);
+/* Returns the context's output buffer, growing it to at least size bytes if
+ * needed, or NULL with an exception set on failure. Must be called with the
+ * GIL held. */
+static char *
+reserve_output_buffer (struct compression_context * context, size_t size)
+{
+  char * buffer;
+
+  if (size <= context->buffer_size)
+    {
+      return context->buffer;
+    }
 
-  if (!PyArg_ParseTupleAndKeywords (args, keywds, "y*|iippppp", kwlist,
-                                    &source,
-                                    &preferences.compressionLevel,
-                                    &preferences.frameInfo.blockSizeID,
-                                    &content_checksum,
-                                    &block_checksum,
-                                    &block_linked,
-                                    &store_size,
-                                    &return_bytearray))
+  if (size > PY_SSIZE_T_MAX)
     {
+      PyErr_Format (PyExc_ValueError,
+                    "input data could require %zu bytes, which is larger than the maximum supported size of %zd bytes",
+                    size, PY_SSIZE_T_MAX);
       return NULL;
     }
 
-  if (content_checksum)
+  /* The old contents don't need preserving, so avoid the copy realloc would
+   * make. */
+  buffer = PyMem_Malloc (size);
+  if (buffer == NULL)
     {
-      preferences.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+      PyErr_NoMemory ();
+      return NULL;
     }
-  else
+
+  PyMem_Free (context->buffer);
+  context->buffer = buffer;
+  context->buffer_size = size;
+
+  return buffer;
+}
+
+/* Releases the stable sources LZ4F can no longer reference, or all of them if
+ * all is set. A linked block may reference up to 64 kB before it, and LZ4F
+ * only compresses a block once it has collected a whole one, unless autoFlush
+ * is enabled, so a source is needed until the blocks holding the 64 kB
+ * following it are compressed. */
+static void
+release_stable_sources (struct compression_context * context, int all)
+{
+  unsigned long long compressed = context->consumed;
+  unsigned long long window = 0;
+  struct stable_source * held;
+
+  if (context->preferences.frameInfo.blockMode == LZ4F_blockLinked)
     {
-      preferences.frameInfo.contentChecksumFlag = LZ4F_noContentChecksum;
+      window = 64 * 1024;
     }
 
-  if (block_linked)
+  if (!context->preferences.autoFlush)
     {
-      preferences.frameInfo.blockMode = LZ4F_blockLinked;
+      /* The IDs of the block sizes from 64 kB to 4 MB are 4 to 7, and 0 is
+         the default of 64 kB. */
+      unsigned long long block_size = 64 * 1024;
+
+      if (context->preferences.frameInfo.blockSizeID != LZ4F_default)
+        {
+          block_size =
+            1ULL << (2 * (int) context->preferences.frameInfo.blockSizeID + 8);
+        }
+      compressed -= (compressed - context->block_start) % block_size;
     }
-  else
+
+  while (context->stable_sources != NULL
+         && (all || context->stable_sources->end + window <= compressed))
     {
-      preferences.frameInfo.blockMode = LZ4F_blockIndependent;
+      held = context->stable_sources;
+      context->stable_sources = held->next;
+      release_buffer_list (&held->source);
+      PyMem_Free (held);
     }
 
-  if (LZ4_versionNumber() >= 10800)
+  if (context->stable_sources == NULL)
     {
-      if (block_checksum)
+      context->stable_sources_last = NULL;
+    }
+}
+
+/* Writes the output held in pending to the fd or callable sink. On failure,
+ * the output not yet written is kept for a later attempt, and -1 is returned
+ * with an exception set. */
+static int
+sink_flush (struct compression_context * context)
+{
+  size_t offset = 0;
+  int result = 0;
+
+  if (context->sink != SINK_FD && context->sink != SINK_CALLABLE)
+    {
+      return 0;
+    }
+
+  context->sink_busy = 1;
+
+  while (offset < context->pending_size)
+    {
+      size_t remaining = context->pending_size - offset;
+      Py_ssize_t written;
+
+      if (context->sink == SINK_FD)
         {
-          preferences.frameInfo.blockChecksumFlag = LZ4F_blockChecksumEnabled;
+          int error;
+
+          TRACE_BEGIN_ALLOW_THREADS
+          written = sink_write (context->sink_fd, context->pending + offset,
+                                remaining);
+          error = errno;
+          TRACE_END_ALLOW_THREADS
+
+          if (written < 0)
+            {
+              if (error == EINTR && PyErr_CheckSignals () == 0)
+                {
+                  continue;
+                }
+              if (!PyErr_Occurred ())
+                {
+                  errno = error;
+                  PyErr_SetFromErrno (PyExc_OSError);
+                }
+              result = -1;
+              break;
+            }
         }
       else
         {
-          preferences.frameInfo.blockChecksumFlag = LZ4F_noBlockChecksum;
+          PyObject * chunk;
+          PyObject * returned;
+
+          chunk = PyBytes_FromStringAndSize (context->pending + offset,
+                                             (Py_ssize_t) remaining);
+          if (chunk == NULL)
+            {
+              result = -1;
+              break;
+            }
+
+          returned =
+            PyObject_CallFunctionObjArgs (context->sink_callable, chunk, NULL);
+          Py_DECREF (chunk);
+          if (returned == NULL)
+            {
+              result = -1;
+              break;
+            }
+
+          /* A callable that returns an int, like the write method of a raw
+           * file, may have consumed only part of the data, and is passed the
+           * rest in another call. */
+          written = (Py_ssize_t) remaining;
+          if (PyLong_Check (returned))
+            {
+              written = PyLong_AsSsize_t (returned);
+            }
+          Py_DECREF (returned);
+
+          if (written == -1 && PyErr_Occurred ())
+            {
+              result = -1;
+              break;
+            }
+          if (written <= 0 || (size_t) written > remaining)
+            {
+              PyErr_Format (PyExc_OSError,
+                            "sink returned %zd after being passed %zu bytes",
+                            written, remaining);
+              result = -1;
+              break;
+            }
         }
+
+      offset += (size_t) written;
     }
-  else if (block_checksum)
+
+  memmove (context->pending, context->pending + offset,
+           context->pending_size - offset);
+  context->pending_size -= offset;
+  context->sink_busy = 0;
+
+  return result;
+}
+
+/* Returns where up to size bytes of output can be written for the sink, or
+ * NULL with an exception set. Output that might not fit in a buffer sink is
+ * written to the context's output buffer, and copied by sink_commit. */
+static char *
+sink_reserve (struct compression_context * context, size_t size)
+{
+  size_t capacity;
+  char * pending;
+
+  if (context->pending_capacity - context->pending_size >= size)
     {
-      PyErr_SetString (PyExc_RuntimeError,
-                       "block_checksum specified but not supported by LZ4 library version");
-      return NULL;
+      return context->pending + context->pending_size;
     }
 
-  source_size = source.len;
+  if (context->sink == SINK_BUFFER)
+    {
+      return reserve_output_buffer (context, size);
+    }
 
-  preferences.autoFlush = 0;
-  if (store_size)
+  /* Pending output is written out once it reaches sink_buffer_size, so this
+   * is normally only reached once, for the first call. */
+  capacity = context->sink_buffer_size + size;
+  if (capacity < context->pending_size + size)
     {
-      preferences.frameInfo.contentSize = source_size;
+      capacity = context->pending_size + size;
     }
-  else
+
+  pending = PyMem_Realloc (context->pending, capacity);
+  if (pending == NULL)
     {
-      preferences.frameInfo.contentSize = 0;
+      PyErr_NoMemory ();
+      return NULL;
     }
 
-  Py_BEGIN_ALLOW_THREADS
-  destination_size =
-    LZ4F_compressFrameBound (source_size, &preferences);
-  Py_END_ALLOW_THREADS
+  context->pending = pending;
+  context->pending_capacity = capacity;
 
-  if (destination_size > PY_SSIZE_T_MAX)
+  return pending + context->pending_size;
+}
+
+/* Adds size bytes of output written to the location returned by sink_reserve
+ * to the pending output, writing it out if enough is held. Returns 0 on
+ * success, or -1 with an exception set. */
+static int
+sink_commit (struct compression_context * context, const char * output,
+             size_t size, int flush)
+{
+  if (output != context->pending + context->pending_size)
     {
-      PyBuffer_Release(&source);
-      PyErr_Format (PyExc_ValueError,
-                    "Input data could require %zu bytes, which is larger than the maximum supported size of %zd bytes",
-                    destination_size, PY_SSIZE_T_MAX);
-      return NULL;
+      if (size > context->pending_capacity - context->pending_size)
+        {
+          PyErr_Format (PyExc_ValueError,
+                        "sink buffer is full: %zu bytes needed, %zu bytes available",
+                        size,
+                        context->pending_capacity - context->pending_size);
+          return -1;
+        }
+      memcpy (context->pending + context->pending_size, output, size);
     }
 
-  destination = PyMem_Malloc (destination_size * sizeof * destination);
-  if (destination == NULL)
+  context->pending_size += size;
+
+  if (flush || context->pending_size >= context->sink_buffer_size)
     {
-      PyBuffer_Release(&source);
-      return PyErr_NoMemory();
+      return sink_flush (context);
     }
 
-  Py_BEGIN_ALLOW_THREADS
-  compressed_size =
-    LZ4F_compressFrame (destination, destination_size, source.buf, source_size,
-                        &preferences);
-  Py_END_ALLOW_THREADS
+  return 0;
+}
+
+/* Releases the sink, discarding any pending output. */
+static void
+release_sink (struct compression_context * context)
+{
+  if (context->sink == SINK_BUFFER)
+    {
+      PyBuffer_Release (&context->sink_view);
+    }
+  else
+    {
+      PyMem_Free (context->pending);
+    }
 
-  PyBuffer_Release(&source);
+  Py_CLEAR (context->sink_callable);
+  context->sink = SINK_NONE;
+  context->sink_fd = -1;
+  context->pending = NULL;
+  context->pending_size = 0;
+  context->pending_capacity = 0;
+}
 
-  if (LZ4F_isError (compressed_size))
+/* Returns the result of a compression call: the output as bytes or
+ * bytearray, or the number of bytes passed to the sink if one is set. */
+static PyObject *
+compression_output (struct compression_context * context, const char * output,
+                    size_t size, int return_bytearray, int flush)
+{
+  PyObject * py_destination;
+
+  if (context->sink != SINK_NONE)
     {
-      PyMem_Free (destination);
-      PyErr_Format (PyExc_RuntimeError,
-                    "LZ4F_compressFrame failed with code: %s",
-                    LZ4F_getErrorName (compressed_size));
-      return NULL;
+      if (sink_commit (context, output, size, flush) < 0)
+        {
+          return NULL;
+        }
+      return PyLong_FromSize_t (size);
     }
 
   if (return_bytearray)
     {
-      py_destination = PyByteArray_FromStringAndSize (destination, (Py_ssize_t) compressed_size);
+      py_destination = PyByteArray_FromStringAndSize (output, (Py_ssize_t) size);
     }
   else
     {
-      py_destination = PyBytes_FromStringAndSize (destination, (Py_ssize_t) compressed_size);
+      py_destination = PyBytes_FromStringAndSize (output, (Py_ssize_t) size);
     }
 
-  PyMem_Free (destination);
-
   if (py_destination == NULL)
     {
       return PyErr_NoMemory ();
@@ -258,1064 +616,4086 @@ compress (PyObject * Py_UNUSED (self), PyObject * args,
   return py_destination;
 }
 
-/******************
- * compress_begin *
- ******************/
-static PyObject *
-compress_begin (PyObject * Py_UNUSED (self), PyObject * args,
-                PyObject * keywds)
+/* Returns where up to size bytes of output can be written: the context's
+ * output buffer, or the sink's pending output if one is set. */
+static char *
+reserve_output (struct compression_context * context, size_t size)
 {
-  PyObject *py_context = NULL;
-  Py_ssize_t source_size = (Py_ssize_t) 0;
-  int return_bytearray = 0;
-  int content_checksum = 0;
-  int block_checksum = 0;
-  int block_linked = 1;
-  LZ4F_preferences_t preferences;
-  PyObject *py_destination;
-  char * destination;
-  /* The destination buffer needs to be large enough for a header, which is 15
-   * bytes. Unfortunately, the lz4 library doesn't provide a #define for this.
-   * We over-allocate to allow for larger headers in the future. */
-  const size_t header_size = 32;
-  struct compression_context *context;
-  size_t result;
-  static char *kwlist[] = { "context",
-                            "source_size",
-                            "compression_level",
-                            "block_size",
-                            "content_checksum",
-                            "block_checksum",
-                            "block_linked",
-                            "auto_flush",
-                            "return_bytearray",
-                            NULL
-                          };
+  if (context->sink_busy)
+    {
+      PyErr_SetString (PyExc_RuntimeError,
+                       "compression context used while its sink is being written to");
+      return NULL;
+    }
 
-  memset (&preferences, 0, sizeof preferences);
+  if (context->sink != SINK_NONE)
+    {
+      return sink_reserve (context, size);
+    }
+
+  return reserve_output_buffer (context, size);
+}
 
-  if (!PyArg_ParseTupleAndKeywords (args, keywds, "O|kiippppp", kwlist,
-                                    &py_context,
-                                    &source_size,
-                                    &preferences.compressionLevel,
-                                    &preferences.frameInfo.blockSizeID,
-                                    &content_checksum,
-                                    &block_checksum,
-                                    &block_linked,
-                                    &preferences.autoFlush,
-                                    &return_bytearray
-                                    ))
+static size_t
+get_block_size (LZ4F_blockSizeID_t block_size_id)
+{
+  switch (block_size_id)
     {
-      return NULL;
+    case LZ4F_max256KB:
+      return 256 * (1 << 10);
+    case LZ4F_max1MB:
+      return 1 << 20;
+    case LZ4F_max4MB:
+      return 4 * (1 << 20);
+    default:
+      return 64 * (1 << 10);
     }
+}
 
-  if (content_checksum)
+/* Lists of buffers up to this size are gathered by compress, rather than
+ * being compressed with a series of updates. */
+#define GATHER_SIZE_MAX (1 << 20)
+
+/* Returns the smallest block size no larger than the one requested that holds
+ * source_size bytes, as LZ4F_compressFrame chooses for a whole frame. */
+static LZ4F_blockSizeID_t
+get_optimal_block_size_id (LZ4F_blockSizeID_t requested, size_t source_size)
+{
+  LZ4F_blockSizeID_t proposed = LZ4F_max64KB;
+  size_t max_block_size = 64 * (1 << 10);
+
+  while (requested > proposed)
     {
-      preferences.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+      if (source_size <= max_block_size)
+        {
+          return proposed;
+        }
+      proposed = (LZ4F_blockSizeID_t) ((int) proposed + 1);
+      max_block_size <<= 2;
     }
-  else
+
+  return requested;
+}
+
+/* Passes the data held in the staging buffer to LZ4F, writing any output to
+ * destination. Returns the number of bytes written, or an LZ4F error code.
+ * Safe to call with the GIL released. */
+static size_t
+flush_staging (struct compression_context * context, char * destination,
+               size_t destination_size)
+{
+  LZ4F_compressOptions_t options;
+  size_t result;
+
+  if (context->staging_size == 0)
     {
-      preferences.frameInfo.contentChecksumFlag = LZ4F_noContentChecksum;
+      return 0;
     }
 
-  if (block_linked)
+  memset (&options, 0, sizeof options);
+  result = LZ4F_compressUpdate (context->context, destination,
+                                destination_size, context->staging,
+                                context->staging_size, &options);
+  if (!LZ4F_isError (result))
     {
-      preferences.frameInfo.blockMode = LZ4F_blockLinked;
+      context->consumed += context->staging_size;
+      context->staging_size = 0;
     }
-  else
+  return result;
+}
+
+/* Feeds the buffers in list to LZ4F_compressUpdate, writing the output to
+ * destination, so that the blocks come out as they would for the buffers
+ * joined together. buffered is the number of bytes LZ4F holds for its current
+ * block.
+ *
+ * For a joined source, LZ4F completes the block it holds, compresses the
+ * whole blocks that follow straight from the source, and keeps the rest.
+ * Linked blocks compress slightly differently when a block doesn't follow the
+ * previous one in memory, so only the first of those whole blocks, and the
+ * ones after it in the same buffer, are passed straight from the buffer, or
+ * from scratch if the first one spans buffers. The rest are passed in pieces
+ * smaller than a block that end at block boundaries, so that LZ4F collects
+ * them in its own buffer, where each block follows the previous one as in the
+ * joined source. scratch must hold a block.
+ *
+ * With autoFlush enabled, every update ends a block, so the buffers are
+ * gathered into scratch, which must then hold them all, and passed in a
+ * single update. Returns the number of bytes written, or an LZ4F error code.
+ * Safe to call with the GIL released. */
+static size_t
+compress_buffer_list (LZ4F_cctx * context,
+                      const LZ4F_preferences_t * preferences,
+                      const struct buffer_list * list, size_t buffered,
+                      char * scratch, char * destination,
+                      size_t destination_size,
+                      const LZ4F_compressOptions_t * options)
+{
+  size_t block_size = get_block_size (preferences->frameInfo.blockSizeID);
+  size_t head = 0;
+  size_t done = 0;
+  size_t offset = 0;
+  size_t written = 0;
+  size_t result;
+  Py_ssize_t i = 0;
+
+  if (preferences->autoFlush)
     {
-      preferences.frameInfo.blockMode = LZ4F_blockIndependent;
+      gather_buffer_list (list, scratch);
+      return LZ4F_compressUpdate (context, destination, destination_size,
+                                  scratch, list->total, options);
     }
 
-  if (LZ4_versionNumber() >= 10800)
+  if (buffered > 0)
     {
-      if (block_checksum)
+      head = block_size - buffered;
+    }
+
+  while (done < list->total)
+    {
+      const char * piece;
+      size_t available;
+      size_t length;
+      size_t filled = (buffered + done) % block_size;
+      int gathered = 0;
+
+      while (offset == (size_t) list->views[i].len)
         {
-          preferences.frameInfo.blockChecksumFlag = LZ4F_blockChecksumEnabled;
+          i++;
+          offset = 0;
+        }
+      piece = (const char *) list->views[i].buf + offset;
+      available = (size_t) list->views[i].len - offset;
+
+      if (preferences->frameInfo.blockMode == LZ4F_blockIndependent)
+        {
+          length = available;
+        }
+      else if (done == head && list->total - done >= block_size
+               && available >= block_size)
+        {
+          length = available - available % block_size;
+        }
+      else if (done == head && list->total - done >= block_size)
+        {
+          for (length = 0; length < block_size; length += available)
+            {
+              available = (size_t) list->views[i].len - offset;
+              if (available > block_size - length)
+                {
+                  available = block_size - length;
+                }
+              memcpy (scratch + length,
+                      (const char *) list->views[i].buf + offset, available);
+              offset += available;
+              if (offset == (size_t) list->views[i].len)
+                {
+                  i++;
+                  offset = 0;
+                }
+            }
+          piece = scratch;
+          gathered = 1;
         }
       else
         {
-          preferences.frameInfo.blockChecksumFlag = LZ4F_noBlockChecksum;
+          /* A whole block at a boundary would be compressed from the piece. */
+          length = block_size - filled - (filled == 0 ? 1 : 0);
+          if (length > available)
+            {
+              length = available;
+            }
         }
-    }
-  else if (block_checksum)
-    {
-      PyErr_SetString (PyExc_RuntimeError,
-                       "block_checksum specified but not supported by LZ4 library version");
-      return NULL;
-    }
 
-  if (block_linked)
-    {
-      preferences.frameInfo.blockMode = LZ4F_blockLinked;
+      result = LZ4F_compressUpdate (context, destination + written,
+                                    destination_size - written, piece, length,
+                                    options);
+      if (LZ4F_isError (result))
+        {
+          return result;
+        }
+      written += result;
+      done += length;
+      if (!gathered)
+        {
+          offset += length;
+        }
     }
-  else
+
+  return written;
+}
+
+/* Encodes the buffers in list with the context's delta filter into its filter
+ * buffer, passing the buffer to LZ4F_compressUpdate each time it fills up and
+ * once more at the end. Returns the number of bytes written, or an LZ4F error
+ * code. Safe to call with the GIL released. */
+static size_t
+compress_filtered (struct compression_context * context,
+                   const struct buffer_list * list, char * destination,
+                   size_t destination_size,
+                   const LZ4F_compressOptions_t * options)
+{
+  size_t written = 0;
+  size_t filled = 0;
+  size_t result;
+  Py_ssize_t i;
+
+  for (i = 0; i < list->count; i++)
     {
-      preferences.frameInfo.blockMode = LZ4F_blockIndependent;
-    }
+      const char * source = list->views[i].buf;
+      size_t remaining = (size_t) list->views[i].len;
 
+      while (remaining > 0)
+        {
+          size_t length = FILTER_BUFFER_SIZE - filled;
 
-  preferences.frameInfo.contentSize = source_size;
+          if (length > remaining)
+            {
+              length = remaining;
+            }
+          apply_delta (&context->delta, source,
+                       context->filter_buffer + filled, length, 0);
+          source += length;
+          remaining -= length;
+          filled += length;
 
-  context =
-    (struct compression_context *) PyCapsule_GetPointer (py_context, compression_context_capsule_name);
+          if (filled < FILTER_BUFFER_SIZE)
+            {
+              continue;
+            }
 
-  if (!context || !context->context)
+          result = LZ4F_compressUpdate (context->context, destination + written,
+                                        destination_size - written,
+                                        context->filter_buffer, filled,
+                                        options);
+          if (LZ4F_isError (result))
+            {
+              return result;
+            }
+          written += result;
+          filled = 0;
+        }
+    }
+
+  if (filled > 0)
     {
-      PyErr_SetString (PyExc_ValueError, "No valid compression context supplied");
-      return NULL;
+      result = LZ4F_compressUpdate (context->context, destination + written,
+                                    destination_size - written,
+                                    context->filter_buffer, filled, options);
+      if (LZ4F_isError (result))
+        {
+          return result;
+        }
+      written += result;
     }
 
-  context->preferences = preferences;
+  return written;
+}
 
-  destination = PyMem_Malloc (header_size * sizeof * destination);
-  if (destination == NULL)
+/* Compresses the buffers in list into a whole frame, choosing the same frame
+ * settings as LZ4F_compressFrame would for the buffers joined together.
+ * destination_size must be at least LZ4F_compressFrameBound for the total
+ * size, and scratch must hold a block of the requested size. Returns the
+ * number of bytes written, or an LZ4F error code. Safe to call with the GIL
+ * released. */
+static size_t
+compress_frame_buffer_list (LZ4F_cctx * context,
+                            const struct buffer_list * list, char * scratch,
+                            char * destination, size_t destination_size,
+                            const LZ4F_preferences_t * preferences)
+{
+  LZ4F_preferences_t frame_preferences = *preferences;
+  LZ4F_compressOptions_t options;
+  size_t written;
+  size_t result;
+
+  frame_preferences.frameInfo.blockSizeID =
+    get_optimal_block_size_id (preferences->frameInfo.blockSizeID, list->total);
+  if (list->total <= get_block_size (frame_preferences.frameInfo.blockSizeID))
     {
-      return PyErr_NoMemory();
+      frame_preferences.frameInfo.blockMode = LZ4F_blockIndependent;
     }
 
-  Py_BEGIN_ALLOW_THREADS
-  result = LZ4F_compressBegin (context->context,
-                               destination,
-                               header_size,
-                               &context->preferences);
-  Py_END_ALLOW_THREADS
+  /* LZ4F_compressFrame enables autoFlush since it makes a single update, but
+     here that would make compress_buffer_list gather all the buffers. */
+  frame_preferences.autoFlush = 0;
 
+  /* stableSrc is left disabled even though all the buffers are held until
+     the frame is complete: LZ4F then keeps the dictionary contiguous with the
+     block that follows, which compresses better with the fast compressor. */
+  memset (&options, 0, sizeof options);
+
+  result = LZ4F_compressBegin (context, destination, destination_size,
+                               &frame_preferences);
   if (LZ4F_isError (result))
     {
-      PyErr_Format (PyExc_RuntimeError,
-                    "LZ4F_compressBegin failed with code: %s",
-                    LZ4F_getErrorName (result));
-      return NULL;
+      return result;
     }
+  written = result;
 
-  if (return_bytearray)
+  result = compress_buffer_list (context, &frame_preferences, list, 0,
+                                 scratch, destination + written,
+                                 destination_size - written, &options);
+  if (LZ4F_isError (result))
     {
-      py_destination = PyByteArray_FromStringAndSize (destination, (Py_ssize_t) result);
+      return result;
     }
-  else
+  written += result;
+
+  result = LZ4F_compressEnd (context, destination + written,
+                             destination_size - written, &options);
+  if (LZ4F_isError (result))
     {
-      py_destination = PyBytes_FromStringAndSize (destination, (Py_ssize_t) result);
+      return result;
     }
 
-  PyMem_Free (destination);
+  return written + result;
+}
 
-  if (py_destination == NULL)
-    {
-      return PyErr_NoMemory ();
-    }
+/*****************************
+* create_compression_context *
+******************************/
+static void
+destroy_compression_context (PyObject * py_context)
+{
+#ifndef PyCapsule_Type
+  struct compression_context *context =
+    PyCapsule_GetPointer (py_context, compression_context_capsule_name);
+#else
+  /* Compatibility with 2.6 via capsulethunk. */
+  struct compression_context *context =  py_context;
+#endif
+  TRACE_BEGIN_ALLOW_THREADS
+  LZ4F_freeCompressionContext (context->context);
+  TRACE_END_ALLOW_THREADS
 
-  return py_destination;
+  release_stable_sources (context, 1);
+  release_sink (context);
+  PyMem_Free (context->buffer);
+  PyMem_Free (context->staging);
+  PyMem_Free (context->filter_buffer);
+  PyMem_Free (context);
 }
 
-/******************
- * compress_chunk *
- ******************/
 static PyObject *
-compress_chunk (PyObject * Py_UNUSED (self), PyObject * args,
-                 PyObject * keywds)
+create_compression_context (PyObject * Py_UNUSED (self))
 {
-  PyObject *py_context = NULL;
-  Py_buffer source;
-  Py_ssize_t source_size;
-  struct compression_context *context;
-  size_t compressed_bound;
-  PyObject *py_destination;
-  char *destination;
-  LZ4F_compressOptions_t compress_options;
-  size_t result;
-  int return_bytearray = 0;
-  static char *kwlist[] = { "context",
-                            "data",
-                            "return_bytearray",
-                            NULL
-  };
+  struct compression_context * context;
+  LZ4F_errorCode_t result;
+  allocator_e alloc = allocator;
 
-  memset (&compress_options, 0, sizeof compress_options);
+  context =
+    (struct compression_context *)
+    PyMem_Malloc (sizeof (struct compression_context));
 
-  if (!PyArg_ParseTupleAndKeywords (args, keywds, "Oy*|p", kwlist,
-                                    &py_context,
-                                    &source,
-                                    &return_bytearray))
+  if (!context)
     {
-      return NULL;
+      return PyErr_NoMemory ();
     }
 
-  source_size = source.len;
+  context->buffer = NULL;
+  context->buffer_size = 0;
+  context->stable_sources = NULL;
+  context->stable_sources_last = NULL;
+  context->consumed = 0;
+  context->block_start = 0;
+  context->sink = SINK_NONE;
+  context->sink_fd = -1;
+  context->sink_callable = NULL;
+  context->pending = NULL;
+  context->pending_size = 0;
+  context->pending_capacity = 0;
+  context->staging = NULL;
+  context->staging_size = 0;
+  memset (&context->delta, 0, sizeof context->delta);
+  context->filter_buffer = NULL;
+  context->sink_buffer_size = SINK_BUFFER_SIZE_DEFAULT;
+  context->sink_busy = 0;
+
+  TRACE_BEGIN_ALLOW_THREADS
+
+  result = new_compression_context (&context->context, alloc);
+  TRACE_END_ALLOW_THREADS
 
-  context =
-    (struct compression_context *) PyCapsule_GetPointer (py_context, compression_context_capsule_name);
-  if (!context || !context->context)
+  if (LZ4F_isError (result))
     {
-      PyBuffer_Release(&source);
-      PyErr_Format (PyExc_ValueError, "No compression context supplied");
+      LZ4F_freeCompressionContext (context->context);
+      PyMem_Free (context);
+      PyErr_Format (PyExc_RuntimeError,
+                    "LZ4F_createCompressionContext failed with code: %s",
+                    LZ4F_getErrorName (result));
       return NULL;
     }
 
-  /* If autoFlush is enabled, then the destination buffer only needs to be as
-     big as LZ4F_compressFrameBound specifies for this source size. However, if
-     autoFlush is disabled, previous calls may have resulted in buffered data,
-     and so we need instead to use LZ4F_compressBound to find the size required
-     for the destination buffer. This means that with autoFlush disabled we may
-     frequently allocate more memory than needed. */
-  Py_BEGIN_ALLOW_THREADS
-  if (context->preferences.autoFlush == 1)
-    {
-      compressed_bound =
-        LZ4F_compressFrameBound (source_size, &context->preferences);
-    }
-  else
-    {
-      compressed_bound =
-        LZ4F_compressBound (source_size, &context->preferences);
-    }
-  Py_END_ALLOW_THREADS
+  return PyCapsule_New (context, compression_context_capsule_name,
+                        destroy_compression_context);
+}
+
+/************
+ * compress *
+ ************/
+/* Frames compressed with a filter are preceded by a skippable frame recording
+ * it, so that lz4.frame.decompress can undo it. For a shuffle filter, the
+ * payload is the tag "SHUF", the filter (1 for a byte shuffle, 2 for a bit
+ * shuffle), a zero byte, the item size as a 16-bit integer and the number of
+ * bytes shuffled at a time as a 32-bit integer, all little endian. For a delta
+ * filter, it's the tag "DLTA", the delta_e value, a zero byte, the item size
+ * as a 16-bit integer and four zero bytes. A frame with both filters has the
+ * delta header first. Other LZ4 decoders skip the skippable frames, and return
+ * the filtered data. */
+#define SHUFFLE_FRAME_MAGIC 0x184D2A5EU
+#define SHUFFLE_PAYLOAD_SIZE 12
+#define SHUFFLE_HEADER_SIZE (8 + SHUFFLE_PAYLOAD_SIZE)
+
+struct shuffle_filter
+{
+  size_t itemsize;
+  int bitshuffle;
+  size_t unit;
+};
 
-  if (compressed_bound > PY_SSIZE_T_MAX)
+static inline void
+store_le (unsigned char * c, uint32_t x, int size)
+{
+  int i;
+
+  for (i = 0; i < size; i++)
     {
-      PyBuffer_Release(&source);
-      PyErr_Format (PyExc_ValueError,
-                    "input data could require %zu bytes, which is larger than the maximum supported size of %zd bytes",
-                    compressed_bound, PY_SSIZE_T_MAX);
-      return NULL;
+      c[i] = (x >> (8 * i)) & 0xff;
     }
+}
 
-  destination = PyMem_Malloc (compressed_bound * sizeof * destination);
-  if (destination == NULL)
+static inline uint32_t
+load_le (const unsigned char * c, int size)
+{
+  uint32_t x = 0;
+  int i;
+
+  for (i = size - 1; i >= 0; i--)
     {
-      PyBuffer_Release(&source);
-      return PyErr_NoMemory();
+      x = (x << 8) | c[i];
     }
+  return x;
+}
 
-  compress_options.stableSrc = 0;
+static void
+write_shuffle_header (char * destination, const struct shuffle_filter * filter)
+{
+  unsigned char * header = (unsigned char *) destination;
+
+  store_le (header, SHUFFLE_FRAME_MAGIC, 4);
+  store_le (header + 4, SHUFFLE_PAYLOAD_SIZE, 4);
+  memcpy (header + 8, "SHUF", 4);
+  header[12] = filter->bitshuffle ? 2 : 1;
+  header[13] = 0;
+  store_le (header + 14, (uint32_t) filter->itemsize, 2);
+  store_le (header + 16, (uint32_t) filter->unit, 4);
+}
 
-  Py_BEGIN_ALLOW_THREADS
-  result =
-    LZ4F_compressUpdate (context->context, destination,
-                         compressed_bound, source.buf, source_size,
-                         &compress_options);
-  Py_END_ALLOW_THREADS
+static void
+write_delta_header (char * destination, const struct delta_state * delta)
+{
+  unsigned char * header = (unsigned char *) destination;
+
+  store_le (header, SHUFFLE_FRAME_MAGIC, 4);
+  store_le (header + 4, SHUFFLE_PAYLOAD_SIZE, 4);
+  memcpy (header + 8, "DLTA", 4);
+  header[12] = (unsigned char) delta->kind;
+  header[13] = 0;
+  store_le (header + 14, (uint32_t) delta->itemsize, 2);
+  store_le (header + 16, 0, 4);
+}
 
-  PyBuffer_Release(&source);
+/* Reads a filter header at the start of source, if there is one, into filter
+ * or delta. Returns 1 if one was found, 0 if not, or -1 with an exception set
+ * if it's invalid. */
+static int
+read_filter_header (const char * source, size_t source_size,
+                    struct shuffle_filter * filter, struct delta_state * delta)
+{
+  const unsigned char * header = (const unsigned char *) source;
 
-  if (LZ4F_isError (result))
+  if (source_size < SHUFFLE_HEADER_SIZE
+      || load_le (header, 4) != SHUFFLE_FRAME_MAGIC
+      || load_le (header + 4, 4) != SHUFFLE_PAYLOAD_SIZE)
     {
-      PyMem_Free (destination);
-      PyErr_Format (PyExc_RuntimeError,
-                    "LZ4F_compressUpdate failed with code: %s",
-                    LZ4F_getErrorName (result));
-      return NULL;
+      return 0;
     }
 
-  if (return_bytearray)
+  if (memcmp (header + 8, "DLTA", 4) == 0)
     {
-      py_destination = PyByteArray_FromStringAndSize (destination, (Py_ssize_t) result);
+      memset (delta, 0, sizeof * delta);
+      delta->kind = (delta_e) header[12];
+      delta->itemsize = load_le (header + 14, 2);
+      if (header[12] < DELTA_PLAIN || header[12] > DELTA_XOR
+          || (delta->itemsize != 1 && delta->itemsize != 2
+              && delta->itemsize != 4 && delta->itemsize != 8))
+        {
+          PyErr_SetString (PyExc_RuntimeError, "Invalid delta filter header");
+          return -1;
+        }
+      return 1;
     }
-  else
+
+  if (memcmp (header + 8, "SHUF", 4) != 0)
     {
-      py_destination = PyBytes_FromStringAndSize (destination, (Py_ssize_t) result);
+      return 0;
     }
 
-  PyMem_Free (destination);
+  filter->bitshuffle = header[12] == 2;
+  filter->itemsize = load_le (header + 14, 2);
+  filter->unit = load_le (header + 16, 4);
 
-  if (py_destination == NULL)
+  if ((header[12] != 1 && header[12] != 2) || filter->itemsize == 0
+      || filter->itemsize > SHUFFLE_ITEMSIZE_MAX || filter->unit == 0)
     {
-      return PyErr_NoMemory ();
+      PyErr_SetString (PyExc_RuntimeError, "Invalid shuffle filter header");
+      return -1;
     }
-
-  return py_destination;
+  return 1;
 }
 
-/******************
- * compress_flush *
- ******************/
-static PyObject *
-compress_flush (PyObject * Py_UNUSED (self), PyObject * args, PyObject * keywds)
+/* Returns whether the size bytes at source, fewer than a whole header, may be
+ * the start of a filter header. */
+static int
+filter_header_prefix (const char * source, size_t size)
 {
-  PyObject *py_context = NULL;
-  LZ4F_compressOptions_t compress_options;
-  struct compression_context *context;
-  size_t destination_size;
-  int return_bytearray = 0;
-  int end_frame = 1;
-  PyObject *py_destination;
-  char * destination;
-  size_t result;
-  static char *kwlist[] = { "context",
-                            "end_frame",
-                            "return_bytearray",
-                            NULL
-  };
-
-  memset (&compress_options, 0, sizeof compress_options);
+  static const char magic[8] =
+    { 0x5E, 0x2A, 0x4D, 0x18, SHUFFLE_PAYLOAD_SIZE, 0, 0, 0 };
+  size_t tag_size;
 
-  if (!PyArg_ParseTupleAndKeywords (args, keywds, "O|pp", kwlist,
-                                    &py_context,
-                                    &end_frame,
-                                    &return_bytearray))
+  if (memcmp (source, magic, size < sizeof magic ? size : sizeof magic) != 0)
     {
-      return NULL;
+      return 0;
     }
-
-  if (!end_frame && LZ4_versionNumber() < 10800)
+  if (size <= sizeof magic)
     {
-      PyErr_SetString (PyExc_RuntimeError,
-                       "Flush without ending a frame is not supported with this version of the LZ4 library");
-      return NULL;
+      return 1;
     }
 
-  context =
-    (struct compression_context *) PyCapsule_GetPointer (py_context, compression_context_capsule_name);
-  if (!context || !context->context)
-    {
-      PyErr_SetString (PyExc_ValueError, "No compression context supplied");
-      return NULL;
-    }
+  tag_size = size - sizeof magic < 4 ? size - sizeof magic : 4;
+  return memcmp (source + sizeof magic, "DLTA", tag_size) == 0
+    || memcmp (source + sizeof magic, "SHUF", tag_size) == 0;
+}
 
-  compress_options.stableSrc = 0;
+/* The shuffle filter is applied to whole blocks, and the streaming
+ * decompressors, which produce the data piece by piece, don't undo it. They
+ * raise this error rather than returning the shuffled data. */
+#define SHUFFLE_UNSUPPORTED_MESSAGE                                     \
+  "Frames compressed with a shuffle filter can only be decompressed by " \
+  "lz4.frame.decompress"
 
-  /* Calling LZ4F_compressBound with srcSize equal to 0 returns a size
-     sufficient to fit (i) any remaining buffered data (when autoFlush is
-     disabled) and the footer size, which is either 4 or 8 bytes depending on
-     whether checksums are enabled. See: https://github.com/lz4/lz4/issues/280
-     and https://github.com/lz4/lz4/issues/290. Prior to 1.7.5, it was necessary
-     to call LZ4F_compressBound with srcSize equal to 1. Since we now require a
-     minimum version to 1.7.5 we'll call this with srcSize equal to 0. */
-  Py_BEGIN_ALLOW_THREADS
-  destination_size = LZ4F_compressBound (0, &(context->preferences));
-  Py_END_ALLOW_THREADS
+/* Undoes the shuffle filter on the data returned by __decompress, returning a
+ * new object of the same type, or NULL with an exception set. */
+static PyObject *
+unshuffle_output (PyObject * data, const struct shuffle_filter * filter)
+{
+  PyObject * py_output;
+  const char * input;
+  char * output;
+  char * scratch = NULL;
+  Py_ssize_t size;
 
-  destination = PyMem_Malloc (destination_size * sizeof * destination);
-  if (destination == NULL)
+  if (filter->bitshuffle)
     {
-      return PyErr_NoMemory();
+      scratch = PyMem_Malloc (filter->unit);
+      if (scratch == NULL)
+        {
+          return PyErr_NoMemory ();
+        }
     }
 
-  Py_BEGIN_ALLOW_THREADS
-  if (end_frame)
+  if (PyByteArray_Check (data))
     {
-      result =
-        LZ4F_compressEnd (context->context, destination,
-                          destination_size, &compress_options);
+      size = PyByteArray_GET_SIZE (data);
+      py_output = PyByteArray_FromStringAndSize (NULL, size);
+      input = PyByteArray_AS_STRING (data);
+      output = py_output ? PyByteArray_AS_STRING (py_output) : NULL;
     }
   else
     {
-      result =
-        LZ4F_flush (context->context, destination,
-                    destination_size, &compress_options);
+      size = PyBytes_GET_SIZE (data);
+      py_output = PyBytes_FromStringAndSize (NULL, size);
+      input = PyBytes_AS_STRING (data);
+      output = py_output ? PyBytes_AS_STRING (py_output) : NULL;
     }
-  Py_END_ALLOW_THREADS
 
-  if (LZ4F_isError (result))
+  if (output != NULL)
     {
-      PyMem_Free (destination);
-      PyErr_Format (PyExc_RuntimeError,
-                    "LZ4F_compressEnd failed with code: %s",
-                    LZ4F_getErrorName (result));
-      return NULL;
+      TRACE_BEGIN_ALLOW_THREADS
+      apply_unshuffle (input, output, scratch, (size_t) size, filter->unit,
+                       filter->itemsize, filter->bitshuffle);
+      TRACE_END_ALLOW_THREADS
     }
 
-  if (return_bytearray)
+  PyMem_Free (scratch);
+  return py_output;
+}
+
+/* Undoes the delta filter on the data returned by __decompress, in place. */
+static void
+decode_output (PyObject * data, struct delta_state * delta)
+{
+  char * buffer;
+  Py_ssize_t size;
+
+  if (PyByteArray_Check (data))
     {
-      py_destination = PyByteArray_FromStringAndSize (destination, (Py_ssize_t) result);
+      buffer = PyByteArray_AS_STRING (data);
+      size = PyByteArray_GET_SIZE (data);
     }
   else
     {
-      py_destination = PyBytes_FromStringAndSize (destination, (Py_ssize_t) result);
+      buffer = PyBytes_AS_STRING (data);
+      size = PyBytes_GET_SIZE (data);
     }
 
-  PyMem_Free (destination);
+  TRACE_BEGIN_ALLOW_THREADS
+  apply_delta (delta, buffer, buffer, (size_t) size, 1);
+  TRACE_END_ALLOW_THREADS
+}
 
-  if (py_destination == NULL)
+/* Set the favorDecSpeed preference, which is only honoured by the HC
+ * optimal parser (compression levels >= 10). Returns 0 on success, or -1 with
+ * an exception set if the LZ4 library doesn't support it. */
+static int
+set_favor_dec_speed (LZ4F_preferences_t * preferences, int favor_dec_speed)
+{
+  if (!favor_dec_speed)
     {
-      return PyErr_NoMemory ();
+      return 0;
     }
 
-  return py_destination;
+#if LZ4_VERSION_NUMBER >= 10802
+  if (LZ4_versionNumber() >= 10802)
+    {
+      preferences->favorDecSpeed = 1;
+      return 0;
+    }
+#endif
+
+  PyErr_SetString (PyExc_RuntimeError,
+                   "favor_decompression_speed specified but not supported by LZ4 library version");
+  return -1;
 }
 
-/******************
- * get_frame_info *
- ******************/
 static PyObject *
-get_frame_info (PyObject * Py_UNUSED (self), PyObject * args,
-                PyObject * keywds)
+compress (PyObject * Py_UNUSED (self), PyObject * const * args,
+          Py_ssize_t nargs, PyObject * kwnames)
 {
-  Py_buffer py_source;
-  char *source;
-  size_t source_size;
-  LZ4F_decompressionContext_t context;
-  LZ4F_frameInfo_t frame_info;
-  size_t result;
-  unsigned int block_size;
-  unsigned int block_size_id;
-  int block_linked;
-  int content_checksum;
-  int block_checksum;
-  int skippable;
+  PyObject *py_source;
+  struct buffer_list source;
+  const char *source_start = NULL;
+  char *gathered = NULL;
+  char *filtered = NULL;
+  char *frame;
+  size_t prefix_size = 0;
+  size_t scratch_size;
+  int gather;
+  int shuffle = 0;
+  int bitshuffle = 0;
+  struct shuffle_filter filter;
+  const char *filter_name = NULL;
+  int itemsize = 0;
+  struct delta_state delta;
+  Py_ssize_t source_size;
+  int store_size = 1;
+  int return_bytearray = 0;
+  int content_checksum = 0;
+  int block_checksum = 0;
+  int block_linked = 1;
+  int favor_dec_speed = 0;
+  LZ4F_preferences_t preferences;
+  size_t destination_size;
+  size_t compressed_size;
+  PyObject *py_destination;
+  char *destination;
+  allocator_e alloc = allocator;
 
   static char *kwlist[] = { "data",
+                            "compression_level",
+                            "block_size",
+                            "content_checksum",
+                            "block_checksum",
+                            "block_linked",
+                            "store_size",
+                            "return_bytearray",
+                            "favor_decompression_speed",
+                            "shuffle",
+                            "bitshuffle",
+                            "filter",
+                            "itemsize",
                             NULL
-  };
-
-  if (!PyArg_ParseTupleAndKeywords (args, keywds, "y*", kwlist,
-                                    &py_source))
-    {
-      return NULL;
-    }
-
-  Py_BEGIN_ALLOW_THREADS
-
-  result = LZ4F_createDecompressionContext (&context, LZ4F_VERSION);
-
-  if (LZ4F_isError (result))
-    {
-      Py_BLOCK_THREADS
-      PyBuffer_Release (&py_source);
-      PyErr_Format (PyExc_RuntimeError,
-                    "LZ4F_createDecompressionContext failed with code: %s",
-                    LZ4F_getErrorName (result));
-      return NULL;
-    }
+                          };
 
-  source = (char *) py_source.buf;
-  source_size = (size_t) py_source.len;
 
-  result =
-    LZ4F_getFrameInfo (context, &frame_info, source, &source_size);
+  memset (&preferences, 0, sizeof preferences);
 
-  if (LZ4F_isError (result))
+  if (!parse_fastcall_args (args, nargs, kwnames, "compress",
+                            "O|iippppppipzi", kwlist,
+                            &py_source,
+                            &preferences.compressionLevel,
+                            &preferences.frameInfo.blockSizeID,
+                            &content_checksum,
+                            &block_checksum,
+                            &block_linked,
+                            &store_size,
+                            &return_bytearray,
+                            &favor_dec_speed,
+                            &shuffle,
+                            &bitshuffle,
+                            &filter_name,
+                            &itemsize))
     {
-      LZ4F_freeDecompressionContext (context);
-      Py_BLOCK_THREADS
-      PyBuffer_Release (&py_source);
-      PyErr_Format (PyExc_RuntimeError,
-                    "LZ4F_getFrameInfo failed with code: %s",
-                    LZ4F_getErrorName (result));
       return NULL;
     }
 
-  result = LZ4F_freeDecompressionContext (context);
-
-  Py_END_ALLOW_THREADS
-
-  PyBuffer_Release (&py_source);
-
-  if (LZ4F_isError (result))
+  if (init_delta_state (&delta, filter_name, itemsize) < 0)
     {
-      PyErr_Format (PyExc_RuntimeError,
-                    "LZ4F_freeDecompressionContext failed with code: %s",
-                    LZ4F_getErrorName (result));
       return NULL;
     }
 
-#define KB *(1<<10)
-#define MB *(1<<20)
-  switch (frame_info.blockSizeID)
+  /* The filter is applied a block at a time. */
+  if (get_shuffle (shuffle, bitshuffle, itemsize, &filter.itemsize) < 0)
     {
-    case LZ4F_default:
-    case LZ4F_max64KB:
-      block_size = 64 KB;
-      block_size_id = LZ4F_max64KB;
-      break;
-    case LZ4F_max256KB:
-      block_size = 256 KB;
-      block_size_id = LZ4F_max256KB;
-      break;
-    case LZ4F_max1MB:
-      block_size = 1 MB;
-      block_size_id = LZ4F_max1MB;
-      break;
-    case LZ4F_max4MB:
-      block_size = 4 MB;
-      block_size_id = LZ4F_max4MB;
-      break;
-    default:
-      PyErr_Format (PyExc_RuntimeError,
-                    "Unrecognized blockSizeID in get_frame_info: %d",
-                    frame_info.blockSizeID);
       return NULL;
     }
-#undef KB
-#undef MB
+  filter.bitshuffle = bitshuffle;
+  filter.unit = get_block_size (preferences.frameInfo.blockSizeID);
 
-  if (frame_info.blockMode == LZ4F_blockLinked)
-    {
-      block_linked = 1;
-    }
-  else if (frame_info.blockMode == LZ4F_blockIndependent)
+  if (content_checksum)
     {
-      block_linked = 0;
+      preferences.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
     }
   else
     {
-      PyErr_Format (PyExc_RuntimeError,
-                    "Unrecognized blockMode in get_frame_info: %d",
-                    frame_info.blockMode);
-      return NULL;
+      preferences.frameInfo.contentChecksumFlag = LZ4F_noContentChecksum;
     }
 
-  if (frame_info.contentChecksumFlag == LZ4F_noContentChecksum)
-    {
-      content_checksum = 0;
-    }
-  else if (frame_info.contentChecksumFlag == LZ4F_contentChecksumEnabled)
+  if (block_linked)
     {
-      content_checksum = 1;
+      preferences.frameInfo.blockMode = LZ4F_blockLinked;
     }
   else
     {
-      PyErr_Format (PyExc_RuntimeError,
-                    "Unrecognized contentChecksumFlag in get_frame_info: %d",
-                    frame_info.contentChecksumFlag);
-      return NULL;
+      preferences.frameInfo.blockMode = LZ4F_blockIndependent;
     }
 
   if (LZ4_versionNumber() >= 10800)
     {
-      if (frame_info.blockChecksumFlag == LZ4F_noBlockChecksum)
-        {
-          block_checksum = 0;
-        }
-      else if (frame_info.blockChecksumFlag == LZ4F_blockChecksumEnabled)
+      if (block_checksum)
         {
-          block_checksum = 1;
+          preferences.frameInfo.blockChecksumFlag = LZ4F_blockChecksumEnabled;
         }
       else
         {
-          PyErr_Format (PyExc_RuntimeError,
-                        "Unrecognized blockChecksumFlag in get_frame_info: %d",
-                        frame_info.blockChecksumFlag);
-          return NULL;
+          preferences.frameInfo.blockChecksumFlag = LZ4F_noBlockChecksum;
         }
     }
-  else
+  else if (block_checksum)
     {
-      /* Prior to LZ4 1.8.0 the blockChecksum functionality wasn't exposed in the
-         frame API, and blocks weren't checksummed, so we'll always return 0
-         here. */
-      block_checksum = 0;
+      PyErr_SetString (PyExc_RuntimeError,
+                       "block_checksum specified but not supported by LZ4 library version");
+      return NULL;
     }
 
-  if (frame_info.frameType == LZ4F_frame)
+  if (set_favor_dec_speed (&preferences, favor_dec_speed) < 0)
     {
-      skippable = 0;
+      return NULL;
     }
-  else if (frame_info.frameType == LZ4F_skippableFrame)
+
+  if (get_buffer_list (py_source, PyBUF_SIMPLE, "compress", "data",
+                       &source) < 0)
     {
-      skippable = 1;
+      return NULL;
+    }
+
+  source_size = (Py_ssize_t) source.total;
+
+  preferences.autoFlush = 0;
+  if (store_size)
+    {
+      preferences.frameInfo.contentSize = source_size;
     }
   else
     {
-      PyErr_Format (PyExc_RuntimeError,
-                    "Unrecognized frameType in get_frame_info: %d",
-                    frame_info.frameType);
-      return NULL;
+      preferences.frameInfo.contentSize = 0;
     }
 
-  return Py_BuildValue ("{s:I,s:I,s:O,s:O,s:O,s:O,s:K}",
-                        "block_size", block_size,
-                        "block_size_id", block_size_id,
-                        "block_linked", block_linked ? Py_True : Py_False,
+  TRACE_BEGIN_ALLOW_THREADS
+  destination_size =
+    LZ4F_compressFrameBound (source_size, &preferences);
+  TRACE_END_ALLOW_THREADS
+
+  if (destination_size > PY_SSIZE_T_MAX)
+    {
+      release_buffer_list(&source);
+      PyErr_Format (PyExc_ValueError,
+                    "Input data could require %zu bytes, which is larger than the maximum supported size of %zd bytes",
+                    destination_size, PY_SSIZE_T_MAX);
+      return NULL;
+    }
+
+  /* A large list of buffers is compressed with a series of updates, rather
+     than being joined first. Below GATHER_SIZE_MAX, setting up a compression
+     context for the updates costs more than copying, so the buffers are
+     gathered after the destination buffer and compressed in one go. With a
+     delta filter, they're always encoded into that space rather than
+     gathered. With a shuffle filter, they're always gathered, and the
+     filtered copy and the bit shuffle's scratch space follow. Otherwise
+     the space holds a block for compress_buffer_list. */
+  if (delta.kind != DELTA_NONE)
+    {
+      prefix_size += SHUFFLE_HEADER_SIZE;
+    }
+  if (filter.itemsize)
+    {
+      prefix_size += SHUFFLE_HEADER_SIZE;
+    }
+
+  scratch_size = 0;
+  gather = delta.kind != DELTA_NONE
+    || (source.count != 1
+        && (filter.itemsize || source.total <= GATHER_SIZE_MAX));
+  if (gather)
+    {
+      scratch_size += source.total;
+    }
+  else if (source.count != 1)
+    {
+      scratch_size += get_block_size (preferences.frameInfo.blockSizeID);
+    }
+  if (filter.itemsize)
+    {
+      scratch_size += source.total + (bitshuffle ? filter.unit : 0);
+    }
+
+  destination = PyMem_Malloc ((prefix_size + destination_size + scratch_size)
+                              * sizeof * destination);
+  if (destination == NULL)
+    {
+      release_buffer_list(&source);
+      return PyErr_NoMemory();
+    }
+
+  frame = destination + prefix_size;
+  filtered = frame + destination_size;
+  if (source.count == 1 && delta.kind == DELTA_NONE)
+    {
+      source_start = source.views[0].buf;
+    }
+  else if (gather)
+    {
+      gathered = filtered;
+      source_start = gathered;
+      filtered = gathered + source.total;
+    }
+
+  if (delta.kind != DELTA_NONE)
+    {
+      write_delta_header (destination, &delta);
+    }
+  if (filter.itemsize)
+    {
+      write_shuffle_header (frame - SHUFFLE_HEADER_SIZE, &filter);
+    }
+
+  TRACE2 (frame__compress__entry, source_size, preferences.compressionLevel);
+  TRACE_BEGIN_ALLOW_THREADS
+  if (source_start == NULL)
+    {
+      LZ4F_cctx * cctx;
+
+      compressed_size = new_compression_context (&cctx, alloc);
+      if (!LZ4F_isError (compressed_size))
+        {
+          compressed_size =
+            compress_frame_buffer_list (cctx, &source, filtered, frame,
+                                        destination_size, &preferences);
+          LZ4F_freeCompressionContext (cctx);
+        }
+    }
+  else
+    {
+      if (delta.kind != DELTA_NONE)
+        {
+          encode_buffer_list (&delta, &source, gathered);
+        }
+      else if (gathered != NULL)
+        {
+          gather_buffer_list (&source, gathered);
+        }
+
+      if (filter.itemsize)
+        {
+          apply_shuffle (source_start, filtered, filtered + source.total,
+                         source.total, filter.unit, filter.itemsize,
+                         bitshuffle);
+          source_start = filtered;
+        }
+
+#ifdef HAVE_LZ4F_CUSTOM_MEM
+      if (alloc == ALLOCATOR_PYTHON)
+        {
+          /* LZ4F_compressFrame uses the default allocator for its internal
+           * state, so use a context created with the selected allocator. */
+          LZ4F_cctx * cctx;
+
+          compressed_size = new_compression_context (&cctx, alloc);
+          if (!LZ4F_isError (compressed_size))
+            {
+              compressed_size =
+                LZ4F_compressFrame_usingCDict (cctx, frame, destination_size,
+                                               source_start, source_size,
+                                               NULL, &preferences);
+              LZ4F_freeCompressionContext (cctx);
+            }
+        }
+      else
+#endif
+        {
+          compressed_size =
+            LZ4F_compressFrame (frame, destination_size, source_start,
+                                source_size, &preferences);
+        }
+    }
+  TRACE_END_ALLOW_THREADS
+  TRACE1 (frame__compress__return, TRACE_RESULT (compressed_size));
+
+  release_buffer_list(&source);
+
+  if (LZ4F_isError (compressed_size))
+    {
+      PyMem_Free (destination);
+      PyErr_Format (PyExc_RuntimeError,
+                    "LZ4F_compressFrame failed with code: %s",
+                    LZ4F_getErrorName (compressed_size));
+      return NULL;
+    }
+
+  compressed_size += prefix_size;
+
+  if (return_bytearray)
+    {
+      py_destination = PyByteArray_FromStringAndSize (destination, (Py_ssize_t) compressed_size);
+    }
+  else
+    {
+      py_destination = PyBytes_FromStringAndSize (destination, (Py_ssize_t) compressed_size);
+    }
+
+  PyMem_Free (destination);
+
+  if (py_destination == NULL)
+    {
+      return PyErr_NoMemory ();
+    }
+
+  return py_destination;
+}
+
+/******************
+ * compress_begin *
+ ******************/
+static PyObject *
+compress_begin (PyObject * Py_UNUSED (self), PyObject * const * args,
+                Py_ssize_t nargs, PyObject * kwnames)
+{
+  PyObject *py_context = NULL;
+  Py_ssize_t source_size = (Py_ssize_t) 0;
+  int return_bytearray = 0;
+  int content_checksum = 0;
+  int block_checksum = 0;
+  int block_linked = 1;
+  int favor_dec_speed = 0;
+  const char *filter_name = NULL;
+  int itemsize = 0;
+  struct delta_state delta;
+  LZ4F_preferences_t preferences;
+  char * destination;
+  /* The destination buffer needs to be large enough for a header, which is 15
+   * bytes. Unfortunately, the lz4 library doesn't provide a #define for this.
+   * We over-allocate to allow for larger headers in the future. */
+  const size_t header_size = 32;
+  size_t prefix_size = 0;
+  size_t buffer_size;
+  struct compression_context *context;
+  size_t result;
+  static char *kwlist[] = { "context",
+                            "source_size",
+                            "compression_level",
+                            "block_size",
+                            "content_checksum",
+                            "block_checksum",
+                            "block_linked",
+                            "auto_flush",
+                            "return_bytearray",
+                            "favor_decompression_speed",
+                            "filter",
+                            "itemsize",
+                            NULL
+                          };
+
+  memset (&preferences, 0, sizeof preferences);
+
+  if (!parse_fastcall_args (args, nargs, kwnames, "compress_begin",
+                            "O|kiippppppzi", kwlist,
+                            &py_context,
+                            &source_size,
+                            &preferences.compressionLevel,
+                            &preferences.frameInfo.blockSizeID,
+                            &content_checksum,
+                            &block_checksum,
+                            &block_linked,
+                            &preferences.autoFlush,
+                            &return_bytearray,
+                            &favor_dec_speed,
+                            &filter_name,
+                            &itemsize))
+    {
+      return NULL;
+    }
+
+  if (init_delta_state (&delta, filter_name, itemsize) < 0)
+    {
+      return NULL;
+    }
+
+  if (content_checksum)
+    {
+      preferences.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+    }
+  else
+    {
+      preferences.frameInfo.contentChecksumFlag = LZ4F_noContentChecksum;
+    }
+
+  if (block_linked)
+    {
+      preferences.frameInfo.blockMode = LZ4F_blockLinked;
+    }
+  else
+    {
+      preferences.frameInfo.blockMode = LZ4F_blockIndependent;
+    }
+
+  if (LZ4_versionNumber() >= 10800)
+    {
+      if (block_checksum)
+        {
+          preferences.frameInfo.blockChecksumFlag = LZ4F_blockChecksumEnabled;
+        }
+      else
+        {
+          preferences.frameInfo.blockChecksumFlag = LZ4F_noBlockChecksum;
+        }
+    }
+  else if (block_checksum)
+    {
+      PyErr_SetString (PyExc_RuntimeError,
+                       "block_checksum specified but not supported by LZ4 library version");
+      return NULL;
+    }
+
+  if (set_favor_dec_speed (&preferences, favor_dec_speed) < 0)
+    {
+      return NULL;
+    }
+
+  if (block_linked)
+    {
+      preferences.frameInfo.blockMode = LZ4F_blockLinked;
+    }
+  else
+    {
+      preferences.frameInfo.blockMode = LZ4F_blockIndependent;
+    }
+
+
+  preferences.frameInfo.contentSize = source_size;
+
+  context =
+    (struct compression_context *) PyCapsule_GetPointer (py_context, compression_context_capsule_name);
+
+  if (!context || !context->context)
+    {
+      PyErr_SetString (PyExc_ValueError, "No valid compression context supplied");
+      return NULL;
+    }
+
+  release_stable_sources (context, 1);
+  context->preferences = preferences;
+  context->staging_size = 0;
+  context->consumed = 0;
+  context->block_start = 0;
+  context->delta = delta;
+
+  if (delta.kind != DELTA_NONE)
+    {
+      prefix_size = SHUFFLE_HEADER_SIZE;
+    }
+
+  /* Size the output buffer once for a whole block, so that typical calls to
+     compress_chunk and compress_flush don't need to allocate. */
+  buffer_size = LZ4F_compressBound (get_block_size (preferences.frameInfo.blockSizeID),
+                                    &context->preferences);
+  if (buffer_size < prefix_size + header_size)
+    {
+      buffer_size = prefix_size + header_size;
+    }
+
+  if (context->sink == SINK_NONE)
+    {
+      destination = reserve_output_buffer (context, buffer_size);
+    }
+  else
+    {
+      destination = reserve_output (context, prefix_size + header_size);
+    }
+  if (destination == NULL)
+    {
+      return NULL;
+    }
+
+  if (delta.kind != DELTA_NONE)
+    {
+      write_delta_header (destination, &delta);
+    }
+
+  TRACE2 (frame__compress_begin__entry, source_size,
+          context->preferences.compressionLevel);
+  TRACE_BEGIN_ALLOW_THREADS
+  result = LZ4F_compressBegin (context->context,
+                               destination + prefix_size,
+                               header_size,
+                               &context->preferences);
+  TRACE_END_ALLOW_THREADS
+  TRACE1 (frame__compress_begin__return, TRACE_RESULT (result));
+
+  if (LZ4F_isError (result))
+    {
+      PyErr_Format (PyExc_RuntimeError,
+                    "LZ4F_compressBegin failed with code: %s",
+                    LZ4F_getErrorName (result));
+      return NULL;
+    }
+
+  result += prefix_size;
+
+  /* With auto flush, the output reaches the sink as soon as it's produced. */
+  return compression_output (context, destination, result, return_bytearray,
+                             context->preferences.autoFlush);
+}
+
+/******************
+ * compress_chunk *
+ ******************/
+static PyObject *
+compress_chunk (PyObject * Py_UNUSED (self), PyObject * const * args,
+                Py_ssize_t nargs, PyObject * kwnames)
+{
+  PyObject *py_context = NULL;
+  PyObject *py_source = NULL;
+  struct buffer_list source;
+  Py_ssize_t source_size;
+  struct compression_context *context;
+  size_t compressed_bound;
+  char *destination;
+  LZ4F_compressOptions_t compress_options;
+  size_t result;
+  size_t staged = 0;
+  int return_bytearray = 0;
+  int stable_src = 0;
+  struct stable_source * held = NULL;
+  char * scratch = NULL;
+  size_t scratch_size = 0;
+  static char *kwlist[] = { "context",
+                            "data",
+                            "return_bytearray",
+                            "stable_src",
+                            NULL
+  };
+
+  memset (&compress_options, 0, sizeof compress_options);
+
+  if (!parse_fastcall_args (args, nargs, kwnames, "compress_chunk",
+                            "OO|pp", kwlist,
+                            &py_context,
+                            &py_source,
+                            &return_bytearray,
+                            &stable_src))
+    {
+      return NULL;
+    }
+
+  context =
+    (struct compression_context *) PyCapsule_GetPointer (py_context, compression_context_capsule_name);
+  if (!context || !context->context)
+    {
+      PyErr_Format (PyExc_ValueError, "No compression context supplied");
+      return NULL;
+    }
+
+  if (get_buffer_list (py_source, PyBUF_SIMPLE, "compress_chunk", "data",
+                       &source) < 0)
+    {
+      return NULL;
+    }
+
+  source_size = (Py_ssize_t) source.total;
+
+  /* With a delta filter, LZ4F is given the encoded copy, so the source is
+     never referenced after this call. */
+  if (context->delta.kind != DELTA_NONE)
+    {
+      stable_src = 0;
+      if (context->filter_buffer == NULL)
+        {
+          context->filter_buffer = PyMem_Malloc (FILTER_BUFFER_SIZE);
+          if (context->filter_buffer == NULL)
+            {
+              release_buffer_list (&source);
+              return PyErr_NoMemory ();
+            }
+        }
+    }
+
+  /* Small chunks, such as lines of text, are collected in the staging buffer
+     instead of being passed to LZ4F one at a time, which would cost far more
+     than copying them. This is only done when LZ4F would buffer them anyway,
+     and not for stable_src calls, where the point is to avoid the copy. */
+  if (context->preferences.autoFlush == 0 && !stable_src
+      && source_size < STAGING_INPUT_MAX)
+    {
+      if (context->staging == NULL)
+        {
+          context->staging = PyMem_Malloc (STAGING_BUFFER_SIZE);
+          if (context->staging == NULL)
+            {
+              release_buffer_list (&source);
+              return PyErr_NoMemory ();
+            }
+        }
+
+      if (context->staging_size + source_size <= STAGING_BUFFER_SIZE)
+        {
+          destination = reserve_output (context, 0);
+          if (destination == NULL)
+            {
+              release_buffer_list (&source);
+              return NULL;
+            }
+          if (context->delta.kind != DELTA_NONE)
+            {
+              encode_buffer_list (&context->delta, &source,
+                                  context->staging + context->staging_size);
+            }
+          else
+            {
+              gather_buffer_list (&source,
+                                  context->staging + context->staging_size);
+            }
+          context->staging_size += source_size;
+          release_buffer_list (&source);
+          return compression_output (context, destination, 0,
+                                     return_bytearray, 0);
+        }
+    }
+
+  /* If autoFlush is enabled, then the destination buffer only needs to be as
+     big as LZ4F_compressFrameBound specifies for this source size. However, if
+     autoFlush is disabled, previous calls may have resulted in buffered data,
+     and so we need instead to use LZ4F_compressBound to find the size required
+     for the destination buffer. Either way the context's output buffer is
+     reused, so it's only allocated when a chunk larger than previously seen
+     is passed in.
+
+     A list of buffers is gathered into a single update with autoFlush
+     enabled, and with autoFlush disabled, LZ4F_compressBound for the total
+     size is sufficient for all the updates together. With a delta filter and
+     autoFlush enabled, each FILTER_BUFFER_SIZE piece of the encoded source
+     ends a block. */
+  TRACE_BEGIN_ALLOW_THREADS
+  if (context->preferences.autoFlush == 1
+      && context->delta.kind != DELTA_NONE)
+    {
+      size_t pieces = source.total / FILTER_BUFFER_SIZE;
+      size_t remainder = source.total % FILTER_BUFFER_SIZE;
+
+      compressed_bound = pieces
+        * LZ4F_compressBound (FILTER_BUFFER_SIZE, &context->preferences);
+      if (remainder > 0)
+        {
+          compressed_bound +=
+            LZ4F_compressBound (remainder, &context->preferences);
+        }
+    }
+  else if (context->preferences.autoFlush == 1)
+    {
+      compressed_bound =
+        LZ4F_compressFrameBound (source_size, &context->preferences);
+    }
+  else
+    {
+      compressed_bound =
+        LZ4F_compressBound (context->staging_size + source_size,
+                            &context->preferences);
+    }
+  TRACE_END_ALLOW_THREADS
+
+  destination = reserve_output (context, compressed_bound);
+  if (destination == NULL)
+    {
+      release_buffer_list(&source);
+      return NULL;
+    }
+
+  /* A list of buffers is passed to LZ4F so that it comes out as the joined
+     buffers would, which takes scratch space for all of them with autoFlush
+     enabled, or for a linked block otherwise. LZ4F then copies what it keeps
+     of them, so they're never held. */
+  if (context->delta.kind == DELTA_NONE && source.count != 1)
+    {
+      stable_src = 0;
+      if (context->preferences.autoFlush)
+        {
+          scratch_size = source.total;
+        }
+      else if (context->preferences.frameInfo.blockMode == LZ4F_blockLinked)
+        {
+          scratch_size =
+            get_block_size (context->preferences.frameInfo.blockSizeID);
+        }
+    }
+  if (scratch_size > 0)
+    {
+      scratch = PyMem_Malloc (scratch_size);
+      if (scratch == NULL)
+        {
+          release_buffer_list (&source);
+          return PyErr_NoMemory ();
+        }
+    }
+
+  /* Allocated before LZ4F may reference the source, which can't be released
+     once it does. */
+  if (stable_src)
+    {
+      held = PyMem_Malloc (sizeof (struct stable_source));
+      if (held == NULL)
+        {
+          release_buffer_list (&source);
+          return PyErr_NoMemory ();
+        }
+    }
+
+  TRACE3 (frame__compress_chunk__entry, source_size,
+          context->preferences.compressionLevel, compressed_bound);
+  TRACE_BEGIN_ALLOW_THREADS
+  result = flush_staging (context, destination, compressed_bound);
+  if (!LZ4F_isError (result))
+    {
+      staged = result;
+      compress_options.stableSrc = stable_src ? 1 : 0;
+      if (context->delta.kind != DELTA_NONE)
+        {
+          result =
+            compress_filtered (context, &source, destination + staged,
+                               compressed_bound - staged, &compress_options);
+        }
+      else if (source.count == 1)
+        {
+          result =
+            LZ4F_compressUpdate (context->context, destination + staged,
+                                 compressed_bound - staged,
+                                 source.views[0].buf, source_size,
+                                 &compress_options);
+        }
+      else
+        {
+          size_t block_size =
+            get_block_size (context->preferences.frameInfo.blockSizeID);
+
+          result =
+            compress_buffer_list (context->context, &context->preferences,
+                                  &source,
+                                  (size_t) ((context->consumed
+                                             - context->block_start)
+                                            % block_size),
+                                  scratch, destination + staged,
+                                  compressed_bound - staged,
+                                  &compress_options);
+        }
+      if (!LZ4F_isError (result))
+        {
+          result += staged;
+        }
+    }
+  TRACE_END_ALLOW_THREADS
+  PyMem_Free (scratch);
+  TRACE1 (frame__compress_chunk__return, TRACE_RESULT (result));
+
+  /* With stable_src, LZ4F skips copying the tail of this source into its own
+     buffer and references it directly instead, so we hold on to it until
+     later blocks no longer can. Earlier stable sources are released once
+     enough data has been compressed past them, which may not happen for a
+     while if this call was only collected into LZ4F's buffer. */
+  if (!LZ4F_isError (result))
+    {
+      context->consumed += (unsigned long long) source_size;
+    }
+  if (held != NULL && !LZ4F_isError (result))
+    {
+      move_buffer_list (&held->source, &source);
+      held->end = context->consumed;
+      held->next = NULL;
+      if (context->stable_sources_last != NULL)
+        {
+          context->stable_sources_last->next = held;
+        }
+      else
+        {
+          context->stable_sources = held;
+        }
+      context->stable_sources_last = held;
+    }
+  else
+    {
+      PyMem_Free (held);
+      release_buffer_list(&source);
+    }
+  release_stable_sources (context, 0);
+
+  if (LZ4F_isError (result))
+    {
+      PyErr_Format (PyExc_RuntimeError,
+                    "LZ4F_compressUpdate failed with code: %s",
+                    LZ4F_getErrorName (result));
+      return NULL;
+    }
+
+  return compression_output (context, destination, result, return_bytearray,
+                             context->preferences.autoFlush);
+}
+
+/******************
+ * compress_flush *
+ ******************/
+static PyObject *
+compress_flush (PyObject * Py_UNUSED (self), PyObject * const * args,
+                Py_ssize_t nargs, PyObject * kwnames)
+{
+  PyObject *py_context = NULL;
+  LZ4F_compressOptions_t compress_options;
+  struct compression_context *context;
+  size_t destination_size;
+  int return_bytearray = 0;
+  int end_frame = 1;
+  char * destination;
+  size_t result;
+  size_t staged = 0;
+  static char *kwlist[] = { "context",
+                            "end_frame",
+                            "return_bytearray",
+                            NULL
+  };
+
+  memset (&compress_options, 0, sizeof compress_options);
+
+  if (!parse_fastcall_args (args, nargs, kwnames, "compress_flush",
+                            "O|pp", kwlist,
+                            &py_context,
+                            &end_frame,
+                            &return_bytearray))
+    {
+      return NULL;
+    }
+
+  if (!end_frame && LZ4_versionNumber() < 10800)
+    {
+      PyErr_SetString (PyExc_RuntimeError,
+                       "Flush without ending a frame is not supported with this version of the LZ4 library");
+      return NULL;
+    }
+
+  context =
+    (struct compression_context *) PyCapsule_GetPointer (py_context, compression_context_capsule_name);
+  if (!context || !context->context)
+    {
+      PyErr_SetString (PyExc_ValueError, "No compression context supplied");
+      return NULL;
+    }
+
+  compress_options.stableSrc = 0;
+
+  /* Calling LZ4F_compressBound with srcSize equal to 0 returns a size
+     sufficient to fit (i) any remaining buffered data (when autoFlush is
+     disabled) and the footer size, which is either 4 or 8 bytes depending on
+     whether checksums are enabled. See: https://github.com/lz4/lz4/issues/280
+     and https://github.com/lz4/lz4/issues/290. Prior to 1.7.5, it was necessary
+     to call LZ4F_compressBound with srcSize equal to 1. Since we now require a
+     minimum version to 1.7.5 we'll call this with srcSize equal to 0. */
+  TRACE_BEGIN_ALLOW_THREADS
+  destination_size = LZ4F_compressBound (context->staging_size,
+                                         &(context->preferences));
+  TRACE_END_ALLOW_THREADS
+
+  destination = reserve_output (context, destination_size);
+  if (destination == NULL)
+    {
+      return NULL;
+    }
+
+  TRACE2 (frame__compress_flush__entry, context->staging_size, end_frame);
+  TRACE_BEGIN_ALLOW_THREADS
+  result = flush_staging (context, destination, destination_size);
+  if (!LZ4F_isError (result))
+    {
+      staged = result;
+      if (end_frame)
+        {
+          result =
+            LZ4F_compressEnd (context->context, destination + staged,
+                              destination_size - staged, &compress_options);
+        }
+      else
+        {
+          result =
+            LZ4F_flush (context->context, destination + staged,
+                        destination_size - staged, &compress_options);
+        }
+      if (!LZ4F_isError (result))
+        {
+          result += staged;
+        }
+    }
+  TRACE_END_ALLOW_THREADS
+  TRACE1 (frame__compress_flush__return, TRACE_RESULT (result));
+
+  /* LZ4F_flush compresses the block collected so far, and starts a new one. */
+  if (!LZ4F_isError (result))
+    {
+      context->block_start = context->consumed;
+    }
+  release_stable_sources (context, end_frame);
+
+  if (LZ4F_isError (result))
+    {
+      PyErr_Format (PyExc_RuntimeError,
+                    "LZ4F_compressEnd failed with code: %s",
+                    LZ4F_getErrorName (result));
+      return NULL;
+    }
+
+  return compression_output (context, destination, result, return_bytearray, 1);
+}
+
+/************
+ * set_sink *
+ ************/
+static PyObject *
+set_sink (PyObject * Py_UNUSED (self), PyObject * const * args,
+          Py_ssize_t nargs, PyObject * kwnames)
+{
+  PyObject *py_context = NULL;
+  PyObject *py_sink = Py_None;
+  Py_ssize_t buffer_size = SINK_BUFFER_SIZE_DEFAULT;
+  struct compression_context *context;
+  static char *kwlist[] = { "context",
+                            "sink",
+                            "buffer_size",
+                            NULL
+  };
+
+  if (!parse_fastcall_args (args, nargs, kwnames, "set_sink",
+                            "O|On", kwlist,
+                            &py_context,
+                            &py_sink,
+                            &buffer_size))
+    {
+      return NULL;
+    }
+
+  context =
+    (struct compression_context *) PyCapsule_GetPointer (py_context, compression_context_capsule_name);
+  if (!context || !context->context)
+    {
+      PyErr_SetString (PyExc_ValueError, "No compression context supplied");
+      return NULL;
+    }
+
+  if (buffer_size <= 0)
+    {
+      PyErr_SetString (PyExc_ValueError, "buffer_size must be positive");
+      return NULL;
+    }
+
+  if (context->sink_busy)
+    {
+      PyErr_SetString (PyExc_RuntimeError,
+                       "compression context used while its sink is being written to");
+      return NULL;
+    }
+
+  /* Output still held for the current sink goes to it first. */
+  if (sink_flush (context) < 0)
+    {
+      return NULL;
+    }
+  release_sink (context);
+
+  context->sink_buffer_size = (size_t) buffer_size;
+
+  if (py_sink == Py_None)
+    {
+      Py_RETURN_NONE;
+    }
+
+  if (PyLong_Check (py_sink))
+    {
+      int fd = PyObject_AsFileDescriptor (py_sink);
+
+      if (fd < 0)
+        {
+          return NULL;
+        }
+      context->sink = SINK_FD;
+      context->sink_fd = fd;
+    }
+  else if (PyCallable_Check (py_sink))
+    {
+      Py_INCREF (py_sink);
+      context->sink = SINK_CALLABLE;
+      context->sink_callable = py_sink;
+    }
+  else if (PyObject_CheckBuffer (py_sink))
+    {
+      if (PyObject_GetBuffer (py_sink, &context->sink_view, PyBUF_WRITABLE) != 0)
+        {
+          return NULL;
+        }
+      context->sink = SINK_BUFFER;
+      context->pending = context->sink_view.buf;
+      context->pending_capacity = (size_t) context->sink_view.len;
+      /* Nothing is written out from a buffer sink. */
+      context->sink_buffer_size = (size_t) -1;
+    }
+  else
+    {
+      PyErr_Format (PyExc_TypeError,
+                    "set_sink() argument 'sink' must be a file descriptor, a writable buffer, a callable or None, not %.50s",
+                    Py_TYPE (py_sink)->tp_name);
+      return NULL;
+    }
+
+  Py_RETURN_NONE;
+}
+
+/******************
+ * get_frame_info *
+ ******************/
+static PyObject *
+get_frame_info (PyObject * Py_UNUSED (self), PyObject * const * args,
+                Py_ssize_t nargs, PyObject * kwnames)
+{
+  Py_buffer py_source;
+  char *source;
+  size_t source_size;
+  LZ4F_decompressionContext_t context;
+  LZ4F_frameInfo_t frame_info;
+  size_t result;
+  allocator_e alloc = allocator;
+  unsigned int block_size;
+  unsigned int block_size_id;
+  int block_linked;
+  int content_checksum;
+  int block_checksum;
+  int skippable;
+  struct shuffle_filter filter;
+  struct delta_state delta;
+  int header;
+
+  static char *kwlist[] = { "data",
+                            NULL
+  };
+
+  if (!parse_fastcall_args (args, nargs, kwnames, "get_frame_info",
+                            "y*", kwlist,
+                            &py_source))
+    {
+      return NULL;
+    }
+
+  source = (char *) py_source.buf;
+  source_size = (size_t) py_source.len;
+
+  /* The information is for the LZ4 frame following any filter headers. */
+  memset (&filter, 0, sizeof filter);
+  memset (&delta, 0, sizeof delta);
+  while ((header = read_filter_header (source, source_size, &filter,
+                                       &delta)) == 1)
+    {
+      source += SHUFFLE_HEADER_SIZE;
+      source_size -= SHUFFLE_HEADER_SIZE;
+    }
+  if (header < 0)
+    {
+      PyBuffer_Release (&py_source);
+      return NULL;
+    }
+
+  TRACE_BEGIN_ALLOW_THREADS
+
+  result = new_decompression_context (&context, alloc);
+
+  if (LZ4F_isError (result))
+    {
+      Py_BLOCK_THREADS
+      PyBuffer_Release (&py_source);
+      PyErr_Format (PyExc_RuntimeError,
+                    "LZ4F_createDecompressionContext failed with code: %s",
+                    LZ4F_getErrorName (result));
+      return NULL;
+    }
+
+  result =
+    LZ4F_getFrameInfo (context, &frame_info, source, &source_size);
+
+  if (LZ4F_isError (result))
+    {
+      LZ4F_freeDecompressionContext (context);
+      Py_BLOCK_THREADS
+      PyBuffer_Release (&py_source);
+      PyErr_Format (PyExc_RuntimeError,
+                    "LZ4F_getFrameInfo failed with code: %s",
+                    LZ4F_getErrorName (result));
+      return NULL;
+    }
+
+  result = LZ4F_freeDecompressionContext (context);
+
+  TRACE_END_ALLOW_THREADS
+
+  PyBuffer_Release (&py_source);
+
+  if (LZ4F_isError (result))
+    {
+      PyErr_Format (PyExc_RuntimeError,
+                    "LZ4F_freeDecompressionContext failed with code: %s",
+                    LZ4F_getErrorName (result));
+      return NULL;
+    }
+
+#define KB *(1<<10)
+#define MB *(1<<20)
+  switch (frame_info.blockSizeID)
+    {
+    case LZ4F_default:
+    case LZ4F_max64KB:
+      block_size = 64 KB;
+      block_size_id = LZ4F_max64KB;
+      break;
+    case LZ4F_max256KB:
+      block_size = 256 KB;
+      block_size_id = LZ4F_max256KB;
+      break;
+    case LZ4F_max1MB:
+      block_size = 1 MB;
+      block_size_id = LZ4F_max1MB;
+      break;
+    case LZ4F_max4MB:
+      block_size = 4 MB;
+      block_size_id = LZ4F_max4MB;
+      break;
+    default:
+      PyErr_Format (PyExc_RuntimeError,
+                    "Unrecognized blockSizeID in get_frame_info: %d",
+                    frame_info.blockSizeID);
+      return NULL;
+    }
+#undef KB
+#undef MB
+
+  if (frame_info.blockMode == LZ4F_blockLinked)
+    {
+      block_linked = 1;
+    }
+  else if (frame_info.blockMode == LZ4F_blockIndependent)
+    {
+      block_linked = 0;
+    }
+  else
+    {
+      PyErr_Format (PyExc_RuntimeError,
+                    "Unrecognized blockMode in get_frame_info: %d",
+                    frame_info.blockMode);
+      return NULL;
+    }
+
+  if (frame_info.contentChecksumFlag == LZ4F_noContentChecksum)
+    {
+      content_checksum = 0;
+    }
+  else if (frame_info.contentChecksumFlag == LZ4F_contentChecksumEnabled)
+    {
+      content_checksum = 1;
+    }
+  else
+    {
+      PyErr_Format (PyExc_RuntimeError,
+                    "Unrecognized contentChecksumFlag in get_frame_info: %d",
+                    frame_info.contentChecksumFlag);
+      return NULL;
+    }
+
+  if (LZ4_versionNumber() >= 10800)
+    {
+      if (frame_info.blockChecksumFlag == LZ4F_noBlockChecksum)
+        {
+          block_checksum = 0;
+        }
+      else if (frame_info.blockChecksumFlag == LZ4F_blockChecksumEnabled)
+        {
+          block_checksum = 1;
+        }
+      else
+        {
+          PyErr_Format (PyExc_RuntimeError,
+                        "Unrecognized blockChecksumFlag in get_frame_info: %d",
+                        frame_info.blockChecksumFlag);
+          return NULL;
+        }
+    }
+  else
+    {
+      /* Prior to LZ4 1.8.0 the blockChecksum functionality wasn't exposed in the
+         frame API, and blocks weren't checksummed, so we'll always return 0
+         here. */
+      block_checksum = 0;
+    }
+
+  if (frame_info.frameType == LZ4F_frame)
+    {
+      skippable = 0;
+    }
+  else if (frame_info.frameType == LZ4F_skippableFrame)
+    {
+      skippable = 1;
+    }
+  else
+    {
+      PyErr_Format (PyExc_RuntimeError,
+                    "Unrecognized frameType in get_frame_info: %d",
+                    frame_info.frameType);
+      return NULL;
+    }
+
+  return Py_BuildValue ("{s:I,s:I,s:O,s:O,s:O,s:O,s:K,s:n,s:O,s:z,s:n}",
+                        "block_size", block_size,
+                        "block_size_id", block_size_id,
+                        "block_linked", block_linked ? Py_True : Py_False,
                         "content_checksum", content_checksum ? Py_True : Py_False,
                         "block_checksum", block_checksum ? Py_True : Py_False,
                         "skippable", skippable ? Py_True : Py_False,
-                        "content_size", frame_info.contentSize);
+                        "content_size", frame_info.contentSize,
+                        "shuffle", (Py_ssize_t) filter.itemsize,
+                        "bitshuffle", filter.bitshuffle ? Py_True : Py_False,
+                        "filter", delta_name (delta.kind),
+                        "itemsize", (Py_ssize_t) delta.itemsize);
+}
+
+/********************************
+ * create_decompression_context *
+ ********************************/
+static void
+destroy_decompression_context (PyObject * py_context)
+{
+#ifndef PyCapsule_Type
+  LZ4F_dctx * context =
+    PyCapsule_GetPointer (py_context, decompression_context_capsule_name);
+#else
+  /* Compatibility with 2.6 via capsulethunk. */
+  LZ4F_dctx * context =  py_context;
+#endif
+  TRACE_BEGIN_ALLOW_THREADS
+  LZ4F_freeDecompressionContext (context);
+  TRACE_END_ALLOW_THREADS
+}
+
+static PyObject *
+create_decompression_context (PyObject * Py_UNUSED (self))
+{
+  LZ4F_dctx * context;
+  LZ4F_errorCode_t result;
+  allocator_e alloc = allocator;
+
+  TRACE_BEGIN_ALLOW_THREADS
+  result = new_decompression_context (&context, alloc);
+  if (LZ4F_isError (result))
+    {
+      Py_BLOCK_THREADS
+      LZ4F_freeDecompressionContext (context);
+      PyErr_Format (PyExc_RuntimeError,
+                    "LZ4F_createDecompressionContext failed with code: %s",
+                    LZ4F_getErrorName (result));
+      return NULL;
+    }
+  TRACE_END_ALLOW_THREADS
+
+  return PyCapsule_New (context, decompression_context_capsule_name,
+                        destroy_decompression_context);
+}
+
+/*******************************
+ * reset_decompression_context *
+ *******************************/
+static PyObject *
+reset_decompression_context (PyObject * Py_UNUSED (self), PyObject * const * args,
+                             Py_ssize_t nargs, PyObject * kwnames)
+{
+  LZ4F_dctx * context;
+  PyObject * py_context = NULL;
+  static char *kwlist[] = { "context",
+                            NULL
+  };
+
+  if (!parse_fastcall_args (args, nargs, kwnames, "reset_decompression_context",
+                            "O", kwlist,
+                            &py_context))
+    {
+      return NULL;
+    }
+
+  context = (LZ4F_dctx *)
+    PyCapsule_GetPointer (py_context, decompression_context_capsule_name);
+
+  if (!context)
+    {
+      PyErr_SetString (PyExc_ValueError,
+                       "No valid decompression context supplied");
+      return NULL;
+    }
+
+  if (LZ4_versionNumber() >= 10800) /* LZ4 >= v1.8.0 has LZ4F_resetDecompressionContext */
+    {
+      /* No error checking possible here - this is always successful. */
+      TRACE_BEGIN_ALLOW_THREADS
+      LZ4F_resetDecompressionContext (context);
+      TRACE_END_ALLOW_THREADS
+    }
+  else
+    {
+      /* No resetDecompressionContext available, so we'll destroy the context
+         and create a new one. */
+      int result;
+      allocator_e alloc = allocator;
+
+      TRACE_BEGIN_ALLOW_THREADS
+      LZ4F_freeDecompressionContext (context);
+
+      result = new_decompression_context (&context, alloc);
+      if (LZ4F_isError (result))
+        {
+          LZ4F_freeDecompressionContext (context);
+          Py_BLOCK_THREADS
+          PyErr_Format (PyExc_RuntimeError,
+                        "LZ4F_createDecompressionContext failed with code: %s",
+                        LZ4F_getErrorName (result));
+          return NULL;
+        }
+      TRACE_END_ALLOW_THREADS
+
+      result = PyCapsule_SetPointer(py_context, context);
+      if (result)
+        {
+          LZ4F_freeDecompressionContext (context);
+          PyErr_SetString (PyExc_RuntimeError,
+                           "PyCapsule_SetPointer failed with code: %s");
+          return NULL;
+        }
+    }
+
+  Py_RETURN_NONE;
+}
+
+/* Once the initial destination buffer is full, __decompress appends output
+ * segments of this size rather than growing (and copying) a single buffer.
+ * This bounds the over-allocation to one segment. The segments are joined
+ * once into the returned object. */
+#define DECOMPRESS_SEGMENT_SIZE (1 << 20)
+
+struct output_segment
+{
+  char * buffer;
+  size_t size;
+  size_t written;
+};
+
+struct output_segments
+{
+  struct output_segment * segments;
+  size_t count;
+  size_t capacity;
+  size_t written;
+};
+
+/* The segment helpers use the raw allocator, as they are called with the GIL
+ * released. */
+static struct output_segment *
+output_segments_add (struct output_segments * output, size_t size)
+{
+  struct output_segment * segment;
+
+  if (output->count == output->capacity)
+    {
+      size_t capacity = output->capacity ? 2 * output->capacity : 8;
+      struct output_segment * segments =
+        PyMem_RawRealloc (output->segments, capacity * sizeof * segments);
+
+      if (segments == NULL)
+        {
+          return NULL;
+        }
+      output->segments = segments;
+      output->capacity = capacity;
+    }
+
+  segment = &output->segments[output->count];
+  /* Avoid a zero byte request, for which malloc may return NULL. */
+  segment->buffer = PyMem_RawMalloc (size ? size : 1);
+  if (segment->buffer == NULL)
+    {
+      return NULL;
+    }
+  segment->size = size;
+  segment->written = 0;
+  output->count++;
+
+  return segment;
+}
+
+static void
+output_segments_free (struct output_segments * output)
+{
+  size_t i;
+
+  for (i = 0; i < output->count; i++)
+    {
+      PyMem_RawFree (output->segments[i].buffer);
+    }
+  PyMem_RawFree (output->segments);
+  output->segments = NULL;
+  output->count = 0;
+  output->capacity = 0;
+}
+
+static PyObject *
+output_segments_join (struct output_segments * output, int return_bytearray)
+{
+  PyObject * py_destination;
+  char * destination;
+  size_t i;
+
+  if (return_bytearray)
+    {
+      py_destination = PyByteArray_FromStringAndSize (NULL, (Py_ssize_t) output->written);
+      if (py_destination == NULL)
+        {
+          return NULL;
+        }
+      destination = PyByteArray_AS_STRING (py_destination);
+    }
+  else
+    {
+      py_destination = PyBytes_FromStringAndSize (NULL, (Py_ssize_t) output->written);
+      if (py_destination == NULL)
+        {
+          return NULL;
+        }
+      destination = PyBytes_AS_STRING (py_destination);
+    }
+
+  for (i = 0; i < output->count; i++)
+    {
+      memcpy (destination, output->segments[i].buffer, output->segments[i].written);
+      destination += output->segments[i].written;
+    }
+
+  return py_destination;
+}
+
+static inline PyObject *
+__decompress(LZ4F_dctx * context, char * source, size_t source_size,
+             Py_ssize_t max_length, Py_ssize_t max_output_size, int full_frame,
+             int return_bytearray, int return_bytes_read)
+{
+  size_t source_remain;
+  size_t source_read;
+  char * source_cursor;
+  char * source_end;
+  size_t destination_write;
+  size_t destination_size;
+  struct output_segments output = { NULL, 0, 0, 0 };
+  struct output_segment * segment;
+  PyObject * py_destination;
+  size_t result = 0;
+  LZ4F_frameInfo_t frame_info;
+  LZ4F_decompressOptions_t options;
+  int end_of_frame = 0;
+  /* Errors found while the GIL is released, which are raised once it's been
+     taken back and the return probe has fired. */
+  enum
+  {
+    DECOMPRESS_OK,
+    DECOMPRESS_FRAME_INFO_FAILED,
+    DECOMPRESS_CONTENT_TOO_LARGE,
+    DECOMPRESS_NO_MEMORY,
+    DECOMPRESS_FAILED,
+    DECOMPRESS_OUTPUT_TOO_LARGE,
+    DECOMPRESS_RESIZE_FAILED
+  } error = DECOMPRESS_OK;
+
+  memset(&options, 0, sizeof options);
+
+  TRACE3 (frame__decompress__entry, source_size, max_length, full_frame);
+  TRACE_BEGIN_ALLOW_THREADS
+
+  source_cursor = source;
+  source_end = source + source_size;
+  source_remain = source_size;
+
+  if (full_frame)
+    {
+      source_read = source_size;
+
+      result =
+        LZ4F_getFrameInfo (context, &frame_info,
+                           source_cursor, &source_read);
+
+      if (LZ4F_isError (result))
+        {
+          error = DECOMPRESS_FRAME_INFO_FAILED;
+          goto exit_now;
+        }
+
+      /* Advance the source_cursor pointer past the header - the call to
+         getFrameInfo above replaces the passed source_read value with the
+         number of bytes read. Also reduce source_remain accordingly. */
+      source_cursor += source_read;
+      source_remain -= source_read;
+
+      /* If the uncompressed content size is available, we'll use that to size
+         the destination buffer. Otherwise, guess at twice the remaining source
+         size as a starting point, up to one segment, and add segments as
+         needed. */
+      if (frame_info.contentSize > 0)
+        {
+          if (max_output_size >= (Py_ssize_t) 0 &&
+              frame_info.contentSize > (unsigned long long) max_output_size)
+            {
+              error = DECOMPRESS_CONTENT_TOO_LARGE;
+              goto exit_now;
+            }
+          destination_size = frame_info.contentSize;
+        }
+      else
+        {
+          destination_size = 2 * source_remain;
+          if (destination_size > DECOMPRESS_SEGMENT_SIZE)
+            {
+              destination_size = DECOMPRESS_SEGMENT_SIZE;
+            }
+        }
+    }
+  else
+    {
+      if (max_length >= (Py_ssize_t) 0)
+        {
+          destination_size = (size_t) max_length;
+        }
+      else
+        {
+          /* Choose an initial destination size as twice the source size, and we'll
+             add segments as needed. */
+          destination_size = 2 * source_remain;
+        }
+    }
+
+  /* Allow for one byte past max_output_size, so that exceeding it can be
+     detected without an extra call to LZ4F_decompress. */
+  if (max_output_size >= (Py_ssize_t) 0 &&
+      destination_size > (size_t) max_output_size + 1)
+    {
+      destination_size = (size_t) max_output_size + 1;
+    }
+
+  segment = output_segments_add (&output, destination_size);
+  if (segment == NULL)
+    {
+      error = DECOMPRESS_NO_MEMORY;
+      goto exit_now;
+    }
+
+  /* Only set stableDst = 1 if we are sure no further segment will be
+     added, since when stableDst = 1 the LZ4 library stores a pointer to the
+     last compressed data, which has to be contiguous with the next output. */
+  if (full_frame && max_length >= (Py_ssize_t) 0)
+    {
+      options.stableDst = 1;
+    }
+  else
+    {
+      options.stableDst = 0;
+    }
+
+  source_read = source_remain;
+
+  while (1)
+    {
+      /* Decompress from the source string and write to the destination
+         until there's no more source string to read, or until we've reached the
+         frame end.
+
+         On calling LZ4F_decompress, source_read is set to the remaining length
+         of source available to read. On return, source_read is set to the
+         actual number of bytes read from source, which may be less than
+         available. NB: LZ4F_decompress does not explicitly fail on empty input.
+
+         On calling LZ4F_decompress, destination_write is the number of bytes in
+         the current segment available for writing. On exit, destination_write
+         is set to the actual number of bytes written to the segment. */
+      destination_write = segment->size - segment->written;
+
+      result = LZ4F_decompress (context,
+                                segment->buffer + segment->written,
+                                &destination_write,
+                                source_cursor,
+                                &source_read,
+                                &options);
+
+      if (LZ4F_isError (result))
+        {
+          error = DECOMPRESS_FAILED;
+          goto exit_now;
+        }
+
+      segment->written += destination_write;
+      output.written += destination_write;
+      source_cursor += source_read;
+      source_read = source_end - source_cursor;
+
+      if (max_output_size >= (Py_ssize_t) 0 &&
+          output.written > (size_t) max_output_size)
+        {
+          error = DECOMPRESS_OUTPUT_TOO_LARGE;
+          goto exit_now;
+        }
+
+      if (result == 0)
+        {
+          /* We've reached the end of the frame. */
+          end_of_frame = 1;
+          break;
+        }
+      else if (source_cursor == source_end)
+        {
+          /* We've reached end of input. */
+          break;
+        }
+      else if (segment->written == segment->size)
+        {
+          /* Current segment is full. So, stop decompressing if
+             max_length is set. Otherwise add a new segment. */
+          if (max_length >= (Py_ssize_t) 0)
+            {
+              break;
+            }
+          else
+            {
+              destination_size = DECOMPRESS_SEGMENT_SIZE;
+              if (max_output_size >= (Py_ssize_t) 0 &&
+                  destination_size > (size_t) max_output_size + 1 - output.written)
+                {
+                  destination_size = (size_t) max_output_size + 1 - output.written;
+                }
+
+              TRACE2 (frame__decompress__grow, output.written,
+                      destination_size);
+              segment = output_segments_add (&output, destination_size);
+              if (segment == NULL)
+                {
+                  error = DECOMPRESS_RESIZE_FAILED;
+                  goto exit_now;
+                }
+            }
+        }
+    }
+
+exit_now:
+  TRACE_END_ALLOW_THREADS
+  TRACE2 (frame__decompress__return,
+          error != DECOMPRESS_OK || (result > 0 && full_frame)
+          ? (long long) -1 : (long long) output.written,
+          source_cursor - source);
+
+  switch (error)
+    {
+    case DECOMPRESS_OK:
+      break;
+    case DECOMPRESS_FRAME_INFO_FAILED:
+      PyErr_Format (PyExc_RuntimeError,
+                    "LZ4F_getFrameInfo failed with code: %s",
+                    LZ4F_getErrorName (result));
+      break;
+    case DECOMPRESS_CONTENT_TOO_LARGE:
+      PyErr_Format (PyExc_RuntimeError,
+                    "Frame content size of %llu bytes exceeds max_output_size of %zd bytes",
+                    frame_info.contentSize, max_output_size);
+      break;
+    case DECOMPRESS_NO_MEMORY:
+      PyErr_NoMemory ();
+      break;
+    case DECOMPRESS_FAILED:
+      PyErr_Format (PyExc_RuntimeError,
+                    "LZ4F_decompress failed with code: %s",
+                    LZ4F_getErrorName (result));
+      break;
+    case DECOMPRESS_OUTPUT_TOO_LARGE:
+      PyErr_Format (PyExc_RuntimeError,
+                    "Decompressed data exceeds max_output_size of %zd bytes",
+                    max_output_size);
+      break;
+    case DECOMPRESS_RESIZE_FAILED:
+      PyErr_SetString (PyExc_RuntimeError, "Failed to resize buffer");
+      break;
+    }
+
+  if (error != DECOMPRESS_OK)
+    {
+      output_segments_free (&output);
+      return NULL;
+    }
+
+  if (result > 0 && full_frame)
+    {
+      PyErr_Format (PyExc_RuntimeError,
+                    "Frame incomplete. LZ4F_decompress returned: %zu", result);
+      output_segments_free (&output);
+      return NULL;
+    }
+
+  py_destination = output_segments_join (&output, return_bytearray);
+
+  output_segments_free (&output);
+
+  if (py_destination == NULL)
+    {
+      return PyErr_NoMemory ();
+    }
+
+  if (full_frame)
+    {
+      if (return_bytes_read)
+        {
+          return Py_BuildValue ("Ni",
+                                py_destination,
+                                source_cursor - source);
+        }
+      else
+        {
+          return py_destination;
+        }
+    }
+  else
+    {
+      return Py_BuildValue ("NiO",
+                            py_destination,
+                            source_cursor - source,
+                            end_of_frame ? Py_True : Py_False);
+    }
+}
+
+/**************
+ * decompress *
+ **************/
+static PyObject *
+decompress (PyObject * Py_UNUSED (self), PyObject * const * args,
+            Py_ssize_t nargs, PyObject * kwnames)
+{
+  LZ4F_dctx * context;
+  LZ4F_errorCode_t result;
+  Py_buffer py_source;
+  char * source;
+  size_t source_size;
+  PyObject * ret;
+  allocator_e alloc = allocator;
+  int return_bytearray = 0;
+  int return_bytes_read = 0;
+  Py_ssize_t max_output_size = (Py_ssize_t) -1;
+  struct shuffle_filter filter;
+  struct delta_state delta;
+  int header;
+  size_t prefix_size = 0;
+  static char *kwlist[] = { "data",
+                            "return_bytearray",
+                            "return_bytes_read",
+                            "max_output_size",
+                            NULL
+                          };
+
+  if (!parse_fastcall_args (args, nargs, kwnames, "decompress",
+                            "y*|ppn", kwlist,
+                            &py_source,
+                            &return_bytearray,
+                            &return_bytes_read,
+                            &max_output_size))
+    {
+      return NULL;
+    }
+
+  TRACE_BEGIN_ALLOW_THREADS
+  result = new_decompression_context (&context, alloc);
+  if (LZ4F_isError (result))
+    {
+      LZ4F_freeDecompressionContext (context);
+      Py_BLOCK_THREADS
+      PyBuffer_Release(&py_source);
+      PyErr_Format (PyExc_RuntimeError,
+                    "LZ4F_createDecompressionContext failed with code: %s",
+                    LZ4F_getErrorName (result));
+      return NULL;
+    }
+  TRACE_END_ALLOW_THREADS
+
+  /* MSVC can't do pointer arithmetic on void * pointers, so cast to char * */
+  source = (char *) py_source.buf;
+  source_size = py_source.len;
+
+  /* Skip over the filter headers, of which there are at most two. */
+  memset (&filter, 0, sizeof filter);
+  memset (&delta, 0, sizeof delta);
+  do
+    {
+      header = read_filter_header (source, source_size, &filter, &delta);
+      if (header > 0)
+        {
+          source += SHUFFLE_HEADER_SIZE;
+          source_size -= SHUFFLE_HEADER_SIZE;
+          prefix_size += SHUFFLE_HEADER_SIZE;
+        }
+    }
+  while (header > 0 && prefix_size < 2 * SHUFFLE_HEADER_SIZE);
+
+  if (header < 0)
+    {
+      PyBuffer_Release(&py_source);
+      TRACE_BEGIN_ALLOW_THREADS
+      LZ4F_freeDecompressionContext (context);
+      TRACE_END_ALLOW_THREADS
+      return NULL;
+    }
+
+  ret = __decompress (context,
+                      source,
+                      source_size,
+                      -1,
+                      max_output_size,
+                      1,
+                      return_bytearray,
+                      return_bytes_read);
+
+  PyBuffer_Release(&py_source);
+
+  TRACE_BEGIN_ALLOW_THREADS
+  LZ4F_freeDecompressionContext (context);
+  TRACE_END_ALLOW_THREADS
+
+  if (prefix_size > 0 && ret != NULL)
+    {
+      PyObject * data = return_bytes_read ? PyTuple_GET_ITEM (ret, 0) : ret;
+      PyObject * output;
+
+      if (filter.itemsize)
+        {
+          output = unshuffle_output (data, &filter);
+        }
+      else
+        {
+          Py_INCREF (data);
+          output = data;
+        }
+
+      if (output != NULL && delta.kind != DELTA_NONE)
+        {
+          decode_output (output, &delta);
+        }
+
+      if (output != NULL && return_bytes_read)
+        {
+          PyObject * bytes_read =
+            PyLong_FromSize_t (PyLong_AsSize_t (PyTuple_GET_ITEM (ret, 1))
+                               + prefix_size);
+          PyObject * tuple = bytes_read ? PyTuple_Pack (2, output, bytes_read) : NULL;
+          Py_XDECREF (bytes_read);
+          Py_DECREF (output);
+          output = tuple;
+        }
+      Py_DECREF (ret);
+      ret = output;
+    }
+
+  return ret;
+}
+
+/*******************
+ * decompress_into *
+ *******************/
+static PyObject *
+decompress_into (PyObject * Py_UNUSED (self), PyObject * const * args,
+                 Py_ssize_t nargs, PyObject * kwnames)
+{
+  LZ4F_dctx * context;
+  size_t result;
+  Py_buffer py_source;
+  PyObject * py_destination;
+  struct buffer_list destination;
+  const char * source_cursor;
+  const char * source_end;
+  size_t source_read;
+  char * output;
+  size_t destination_write;
+  size_t written = 0;
+  size_t offset = 0;
+  Py_ssize_t index = 0;
+  /* Once the destination buffers are full, LZ4F_decompress is given this
+     one byte buffer instead, so that any further output is detected. */
+  char overflow;
+  int too_small = 0;
+  LZ4F_decompressOptions_t options;
+  allocator_e alloc = allocator;
+  int return_bytes_read = 0;
+  static char *kwlist[] = { "data",
+                            "destination",
+                            "return_bytes_read",
+                            NULL
+                          };
+
+  if (!parse_fastcall_args (args, nargs, kwnames, "decompress_into",
+                            "y*O|p", kwlist,
+                            &py_source,
+                            &py_destination,
+                            &return_bytes_read))
+    {
+      return NULL;
+    }
+
+  if (get_buffer_list (py_destination, PyBUF_WRITABLE, "decompress_into",
+                       "destination", &destination) < 0)
+    {
+      PyBuffer_Release(&py_source);
+      return NULL;
+    }
+
+  memset (&options, 0, sizeof options);
+
+  /* The context is created first, so that every entry probe is matched by a
+     return probe. */
+  result = new_decompression_context (&context, alloc);
+  if (LZ4F_isError (result))
+    {
+      LZ4F_freeDecompressionContext (context);
+      release_buffer_list(&destination);
+      PyBuffer_Release(&py_source);
+      PyErr_Format (PyExc_RuntimeError,
+                    "LZ4F_createDecompressionContext failed with code: %s",
+                    LZ4F_getErrorName (result));
+      return NULL;
+    }
+
+  TRACE2 (frame__decompress_into__entry, py_source.len, destination.total);
+  TRACE_BEGIN_ALLOW_THREADS
+
+  /* MSVC can't do pointer arithmetic on void * pointers, so cast to char * */
+  source_cursor = (const char *) py_source.buf;
+  source_end = source_cursor + py_source.len;
+
+  while (1)
+    {
+      /* Move on to the next destination buffer with room. LZ4F_decompress
+         keeps the history it needs for linked blocks, so the output doesn't
+         need to be contiguous. */
+      while (index < destination.count &&
+             offset == (size_t) destination.views[index].len)
+        {
+          index++;
+          offset = 0;
+        }
+
+      if (index < destination.count)
+        {
+          output = (char *) destination.views[index].buf + offset;
+          destination_write = (size_t) destination.views[index].len - offset;
+        }
+      else
+        {
+          output = &overflow;
+          destination_write = 1;
+        }
+
+      source_read = source_end - source_cursor;
+
+      result = LZ4F_decompress (context,
+                                output,
+                                &destination_write,
+                                source_cursor,
+                                &source_read,
+                                &options);
+
+      if (LZ4F_isError (result))
+        {
+          break;
+        }
+
+      if (output == &overflow && destination_write > 0)
+        {
+          too_small = 1;
+          break;
+        }
+
+      offset += destination_write;
+      written += destination_write;
+      source_cursor += source_read;
+
+      if (result == 0 || source_cursor == source_end)
+        {
+          /* We've reached the end of the frame, or of the input. */
+          break;
+        }
+    }
+
+  LZ4F_freeDecompressionContext (context);
+  TRACE_END_ALLOW_THREADS
+  TRACE1 (frame__decompress_into__return,
+          LZ4F_isError (result) || too_small ? (long long) -1
+                                             : (long long) written);
+
+  release_buffer_list(&destination);
+  PyBuffer_Release(&py_source);
+
+  if (LZ4F_isError (result))
+    {
+      PyErr_Format (PyExc_RuntimeError,
+                    "LZ4F_decompress failed with code: %s",
+                    LZ4F_getErrorName (result));
+      return NULL;
+    }
+
+  if (too_small)
+    {
+      PyErr_Format (PyExc_ValueError,
+                    "Decompressed data exceeds the destination size of %zu bytes",
+                    written);
+      return NULL;
+    }
+
+  if (result > 0)
+    {
+      PyErr_Format (PyExc_RuntimeError,
+                    "Frame incomplete. LZ4F_decompress returned: %zu", result);
+      return NULL;
+    }
+
+  if (return_bytes_read)
+    {
+      return Py_BuildValue ("nn",
+                            (Py_ssize_t) written,
+                            (Py_ssize_t) (source_cursor - (const char *) py_source.buf));
+    }
+
+  return PyLong_FromSize_t (written);
+}
+
+/*********************
+ * get_filter_header *
+ *********************/
+static const char * delta_state_capsule_name = "_frame.delta_state";
+
+static void
+destroy_delta_state (PyObject * py_state)
+{
+  PyMem_Free (PyCapsule_GetPointer (py_state, delta_state_capsule_name));
+}
+
+static PyObject *
+get_filter_header (PyObject * Py_UNUSED (self), PyObject * const * args,
+                   Py_ssize_t nargs, PyObject * kwnames)
+{
+  Py_buffer py_source;
+  struct shuffle_filter filter;
+  struct delta_state delta;
+  struct delta_state * state;
+  PyObject * py_state;
+  size_t size;
+  int header;
+  static char *kwlist[] = { "data",
+                            NULL
+                          };
+
+  if (!parse_fastcall_args (args, nargs, kwnames, "get_filter_header",
+                            "y*", kwlist,
+                            &py_source))
+    {
+      return NULL;
+    }
+
+  size = (size_t) py_source.len;
+  if (size < SHUFFLE_HEADER_SIZE)
+    {
+      header = filter_header_prefix (py_source.buf, size);
+      PyBuffer_Release (&py_source);
+      if (header)
+        {
+          return PyLong_FromLong (0);
+        }
+      Py_RETURN_NONE;
+    }
+
+  memset (&filter, 0, sizeof filter);
+  memset (&delta, 0, sizeof delta);
+  header = read_filter_header (py_source.buf, size, &filter, &delta);
+  PyBuffer_Release (&py_source);
+
+  if (header < 0)
+    {
+      return NULL;
+    }
+  else if (header == 0)
+    {
+      Py_RETURN_NONE;
+    }
+  else if (filter.itemsize)
+    {
+      PyErr_SetString (PyExc_RuntimeError, SHUFFLE_UNSUPPORTED_MESSAGE);
+      return NULL;
+    }
+
+  state = PyMem_Malloc (sizeof * state);
+  if (state == NULL)
+    {
+      return PyErr_NoMemory ();
+    }
+  *state = delta;
+
+  py_state = PyCapsule_New (state, delta_state_capsule_name,
+                            destroy_delta_state);
+  if (py_state == NULL)
+    {
+      PyMem_Free (state);
+      return NULL;
+    }
+
+  return Py_BuildValue ("nN", (Py_ssize_t) SHUFFLE_HEADER_SIZE, py_state);
+}
+
+/* The filter state saved by save_filter_state: the delta_e value, the item
+ * size, the number of bytes of a split item and a zero byte, then the
+ * previous item and difference as 64-bit integers and the bytes of the split
+ * item, all little endian. */
+#define FILTER_STATE_SIZE (4 + 8 + 8 + 8)
+
+static struct delta_state *
+get_delta_state (PyObject * py_filter)
+{
+  return (struct delta_state *)
+    PyCapsule_GetPointer (py_filter, delta_state_capsule_name);
+}
+
+/*****************
+ * decode_filter *
+ *****************/
+static PyObject *
+decode_filter (PyObject * Py_UNUSED (self), PyObject * const * args,
+               Py_ssize_t nargs, PyObject * kwnames)
+{
+  PyObject * py_filter;
+  PyObject * py_output;
+  Py_buffer py_source;
+  struct delta_state * delta;
+  static char *kwlist[] = { "filter",
+                            "data",
+                            NULL
+                          };
+
+  if (!parse_fastcall_args (args, nargs, kwnames, "decode_filter",
+                            "Oy*", kwlist,
+                            &py_filter,
+                            &py_source))
+    {
+      return NULL;
+    }
+
+  delta = get_delta_state (py_filter);
+  if (delta == NULL)
+    {
+      PyBuffer_Release (&py_source);
+      return NULL;
+    }
+
+  py_output = PyBytes_FromStringAndSize (py_source.buf, py_source.len);
+  PyBuffer_Release (&py_source);
+  if (py_output != NULL)
+    {
+      decode_output (py_output, delta);
+    }
+  return py_output;
+}
+
+/*********************
+ * save_filter_state *
+ *********************/
+static PyObject *
+save_filter_state (PyObject * Py_UNUSED (self), PyObject * const * args,
+                   Py_ssize_t nargs, PyObject * kwnames)
+{
+  PyObject * py_filter;
+  struct delta_state * delta;
+  unsigned char state[FILTER_STATE_SIZE];
+  static char *kwlist[] = { "filter",
+                            NULL
+                          };
+
+  if (!parse_fastcall_args (args, nargs, kwnames, "save_filter_state",
+                            "O", kwlist,
+                            &py_filter))
+    {
+      return NULL;
+    }
+
+  delta = get_delta_state (py_filter);
+  if (delta == NULL)
+    {
+      return NULL;
+    }
+
+  memset (state, 0, sizeof state);
+  state[0] = (unsigned char) delta->kind;
+  state[1] = (unsigned char) delta->itemsize;
+  state[2] = (unsigned char) delta->partial_size;
+  delta_store (state + 4, delta->previous, 8);
+  delta_store (state + 12, delta->previous_delta, 8);
+  memcpy (state + 20, delta->partial, delta->partial_size);
+
+  return PyBytes_FromStringAndSize ((const char *) state, sizeof state);
+}
+
+/*********************
+ * load_filter_state *
+ *********************/
+static PyObject *
+load_filter_state (PyObject * Py_UNUSED (self), PyObject * const * args,
+                   Py_ssize_t nargs, PyObject * kwnames)
+{
+  Py_buffer py_state;
+  const unsigned char * state;
+  struct delta_state * delta;
+  PyObject * py_filter;
+  static char *kwlist[] = { "state",
+                            NULL
+                          };
+
+  if (!parse_fastcall_args (args, nargs, kwnames, "load_filter_state",
+                            "y*", kwlist,
+                            &py_state))
+    {
+      return NULL;
+    }
+
+  state = (const unsigned char *) py_state.buf;
+  if (py_state.len != FILTER_STATE_SIZE
+      || state[0] < DELTA_PLAIN || state[0] > DELTA_XOR
+      || (state[1] != 1 && state[1] != 2 && state[1] != 4 && state[1] != 8)
+      || state[2] >= state[1])
+    {
+      PyBuffer_Release (&py_state);
+      PyErr_SetString (PyExc_ValueError, "Invalid filter state");
+      return NULL;
+    }
+
+  delta = PyMem_Malloc (sizeof * delta);
+  if (delta == NULL)
+    {
+      PyBuffer_Release (&py_state);
+      return PyErr_NoMemory ();
+    }
+  memset (delta, 0, sizeof * delta);
+  delta->kind = (delta_e) state[0];
+  delta->itemsize = state[1];
+  delta->partial_size = state[2];
+  delta->previous = delta_load (state + 4, 8);
+  delta->previous_delta = delta_load (state + 12, 8);
+  memcpy (delta->partial, state + 20, delta->partial_size);
+  PyBuffer_Release (&py_state);
+
+  py_filter = PyCapsule_New (delta, delta_state_capsule_name,
+                             destroy_delta_state);
+  if (py_filter == NULL)
+    {
+      PyMem_Free (delta);
+    }
+  return py_filter;
+}
+
+/********************
+ * decompress_chunk *
+ ********************/
+static PyObject *
+decompress_chunk (PyObject * Py_UNUSED (self), PyObject * const * args,
+                  Py_ssize_t nargs, PyObject * kwnames)
+{
+  PyObject * py_context = NULL;
+  PyObject * ret;
+  LZ4F_dctx * context;
+  Py_buffer py_source;
+  char * source;
+  size_t source_size;
+  Py_ssize_t max_length = (Py_ssize_t) -1;
+  int return_bytearray = 0;
+  PyObject * py_filter = Py_None;
+  struct delta_state * delta = NULL;
+  static char *kwlist[] = { "context",
+                            "data",
+                            "max_length",
+                            "return_bytearray",
+                            "filter",
+                            NULL
+                          };
+
+  if (!parse_fastcall_args (args, nargs, kwnames, "decompress_chunk",
+                            "Oy*|npO", kwlist,
+                            &py_context,
+                            &py_source,
+                            &max_length,
+                            &return_bytearray,
+                            &py_filter))
+    {
+      return NULL;
+    }
+
+  if (py_filter != Py_None)
+    {
+      delta = (struct delta_state *)
+        PyCapsule_GetPointer (py_filter, delta_state_capsule_name);
+      if (delta == NULL)
+        {
+          PyBuffer_Release(&py_source);
+          return NULL;
+        }
+    }
+
+  context = (LZ4F_dctx *)
+    PyCapsule_GetPointer (py_context, decompression_context_capsule_name);
+
+  if (!context)
+    {
+      PyBuffer_Release(&py_source);
+      PyErr_SetString (PyExc_ValueError,
+                       "No valid decompression context supplied");
+      return NULL;
+    }
+
+  /* MSVC can't do pointer arithmetic on void * pointers, so cast to char * */
+  source = (char *) py_source.buf;
+  source_size = py_source.len;
+
+  ret = __decompress (context,
+                      source,
+                      source_size,
+                      max_length,
+                      -1,
+                      0,
+                      return_bytearray,
+                      0);
+
+  PyBuffer_Release(&py_source);
+
+  if (delta != NULL && ret != NULL)
+    {
+      decode_output (PyTuple_GET_ITEM (ret, 0), delta);
+    }
+
+  return ret;
+}
+
+/****************
+ * Frame reader *
+ ****************/
+
+/* A reader decompressing LZ4 frames from a file object. It holds the
+ * decompression context, a buffer of compressed data read from the file and
+ * a buffer of decompressed data, and implements the reading methods of
+ * LZ4FrameFile natively, replacing the io.BufferedReader and DecompressReader
+ * pair. Consecutive frames are read as a single stream. */
+
+#define READER_INPUT_SIZE (128 * 1024)
+#define READER_OUTPUT_SIZE (128 * 1024)
+
+typedef struct
+{
+  PyObject_HEAD
+  PyObject * fp;
+  LZ4F_dctx * context;
+  /* Serializes the methods, which release the GIL while decompressing. */
+  PyThread_type_lock lock;
+  unsigned long owner;
+  char * input;
+  size_t input_pos;
+  size_t input_end;
+  char * output;
+  size_t output_pos;
+  size_t output_end;
+  /* Position in the decompressed stream. */
+  long long position;
+  /* Decompressed size of the stream, once the end has been reached. */
+  long long size;
+  int use_readinto;
+  int in_frame;
+  int eof;
+  /* Whether any compressed data has been read. An empty file isn't a valid
+   * stream, and raises EOFError as the Python reader did. */
+  int started;
+  /* The delta filter of the current frame, undone as it's decompressed. */
+  struct delta_state delta;
+} frame_reader_t;
+
+#define READER_AVAILABLE(self) ((self)->output_end - (self)->output_pos)
+
+static int
+reader_enter (frame_reader_t * self)
+{
+  if (self->context == NULL)
+    {
+      PyErr_SetString (PyExc_ValueError, "I/O operation on closed file");
+      return -1;
+    }
+
+  if (!PyThread_acquire_lock (self->lock, 0))
+    {
+      if (self->owner == PyThread_get_thread_ident ())
+        {
+          PyErr_SetString (PyExc_RuntimeError,
+                           "reentrant call inside frame reader");
+          return -1;
+        }
+      TRACE_BEGIN_ALLOW_THREADS
+      PyThread_acquire_lock (self->lock, 1);
+      TRACE_END_ALLOW_THREADS
+    }
+  self->owner = PyThread_get_thread_ident ();
+
+  /* Closed by another thread meanwhile. */
+  if (self->context == NULL)
+    {
+      self->owner = 0;
+      PyThread_release_lock (self->lock);
+      PyErr_SetString (PyExc_ValueError, "I/O operation on closed file");
+      return -1;
+    }
+
+  return 0;
+}
+
+static void
+reader_leave (frame_reader_t * self)
+{
+  self->owner = 0;
+  PyThread_release_lock (self->lock);
+}
+
+/* Reads the next piece of compressed data from the file, after what's left
+ * of the input, which is at most part of a filter header. Returns its size, 0
+ * at the end of the file, or -1 with an exception set. */
+static Py_ssize_t
+reader_read_input (frame_reader_t * self)
+{
+  PyObject * result;
+  Py_ssize_t size;
+  size_t kept = self->input_end - self->input_pos;
+  Py_ssize_t capacity = (Py_ssize_t) (READER_INPUT_SIZE - kept);
+
+  memmove (self->input, self->input + self->input_pos, kept);
+  self->input_pos = 0;
+  self->input_end = kept;
+
+  if (self->use_readinto)
+    {
+      PyObject * view = PyMemoryView_FromMemory (self->input + kept, capacity,
+                                                 PyBUF_WRITE);
+      if (view == NULL)
+        {
+          return -1;
+        }
+      result = PyObject_CallMethod (self->fp, "readinto", "O", view);
+      Py_DECREF (view);
+      if (result == NULL)
+        {
+          return -1;
+        }
+      if (result == Py_None)
+        {
+          Py_DECREF (result);
+          PyErr_SetString (PyExc_BlockingIOError,
+                           "compressed file has no data available");
+          return -1;
+        }
+      size = PyLong_AsSsize_t (result);
+      Py_DECREF (result);
+      if (size == -1 && PyErr_Occurred ())
+        {
+          return -1;
+        }
+    }
+  else
+    {
+      Py_buffer view;
+
+      result = PyObject_CallMethod (self->fp, "read", "n", capacity);
+      if (result == NULL)
+        {
+          return -1;
+        }
+      if (PyObject_GetBuffer (result, &view, PyBUF_SIMPLE) != 0)
+        {
+          Py_DECREF (result);
+          return -1;
+        }
+      size = view.len;
+      if (size <= capacity)
+        {
+          memcpy (self->input + kept, view.buf, size);
+        }
+      PyBuffer_Release (&view);
+      Py_DECREF (result);
+    }
+
+  if (size < 0 || size > capacity)
+    {
+      PyErr_Format (PyExc_OSError,
+                    "compressed file returned an invalid size: %zd", size);
+      return -1;
+    }
+
+  self->input_end = kept + (size_t) size;
+  if (size > 0)
+    {
+      self->started = 1;
+    }
+  return size;
+}
+
+/* Checks the start of a frame for a filter header, reading the rest of one
+ * that's split between reads. A delta filter header is consumed, and the
+ * filter undone for the rest of the frame. Returns 1 if a header was
+ * consumed, 0 if there's none, or -1 with an exception set if the frame was
+ * compressed with a shuffle filter. */
+static int
+reader_filter_header (frame_reader_t * self)
+{
+  struct shuffle_filter filter;
+  struct delta_state delta;
+  int header;
+
+  while (self->input_end - self->input_pos < SHUFFLE_HEADER_SIZE
+         && filter_header_prefix (self->input + self->input_pos,
+                                  self->input_end - self->input_pos))
+    {
+      Py_ssize_t size = reader_read_input (self);
+      if (size < 0)
+        {
+          return -1;
+        }
+      if (size == 0)
+        {
+          /* Left for LZ4F_decompress to report as a truncated frame. */
+          return 0;
+        }
+    }
+
+  memset (&filter, 0, sizeof filter);
+  header = read_filter_header (self->input + self->input_pos,
+                               self->input_end - self->input_pos,
+                               &filter, &delta);
+  if (header > 0 && filter.itemsize)
+    {
+      PyErr_SetString (PyExc_RuntimeError, SHUFFLE_UNSUPPORTED_MESSAGE);
+      return -1;
+    }
+  if (header > 0)
+    {
+      self->delta = delta;
+      self->input_pos += SHUFFLE_HEADER_SIZE;
+    }
+  return header;
+}
+
+/* Decompresses into destination until some data is produced, reading from
+ * the file as needed. Returns the size of the data produced, 0 at the end of
+ * the stream, or -1 with an exception set. */
+static Py_ssize_t
+reader_decompress (frame_reader_t * self, char * destination, size_t capacity)
+{
+  size_t produced = 0;
+
+  while (produced == 0)
+    {
+      size_t source_size;
+      size_t result;
+
+      if (self->input_pos == self->input_end)
+        {
+          Py_ssize_t size;
+
+          if (self->eof)
+            {
+              return 0;
+            }
+
+          size = reader_read_input (self);
+          if (size < 0)
+            {
+              return -1;
+            }
+          if (size == 0)
+            {
+              /* Raised again by later reads, as the Python reader did. */
+              if (self->in_frame || self->delta.kind != DELTA_NONE
+                  || !self->started)
+                {
+                  PyErr_SetString (PyExc_EOFError,
+                                   "Compressed file ended before the end-of-stream marker was reached");
+                  return -1;
+                }
+              self->eof = 1;
+              return 0;
+            }
+        }
+
+      if (!self->in_frame)
+        {
+          int header = reader_filter_header (self);
+          if (header < 0)
+            {
+              return -1;
+            }
+          if (header > 0)
+            {
+              continue;
+            }
+        }
+
+      source_size = self->input_end - self->input_pos;
+      produced = capacity;
+
+      /* Each piece fires the probes of decompress_chunk. */
+      TRACE3 (frame__decompress__entry, source_size, capacity, 0);
+      TRACE_BEGIN_ALLOW_THREADS
+      result = LZ4F_decompress (self->context, destination, &produced,
+                                self->input + self->input_pos, &source_size,
+                                NULL);
+      if (!LZ4F_isError (result) && self->delta.kind != DELTA_NONE)
+        {
+          apply_delta (&self->delta, destination, destination, produced, 1);
+        }
+      TRACE_END_ALLOW_THREADS
+      TRACE2 (frame__decompress__return,
+              LZ4F_isError (result) ? (long long) -1 : (long long) produced,
+              source_size);
+
+      if (LZ4F_isError (result))
+        {
+          PyErr_Format (PyExc_RuntimeError,
+                        "LZ4F_decompress failed with code: %s",
+                        LZ4F_getErrorName (result));
+          return -1;
+        }
+
+      self->input_pos += source_size;
+      /* LZ4F_decompress returns 0 once a frame is complete, and starts the
+       * next frame on the following call. */
+      self->in_frame = (result != 0);
+      if (!self->in_frame)
+        {
+          self->delta.kind = DELTA_NONE;
+        }
+    }
+
+  return (Py_ssize_t) produced;
+}
+
+/* Refills the buffer of decompressed data, which must be empty. Returns the
+ * size of the data available, 0 at the end of the stream, or -1 with an
+ * exception set. */
+static Py_ssize_t
+reader_fill (frame_reader_t * self)
+{
+  Py_ssize_t size = reader_decompress (self, self->output, READER_OUTPUT_SIZE);
+
+  self->output_pos = 0;
+  self->output_end = size > 0 ? (size_t) size : 0;
+  return size;
+}
+
+/* Copies up to size bytes of the stream to destination, stopping only at the
+ * end of the stream. Returns the number of bytes copied, or -1 with an
+ * exception set. */
+static Py_ssize_t
+reader_read_into (frame_reader_t * self, char * destination, size_t size)
+{
+  size_t done = 0;
+
+  while (done < size)
+    {
+      Py_ssize_t produced;
+      size_t length = READER_AVAILABLE (self);
+
+      if (length > 0)
+        {
+          if (length > size - done)
+            {
+              length = size - done;
+            }
+          memcpy (destination + done, self->output + self->output_pos, length);
+          self->output_pos += length;
+          done += length;
+          continue;
+        }
+
+      /* Large reads are decompressed in place. */
+      if (size - done >= READER_OUTPUT_SIZE)
+        {
+          produced = reader_decompress (self, destination + done, size - done);
+          if (produced > 0)
+            {
+              done += (size_t) produced;
+            }
+        }
+      else
+        {
+          produced = reader_fill (self);
+        }
+
+      if (produced < 0)
+        {
+          self->position += done;
+          return -1;
+        }
+      if (produced == 0)
+        {
+          break;
+        }
+    }
+
+  self->position += done;
+  return (Py_ssize_t) done;
+}
+
+/* Reads the rest of the stream into a bytes object. */
+static PyObject *
+reader_read_all (frame_reader_t * self)
+{
+  PyObject * bytes;
+  size_t capacity = READER_AVAILABLE (self) + 4 * READER_OUTPUT_SIZE;
+  size_t size = 0;
+
+  bytes = PyBytes_FromStringAndSize (NULL, (Py_ssize_t) capacity);
+  if (bytes == NULL)
+    {
+      return NULL;
+    }
+
+  for (;;)
+    {
+      Py_ssize_t length = reader_read_into (self, PyBytes_AS_STRING (bytes) + size,
+                                            capacity - size);
+      if (length < 0)
+        {
+          Py_DECREF (bytes);
+          return NULL;
+        }
+      size += (size_t) length;
+      if (size < capacity)
+        {
+          break;
+        }
+
+      capacity *= 2;
+      if (capacity > PY_SSIZE_T_MAX || _PyBytes_Resize (&bytes, (Py_ssize_t) capacity) != 0)
+        {
+          Py_XDECREF (bytes);
+          return PyErr_NoMemory ();
+        }
+    }
+
+  if (_PyBytes_Resize (&bytes, (Py_ssize_t) size) != 0)
+    {
+      return NULL;
+    }
+  return bytes;
+}
+
+/* Reads a line of at most size bytes, or of any length if size is negative. */
+static PyObject *
+reader_read_line (frame_reader_t * self, Py_ssize_t size)
+{
+  char * line = NULL;
+  size_t line_size = 0;
+  size_t capacity = 0;
+  PyObject * result;
+
+  for (;;)
+    {
+      const char * start;
+      const char * end;
+      size_t length;
+
+      if (READER_AVAILABLE (self) == 0)
+        {
+          Py_ssize_t produced = reader_fill (self);
+          if (produced < 0)
+            {
+              PyMem_Free (line);
+              return NULL;
+            }
+          if (produced == 0)
+            {
+              break;
+            }
+        }
+
+      start = self->output + self->output_pos;
+      length = READER_AVAILABLE (self);
+      if (size >= 0 && length > (size_t) size - line_size)
+        {
+          length = (size_t) size - line_size;
+        }
+
+      end = memchr (start, '\n', length);
+      if (end != NULL)
+        {
+          length = end - start + 1;
+        }
+
+      /* Most lines are found in the buffer in one piece. */
+      if (line == NULL && (end != NULL || line_size + length == (size_t) size))
+        {
+          self->output_pos += length;
+          self->position += length;
+          return PyBytes_FromStringAndSize (start, (Py_ssize_t) length);
+        }
+
+      if (line_size + length > capacity)
+        {
+          char * grown;
+
+          capacity = 2 * (line_size + length);
+          grown = PyMem_Realloc (line, capacity);
+          if (grown == NULL)
+            {
+              PyMem_Free (line);
+              return PyErr_NoMemory ();
+            }
+          line = grown;
+        }
+      memcpy (line + line_size, start, length);
+      line_size += length;
+      self->output_pos += length;
+      self->position += length;
+
+      if (end != NULL || line_size == (size_t) size)
+        {
+          break;
+        }
+    }
+
+  result = PyBytes_FromStringAndSize (line, (Py_ssize_t) line_size);
+  PyMem_Free (line);
+  return result;
+}
+
+/* Restarts reading from the beginning of the file. */
+static int
+reader_rewind (frame_reader_t * self)
+{
+  PyObject * result = PyObject_CallMethod (self->fp, "seek", "i", 0);
+
+  if (result == NULL)
+    {
+      return -1;
+    }
+  Py_DECREF (result);
+
+  if (LZ4_versionNumber () >= 10800) /* LZ4 >= v1.8.0 has LZ4F_resetDecompressionContext */
+    {
+      LZ4F_resetDecompressionContext (self->context);
+    }
+  else
+    {
+      LZ4F_dctx * context;
+      LZ4F_errorCode_t error = new_decompression_context (&context, allocator);
+
+      if (LZ4F_isError (error))
+        {
+          PyErr_Format (PyExc_RuntimeError,
+                        "LZ4F_createDecompressionContext failed with code: %s",
+                        LZ4F_getErrorName (error));
+          return -1;
+        }
+      LZ4F_freeDecompressionContext (self->context);
+      self->context = context;
+    }
+
+  self->input_pos = self->input_end = 0;
+  self->output_pos = self->output_end = 0;
+  self->position = 0;
+  self->in_frame = 0;
+  self->eof = 0;
+  self->started = 0;
+  self->delta.kind = DELTA_NONE;
+  return 0;
 }
 
-/********************************
- * create_decompression_context *
- ********************************/
-static void
-destroy_decompression_context (PyObject * py_context)
-{
-#ifndef PyCapsule_Type
-  LZ4F_dctx * context =
-    PyCapsule_GetPointer (py_context, decompression_context_capsule_name);
-#else
-  /* Compatibility with 2.6 via capsulethunk. */
-  LZ4F_dctx * context =  py_context;
-#endif
-  Py_BEGIN_ALLOW_THREADS
-  LZ4F_freeDecompressionContext (context);
-  Py_END_ALLOW_THREADS
+/* Parses the optional size argument of the reading methods, which may also be
+ * None. */
+static int
+reader_size_arg (PyObject * const * args, Py_ssize_t nargs, const char * name,
+                 Py_ssize_t * size)
+{
+  *size = -1;
+
+  if (nargs > 1)
+    {
+      PyErr_Format (PyExc_TypeError,
+                    "%s() takes at most 1 argument (%zd given)", name, nargs);
+      return -1;
+    }
+
+  if (nargs == 1 && args[0] != Py_None)
+    {
+      *size = PyNumber_AsSsize_t (args[0], PyExc_OverflowError);
+      if (*size == -1 && PyErr_Occurred ())
+        {
+          return -1;
+        }
+    }
+
+  return 0;
 }
 
 static PyObject *
-create_decompression_context (PyObject * Py_UNUSED (self))
+frame_reader_new (PyTypeObject * type, PyObject * args, PyObject * kwds)
 {
-  LZ4F_dctx * context;
+  frame_reader_t * self;
+  PyObject * fp;
   LZ4F_errorCode_t result;
+  static char * kwlist[] = { "fileobj", NULL };
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "O:FrameReader", kwlist, &fp))
+    {
+      return NULL;
+    }
+
+  self = (frame_reader_t *) type->tp_alloc (type, 0);
+  if (self == NULL)
+    {
+      return NULL;
+    }
+
+  Py_INCREF (fp);
+  self->fp = fp;
+  self->use_readinto = PyObject_HasAttrString (fp, "readinto");
+  self->size = -1;
+
+  self->lock = PyThread_allocate_lock ();
+  self->input = PyMem_Malloc (READER_INPUT_SIZE);
+  self->output = PyMem_Malloc (READER_OUTPUT_SIZE);
+  if (self->lock == NULL || self->input == NULL || self->output == NULL)
+    {
+      Py_DECREF (self);
+      return PyErr_NoMemory ();
+    }
 
-  Py_BEGIN_ALLOW_THREADS
-  result = LZ4F_createDecompressionContext (&context, LZ4F_VERSION);
+  result = new_decompression_context (&self->context, allocator);
   if (LZ4F_isError (result))
     {
-      Py_BLOCK_THREADS
-      LZ4F_freeDecompressionContext (context);
+      self->context = NULL;
+      Py_DECREF (self);
       PyErr_Format (PyExc_RuntimeError,
                     "LZ4F_createDecompressionContext failed with code: %s",
                     LZ4F_getErrorName (result));
       return NULL;
     }
-  Py_END_ALLOW_THREADS
 
-  return PyCapsule_New (context, decompression_context_capsule_name,
-                        destroy_decompression_context);
+  return (PyObject *) self;
 }
 
-/*******************************
- * reset_decompression_context *
- *******************************/
-static PyObject *
-reset_decompression_context (PyObject * Py_UNUSED (self), PyObject * args,
-                             PyObject * keywds)
+static void
+reader_release (frame_reader_t * self)
 {
-  LZ4F_dctx * context;
-  PyObject * py_context = NULL;
-  static char *kwlist[] = { "context",
-                            NULL
-  };
+  if (self->context != NULL)
+    {
+      LZ4F_freeDecompressionContext (self->context);
+      self->context = NULL;
+    }
+  PyMem_Free (self->input);
+  self->input = NULL;
+  PyMem_Free (self->output);
+  self->output = NULL;
+  self->input_pos = self->input_end = 0;
+  self->output_pos = self->output_end = 0;
+  Py_CLEAR (self->fp);
+}
 
-  if (!PyArg_ParseTupleAndKeywords (args, keywds, "O", kwlist,
-                                    &py_context
-                                    ))
+static void
+frame_reader_dealloc (frame_reader_t * self)
+{
+  PyTypeObject * type = Py_TYPE (self);
+
+  reader_release (self);
+  if (self->lock != NULL)
     {
-      return NULL;
+      PyThread_free_lock (self->lock);
     }
+  type->tp_free ((PyObject *) self);
+  Py_DECREF (type);
+}
 
-  context = (LZ4F_dctx *)
-    PyCapsule_GetPointer (py_context, decompression_context_capsule_name);
+static PyObject *
+frame_reader_read (frame_reader_t * self, PyObject * const * args,
+                   Py_ssize_t nargs)
+{
+  PyObject * result;
+  Py_ssize_t size;
+  Py_ssize_t length;
 
-  if (!context)
+  if (reader_size_arg (args, nargs, "read", &size) != 0 || reader_enter (self) != 0)
     {
-      PyErr_SetString (PyExc_ValueError,
-                       "No valid decompression context supplied");
       return NULL;
     }
 
-  if (LZ4_versionNumber() >= 10800) /* LZ4 >= v1.8.0 has LZ4F_resetDecompressionContext */
+  if (size < 0)
     {
-      /* No error checking possible here - this is always successful. */
-      Py_BEGIN_ALLOW_THREADS
-      LZ4F_resetDecompressionContext (context);
-      Py_END_ALLOW_THREADS
+      result = reader_read_all (self);
     }
   else
     {
-      /* No resetDecompressionContext available, so we'll destroy the context
-         and create a new one. */
-      int result;
-
-      Py_BEGIN_ALLOW_THREADS
-      LZ4F_freeDecompressionContext (context);
-
-      result = LZ4F_createDecompressionContext (&context, LZ4F_VERSION);
-      if (LZ4F_isError (result))
-        {
-          LZ4F_freeDecompressionContext (context);
-          Py_BLOCK_THREADS
-          PyErr_Format (PyExc_RuntimeError,
-                        "LZ4F_createDecompressionContext failed with code: %s",
-                        LZ4F_getErrorName (result));
-          return NULL;
-        }
-      Py_END_ALLOW_THREADS
-
-      result = PyCapsule_SetPointer(py_context, context);
-      if (result)
+      result = PyBytes_FromStringAndSize (NULL, size);
+      if (result != NULL)
         {
-          LZ4F_freeDecompressionContext (context);
-          PyErr_SetString (PyExc_RuntimeError,
-                           "PyCapsule_SetPointer failed with code: %s");
-          return NULL;
+          length = reader_read_into (self, PyBytes_AS_STRING (result), size);
+          if (length < 0)
+            {
+              Py_CLEAR (result);
+            }
+          else if (length < size)
+            {
+              _PyBytes_Resize (&result, length);
+            }
         }
     }
 
-  Py_RETURN_NONE;
+  reader_leave (self);
+  return result;
 }
 
-static inline PyObject *
-__decompress(LZ4F_dctx * context, char * source, size_t source_size,
-             Py_ssize_t max_length, int full_frame,
-             int return_bytearray, int return_bytes_read)
+static PyObject *
+frame_reader_read1 (frame_reader_t * self, PyObject * const * args,
+                    Py_ssize_t nargs)
 {
-  size_t source_remain;
-  size_t source_read;
-  char * source_cursor;
-  char * source_end;
-  char * destination;
-  size_t destination_write;
-  char * destination_cursor;
-  size_t destination_written;
-  size_t destination_size;
-  PyObject * py_destination;
-  size_t result = 0;
-  LZ4F_frameInfo_t frame_info;
-  LZ4F_decompressOptions_t options;
-  int end_of_frame = 0;
-  int resize_factor = 1;
-
-  memset(&options, 0, sizeof options);
+  PyObject * result = NULL;
+  Py_ssize_t size;
+  size_t length;
 
-  Py_BEGIN_ALLOW_THREADS
-
-  source_cursor = source;
-  source_end = source + source_size;
-  source_remain = source_size;
+  if (reader_size_arg (args, nargs, "read1", &size) != 0 || reader_enter (self) != 0)
+    {
+      return NULL;
+    }
 
-  if (full_frame)
+  if (size != 0 && READER_AVAILABLE (self) == 0 && reader_fill (self) < 0)
     {
-      source_read = source_size;
+      goto exit_now;
+    }
 
-      result =
-        LZ4F_getFrameInfo (context, &frame_info,
-                           source_cursor, &source_read);
+  length = READER_AVAILABLE (self);
+  if (size >= 0 && length > (size_t) size)
+    {
+      length = (size_t) size;
+    }
+  result = PyBytes_FromStringAndSize (self->output + self->output_pos, length);
+  if (result != NULL)
+    {
+      self->output_pos += length;
+      self->position += length;
+    }
 
-      if (LZ4F_isError (result))
-        {
-          Py_BLOCK_THREADS
-          PyErr_Format (PyExc_RuntimeError,
-                        "LZ4F_getFrameInfo failed with code: %s",
-                        LZ4F_getErrorName (result));
-          return NULL;
-        }
+exit_now:
+  reader_leave (self);
+  return result;
+}
 
-      /* Advance the source_cursor pointer past the header - the call to
-         getFrameInfo above replaces the passed source_read value with the
-         number of bytes read. Also reduce source_remain accordingly. */
-      source_cursor += source_read;
-      source_remain -= source_read;
+static PyObject *
+frame_reader_readinto (frame_reader_t * self, PyObject * arg)
+{
+  Py_buffer buffer;
+  Py_ssize_t length;
 
-      /* If the uncompressed content size is available, we'll use that to size
-         the destination buffer. Otherwise, guess at twice the remaining source
-         source as a starting point, and adjust if needed. */
-      if (frame_info.contentSize > 0)
-        {
-          destination_size = frame_info.contentSize;
-        }
-      else
-        {
-          destination_size = 2 * source_remain;
-        }
-    }
-  else
+  if (PyObject_GetBuffer (arg, &buffer, PyBUF_WRITABLE) != 0)
     {
-      if (max_length >= (Py_ssize_t) 0)
-        {
-          destination_size = (size_t) max_length;
-        }
-      else
-        {
-          /* Choose an initial destination size as twice the source size, and we'll
-             grow the allocation as needed. */
-          destination_size = 2 * source_remain;
-        }
+      return NULL;
     }
 
-  Py_BLOCK_THREADS
-
-  destination = PyMem_Malloc (destination_size * sizeof * destination);
-  if (destination == NULL)
+  if (reader_enter (self) != 0)
     {
-      return PyErr_NoMemory();
+      PyBuffer_Release (&buffer);
+      return NULL;
     }
 
-  Py_UNBLOCK_THREADS
+  length = reader_read_into (self, buffer.buf, buffer.len);
 
-  /* Only set stableDst = 1 if we are sure no PyMem_Realloc will be called since
-     when stableDst = 1 the LZ4 library stores a pointer to the last compressed
-     data, which may be invalid after a PyMem_Realloc. */
-  if (full_frame && max_length >= (Py_ssize_t) 0)
+  reader_leave (self);
+  PyBuffer_Release (&buffer);
+
+  if (length < 0)
     {
-      options.stableDst = 1;
+      return NULL;
     }
-  else
+  return PyLong_FromSsize_t (length);
+}
+
+static PyObject *
+frame_reader_readline (frame_reader_t * self, PyObject * const * args,
+                       Py_ssize_t nargs)
+{
+  PyObject * result;
+  Py_ssize_t size;
+
+  if (reader_size_arg (args, nargs, "readline", &size) != 0 || reader_enter (self) != 0)
     {
-      options.stableDst = 0;
+      return NULL;
     }
 
-  source_read = source_remain;
+  result = reader_read_line (self, size);
+
+  reader_leave (self);
+  return result;
+}
 
-  destination_write = destination_size;
-  destination_cursor = destination;
-  destination_written = 0;
+static PyObject *
+frame_reader_peek (frame_reader_t * self, PyObject * const * args,
+                   Py_ssize_t nargs)
+{
+  PyObject * result = NULL;
+  Py_ssize_t size;
 
-  while (1)
+  /* As with io.BufferedReader, the size is ignored. */
+  if (reader_size_arg (args, nargs, "peek", &size) != 0 || reader_enter (self) != 0)
     {
-      /* Decompress from the source string and write to the destination
-         until there's no more source string to read, or until we've reached the
-         frame end.
+      return NULL;
+    }
 
-         On calling LZ4F_decompress, source_read is set to the remaining length
-         of source available to read. On return, source_read is set to the
-         actual number of bytes read from source, which may be less than
-         available. NB: LZ4F_decompress does not explicitly fail on empty input.
+  if (READER_AVAILABLE (self) == 0 && reader_fill (self) < 0)
+    {
+      goto exit_now;
+    }
 
-         On calling LZ4F_decompress, destination_write is the number of bytes in
-         destination available for writing. On exit, destination_write is set to
-         the actual number of bytes written to destination. */
-      result = LZ4F_decompress (context,
-                                destination_cursor,
-                                &destination_write,
-                                source_cursor,
-                                &source_read,
-                                &options);
+  result = PyBytes_FromStringAndSize (self->output + self->output_pos,
+                                      READER_AVAILABLE (self));
 
-      if (LZ4F_isError (result))
-        {
-          Py_BLOCK_THREADS
-          PyErr_Format (PyExc_RuntimeError,
-                        "LZ4F_decompress failed with code: %s",
-                        LZ4F_getErrorName (result));
-          PyMem_Free (destination);
-          return NULL;
-        }
+exit_now:
+  reader_leave (self);
+  return result;
+}
 
-      destination_written += destination_write;
-      source_cursor += source_read;
-      source_read = source_end - source_cursor;
+/* Discards decompressed data up to target, stopping at the end of the
+ * stream. */
+static int
+reader_skip (frame_reader_t * self, long long target)
+{
+  while (self->position < target)
+    {
+      size_t length = READER_AVAILABLE (self);
 
-      if (result == 0)
-        {
-          /* We've reached the end of the frame. */
-          end_of_frame = 1;
-          break;
-        }
-      else if (source_cursor == source_end)
-        {
-          /* We've reached end of input. */
-          break;
-        }
-      else if (destination_written == destination_size)
+      if (length == 0)
         {
-          /* Destination buffer is full. So, stop decompressing if
-             max_length is set. Otherwise expand the destination
-             buffer. */
-          if (max_length >= (Py_ssize_t) 0)
-            {
-              break;
-            }
-          else
+          Py_ssize_t produced = reader_fill (self);
+          if (produced <= 0)
             {
-              /* Expand the destination buffer. We've tried various strategies
-                 here to estimate the compression ratio so far and adjust the
-                 buffer size accordingly. However, that grows the buffer too
-                 slowly. The best choices found were to either double the buffer
-                 size each time, or to grow faster by multiplying the buffer
-                 size by 2^N, where N is the number of resizes. We take the
-                 latter approach, though the former approach may actually be
-                 good enough in practice. */
-              char * buff;
-
-              resize_factor *= 2;
-              destination_size *= resize_factor;
-
-              Py_BLOCK_THREADS
-              buff = PyMem_Realloc (destination, destination_size);
-              if (buff == NULL)
-                {
-                  PyErr_SetString (PyExc_RuntimeError,
-                                   "Failed to resize buffer");
-                  return NULL;
-                }
-              else
-                {
-                  destination = buff;
-                }
-              Py_UNBLOCK_THREADS
+              return (int) produced;
             }
+          length = (size_t) produced;
+        }
+
+      if ((long long) length > target - self->position)
+        {
+          length = (size_t) (target - self->position);
         }
-      /* Data still remaining to be decompressed, so increment the destination
-         cursor location, and reset destination_write ready for the next
-         iteration. Important to re-initialize destination_cursor here (as
-         opposed to simply incrementing it) so we're pointing to the realloc'd
-         memory location. */
-      destination_cursor = destination + destination_written;
-      destination_write = destination_size - destination_written;
+      self->output_pos += length;
+      self->position += length;
     }
 
-  Py_END_ALLOW_THREADS
+  return 0;
+}
 
-  if (result > 0 && full_frame)
+static PyObject *
+frame_reader_seek (frame_reader_t * self, PyObject * args)
+{
+  long long offset;
+  int whence = 0;
+  long long target;
+  PyObject * result = NULL;
+
+  if (!PyArg_ParseTuple (args, "L|i:seek", &offset, &whence) || reader_enter (self) != 0)
     {
-      PyErr_Format (PyExc_RuntimeError,
-                    "Frame incomplete. LZ4F_decompress returned: %zu", result);
-      PyMem_Free (destination);
       return NULL;
     }
 
-  if (LZ4F_isError (result))
+  switch (whence)
+    {
+    case 0: /* io.SEEK_SET */
+      target = offset;
+      break;
+    case 1: /* io.SEEK_CUR */
+      target = self->position + offset;
+      break;
+    case 2: /* io.SEEK_END */
+      /* Seeking relative to the end requires knowing the size */
+      if (self->size < 0)
+        {
+          if (reader_skip (self, LLONG_MAX) != 0)
+            {
+              goto exit_now;
+            }
+          self->size = self->position;
+        }
+      target = self->size + offset;
+      break;
+    default:
+      PyErr_Format (PyExc_ValueError, "Invalid value for whence: %d", whence);
+      goto exit_now;
+    }
+
+  if (target < 0)
     {
-      PyErr_Format (PyExc_RuntimeError,
-                    "LZ4F_freeDecompressionContext failed with code: %s",
-                    LZ4F_getErrorName (result));
-      PyMem_Free (destination);
-      return NULL;
+      target = 0;
     }
 
-  if (return_bytearray)
+  /* Seeking backwards restarts from the beginning. */
+  if (target < self->position && reader_rewind (self) != 0)
     {
-      py_destination = PyByteArray_FromStringAndSize (destination, (Py_ssize_t) destination_written);
+      goto exit_now;
     }
-  else
+
+  if (reader_skip (self, target) != 0)
     {
-      py_destination = PyBytes_FromStringAndSize (destination, (Py_ssize_t) destination_written);
+      goto exit_now;
     }
 
-  PyMem_Free (destination);
+  result = PyLong_FromLongLong (self->position);
 
-  if (py_destination == NULL)
-    {
-      return PyErr_NoMemory ();
-    }
+exit_now:
+  reader_leave (self);
+  return result;
+}
 
-  if (full_frame)
+static PyObject *
+frame_reader_tell (frame_reader_t * self, PyObject * Py_UNUSED (args))
+{
+  if (self->context == NULL)
     {
-      if (return_bytes_read)
-        {
-          return Py_BuildValue ("Ni",
-                                py_destination,
-                                source_cursor - source);
-        }
-      else
-        {
-          return py_destination;
-        }
+      PyErr_SetString (PyExc_ValueError, "I/O operation on closed file");
+      return NULL;
     }
-  else
+
+  return PyLong_FromLongLong (self->position);
+}
+
+static PyObject *
+frame_reader_seekable (frame_reader_t * self, PyObject * Py_UNUSED (args))
+{
+  if (self->context == NULL)
     {
-      return Py_BuildValue ("NiO",
-                            py_destination,
-                            source_cursor - source,
-                            end_of_frame ? Py_True : Py_False);
+      PyErr_SetString (PyExc_ValueError, "I/O operation on closed file");
+      return NULL;
     }
+
+  return PyObject_CallMethod (self->fp, "seekable", NULL);
 }
 
-/**************
- * decompress *
- **************/
 static PyObject *
-decompress (PyObject * Py_UNUSED (self), PyObject * args,
-            PyObject * keywds)
+frame_reader_close (frame_reader_t * self, PyObject * Py_UNUSED (args))
 {
-  LZ4F_dctx * context;
-  LZ4F_errorCode_t result;
-  Py_buffer py_source;
-  char * source;
-  size_t source_size;
-  PyObject * ret;
-  int return_bytearray = 0;
-  int return_bytes_read = 0;
-  static char *kwlist[] = { "data",
-                            "return_bytearray",
-                            "return_bytes_read",
-                            NULL
-                          };
-
-  if (!PyArg_ParseTupleAndKeywords (args, keywds, "y*|pp", kwlist,
-                                    &py_source,
-                                    &return_bytearray,
-                                    &return_bytes_read
-                                    ))
+  if (self->context == NULL)
     {
-      return NULL;
+      Py_RETURN_NONE;
     }
 
-  Py_BEGIN_ALLOW_THREADS
-  result = LZ4F_createDecompressionContext (&context, LZ4F_VERSION);
-  if (LZ4F_isError (result))
+  if (reader_enter (self) != 0)
     {
-      LZ4F_freeDecompressionContext (context);
-      Py_BLOCK_THREADS
-      PyBuffer_Release(&py_source);
-      PyErr_Format (PyExc_RuntimeError,
-                    "LZ4F_createDecompressionContext failed with code: %s",
-                    LZ4F_getErrorName (result));
       return NULL;
     }
-  Py_END_ALLOW_THREADS
-
-  /* MSVC can't do pointer arithmetic on void * pointers, so cast to char * */
-  source = (char *) py_source.buf;
-  source_size = py_source.len;
+  reader_release (self);
+  reader_leave (self);
 
-  ret = __decompress (context,
-                      source,
-                      source_size,
-                      -1,
-                      1,
-                      return_bytearray,
-                      return_bytes_read);
+  Py_RETURN_NONE;
+}
 
-  PyBuffer_Release(&py_source);
+static PyObject *
+frame_reader_get_closed (frame_reader_t * self, void * Py_UNUSED (closure))
+{
+  return PyBool_FromLong (self->context == NULL);
+}
 
-  Py_BEGIN_ALLOW_THREADS
-  LZ4F_freeDecompressionContext (context);
-  Py_END_ALLOW_THREADS
+static PyObject *
+frame_reader_iter (frame_reader_t * self)
+{
+  if (self->context == NULL)
+    {
+      PyErr_SetString (PyExc_ValueError, "I/O operation on closed file");
+      return NULL;
+    }
 
-  return ret;
+  Py_INCREF (self);
+  return (PyObject *) self;
 }
 
-/********************
- * decompress_chunk *
- ********************/
 static PyObject *
-decompress_chunk (PyObject * Py_UNUSED (self), PyObject * args,
-                  PyObject * keywds)
+frame_reader_iternext (frame_reader_t * self)
 {
-  PyObject * py_context = NULL;
-  PyObject * ret;
-  LZ4F_dctx * context;
-  Py_buffer py_source;
-  char * source;
-  size_t source_size;
-  Py_ssize_t max_length = (Py_ssize_t) -1;
-  int return_bytearray = 0;
-  static char *kwlist[] = { "context",
-                            "data",
-                            "max_length",
-                            "return_bytearray",
-                            NULL
-                          };
+  PyObject * line;
 
-  if (!PyArg_ParseTupleAndKeywords (args, keywds, "Oy*|np", kwlist,
-                                    &py_context,
-                                    &py_source,
-                                    &max_length,
-                                    &return_bytearray
-                                    ))
+  if (reader_enter (self) != 0)
     {
       return NULL;
     }
 
-  context = (LZ4F_dctx *)
-    PyCapsule_GetPointer (py_context, decompression_context_capsule_name);
+  line = reader_read_line (self, -1);
 
-  if (!context)
+  reader_leave (self);
+
+  if (line != NULL && PyBytes_GET_SIZE (line) == 0)
     {
-      PyBuffer_Release(&py_source);
-      PyErr_SetString (PyExc_ValueError,
-                       "No valid decompression context supplied");
-      return NULL;
+      /* End of iteration, without an exception set */
+      Py_CLEAR (line);
     }
+  return line;
+}
 
-  /* MSVC can't do pointer arithmetic on void * pointers, so cast to char * */
-  source = (char *) py_source.buf;
-  source_size = py_source.len;
+PyDoc_STRVAR (frame_reader_read__doc,
+              "read(size=-1)\n"                                                          \
+              "\n"                                                                       \
+              "Reads up to size decompressed bytes, or up to the end of the stream if\n" \
+              "size is negative. Fewer bytes are returned only at the end of the\n"      \
+              "stream.\n");
+
+PyDoc_STRVAR (frame_reader_read1__doc,
+              "read1(size=-1)\n" \
+              "\n"               \
+              "Reads up to size decompressed bytes, decompressing at most once.\n");
+
+PyDoc_STRVAR (frame_reader_readinto__doc,
+              "readinto(b)\n"                                                         \
+              "\n"                                                                    \
+              "Reads decompressed data into the writable buffer b, and returns the\n" \
+              "number of bytes read.\n");
+
+PyDoc_STRVAR (frame_reader_readline__doc,
+              "readline(size=-1)\n"                                                      \
+              "\n"                                                                       \
+              "Reads a line, including its terminating newline, of at most size bytes\n" \
+              "if size is not negative.\n");
+
+PyDoc_STRVAR (frame_reader_peek__doc,
+              "peek(size=0)\n"                                                      \
+              "\n"                                                                  \
+              "Returns the decompressed data buffered, without advancing the\n"     \
+              "position. At least one byte is returned, unless at the end of the\n" \
+              "stream.\n");
+
+PyDoc_STRVAR (frame_reader_seek__doc,
+              "seek(offset, whence=0)\n"                                               \
+              "\n"                                                                     \
+              "Changes the position in the decompressed stream. Seeking is emulated\n" \
+              "by decompressing, and seeking backwards restarts from the beginning.\n");
+
+static PyMethodDef frame_reader_methods[] = {
+  {
+    "read", FASTCALL_FUNCTION (frame_reader_read),
+    METH_FASTCALL, frame_reader_read__doc
+  },
+  {
+    "read1", FASTCALL_FUNCTION (frame_reader_read1),
+    METH_FASTCALL, frame_reader_read1__doc
+  },
+  {
+    "readinto", (PyCFunction) frame_reader_readinto,
+    METH_O, frame_reader_readinto__doc
+  },
+  {
+    "readline", FASTCALL_FUNCTION (frame_reader_readline),
+    METH_FASTCALL, frame_reader_readline__doc
+  },
+  {
+    "peek", FASTCALL_FUNCTION (frame_reader_peek),
+    METH_FASTCALL, frame_reader_peek__doc
+  },
+  {
+    "seek", (PyCFunction) frame_reader_seek,
+    METH_VARARGS, frame_reader_seek__doc
+  },
+  {
+    "tell", (PyCFunction) frame_reader_tell,
+    METH_NOARGS, NULL
+  },
+  {
+    "seekable", (PyCFunction) frame_reader_seekable,
+    METH_NOARGS, NULL
+  },
+  {
+    "close", (PyCFunction) frame_reader_close,
+    METH_NOARGS, NULL
+  },
+  {NULL, NULL, 0, NULL}		/* Sentinel */
+};
 
-  ret = __decompress (context,
-                      source,
-                      source_size,
-                      max_length,
-                      0,
-                      return_bytearray,
-                      0);
+static PyGetSetDef frame_reader_getset[] = {
+  {"closed", (getter) frame_reader_get_closed, NULL, NULL, NULL},
+  {NULL, NULL, NULL, NULL, NULL}	/* Sentinel */
+};
 
-  PyBuffer_Release(&py_source);
+PyDoc_STRVAR (frame_reader__doc,
+              "FrameReader(fileobj)\n"                                                  \
+              "\n"                                                                      \
+              "Reads the LZ4 frames of the file object fileobj as a single stream of\n" \
+              "decompressed data. Used by LZ4FrameFile in read mode. Iterating over\n"  \
+              "it yields lines.\n");
+
+static PyType_Slot frame_reader_slots[] = {
+  {Py_tp_doc, (void *) frame_reader__doc},
+  {Py_tp_new, frame_reader_new},
+  {Py_tp_dealloc, frame_reader_dealloc},
+  {Py_tp_iter, frame_reader_iter},
+  {Py_tp_iternext, frame_reader_iternext},
+  {Py_tp_methods, frame_reader_methods},
+  {Py_tp_getset, frame_reader_getset},
+  {0, NULL}
+};
+
+static PyType_Spec frame_reader_spec = {
+  "lz4.frame._frame.FrameReader",
+  sizeof (frame_reader_t),
+  0,
+  Py_TPFLAGS_DEFAULT,
+  frame_reader_slots
+};
 
-  return ret;
-}
 
 PyDoc_STRVAR(
  create_compression_context__doc,
@@ -1367,14 +4747,48 @@ PyDoc_STRVAR(
   "        library has version >= 1.8.0. Attempting to set this value\n" \
   "        to ``True`` with a version of LZ4 < 1.8.0 will cause a\n"    \
   "        ``RuntimeError`` to be raised.\n"                            \
+  "    favor_decompression_speed (bool): If ``True``, the high compression\n" \
+  "        parser favors decompression speed over compression ratio. This\n" \
+  "        only has an effect for ``compression_level`` of 10 or above.\n" \
+  "        Default is ``False``. Requires LZ4 library version >= 1.8.2.\n" \
   "    return_bytearray (bool): If ``True`` a ``bytearray`` object will be\n" \
   "        returned. If ``False``, a string of bytes is returned. The default\n" \
   "        is ``False``.\n" \
 
+#define SHUFFLE_KWARGS_DOCSTRING                                        \
+  "    shuffle (bool or int): If ``True``, ``data`` is treated as an\n" \
+  "        array of items of ``itemsize`` bytes, such as ``8`` for float64\n" \
+  "        values, and each block is byte shuffled before compression: the\n" \
+  "        first bytes of all the items are stored first, then the second\n" \
+  "        bytes, and so on. This usually compresses numeric arrays much\n" \
+  "        better. An integer greater than ``1`` gives the item size\n"  \
+  "        directly. The filter is recorded in a skippable frame ahead of\n" \
+  "        the LZ4 frame, and undone by `lz4.frame.decompress`. The\n"  \
+  "        streaming decompressors of this module raise a ``RuntimeError``\n" \
+  "        when they meet it, and other decoders skip it and return the\n" \
+  "        shuffled data. Default is ``0``.\n"                          \
+  "    bitshuffle (bool): If ``True``, the bits of the items are shuffled\n" \
+  "        rather than their bytes. The item size is ``1`` if neither\n" \
+  "        ``shuffle`` nor ``itemsize`` sets it. Default is ``False``.\n"
+
+#define DELTA_KWARGS_DOCSTRING                                          \
+  "    filter (str): If specified, ``data`` is treated as an array of\n" \
+  "        little endian integers of ``itemsize`` bytes, and each item is\n" \
+  "        stored relative to the previous one before compression.\n"   \
+  "        ``'delta'`` stores the difference, which suits steadily\n"   \
+  "        increasing values such as timestamps, ``'delta_of_delta'`` the\n" \
+  "        change in the difference, and ``'xor'`` the bits that changed,\n" \
+  "        which suits slowly changing floating point values. The filter\n" \
+  "        is recorded in a skippable frame ahead of the LZ4 frame, and\n" \
+  "        undone when decompressing. Default is ``None``.\n"          \
+  "    itemsize (int): The item size for ``filter``: ``1``, ``2``, ``4``\n" \
+  "        or ``8``.\n"
+
 PyDoc_STRVAR(
  compress__doc,
  "compress(data, compression_level=0, block_size=0, content_checksum=0,\n" \
- "block_linked=True, store_size=True, return_bytearray=False)\n"        \
+ "block_linked=True, store_size=True, return_bytearray=False, shuffle=0,\n" \
+ "bitshuffle=False, filter=None, itemsize=0)\n"                        \
  "\n"                                                                   \
  "Compresses ``data`` returning the compressed data as a complete frame.\n" \
  "\n"                                                                   \
@@ -1382,13 +4796,18 @@ PyDoc_STRVAR(
  "for writing to a file.\n"                                           \
  "\n"                                                                   \
  "Args:\n"                                                              \
- "    data (str, bytes or buffer-compatible object): data to compress\n" \
+ "    data (str, bytes or buffer-compatible object): data to compress.\n" \
+ "        This may also be a list or tuple of buffer-compatible objects,\n" \
+ "        which are compressed as if joined together, without copying\n" \
+ "        them first.\n"                                                \
  "\n"                                                                   \
  "Keyword Args:\n"                                                      \
  COMPRESS_KWARGS_DOCSTRING                                              \
  "    store_size (bool): If ``True`` then the frame will include an 8-byte\n" \
  "        header field that is the uncompressed size of data included\n" \
  "        within the frame. Default is ``True``.\n"                     \
+ SHUFFLE_KWARGS_DOCSTRING                                               \
+ DELTA_KWARGS_DOCSTRING                                                 \
  "\n"                                                                   \
  "Returns:\n"                                                           \
  "    bytes or bytearray: Compressed data\n"
@@ -1398,7 +4817,7 @@ PyDoc_STRVAR
  compress_begin__doc,
  "compress_begin(context, source_size=0, compression_level=0, block_size=0,\n" \
  "content_checksum=0, content_size=1, block_linked=0, frame_type=0,\n"    \
- "auto_flush=1)\n"                                                      \
+ "auto_flush=1, filter=None, itemsize=0)\n"                             \
  "\n"                                                                   \
  "Creates a frame header from a compression context.\n\n"               \
  "Args:\n"                                                              \
@@ -1412,17 +4831,22 @@ PyDoc_STRVAR
  "        of the data to be compressed. If specified, the size will be stored\n" \
  "        in the frame header for use during decompression. Default is ``True``\n"   \
  "    return_bytearray (bool): If ``True`` a bytearray object will be returned.\n" \
- "        If ``False``, a string of bytes is returned. Default is ``False``.\n\n" \
+ "        If ``False``, a string of bytes is returned. Default is ``False``.\n" \
+ DELTA_KWARGS_DOCSTRING                                                 \
+ "\n"                                                                   \
  "Returns:\n"                                                           \
- "    bytes or bytearray: Frame header.\n"
+ "    bytes or bytearray: Frame header, or its size if the context has a\n" \
+ "    sink set with `lz4.frame.set_sink`.\n"
  );
 
 #undef COMPRESS_KWARGS_DOCSTRING
+#undef SHUFFLE_KWARGS_DOCSTRING
+#undef DELTA_KWARGS_DOCSTRING
 
 PyDoc_STRVAR
 (
  compress_chunk__doc,
- "compress_chunk(context, data)\n"                                      \
+ "compress_chunk(context, data, return_bytearray=False, stable_src=False)\n" \
  "\n"                                                                   \
  "Compresses blocks of data and returns the compressed data.\n"         \
  "\n"                                                                   \
@@ -1432,15 +4856,30 @@ PyDoc_STRVAR
  "\n"                                                                   \
  "Args:\n"                                                              \
  "    context (cCtx): compression context\n"                            \
- "    data (str, bytes or buffer-compatible object): data to compress\n" \
+ "    data (str, bytes or buffer-compatible object): data to compress.\n" \
+ "        This may also be a list or tuple of buffer-compatible objects,\n" \
+ "        which are compressed as if joined together, without copying\n" \
+ "        them first unless auto flush is enabled. ``stable_src`` has no\n" \
+ "        effect for them.\n"                                           \
  "\n"                                                                   \
  "Keyword Args:\n"                                                      \
  "    return_bytearray (bool): If ``True`` a bytearray object will be\n" \
  "        returned. If ``False``, a string of bytes is returned. The\n" \
  "        default is False.\n"                                          \
+ "    stable_src (bool): If ``True``, the LZ4 library references ``data``\n" \
+ "        directly as the dictionary for later blocks rather than\n"   \
+ "        copying it into its internal buffer. A reference to ``data`` is\n" \
+ "        held by the context for as long as the library may read it:\n" \
+ "        until the blocks holding the 64 kB of data following it are\n" \
+ "        compressed, or the frame is ended by\n"                      \
+ "        `lz4.frame.compress_flush` or `lz4.frame.compress_begin`.\n" \
+ "        Without auto flush, a block is only compressed once a whole\n" \
+ "        block of data has been passed in. ``data`` must not be\n"    \
+ "        modified while it is held. The default is False.\n"          \
  "\n"                                                                   \
  "Returns:\n"                                                           \
- "    bytes or bytearray: Compressed data.\n\n"                          \
+ "    bytes or bytearray: Compressed data, or its size if the context has\n" \
+ "    a sink set with `lz4.frame.set_sink`.\n\n"                       \
  "Notes:\n"                                                             \
  "    If auto flush is disabled (``auto_flush=False`` when calling\n" \
  "    `lz4.frame.compress_begin`) this function may buffer and retain\n" \
@@ -1479,7 +4918,9 @@ PyDoc_STRVAR
  "        The default is ``False``.\n"                                  \
  "\n"                                                                   \
  "Returns:\n"                                                           \
- "    bytes or bytearray: compressed data.\n"                           \
+ "    bytes or bytearray: compressed data, or its size if the context has\n" \
+ "    a sink set with `lz4.frame.set_sink`, in which case all the output\n" \
+ "    held for the sink is also written to it.\n"                      \
  "\n"                                                                   \
  "Notes:\n"                                                             \
  "    If ``end_frame`` is ``False`` but the underlying LZ4 library does not" \
@@ -1487,6 +4928,48 @@ PyDoc_STRVAR
  "    raised.\n"
  );
 
+PyDoc_STRVAR
+(
+ set_sink__doc,
+ "set_sink(context, sink=None, buffer_size=262144)\n"                 \
+ "\n"                                                                   \
+ "Sets where the output of a compression context is written.\n"       \
+ "\n"                                                                   \
+ "Once a sink is set, `lz4.frame.compress_begin`,\n"                   \
+ "`lz4.frame.compress_chunk` and `lz4.frame.compress_flush` pass their\n" \
+ "output to the sink rather than returning it, and return the number of\n" \
+ "compressed bytes produced instead. The output is collected in a native\n" \
+ "buffer, which is written to the sink once it holds ``buffer_size``\n" \
+ "bytes, and whenever `lz4.frame.compress_flush` is called. This avoids\n" \
+ "creating an object and making a system call for every chunk. With\n" \
+ "auto flush enabled, the output of every call is written to the sink\n" \
+ "straight away instead.\n"                                            \
+ "\n"                                                                   \
+ "Output still held for the previous sink is written to it before the\n" \
+ "new sink is set. Output held when the context is destroyed is lost.\n" \
+ "\n"                                                                   \
+ "Args:\n"                                                              \
+ "    context (cCtx): Compression context\n"                            \
+ "\n"                                                                   \
+ "Keyword Args:\n"                                                      \
+ "    sink (int, buffer-compatible object, callable or None): One of:\n" \
+ "\n"                                                                   \
+ "        - a file descriptor, which is written to directly.\n"        \
+ "        - a writable buffer, such as a ``bytearray`` or ``mmap``, which\n" \
+ "          is filled from the start. A ``ValueError`` is raised if the\n" \
+ "          output doesn't fit.\n"                                     \
+ "        - a callable, such as the ``write`` method of a file object,\n" \
+ "          which is called with a ``bytes`` object. If it returns an int\n" \
+ "          smaller than the length of the data, the rest of the data is\n" \
+ "          passed in a further call.\n"                                \
+ "        - ``None`` to return the output from each call again. This is\n" \
+ "          the default.\n"                                            \
+ "\n"                                                                   \
+ "    buffer_size (int): The amount of output collected before it's\n"  \
+ "        written to a file descriptor or callable sink. The default is\n" \
+ "        256 kB.\n"
+ );
+
 PyDoc_STRVAR
 (
  get_frame_info__doc,
@@ -1511,7 +4994,16 @@ PyDoc_STRVAR
  "    - ``block_checksum`` (bool): specifies whether each block contains a\n" \
  "      checksum of its contents\n"                                     \
  "    - ``skippable`` (bool): whether the block is skippable (``True``) or\n" \
- "      not (``False``)\n"
+ "      not (``False``)\n"                                              \
+ "    - ``shuffle`` (int): the item size of the shuffle filter recorded\n" \
+ "      ahead of the frame by `lz4.frame.compress`, or ``0`` if none\n" \
+ "    - ``bitshuffle`` (bool): whether that filter is a bit shuffle\n"  \
+ "    - ``filter`` (str): the delta filter recorded ahead of the frame,\n" \
+ "      or ``None`` if none\n"                                           \
+ "    - ``itemsize`` (int): the item size of that filter, or ``0``\n"   \
+ "\n"                                                                   \
+ "    Filter headers ahead of the frame are skipped, and the information\n" \
+ "    is for the LZ4 frame that follows them.\n"
  );
 
 PyDoc_STRVAR
@@ -1544,9 +5036,11 @@ PyDoc_STRVAR
 PyDoc_STRVAR
 (
  decompress__doc,
- "decompress(data, return_bytearray=False, return_bytes_read=False)\n"  \
+ "decompress(data, return_bytearray=False, return_bytes_read=False,\n" \
+ "           max_output_size=-1)\n"                                   \
  "\n"                                                                   \
  "Decompresses a frame of data and returns it as a string of bytes.\n"  \
+ "A shuffle filter selected when compressing is undone.\n"             \
  "\n"                                                                   \
  "Args:\n"                                                              \
  "    data (str, bytes or buffer-compatible object): data to decompress.\n" \
@@ -1558,6 +5052,10 @@ PyDoc_STRVAR
  "        default is ``False``.\n"                                      \
  "    return_bytes_read (bool): If ``True`` then the number of bytes read\n" \
  "        from ``data`` will also be returned. Default is ``False``\n"  \
+ "    max_output_size (int): If non-negative, the maximum number of bytes\n" \
+ "        of uncompressed data. A ``RuntimeError`` is raised as soon as the\n" \
+ "        frame is found to be larger, without decompressing or allocating\n" \
+ "        more than this. Default is ``-1`` (no limit).\n"           \
  "\n"                                                                   \
  "Returns:\n"                                                           \
  "    bytes/bytearray or tuple: Uncompressed data and optionally the number" \
@@ -1570,10 +5068,105 @@ PyDoc_STRVAR
  "    - int: Number of bytes consumed from ``data``\n"
  );
 
+PyDoc_STRVAR
+(
+ decompress_into__doc,
+ "decompress_into(data, destination, return_bytes_read=False)\n"       \
+ "\n"                                                                   \
+ "Decompresses a frame of data into a writable buffer, or a list or\n" \
+ "tuple of writable buffers, and returns the number of bytes written.\n" \
+ "When a list of buffers is given, the uncompressed data is written\n" \
+ "across them in order, filling each buffer before moving on to the\n" \
+ "next.\n"                                                              \
+ "\n"                                                                   \
+ "Args:\n"                                                              \
+ "    data (str, bytes or buffer-compatible object): data to decompress.\n" \
+ "       This should contain a complete LZ4 frame of compressed data.\n" \
+ "    destination (buffer-compatible object, or list or tuple of them):\n" \
+ "       writable buffers to decompress into. A ``ValueError`` is raised\n" \
+ "       if the uncompressed data doesn't fit.\n"                      \
+ "\n"                                                                   \
+ "Keyword Args:\n"                                                      \
+ "    return_bytes_read (bool): If ``True`` then the number of bytes read\n" \
+ "        from ``data`` will also be returned. Default is ``False``\n"  \
+ "\n"                                                                   \
+ "Returns:\n"                                                           \
+ "    int or tuple: Number of bytes written and optionally the number\n" \
+ "        of bytes read\n"                                              \
+ "\n"                                                                   \
+ "    If the ``return_bytes_read`` argument is ``True`` this function\n" \
+ "    returns a tuple consisting of:\n"                                 \
+ "\n"                                                                   \
+ "    - int: Number of bytes written to ``destination``\n"              \
+ "    - int: Number of bytes consumed from ``data``\n"
+ );
+
+PyDoc_STRVAR
+(
+ get_filter_header__doc,
+ "get_filter_header(data)\n"                                            \
+ "\n"                                                                   \
+ "Reads the delta filter header written at the start of ``data`` by\n"  \
+ "`lz4.frame.compress_begin`, if there is one.\n"                      \
+ "\n"                                                                   \
+ "Args:\n"                                                              \
+ "    data (str, bytes or buffer-compatible object): the start of the\n" \
+ "        compressed data\n"                                            \
+ "\n"                                                                   \
+ "Returns:\n"                                                           \
+ "    ``None`` if ``data`` doesn't start with a filter header, ``0`` if\n" \
+ "    it's too short to tell, or otherwise a tuple of the size of the\n" \
+ "    header and the filter state to pass to\n"                        \
+ "    `lz4.frame.decompress_chunk` for the rest of the frame.\n"       \
+ "\n"                                                                   \
+ "Raises:\n"                                                            \
+ "    RuntimeError: If ``data`` starts with a shuffle filter header,\n" \
+ "        which only `lz4.frame.decompress` undoes.\n"
+ );
+
+PyDoc_STRVAR
+(
+ decode_filter__doc,
+ "decode_filter(filter, data)\n"                                        \
+ "\n"                                                                   \
+ "Undoes a delta filter on data decompressed without it, continuing\n"  \
+ "from the data decoded with ``filter`` before.\n"                      \
+ "\n"                                                                   \
+ "Args:\n"                                                              \
+ "    filter: The filter state returned by\n"                           \
+ "        `lz4.frame.get_filter_header`.\n"                             \
+ "    data (str, bytes or buffer-compatible object): the decompressed\n" \
+ "        data\n"                                                       \
+ "\n"                                                                   \
+ "Returns:\n"                                                           \
+ "    bytes: The decoded data.\n"
+ );
+
+PyDoc_STRVAR
+(
+ save_filter_state__doc,
+ "save_filter_state(filter)\n"                                          \
+ "\n"                                                                   \
+ "Returns a filter state as bytes, to restore with\n"                   \
+ "``load_filter_state``.\n"
+ );
+
+PyDoc_STRVAR
+(
+ load_filter_state__doc,
+ "load_filter_state(state)\n"                                           \
+ "\n"                                                                   \
+ "Restores a filter state saved by ``save_filter_state``.\n"           \
+ "\n"                                                                   \
+ "Raises:\n"                                                            \
+ "    ValueError: If ``state`` is invalid.\n"
+ );
+
 PyDoc_STRVAR
 (
  decompress_chunk__doc,
- "decompress_chunk(context, data, max_length=-1)\n"                     \
+ "decompress_chunk(context, data, max_length=-1, return_bytearray=False,\n" \
+ "filter=None)\n"                                                       \
  "\n"                                                                   \
  "Decompresses part of a frame of compressed data.\n"                   \
  "\n"                                                                   \
@@ -1591,6 +5184,10 @@ PyDoc_STRVAR
  "    return_bytearray (bool): If ``True`` a bytearray object will be\n" \
  "        returned.If ``False``, a string of bytes is returned. The\n"  \
  "        default is ``False``.\n"                                      \
+ "    filter: The filter state returned by\n"                           \
+ "        `lz4.frame.get_filter_header` for the frame, if it has one.\n" \
+ "        The uncompressed data is decoded with it before being\n"      \
+ "        returned. Default is ``None``.\n"                             \
  "\n"                                                                   \
  "Returns:\n"                                                           \
  "    tuple: uncompressed data, bytes read, end of frame indicator\n"   \
@@ -1605,6 +5202,37 @@ PyDoc_STRVAR
  "frame has been reached, or ``False`` otherwise\n"
   );
 
+PyDoc_STRVAR
+(
+ set_allocator__doc,
+ "set_allocator(allocator)\n"                                           \
+ "\n"                                                                   \
+ "Selects the memory allocator used for LZ4 frame contexts.\n"          \
+ "\n"                                                                   \
+ "The allocator applies to compression and decompression contexts, and\n" \
+ "to the internal state of one-shot functions, created after this call.\n" \
+ "Existing contexts keep using the allocator they were created with.\n" \
+ "\n"                                                                   \
+ "Args:\n"                                                              \
+ "    allocator (str): Either ``'default'``, the LZ4 library default\n" \
+ "        (``malloc``), or ``'python'``, which uses the Python raw memory\n" \
+ "        allocator so that allocations are visible to ``tracemalloc``.\n" \
+ "        The ``'python'`` allocator requires LZ4 library version >= 1.9.4,\n" \
+ "        and a ``RuntimeError`` is raised otherwise.\n"
+ );
+
+PyDoc_STRVAR
+(
+ get_allocator__doc,
+ "get_allocator()\n"                                                    \
+ "\n"                                                                   \
+ "Returns the name of the memory allocator used for new LZ4 frame\n"    \
+ "contexts. See `lz4.frame.set_allocator`.\n"                          \
+ "\n"                                                                   \
+ "Returns:\n"                                                           \
+ "    str: ``'default'`` or ``'python'``\n"
+ );
+
 static PyMethodDef module_methods[] =
 {
   {
@@ -1612,40 +5240,72 @@ static PyMethodDef module_methods[] =
     METH_NOARGS, create_compression_context__doc
   },
   {
-    "compress", (PyCFunction) compress,
-    METH_VARARGS | METH_KEYWORDS, compress__doc
+    "compress", FASTCALL_FUNCTION (compress),
+    METH_FASTCALL | METH_KEYWORDS, compress__doc
   },
   {
-    "compress_begin", (PyCFunction) compress_begin,
-    METH_VARARGS | METH_KEYWORDS, compress_begin__doc
+    "compress_begin", FASTCALL_FUNCTION (compress_begin),
+    METH_FASTCALL | METH_KEYWORDS, compress_begin__doc
   },
   {
-    "compress_chunk", (PyCFunction) compress_chunk,
-    METH_VARARGS | METH_KEYWORDS, compress_chunk__doc
+    "compress_chunk", FASTCALL_FUNCTION (compress_chunk),
+    METH_FASTCALL | METH_KEYWORDS, compress_chunk__doc
   },
   {
-    "compress_flush", (PyCFunction) compress_flush,
-    METH_VARARGS | METH_KEYWORDS, compress_flush__doc
+    "compress_flush", FASTCALL_FUNCTION (compress_flush),
+    METH_FASTCALL | METH_KEYWORDS, compress_flush__doc
   },
   {
-    "get_frame_info", (PyCFunction) get_frame_info,
-    METH_VARARGS | METH_KEYWORDS, get_frame_info__doc
+    "set_sink", FASTCALL_FUNCTION (set_sink),
+    METH_FASTCALL | METH_KEYWORDS, set_sink__doc
+  },
+  {
+    "get_frame_info", FASTCALL_FUNCTION (get_frame_info),
+    METH_FASTCALL | METH_KEYWORDS, get_frame_info__doc
   },
   {
     "create_decompression_context", (PyCFunction) create_decompression_context,
     METH_NOARGS, create_decompression_context__doc
   },
   {
-    "reset_decompression_context", (PyCFunction) reset_decompression_context,
-    METH_VARARGS | METH_KEYWORDS, reset_decompression_context__doc
+    "reset_decompression_context", FASTCALL_FUNCTION (reset_decompression_context),
+    METH_FASTCALL | METH_KEYWORDS, reset_decompression_context__doc
+  },
+  {
+    "decompress", FASTCALL_FUNCTION (decompress),
+    METH_FASTCALL | METH_KEYWORDS, decompress__doc
   },
   {
-    "decompress", (PyCFunction) decompress,
-    METH_VARARGS | METH_KEYWORDS, decompress__doc
+    "decompress_into", FASTCALL_FUNCTION (decompress_into),
+    METH_FASTCALL | METH_KEYWORDS, decompress_into__doc
   },
   {
-    "decompress_chunk", (PyCFunction) decompress_chunk,
-    METH_VARARGS | METH_KEYWORDS, decompress_chunk__doc
+    "get_filter_header", FASTCALL_FUNCTION (get_filter_header),
+    METH_FASTCALL | METH_KEYWORDS, get_filter_header__doc
+  },
+  {
+    "decode_filter", FASTCALL_FUNCTION (decode_filter),
+    METH_FASTCALL | METH_KEYWORDS, decode_filter__doc
+  },
+  {
+    "save_filter_state", FASTCALL_FUNCTION (save_filter_state),
+    METH_FASTCALL | METH_KEYWORDS, save_filter_state__doc
+  },
+  {
+    "load_filter_state", FASTCALL_FUNCTION (load_filter_state),
+    METH_FASTCALL | METH_KEYWORDS, load_filter_state__doc
+  },
+  {
+    "decompress_chunk", FASTCALL_FUNCTION (decompress_chunk),
+    METH_FASTCALL | METH_KEYWORDS, decompress_chunk__doc
+  },
+  {
+    "set_allocator", (PyCFunction) set_allocator,
+    METH_VARARGS | METH_KEYWORDS, set_allocator__doc
+  },
+  {
+    "get_allocator", (PyCFunction) get_allocator,
+    METH_NOARGS, get_allocator__doc
   },
   {NULL, NULL, 0, NULL}		/* Sentinel */
 };
@@ -1667,6 +5327,7 @@ PyMODINIT_FUNC
 PyInit__frame(void)
 {
   PyObject *module = PyModule_Create (&moduledef);
+  PyObject *reader_type;
 
   if (module == NULL)
     return NULL;
@@ -1677,6 +5338,14 @@ PyInit__frame(void)
   PyModule_AddIntConstant (module, "BLOCKSIZE_MAX1MB", LZ4F_max1MB);
   PyModule_AddIntConstant (module, "BLOCKSIZE_MAX4MB", LZ4F_max4MB);
 
+  reader_type = PyType_FromSpec (&frame_reader_spec);
+  if (reader_type == NULL || PyModule_AddObject (module, "FrameReader", reader_type) != 0)
+    {
+      Py_XDECREF (reader_type);
+      Py_DECREF (module);
+      return NULL;
+    }
+
   #ifdef Py_GIL_DISABLED
     PyUnstable_Module_SetGIL(module, Py_MOD_GIL_NOT_USED);
   #endif
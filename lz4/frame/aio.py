@@ -0,0 +1,318 @@
+"""asyncio adapters for the LZ4 frame format.
+
+Compressing or decompressing a large buffer holds up the event loop for as
+long as it takes. The coroutines in this module handle small inputs inline,
+where handing them to another thread would cost more than it saves, and pass
+large inputs to a dedicated worker thread. As the LZ4 bindings release the GIL
+while they run, the event loop carries on meanwhile.
+
+"""
+
+import asyncio
+import functools
+import threading
+from concurrent.futures import ThreadPoolExecutor
+
+from . import (
+    compress,
+    compress_flush,
+    decompress,
+    LZ4FrameCompressor,
+    LZ4FrameDecompressor,
+    COMPRESSIONLEVEL_MIN,
+    COMPRESSIONLEVEL_MINHC,
+)
+
+
+OFFLOAD_THRESHOLD = 256 * 1024
+"""Size in bytes from which data is handed to the worker thread.
+
+High compression levels are much slower, so they use a threshold 16 times
+lower.
+
+"""
+
+_executor = None
+_executor_lock = threading.Lock()
+
+
+def _get_executor():
+    global _executor
+    with _executor_lock:
+        if _executor is None:
+            _executor = ThreadPoolExecutor(
+                max_workers=1, thread_name_prefix='lz4.frame.aio')
+        return _executor
+
+
+def _size(data):
+    if isinstance(data, (list, tuple)):
+        return sum(_size(item) for item in data)
+    if isinstance(data, (bytes, bytearray)):
+        return len(data)
+    return memoryview(data).nbytes
+
+
+def _threshold(compression_level, offload_threshold):
+    if offload_threshold is None:
+        offload_threshold = OFFLOAD_THRESHOLD
+        if compression_level >= COMPRESSIONLEVEL_MINHC:
+            offload_threshold //= 16
+    return offload_threshold
+
+
+async def _run(size, threshold, function, *args, **kwargs):
+    if size < threshold:
+        return function(*args, **kwargs)
+    loop = asyncio.get_running_loop()
+    return await loop.run_in_executor(
+        _get_executor(), functools.partial(function, *args, **kwargs))
+
+
+async def compress_async(data, offload_threshold=None, **kwargs):
+    """Compresses ``data`` into a LZ4 frame without blocking the event loop.
+
+    This is `lz4.frame.compress`, run in the worker thread when ``data`` is at
+    least ``offload_threshold`` bytes long.
+
+    Args:
+        data (str, bytes, buffer-compatible object, or a list or tuple of
+            them): data to compress
+        offload_threshold (int): The size from which the data is compressed
+            in the worker thread. If unspecified, `OFFLOAD_THRESHOLD` is used,
+            or a sixteenth of it for high compression levels.
+
+    Keyword Args:
+        **kwargs: The arguments of `lz4.frame.compress`.
+
+    Returns:
+        bytes or bytearray: Compressed data
+
+    """
+    threshold = _threshold(
+        kwargs.get('compression_level', COMPRESSIONLEVEL_MIN), offload_threshold)
+    return await _run(_size(data), threshold, compress, data, **kwargs)
+
+
+async def decompress_async(data, offload_threshold=None, **kwargs):
+    """Decompresses LZ4 frames without blocking the event loop.
+
+    This is `lz4.frame.decompress`, run in the worker thread when ``data`` is
+    at least ``offload_threshold`` bytes long.
+
+    Args:
+        data (str, bytes or buffer-compatible object): compressed data
+        offload_threshold (int): The size from which the data is decompressed
+            in the worker thread. If unspecified, `OFFLOAD_THRESHOLD` is used.
+
+    Keyword Args:
+        **kwargs: The arguments of `lz4.frame.decompress`.
+
+    Returns:
+        bytes or bytearray: Uncompressed data, as returned by
+        `lz4.frame.decompress`.
+
+    """
+    threshold = _threshold(COMPRESSIONLEVEL_MIN, offload_threshold)
+    return await _run(_size(data), threshold, decompress, data, **kwargs)
+
+
+class AsyncLZ4FrameWriter(object):
+    """Compresses data into a LZ4 frame written to an `asyncio.StreamWriter`.
+
+    Each call to `write()` waits for the writer to drain, so a slow peer
+    holds up the producer instead of the compressed data piling up in memory.
+    The underlying writer isn't closed by `close()`.
+
+    Args:
+        writer (asyncio.StreamWriter): The writer the compressed data is
+            written to.
+        offload_threshold (int): The size from which data is compressed in
+            the worker thread. If unspecified, `OFFLOAD_THRESHOLD` is used, or
+            a sixteenth of it for high compression levels.
+
+    Keyword Args:
+        **kwargs: The arguments of `lz4.frame.LZ4FrameCompressor`, except
+            ``sink``.
+
+    """
+
+    def __init__(self, writer, offload_threshold=None, **kwargs):
+        self._writer = writer
+        self._compressor = LZ4FrameCompressor(**kwargs)
+        self._threshold = _threshold(
+            self._compressor.compression_level, offload_threshold)
+        self._lock = None
+        self._closed = False
+
+    async def __aenter__(self):
+        return self
+
+    async def __aexit__(self, exception_type, exception, traceback):
+        if exception_type is None:
+            await self.close()
+
+    async def _write(self, function, size, *args):
+        if self._closed:
+            raise ValueError('I/O operation on closed writer')
+        if self._lock is None:
+            self._lock = asyncio.Lock()
+        # The compressor must see the chunks in order, even when one of them
+        # is being compressed in the worker thread.
+        async with self._lock:
+            compressed = b''
+            if not self._compressor.started():
+                compressed = self._compressor.begin()
+            compressed += await _run(size, self._threshold, function, *args)
+            if compressed:
+                self._writer.write(compressed)
+            await self._writer.drain()
+
+    async def write(self, data):
+        """Compresses ``data`` and writes it.
+
+        Args:
+            data (str, bytes, buffer-compatible object, or a list or tuple of
+                them): data to compress
+
+        Returns:
+            int: The number of uncompressed bytes written.
+
+        """
+        size = _size(data)
+        await self._write(self._compressor.compress, size, data)
+        return size
+
+    async def flush(self):
+        """Writes the data buffered by the compressor, without ending the
+        frame.
+
+        """
+        await self._write(self._flush_blocks, 0)
+
+    def _flush_blocks(self):
+        return compress_flush(
+            self._compressor._context,
+            end_frame=False,
+            return_bytearray=self._compressor.return_bytearray,
+        )
+
+    async def close(self):
+        """Ends the frame, writes it out and waits for the writer to drain.
+
+        May be called more than once without error.
+
+        """
+        if self._closed:
+            return
+        await self._write(self._compressor.flush, 0)
+        self._closed = True
+
+    @property
+    def closed(self):
+        """bool: ``True`` once `close()` has been called."""
+        return self._closed
+
+
+class AsyncLZ4FrameReader(object):
+    """Decompresses LZ4 frames read from an `asyncio.StreamReader`.
+
+    Consecutive frames are decompressed as a single stream. The reader can
+    also be iterated over with ``async for``, which yields the decompressed
+    data as it comes in.
+
+    Args:
+        reader (asyncio.StreamReader): The reader the compressed data is read
+            from.
+        read_size (int): The amount of compressed data read at once. The
+            default is 64 kB.
+        chunk_size (int): The maximum amount of data decompressed at once,
+            which bounds the memory used by a single step. The default is
+            1 MB.
+        offload_threshold (int): The size from which the compressed data is
+            decompressed in the worker thread. If unspecified,
+            `OFFLOAD_THRESHOLD` is used.
+
+    """
+
+    def __init__(self, reader, read_size=64 * 1024, chunk_size=1024 * 1024,
+                 offload_threshold=None):
+        self._reader = reader
+        self._read_size = read_size
+        self._chunk_size = chunk_size
+        self._threshold = _threshold(COMPRESSIONLEVEL_MIN, offload_threshold)
+        self._decompressor = LZ4FrameDecompressor()
+        self._in_frame = False
+        self._input = b''
+        self._buffer = b''
+        self._offset = 0
+        self._eof = False
+
+    def __aiter__(self):
+        return self
+
+    async def __anext__(self):
+        if self._offset < len(self._buffer):
+            data = self._buffer[self._offset:]
+        else:
+            data = await self._decompress_chunk()
+        self._buffer = b''
+        self._offset = 0
+        if not data:
+            raise StopAsyncIteration
+        return data
+
+    async def _decompress_chunk(self):
+        while True:
+            data = self._input
+            self._input = b''
+            if not data and self._decompressor.needs_input:
+                if self._eof:
+                    return b''
+                data = await self._reader.read(self._read_size)
+                if not data:
+                    self._eof = True
+                    if self._in_frame:
+                        raise EOFError('Compressed file ended before the '
+                                       'end-of-stream marker was reached')
+                    return b''
+
+            self._in_frame = True
+            decompressed = await _run(len(data), self._threshold,
+                                      self._decompressor.decompress,
+                                      data, self._chunk_size)
+            if self._decompressor.eof:
+                self._input = self._decompressor.unused_data or b''
+                self._decompressor = LZ4FrameDecompressor()
+                self._in_frame = False
+
+            if decompressed:
+                return decompressed
+
+    async def read(self, size=-1):
+        """Reads up to ``size`` uncompressed bytes.
+
+        Args:
+            size (int): The number of bytes to read. If negative, the data is
+                read until the end of the stream.
+
+        Returns:
+            bytes: The data read, which is shorter than ``size`` only at the
+            end of the stream.
+
+        """
+        chunks = []
+        while size != 0:
+            if self._offset == len(self._buffer):
+                self._buffer = await self._decompress_chunk()
+                self._offset = 0
+                if not self._buffer:
+                    break
+            end = len(self._buffer)
+            if 0 <= size < end - self._offset:
+                end = self._offset + size
+            chunks.append(self._buffer[self._offset:end])
+            if size > 0:
+                size -= end - self._offset
+            self._offset = end
+        return b''.join(chunks)
@@ -0,0 +1,469 @@
+"""Reading of LZ4 frame files that are still being written.
+
+`LZ4FrameTail` follows a file written with ``auto_flush=True``, such as a log,
+returning the data decompressed so far and then waiting for the file to grow.
+Unlike `LZ4FrameFile`, reaching the end of the file isn't final: the
+decompression context is kept, and decompression resumes from the last
+complete block when more data arrives.
+
+Only whole blocks are passed to the decompression context, so that the reader
+is always at a block boundary. Its state there can be saved with
+`LZ4FrameTail.checkpoint`, and a new reader started from the checkpoint later,
+without reading the file again from the start.
+
+A delta filter recorded ahead of a frame is undone. Frames compressed with a
+shuffle filter raise a ``RuntimeError``.
+
+"""
+
+import builtins
+import collections
+import ctypes
+import ctypes.util
+import os
+import select
+import struct
+import sys
+import time
+
+from . import (
+    create_decompression_context,
+    decompress_chunk,
+    get_filter_header,
+    _decode_filter,
+    _save_filter_state,
+    _load_filter_state,
+)
+from ..xxhash import xxh32
+
+
+_FRAME_MAGIC = 0x184D2204
+_SKIPPABLE_MAGIC = 0x184D2A50
+_SKIPPABLE_MASK = 0xFFFFFFF0
+_UNCOMPRESSED_BLOCK = 0x80000000
+
+_FLG_INDEPENDENT = 0x20
+_FLG_BLOCK_CHECKSUM = 0x10
+_FLG_CONTENT_SIZE = 0x08
+_FLG_CONTENT_CHECKSUM = 0x04
+_FLG_DICT_ID = 0x01
+
+# Linked blocks refer back to at most 64 kB of earlier data.
+_HISTORY_SIZE = 64 * 1024
+
+_READ_SIZE = 256 * 1024
+# Output buffer size used to collect the data the decompression context holds
+# back.
+_DRAIN_SIZE = 64 * 1024
+
+_CHECKPOINT_MAGIC = b'LZ4T'
+_CHECKPOINT_VERSION = 2
+_CHECKPOINT = struct.Struct('<4sBQQB')
+
+_U32 = struct.Struct('<I')
+
+_IN_MODIFY = 0x002
+_IN_ATTRIB = 0x004
+_IN_CLOSE_WRITE = 0x008
+
+
+def _header_size(flg):
+    size = 7
+    if flg & _FLG_CONTENT_SIZE:
+        size += 8
+    if flg & _FLG_DICT_ID:
+        size += 4
+    return size
+
+
+def _resume_header(header):
+    # The frame header without the content size and content checksum, which
+    # can't be checked from the middle of a frame.
+    flg = header[4] & ~(_FLG_CONTENT_SIZE | _FLG_CONTENT_CHECKSUM)
+    descriptor = bytes([flg, header[5]])
+    if flg & _FLG_DICT_ID:
+        descriptor += header[-5:-1]
+    checksum = (xxh32(descriptor) >> 8) & 0xFF
+    return header[:4] + descriptor + bytes([checksum])
+
+
+class _Inotify(object):
+    # Waits for changes to a file with inotify, on Linux.
+
+    def __init__(self, filename):
+        libc = ctypes.CDLL(ctypes.util.find_library('c'), use_errno=True)
+        self._fd = libc.inotify_init1(os.O_NONBLOCK | os.O_CLOEXEC)
+        if self._fd < 0:
+            raise OSError(ctypes.get_errno(), 'inotify_init1 failed')
+        if libc.inotify_add_watch(
+                self._fd, os.fsencode(filename),
+                _IN_MODIFY | _IN_ATTRIB | _IN_CLOSE_WRITE) < 0:
+            errno = ctypes.get_errno()
+            os.close(self._fd)
+            raise OSError(errno, 'inotify_add_watch failed')
+
+    def wait(self, timeout):
+        readable, _, _ = select.select([self._fd], [], [], timeout)
+        if readable:
+            try:
+                while os.read(self._fd, 4096):
+                    pass
+            except BlockingIOError:
+                pass
+        return bool(readable)
+
+    def close(self):
+        os.close(self._fd)
+
+
+class LZ4FrameTail(object):
+    """Follows an LZ4 frame file while it's being written.
+
+    Consecutive frames are read as a single stream, and skippable frames are
+    skipped, other than the delta filter header ahead of a frame. The file
+    must be written with ``auto_flush=True``, or flushed with
+    `LZ4FrameCompressor.flush`, for data to become readable before the end of
+    a frame.
+
+    Args:
+        filename (str, bytes or PathLike): The file to follow.
+
+    Keyword Args:
+        checkpoint (bytes): A checkpoint returned by
+            `LZ4FrameTail.checkpoint`, to continue from instead of the start
+            of the file.
+        poll_interval (float): How often `LZ4FrameTail.wait` checks whether
+            the file has grown, in seconds, when inotify isn't used. The
+            default is ``0.25``.
+        use_inotify (bool): If ``True``, `LZ4FrameTail.wait` waits for changes
+            to the file with inotify where available, rather than polling.
+            The default is ``True``.
+
+    """
+
+    def __init__(self, filename, checkpoint=None, poll_interval=0.25,
+                 use_inotify=True):
+        self._fp = builtins.open(filename, 'rb', buffering=0)
+        self._poll_interval = poll_interval
+        self._inotify = None
+        if use_inotify and sys.platform.startswith('linux'):
+            try:
+                self._inotify = _Inotify(filename)
+            except (OSError, AttributeError):
+                pass
+
+        self._context = create_decompression_context()
+        self._input = bytearray()
+        # Offset in the file of the first byte of _input, which is always at
+        # a block or frame boundary.
+        self._offset = 0
+        self._position = 0
+        self._pending = bytearray()
+        self._header = None
+        # The delta filter of the next or current frame, if it has one.
+        self._filter = None
+        self._resumed = False
+        self._history = collections.deque()
+        self._history_size = 0
+
+        try:
+            if checkpoint is not None:
+                self._restore(checkpoint)
+        except BaseException:
+            self.close()
+            raise
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exception_type, exception, traceback):
+        self.close()
+
+    @property
+    def closed(self):
+        """``True`` once the reader has been closed."""
+        return self._fp is None
+
+    @property
+    def offset(self):
+        """The offset in the file up to which blocks have been decompressed."""
+        return self._offset
+
+    @property
+    def position(self):
+        """The number of decompressed bytes returned so far."""
+        return self._position
+
+    def read(self, size=-1):
+        """Returns the decompressed data available, without waiting.
+
+        Args:
+            size (int): If non-negative, at most this many bytes are
+                returned.
+
+        Returns:
+            bytes: The data, which is empty if no more is available yet.
+
+        """
+        if self._fp is None:
+            raise ValueError('I/O operation on closed file')
+        if size < 0 or len(self._pending) < size:
+            self._fill()
+        if size < 0 or size >= len(self._pending):
+            data = bytes(self._pending)
+            self._pending.clear()
+        else:
+            data = bytes(self._pending[:size])
+            del self._pending[:size]
+        self._position += len(data)
+        return data
+
+    def wait(self, timeout=None):
+        """Waits for the file to grow.
+
+        Args:
+            timeout (float): The longest time to wait, in seconds, or
+                ``None`` to wait indefinitely.
+
+        Returns:
+            bool: ``True`` if there may be more data to read, or ``False`` if
+            the timeout expired.
+
+        """
+        if self._fp is None:
+            raise ValueError('I/O operation on closed file')
+        deadline = None if timeout is None else time.monotonic() + timeout
+        while True:
+            if self._pending or self._grown():
+                return True
+            remaining = None if deadline is None else deadline - time.monotonic()
+            if remaining is not None and remaining <= 0:
+                return False
+            if self._inotify is not None:
+                self._inotify.wait(remaining)
+            else:
+                time.sleep(self._poll_interval if remaining is None
+                           else min(self._poll_interval, remaining))
+
+    def follow(self, timeout=None):
+        """Yields the decompressed data as it becomes available.
+
+        Args:
+            timeout (float): Stop once the file hasn't grown for this many
+                seconds. If ``None`` (default), follow the file indefinitely.
+
+        Yields:
+            bytes: The decompressed data.
+
+        """
+        while True:
+            data = self.read()
+            if data:
+                yield data
+            elif not self.wait(timeout):
+                return
+
+    def checkpoint(self):
+        """Returns the state of the reader, to continue from later.
+
+        The checkpoint holds the offset of the next block to decompress, the
+        frame header and, for frames with linked blocks, the last 64 kB of
+        decompressed data, which later blocks may refer to. Data decompressed
+        but not returned by `LZ4FrameTail.read` yet is included as well, and
+        the state of the frame's delta filter if it has one.
+
+        Returns:
+            bytes: The checkpoint, to pass to `LZ4FrameTail` later.
+
+        """
+        header = self._header or b''
+        history = b''
+        if self._header is not None and not header[4] & _FLG_INDEPENDENT:
+            history = b''.join(self._history)[-_HISTORY_SIZE:]
+        filter_state = b''
+        if self._filter is not None:
+            filter_state = _save_filter_state(self._filter)
+        return b''.join([
+            _CHECKPOINT.pack(_CHECKPOINT_MAGIC, _CHECKPOINT_VERSION,
+                             self._offset, self._position, len(header)),
+            header,
+            _U32.pack(len(history)), history,
+            _U32.pack(len(self._pending)), self._pending,
+            _U32.pack(len(filter_state)), filter_state,
+        ])
+
+    def close(self):
+        """Closes the reader and the file."""
+        if self._fp is None:
+            return
+        if self._inotify is not None:
+            self._inotify.close()
+            self._inotify = None
+        self._fp.close()
+        self._fp = None
+        self._context = None
+        self._input = None
+        self._history.clear()
+
+    def _restore(self, checkpoint):
+        checkpoint = bytes(checkpoint)
+        try:
+            (magic, version, self._offset, self._position,
+             header_size) = _CHECKPOINT.unpack_from(checkpoint)
+            start = _CHECKPOINT.size
+            header = checkpoint[start:start + header_size]
+            start += header_size
+            history_size, = _U32.unpack_from(checkpoint, start)
+            history = checkpoint[start + 4:start + 4 + history_size]
+            start += 4 + history_size
+            pending_size, = _U32.unpack_from(checkpoint, start)
+            self._pending += checkpoint[start + 4:start + 4 + pending_size]
+            start += 4 + pending_size
+            filter_size, = _U32.unpack_from(checkpoint, start)
+            filter_state = checkpoint[start + 4:start + 4 + filter_size]
+        except struct.error:
+            raise ValueError('Invalid checkpoint: too short')
+        if magic != _CHECKPOINT_MAGIC or version != _CHECKPOINT_VERSION:
+            raise ValueError('Invalid checkpoint')
+        if filter_state:
+            self._filter = _load_filter_state(filter_state)
+        if header_size == 0:
+            return
+
+        # Prime a new context by passing it the frame header, and the history
+        # as an uncompressed block that later blocks may refer to.
+        self._header = header
+        self._resumed = True
+        primer = _resume_header(header)
+        if history:
+            primer += _U32.pack(len(history) | _UNCOMPRESSED_BLOCK) + history
+            if header[4] & _FLG_BLOCK_CHECKSUM:
+                primer += _U32.pack(xxh32(history))
+        decompressed, bytes_read = self._decompress_chunk(primer)
+        if bytes_read != len(primer) or decompressed != history:
+            raise ValueError('Invalid checkpoint: frame header rejected')
+        self._add_history(history)
+
+    def _decompress_chunk(self, data):
+        # decompress_chunk sizes its output from the input, and the context
+        # keeps what doesn't fit once all the input is consumed. That's
+        # collected by calling it again without input until nothing is left.
+        decompressed, bytes_read, _ = decompress_chunk(self._context, data)
+        chunks = [decompressed]
+        while True:
+            decompressed, _, _ = decompress_chunk(self._context, b'',
+                                                  _DRAIN_SIZE)
+            if not decompressed:
+                return b''.join(chunks), bytes_read
+            chunks.append(decompressed)
+
+    def _add_history(self, data):
+        if not data:
+            return
+        self._history.append(data)
+        self._history_size += len(data)
+        while self._history_size - len(self._history[0]) >= _HISTORY_SIZE:
+            self._history_size -= len(self._history.popleft())
+
+    def _grown(self):
+        return (os.fstat(self._fp.fileno()).st_size >
+                self._offset + len(self._input))
+
+    def _fill(self):
+        # Reads what's been added to the file, and decompresses the complete
+        # blocks.
+        self._fp.seek(self._offset + len(self._input))
+        while True:
+            data = self._fp.read(_READ_SIZE)
+            if not data:
+                break
+            self._input += data
+            self._decompress()
+        self._decompress()
+
+    def _feed(self, start, end):
+        if start == end:
+            return
+        data = bytes(self._input[start:end])
+        decompressed, bytes_read = self._decompress_chunk(data)
+        if bytes_read != len(data):
+            raise RuntimeError('LZ4 frame decompression stopped early')
+        # Later blocks refer to the data as decompressed, before the filter is
+        # undone.
+        if self._header is not None:
+            self._add_history(decompressed)
+        if self._filter is not None:
+            decompressed = _decode_filter(self._filter, decompressed)
+        self._pending += decompressed
+
+    def _decompress(self):
+        buffer = self._input
+        size = len(buffer)
+        position = 0
+        # Start of the data not yet passed to the decompression context.
+        start = 0
+
+        while size - position >= 4:
+            value, = _U32.unpack_from(buffer, position)
+
+            if self._header is None:
+                if value & _SKIPPABLE_MASK == _SKIPPABLE_MAGIC:
+                    if size - position < 8:
+                        break
+                    length = 8 + _U32.unpack_from(buffer, position + 4)[0]
+                    if size - position < length:
+                        break
+                    self._feed(start, position)
+                    header = get_filter_header(
+                        buffer[position:position + length])
+                    if header:
+                        self._filter = header[1]
+                    position += length
+                    start = position
+                    continue
+                if value != _FRAME_MAGIC:
+                    raise RuntimeError(
+                        'Invalid LZ4 frame at offset {}'.format(
+                            self._offset + position))
+                if size - position < 7:
+                    break
+                length = _header_size(buffer[position + 4])
+                if size - position < length:
+                    break
+                # Linked blocks of the previous frame aren't needed any more.
+                self._feed(start, position)
+                start = position
+                self._history.clear()
+                self._history_size = 0
+                self._header = bytes(buffer[position:position + length])
+                self._resumed = False
+                position += length
+                continue
+
+            flg = self._header[4]
+            if value == 0:
+                length = 8 if flg & _FLG_CONTENT_CHECKSUM else 4
+                if size - position < length:
+                    break
+                position += length
+                if self._resumed:
+                    # The content checksum was left out of the header given
+                    # to the context, so it's skipped here.
+                    self._feed(start, position - length + 4)
+                else:
+                    self._feed(start, position)
+                start = position
+                self._header = None
+                self._filter = None
+                continue
+
+            length = 4 + (value & ~_UNCOMPRESSED_BLOCK)
+            if flg & _FLG_BLOCK_CHECKSUM:
+                length += 4
+            if size - position < length:
+                break
+            position += length
+
+        self._feed(start, position)
+        del buffer[:position]
+        self._offset += position
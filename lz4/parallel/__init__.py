@@ -0,0 +1,330 @@
+"""Compression across processes through shared memory.
+
+`ProcessPool` compresses and decompresses large inputs on a pool of worker
+processes, which avoids the GIL without pickling the data. The input is copied
+once into a `multiprocessing.shared_memory` segment, and the output is written
+by the workers into a second segment. Only the names of the segments, and the
+offsets and sizes of the pieces, are sent to the workers.
+
+Compression splits the input into chunks of ``chunk_size`` bytes, each
+compressed as a separate LZ4 frame straight into the output segment through a
+compression context with the segment as its sink. The result is these frames
+concatenated, which `lz4.frame.open` and the ``lz4`` command line tools read
+as a single stream, and `ProcessPool.decompress` decompresses in parallel.
+
+Decompression walks the frames of the input, and each frame storing its
+content size is decompressed by a worker straight into its place in the
+output segment. Other frames, and frames with a filter, are decompressed in
+the calling process.
+
+"""
+
+import contextlib
+import os
+import struct
+from concurrent.futures import ProcessPoolExecutor, wait
+from multiprocessing import shared_memory
+
+from .. import frame as _frame
+
+
+_FRAME_MAGIC = 0x184D2204
+_SKIPPABLE_MAGIC = 0x184D2A50
+_SKIPPABLE_MASK = 0xFFFFFFF0
+_FILTER_MAGIC = 0x184D2A5E
+_UNCOMPRESSED_BLOCK = 0x80000000
+
+_FLG_BLOCK_CHECKSUM = 0x10
+_FLG_CONTENT_SIZE = 0x08
+_FLG_CONTENT_CHECKSUM = 0x04
+_FLG_DICT_ID = 0x01
+
+_U32 = struct.Struct('<I')
+_U64 = struct.Struct('<Q')
+
+# The frame header is at most 19 bytes, and each block of up to 64 kB adds a
+# 4 byte size and a 4 byte checksum. The end mark and the content checksum
+# add 8 more.
+_SMALLEST_BLOCK = 64 * 1024
+_FRAME_OVERHEAD = 19 + 8
+
+CHUNK_SIZE_DEFAULT = 4 * 1024 * 1024
+"""Default size of the pieces the input is split into for compression."""
+
+
+def _frame_bound(size):
+    return size + _FRAME_OVERHEAD + 8 * (size // _SMALLEST_BLOCK + 1)
+
+
+def _attach(name):
+    try:
+        return shared_memory.SharedMemory(name, track=False)
+    except TypeError:
+        # Before Python 3.13, attaching also registers the segment with the
+        # resource tracker shared with the parent, which is harmless as the
+        # parent unregisters it when unlinking it.
+        return shared_memory.SharedMemory(name)
+
+
+@contextlib.contextmanager
+def _segments(*names):
+    segments = []
+    try:
+        for name in names:
+            segments.append(_attach(name))
+        yield [segment.buf for segment in segments]
+    finally:
+        for segment in segments:
+            segment.close()
+
+
+def _compress_chunk(source, offset, size, dest, dest_offset, dest_size,
+                    options):
+    # Runs in the worker processes.
+    with _segments(source, dest) as (source_buf, dest_buf):
+        with source_buf[offset:offset + size] as data, \
+                dest_buf[dest_offset:dest_offset + dest_size] as sink:
+            context = _frame.create_compression_context()
+            _frame.set_sink(context, sink=sink)
+            try:
+                written = _frame.compress_begin(context, source_size=size,
+                                                **options)
+                written += _frame.compress_chunk(context, data)
+                written += _frame.compress_flush(context)
+            finally:
+                # Releases the sink, so that the segment can be closed.
+                _frame.set_sink(context, sink=None)
+                del context
+    return written
+
+
+def _decompress_frame(source, offset, size, dest, dest_offset, dest_size):
+    # Runs in the worker processes.
+    with _segments(source, dest) as (source_buf, dest_buf):
+        with source_buf[offset:offset + size] as data, \
+                dest_buf[dest_offset:dest_offset + dest_size] as destination:
+            written = _frame.decompress_into(data, destination)
+    if written != dest_size:
+        raise ValueError('LZ4 frame content size mismatch')
+    return written
+
+
+def _header_size(flg):
+    size = 7
+    if flg & _FLG_CONTENT_SIZE:
+        size += 8
+    if flg & _FLG_DICT_ID:
+        size += 4
+    return size
+
+
+def _frames(data):
+    # Returns the start, end and content size of each frame, the latter None
+    # if it isn't known. A filter header is included in the frame following
+    # it, other skippable frames are dropped.
+    frames = []
+    start = pos = 0
+    size = len(data)
+    while pos < size:
+        if size - pos < 8:
+            raise ValueError('Truncated LZ4 frame')
+        magic, = _U32.unpack_from(data, pos)
+        if magic & _SKIPPABLE_MASK == _SKIPPABLE_MAGIC:
+            pos += 8 + _U32.unpack_from(data, pos + 4)[0]
+            if magic != _FILTER_MAGIC:
+                start = pos
+            continue
+        if magic != _FRAME_MAGIC:
+            raise ValueError('Not an LZ4 frame')
+        flg = data[pos + 4]
+        content_size = None
+        if flg & _FLG_CONTENT_SIZE and start == pos:
+            if size - pos < 14:
+                raise ValueError('Truncated LZ4 frame')
+            content_size, = _U64.unpack_from(data, pos + 6)
+        pos += _header_size(flg)
+        block_checksum = 4 if flg & _FLG_BLOCK_CHECKSUM else 0
+        while True:
+            if pos + 4 > size:
+                raise ValueError('Truncated LZ4 frame')
+            block, = _U32.unpack_from(data, pos)
+            pos += 4
+            if block == 0:
+                break
+            pos += (block & ~_UNCOMPRESSED_BLOCK) + block_checksum
+        if flg & _FLG_CONTENT_CHECKSUM:
+            pos += 4
+        if pos > size:
+            raise ValueError('Truncated LZ4 frame')
+        frames.append((start, pos, content_size))
+        start = pos
+    return frames
+
+
+class _Segment(object):
+    # A shared memory segment, unlinked on exit.
+
+    def __init__(self, size):
+        self._memory = shared_memory.SharedMemory(create=True,
+                                                  size=max(size, 1))
+        self.name = self._memory.name
+        self.buf = self._memory.buf
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exception_type, exception, traceback):
+        self.buf = None
+        try:
+            self._memory.close()
+        finally:
+            self._memory.unlink()
+
+
+class ProcessPool(object):
+    """A pool of worker processes compressing and decompressing data held in
+    shared memory.
+
+    The workers are started on first use and kept until `close` is called,
+    which also happens when leaving the pool as a context manager.
+
+    Args:
+        processes (int): The number of worker processes. The default is the
+            number of CPUs.
+
+    Keyword Args:
+        mp_context: The `multiprocessing` context used to start the workers.
+            The default is the default context.
+
+    """
+
+    def __init__(self, processes=None, *, mp_context=None):
+        if processes is None:
+            processes = os.cpu_count() or 1
+        if processes < 1:
+            raise ValueError('processes must be positive')
+        self._executor = ProcessPoolExecutor(processes, mp_context=mp_context)
+
+    def _submit(self, function, tasks):
+        if self._executor is None:
+            raise ValueError('ProcessPool is closed')
+        return [self._executor.submit(function, *task) for task in tasks]
+
+    @staticmethod
+    def _results(futures):
+        # Waits for all the tasks, as they use the segments, before raising
+        # the first error.
+        wait(futures)
+        return [future.result() for future in futures]
+
+    def compress(self, data, *, chunk_size=CHUNK_SIZE_DEFAULT,
+                 compression_level=0, block_size=_frame.BLOCKSIZE_DEFAULT,
+                 content_checksum=False, block_checksum=False,
+                 block_linked=True):
+        """Compresses data in parallel into concatenated LZ4 frames.
+
+        Args:
+            data (bytes or buffer-compatible object): The data to compress.
+
+        Keyword Args:
+            chunk_size (int): The input is split into chunks of this many
+                bytes, each compressed as a frame by a worker. The default is
+                `CHUNK_SIZE_DEFAULT`.
+            compression_level (int): Passed to `lz4.frame.compress_begin`.
+            block_size (int): Passed to `lz4.frame.compress_begin`.
+            content_checksum (bool): Passed to `lz4.frame.compress_begin`.
+            block_checksum (bool): Passed to `lz4.frame.compress_begin`.
+            block_linked (bool): Passed to `lz4.frame.compress_begin`.
+
+        Returns:
+            bytes: The compressed frames, each storing its content size.
+
+        """
+        if chunk_size < 1:
+            raise ValueError('chunk_size must be positive')
+        options = {
+            'compression_level': compression_level,
+            'block_size': block_size,
+            'content_checksum': content_checksum,
+            'block_checksum': block_checksum,
+            'block_linked': block_linked,
+        }
+        with memoryview(data) as data_view, data_view.cast('B') as view:
+            size = len(view)
+            chunks = [(offset, min(chunk_size, size - offset))
+                      for offset in range(0, size, chunk_size)] or [(0, 0)]
+            bounds = []
+            total = 0
+            for _, length in chunks:
+                bounds.append((total, _frame_bound(length)))
+                total += _frame_bound(length)
+            with _Segment(size) as source, _Segment(total) as dest:
+                source.buf[:size] = view
+                written = self._results(self._submit(_compress_chunk, [
+                    (source.name, offset, length, dest.name, dest_offset,
+                     dest_size, options)
+                    for (offset, length), (dest_offset, dest_size)
+                    in zip(chunks, bounds)
+                ]))
+                return b''.join(
+                    dest.buf[dest_offset:dest_offset + length]
+                    for (dest_offset, _), length in zip(bounds, written)
+                )
+
+    def decompress(self, data):
+        """Decompresses concatenated LZ4 frames in parallel.
+
+        Args:
+            data (bytes or buffer-compatible object): The frames, such as the
+                output of `compress`.
+
+        Returns:
+            bytes: The decompressed data.
+
+        """
+        with memoryview(data) as data_view, data_view.cast('B') as view:
+            frames = _frames(view)
+            total = sum(content_size for _, _, content_size in frames
+                        if content_size is not None)
+            with _Segment(len(view)) as source, _Segment(total) as dest:
+                source.buf[:len(view)] = view
+                tasks = []
+                offset = 0
+                for start, end, content_size in frames:
+                    if content_size is not None:
+                        tasks.append((source.name, start, end - start,
+                                      dest.name, offset, content_size))
+                        offset += content_size
+                futures = self._submit(_decompress_frame, tasks)
+                parts = []
+                try:
+                    try:
+                        # Frames of unknown size are decompressed here
+                        # meanwhile.
+                        offset = 0
+                        for start, end, content_size in frames:
+                            if content_size is None:
+                                parts.append(
+                                    _frame.decompress(view[start:end]))
+                            else:
+                                parts.append(
+                                    dest.buf[offset:offset + content_size])
+                                offset += content_size
+                    finally:
+                        self._results(futures)
+                    return b''.join(parts)
+                finally:
+                    # Releases the views of the segment before it is closed.
+                    del parts[:]
+
+    def close(self):
+        """Shuts down the worker processes, waiting for them to exit."""
+        if self._executor is not None:
+            self._executor.shutdown()
+            self._executor = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exception_type, exception, traceback):
+        self.close()
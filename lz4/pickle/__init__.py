@@ -0,0 +1,293 @@
+"""Pickling with LZ4 compressed out-of-band buffers.
+
+Objects are pickled with protocol 5, and the buffers they expose through
+`pickle.PickleBuffer`, such as the data of large arrays, are passed out of
+band rather than copied into the pickle stream. The pickle stream and each of
+the buffers are then compressed separately with `lz4.frame.compress`, reading
+the buffers directly from the memory of the objects. Buffers are split into
+chunks of ``chunk_size`` bytes, and the chunks are compressed in parallel.
+
+On loading, a destination is allocated for each buffer, and its chunks are
+decompressed in parallel directly into it with `lz4.frame.decompress_into`.
+The objects are then rebuilt on top of these destinations.
+
+Buffers smaller than 64 kB are kept in the pickle stream.
+
+The layout of the data, with all integers little endian, is:
+
+- The 16 byte header: ``b'LZ4P'``, the format version (1), three zero bytes,
+  the number of out-of-band buffers as a 32-bit integer and the chunk size as
+  a 32-bit integer.
+- The pickle stream followed by each buffer, in order. Each starts with its
+  size as a 64-bit integer and a flag byte, which is 1 for a read-only buffer.
+  Then comes each chunk: the size of the compressed chunk as a 32-bit integer,
+  followed by the chunk compressed as an LZ4 frame.
+
+"""
+
+import collections
+import os
+import pickle
+import struct
+from concurrent.futures import Future, ThreadPoolExecutor
+
+from .. import frame as _frame
+
+
+_MAGIC = b'LZ4P'
+_VERSION = 1
+_HEADER = struct.Struct('<4sB3xII')
+_SEGMENT = struct.Struct('<QB')
+_CHUNK = struct.Struct('<I')
+
+_READ_ONLY = 1
+
+# Smaller buffers cost more as separate frames than copying them in band.
+_MIN_OUT_OF_BAND = 64 * 1024
+
+CHUNK_SIZE_DEFAULT = 4 * 1024 * 1024
+"""Default size of the pieces buffers are split into for compression."""
+
+
+def _threads(threads):
+    if threads is None:
+        return os.cpu_count() or 1
+    if threads < 1:
+        raise ValueError('threads must be positive')
+    return threads
+
+
+class _Ordered(object):
+    # Runs calls on a thread pool, returning their results in the order they
+    # were submitted, with at most two calls per thread in flight. With a
+    # single thread, calls are made when submitted.
+
+    def __init__(self, threads, consume):
+        self._consume = consume
+        self._pending = collections.deque()
+        self._limit = 2 * threads
+        self._executor = ThreadPoolExecutor(threads) if threads > 1 else None
+
+    def submit(self, function, *args):
+        if self._executor is None:
+            self._consume(function(*args))
+            return
+        self._pending.append(self._executor.submit(function, *args))
+        while len(self._pending) >= self._limit:
+            self._consume(self._pending.popleft().result())
+
+    def put(self, result):
+        # Add a result that is already known, after those pending.
+        if self._executor is None:
+            self._consume(result)
+            return
+        future = Future()
+        future.set_result(result)
+        self._pending.append(future)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exception_type, exception, traceback):
+        try:
+            if exception_type is None:
+                while self._pending:
+                    self._consume(self._pending.popleft().result())
+        finally:
+            if self._executor is not None:
+                self._executor.shutdown(cancel_futures=True)
+
+
+def _pickle(obj, protocol, fix_imports):
+    if protocol < 5:
+        raise ValueError('lz4.pickle requires pickle protocol 5 or later')
+    buffers = []
+
+    def buffer_callback(buffer):
+        try:
+            raw = buffer.raw()
+        except BufferError:
+            # Not contiguous, which pickle reports as it would without a
+            # callback.
+            return True
+        if raw.nbytes < _MIN_OUT_OF_BAND:
+            return True
+        buffers.append(raw)
+        return False
+
+    stream = pickle.dumps(obj, protocol=protocol, fix_imports=fix_imports,
+                          buffer_callback=buffer_callback)
+    return [memoryview(stream)] + buffers
+
+
+def _compress(segments, write, chunk_size, threads, compression_level,
+              content_checksum):
+    if not 0 < chunk_size < 1 << 32:
+        raise ValueError('chunk_size must be between 1 and 2**32 - 1')
+
+    def compress_chunk(chunk):
+        compressed = _frame.compress(chunk,
+                                     compression_level=compression_level,
+                                     content_checksum=content_checksum)
+        return _CHUNK.pack(len(compressed)), compressed
+
+    def write_parts(parts):
+        for part in parts:
+            write(part)
+
+    write(_HEADER.pack(_MAGIC, _VERSION, len(segments) - 1, chunk_size))
+    with _Ordered(_threads(threads), write_parts) as pool:
+        for segment in segments:
+            # Written once the chunks of the previous segments are.
+            pool.put((_SEGMENT.pack(segment.nbytes,
+                                    _READ_ONLY if segment.readonly else 0),))
+            for offset in range(0, segment.nbytes, chunk_size):
+                pool.submit(compress_chunk,
+                            segment[offset:offset + chunk_size])
+
+
+def _decompress(read, threads):
+    def check(result):
+        written, expected = result
+        if written != expected:
+            raise ValueError('Corrupt lz4.pickle data: chunk size mismatch')
+
+    def decompress_into(source, destination):
+        return (_frame.decompress_into(source, destination),
+                len(destination))
+
+    magic, version, count, chunk_size = _HEADER.unpack(read(_HEADER.size))
+    if magic != _MAGIC:
+        raise ValueError('Not lz4.pickle data')
+    if version != _VERSION:
+        raise ValueError(
+            'Unsupported lz4.pickle format version: {}'.format(version))
+    if chunk_size == 0:
+        raise ValueError('Corrupt lz4.pickle data: chunk size is zero')
+
+    buffers = []
+    with _Ordered(_threads(threads), check) as pool:
+        for _ in range(count + 1):
+            size, flags = _SEGMENT.unpack(read(_SEGMENT.size))
+            destination = bytearray(size)
+            view = memoryview(destination)
+            for offset in range(0, size, chunk_size):
+                length, = _CHUNK.unpack(read(_CHUNK.size))
+                pool.submit(decompress_into, read(length),
+                            view[offset:offset + chunk_size])
+            if flags & _READ_ONLY:
+                view = view.toreadonly()
+            buffers.append(view)
+    return buffers[0], buffers[1:]
+
+
+def _reader(data):
+    view = memoryview(data).cast('B')
+    position = 0
+
+    def read(size):
+        nonlocal position
+        if position + size > len(view):
+            raise ValueError('Truncated lz4.pickle data')
+        chunk = view[position:position + size]
+        position += size
+        return chunk
+    return read
+
+
+def _file_reader(file):
+    def read(size):
+        data = file.read(size)
+        if len(data) != size:
+            raise ValueError('Truncated lz4.pickle data')
+        return data
+    return read
+
+
+def dumps(obj, protocol=5, *, fix_imports=True, compression_level=0,
+          content_checksum=False, chunk_size=CHUNK_SIZE_DEFAULT,
+          threads=None):
+    """Pickle an object, compressing the pickle stream and its out-of-band
+    buffers.
+
+    Args:
+        obj: The object to pickle.
+        protocol (int): The pickle protocol, which must be 5 or later.
+
+    Keyword Args:
+        fix_imports (bool): Passed to `pickle.dumps`.
+        compression_level (int): The compression level passed to
+            `lz4.frame.compress`. The default is 0.
+        content_checksum (bool): If ``True``, each compressed chunk includes a
+            checksum of its content.
+        chunk_size (int): Buffers are split into chunks of this many bytes,
+            compressed as separate frames. The default is
+            `CHUNK_SIZE_DEFAULT`.
+        threads (int): The number of threads compressing chunks. The default
+            is the number of CPUs.
+
+    Returns:
+        bytes: The compressed pickle.
+
+    """
+    segments = _pickle(obj, protocol, fix_imports)
+    parts = []
+    _compress(segments, parts.append, chunk_size, threads, compression_level,
+              content_checksum)
+    return b''.join(parts)
+
+
+def dump(obj, file, protocol=5, *, fix_imports=True, compression_level=0,
+         content_checksum=False, chunk_size=CHUNK_SIZE_DEFAULT,
+         threads=None):
+    """Pickle an object to a file, compressing the pickle stream and its
+    out-of-band buffers.
+
+    Compressed chunks are written to the file as they are ready. The
+    arguments are the same as for `dumps`, with ``file`` an object with a
+    ``write`` method accepting bytes.
+
+    """
+    segments = _pickle(obj, protocol, fix_imports)
+    _compress(segments, file.write, chunk_size, threads, compression_level,
+              content_checksum)
+
+
+def loads(data, *, fix_imports=True, encoding='ASCII', errors='strict',
+          threads=None):
+    """Unpickle an object from data written by `dumps`.
+
+    Compressed chunks are decompressed directly into the buffers handed to
+    the unpickled objects, without intermediate copies.
+
+    Args:
+        data (bytes or buffer-compatible object): The compressed pickle.
+
+    Keyword Args:
+        fix_imports (bool): Passed to `pickle.loads`.
+        encoding (str): Passed to `pickle.loads`.
+        errors (str): Passed to `pickle.loads`.
+        threads (int): The number of threads decompressing chunks. The
+            default is the number of CPUs.
+
+    Returns:
+        The unpickled object.
+
+    """
+    stream, buffers = _decompress(_reader(data), threads)
+    return pickle.loads(stream, fix_imports=fix_imports, encoding=encoding,
+                        errors=errors, buffers=buffers)
+
+
+def load(file, *, fix_imports=True, encoding='ASCII', errors='strict',
+         threads=None):
+    """Unpickle an object from a file written by `dump`.
+
+    Each compressed chunk is read from the file and decompressed while the
+    following ones are read. The arguments are the same as for `loads`, with
+    ``file`` an object with a ``read`` method returning bytes.
+
+    """
+    stream, buffers = _decompress(_file_reader(file), threads)
+    return pickle.loads(stream, fix_imports=fix_imports, encoding=encoding,
+                        errors=errors, buffers=buffers)
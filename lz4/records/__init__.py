@@ -0,0 +1,442 @@
+"""An indexed container of individually retrievable LZ4 compressed records.
+
+Records are appended to the container one at a time, and grouped into blocks
+of about ``block_size`` bytes, each compressed independently with
+`lz4.block.compress`, optionally against a shared dictionary. The file ends
+with an index of the blocks, so reading a record only decompresses the block
+holding it. Recently decompressed blocks are kept in a small cache, so reading
+neighbouring records is cheap.
+
+The file layout, with all integers little endian, is:
+
+- The 8 byte header ``b'LZ4R'``, the format version (1) and three zero bytes.
+- The blocks. Each is compressed with ``store_size=True``, and holds the end
+  offsets of its records as 32-bit integers, followed by the records.
+- The dictionary, if there is one.
+- The index, aligned to 8 bytes: the file offset of each block as a 64-bit
+  integer, then the number of the first record of each block as a 64-bit
+  integer.
+- The 40 byte footer: the offset of the index, the number of blocks, the
+  number of records and the offset of the dictionary as 64-bit integers, the
+  size of the dictionary as a 32-bit integer, and ``b'LZ4R'``.
+
+Appending records leaves the existing file intact, and writes the new blocks,
+dictionary, index and footer after the old footer. The old dictionary, index
+and footer are then indexed as a block holding no records, which is never
+read.
+
+"""
+
+import bisect
+import builtins
+import collections
+import mmap
+import os
+import struct
+import sys
+import threading
+from array import array
+
+from .. import block as _block
+
+
+_MAGIC = b'LZ4R'
+_VERSION = 1
+_HEADER = _MAGIC + bytes([_VERSION, 0, 0, 0])
+_FOOTER = struct.Struct('<QQQQI4s')
+
+BLOCK_SIZE_DEFAULT = 64 * 1024
+"""Default amount of record data grouped into a compressed block."""
+
+CACHE_SIZE_DEFAULT = 16
+"""Default number of decompressed blocks kept by `RecordReader`."""
+
+
+def _load_array(typecode, data):
+    values = array(typecode)
+    values.frombytes(data)
+    if sys.byteorder != 'little':
+        values.byteswap()
+    return values
+
+
+def _dump_array(typecode, values):
+    values = array(typecode, values)
+    if sys.byteorder != 'little':
+        values.byteswap()
+    return values.tobytes()
+
+
+def _read_footer(fp):
+    size = fp.seek(0, os.SEEK_END)
+    if size < len(_HEADER) + _FOOTER.size:
+        raise ValueError('Not an LZ4 record file: too short')
+    fp.seek(0)
+    header = fp.read(len(_HEADER))
+    fp.seek(size - _FOOTER.size)
+    (index_offset, block_count, record_count, dict_offset, dict_size,
+     magic) = _FOOTER.unpack(fp.read(_FOOTER.size))
+    if header[:4] != _MAGIC or magic != _MAGIC:
+        raise ValueError('Not an LZ4 record file')
+    if header[4] != _VERSION:
+        raise ValueError(
+            'Unsupported LZ4 record file version: {}'.format(header[4]))
+    if (index_offset + 16 * block_count + _FOOTER.size != size
+            or dict_offset + dict_size > index_offset):
+        raise ValueError('Corrupt LZ4 record file index')
+
+    fp.seek(dict_offset)
+    dictionary = fp.read(dict_size) if dict_size else None
+    fp.seek(index_offset)
+    offsets = _load_array('Q', fp.read(8 * block_count))
+    firsts = _load_array('Q', fp.read(8 * block_count))
+    return offsets, firsts, record_count, dict_offset, dictionary
+
+
+class RecordWriter(object):
+    """Appends records to an LZ4 record file.
+
+    Use `lz4.records.open` to create instances of this class.
+
+    Args:
+        fp (file object): The file to write to, opened in binary mode. It must
+            be readable and seekable when appending to an existing file.
+
+    Keyword Args:
+        append (bool): If ``True``, records are added to the existing
+            contents of ``fp``, rather than writing a new file. The
+            dictionary the file was created with is used. The existing
+            contents are never overwritten, and the file is left unchanged
+            if no records are appended.
+        block_size (int): Records are collected until they add up to at least
+            this many bytes, and then compressed together as a block. Larger
+            blocks compress better, but more data is decompressed to read a
+            single record. The default is `BLOCK_SIZE_DEFAULT`.
+        dict (bytes): A dictionary used to compress every block, which
+            improves the compression of small blocks of similar records.
+        mode (str): The compression mode passed to `lz4.block.compress`. The
+            default is ``'default'``.
+        compression (int): The compression level passed to
+            `lz4.block.compress` for ``'high_compression'`` mode.
+
+    """
+
+    def __init__(self, fp, append=False, block_size=BLOCK_SIZE_DEFAULT,
+                 dict=None, mode='default', compression=9):
+        if block_size <= 0:
+            raise ValueError(
+                'block_size must be positive, got {}'.format(block_size))
+        self._fp = fp
+        self._block_size = block_size
+        self._mode = mode
+        self._compression = compression
+        self._pending = []
+        self._pending_size = 0
+        self._lock = threading.Lock()
+
+        if append:
+            (offsets, firsts, self._count, dict_offset,
+             self._dict) = _read_footer(fp)
+            if dict is not None and dict != self._dict:
+                raise ValueError(
+                    'dict differs from the dictionary of the existing file')
+            self._offsets = offsets.tolist()
+            self._firsts = firsts.tolist()
+            # The old dictionary, index and footer become a block without
+            # records, which readers skip, and the new blocks follow them.
+            self._offsets.append(dict_offset)
+            self._firsts.append(self._count)
+            self._appended = len(self._offsets)
+            fp.seek(0, os.SEEK_END)
+        else:
+            self._count = 0
+            self._dict = bytes(dict) if dict is not None else None
+            self._offsets = []
+            self._firsts = []
+            self._appended = None
+            fp.write(_HEADER)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exception_type, exception, traceback):
+        self.close()
+
+    def __len__(self):
+        return self._count
+
+    @property
+    def closed(self):
+        """``True`` once the file has been closed."""
+        return self._fp is None
+
+    def append(self, record):
+        """Appends a record.
+
+        Args:
+            record (bytes or buffer-compatible object): The record.
+
+        Returns:
+            int: The number of the record, for use with `RecordReader.get`.
+
+        """
+        record = bytes(record)
+        with self._lock:
+            if self._fp is None:
+                raise ValueError('I/O operation on closed file')
+            self._pending.append(record)
+            self._pending_size += len(record)
+            number = self._count
+            self._count += 1
+            if self._pending_size >= self._block_size:
+                self._write_block()
+            return number
+
+    def extend(self, records):
+        """Appends each of ``records`` in turn."""
+        for record in records:
+            self.append(record)
+
+    def _write_block(self):
+        if not self._pending:
+            return
+        ends = []
+        end = 0
+        for record in self._pending:
+            end += len(record)
+            ends.append(end)
+        if end > 0xFFFFFFFF:
+            raise ValueError('Block of records larger than 4 GB')
+        compressed = _block.compress(
+            [_dump_array('I', ends)] + self._pending, mode=self._mode,
+            compression=self._compression, store_size=True, dict=self._dict)
+        self._offsets.append(self._fp.tell())
+        self._firsts.append(self._count - len(self._pending))
+        self._fp.write(compressed)
+        self._pending = []
+        self._pending_size = 0
+
+    def close(self):
+        """Compresses any records still pending, and writes the index.
+
+        The file object is closed if it was opened by `lz4.records.open`.
+
+        """
+        with self._lock:
+            if self._fp is None:
+                return
+            fp = self._fp
+            try:
+                self._write_block()
+                if self._appended == len(self._offsets):
+                    # Nothing was appended, so the file is left as it was.
+                    return
+                dict_offset = fp.tell()
+                dict_size = len(self._dict) if self._dict else 0
+                if dict_size:
+                    fp.write(self._dict)
+                fp.write(b'\0' * (-(dict_offset + dict_size) % 8))
+                index_offset = fp.tell()
+                fp.write(_dump_array('Q', self._offsets))
+                fp.write(_dump_array('Q', self._firsts))
+                fp.write(_FOOTER.pack(index_offset, len(self._offsets),
+                                      self._count, dict_offset, dict_size,
+                                      _MAGIC))
+                fp.flush()
+            finally:
+                self._fp = None
+                if getattr(self, '_close_fp', False):
+                    fp.close()
+
+
+class RecordReader(object):
+    """Reads records from an LZ4 record file.
+
+    Use `lz4.records.open` to create instances of this class. Records are
+    numbered from zero in the order they were appended, and negative numbers
+    count from the end. The methods may be called from several threads.
+
+    Args:
+        fp (file object): The file to read from, opened in binary mode.
+
+    Keyword Args:
+        use_mmap (bool): If ``True``, the file is memory mapped and the
+            blocks are read from the mapping. Otherwise they are read with
+            ``os.pread`` where available, or ``seek`` and ``read``. File
+            objects without a file descriptor are always read with ``seek``
+            and ``read``. The default is ``True``.
+        cache_size (int): The number of decompressed blocks kept, least
+            recently used first out. The default is `CACHE_SIZE_DEFAULT`.
+
+    """
+
+    def __init__(self, fp, use_mmap=True, cache_size=CACHE_SIZE_DEFAULT):
+        self._fp = fp
+        (self._offsets, self._firsts, self._count, dict_offset,
+         self._dict) = _read_footer(fp)
+        # The end of each block is the start of the next, and the last one
+        # ends where the dictionary starts.
+        self._offsets.append(dict_offset)
+        self._cache = collections.OrderedDict()
+        self._cache_size = max(cache_size, 1)
+        self._lock = threading.Lock()
+        self._mmap = None
+        self._fd = None
+        try:
+            fd = fp.fileno()
+        except (AttributeError, OSError, ValueError):
+            fd = None
+        if fd is not None and use_mmap:
+            self._mmap = mmap.mmap(fd, 0, access=mmap.ACCESS_READ)
+        elif fd is not None and hasattr(os, 'pread'):
+            self._fd = fd
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exception_type, exception, traceback):
+        self.close()
+
+    def __len__(self):
+        return self._count
+
+    def __getitem__(self, number):
+        return self.get(number)
+
+    def __iter__(self):
+        for block in range(len(self._firsts)):
+            if self._record_count(block) == 0:
+                continue
+            ends, data = self._decode(block)
+            start = 0
+            for end in ends:
+                yield bytes(data[start:end])
+                start = end
+
+    @property
+    def closed(self):
+        """``True`` once the file has been closed."""
+        return self._fp is None
+
+    def get(self, number):
+        """Returns a record.
+
+        Only the block holding the record is read and decompressed, unless
+        it's in the cache already.
+
+        Args:
+            number (int): The number of the record.
+
+        Returns:
+            bytes: The record.
+
+        Raises:
+            IndexError: If there's no such record.
+
+        """
+        if number < 0:
+            number += self._count
+        if not 0 <= number < self._count:
+            raise IndexError('record number out of range')
+        block = bisect.bisect_right(self._firsts, number) - 1
+        ends, data = self._decode(block)
+        index = number - self._firsts[block]
+        start = ends[index - 1] if index > 0 else 0
+        return bytes(data[start:ends[index]])
+
+    def _record_count(self, block):
+        if block + 1 < len(self._firsts):
+            return self._firsts[block + 1] - self._firsts[block]
+        return self._count - self._firsts[block]
+
+    def _read(self, start, end):
+        if self._mmap is not None:
+            return self._mmap[start:end]
+        if self._fd is not None:
+            return os.pread(self._fd, end - start, start)
+        self._fp.seek(start)
+        return self._fp.read(end - start)
+
+    def _decode(self, block):
+        with self._lock:
+            if self._fp is None:
+                raise ValueError('I/O operation on closed file')
+            entry = self._cache.get(block)
+            if entry is not None:
+                self._cache.move_to_end(block)
+                return entry
+            compressed = self._read(self._offsets[block],
+                                    self._offsets[block + 1])
+
+        decompressed = memoryview(_block.decompress(compressed,
+                                                    dict=self._dict))
+        count = self._record_count(block)
+        ends = _load_array('I', decompressed[:4 * count])
+        entry = (ends, decompressed[4 * count:])
+
+        with self._lock:
+            self._cache[block] = entry
+            while len(self._cache) > self._cache_size:
+                self._cache.popitem(last=False)
+        return entry
+
+    def close(self):
+        """Closes the reader, and the file object if it was opened by
+        `lz4.records.open`."""
+        with self._lock:
+            if self._fp is None:
+                return
+            fp, self._fp = self._fp, None
+            self._cache.clear()
+            if self._mmap is not None:
+                self._mmap.close()
+                self._mmap = None
+            if getattr(self, '_close_fp', False):
+                fp.close()
+
+
+def open(filename, mode='r', **kwargs):
+    """Opens an LZ4 record file.
+
+    Args:
+        filename (str, bytes, PathLike or file object): The file name, or an
+            existing file object opened in binary mode.
+
+    Keyword Args:
+        mode (str): ``'r'`` (default) to read records, ``'w'`` to write a new
+            file, ``'x'`` to create one exclusively, or ``'a'`` to append
+            records to an existing file, which is created if missing.
+        **kwargs: Passed on to `RecordReader` or `RecordWriter`.
+
+    Returns:
+        RecordReader or RecordWriter: The reader or writer.
+
+    """
+    mode = mode.replace('b', '')
+    if mode not in ('r', 'w', 'x', 'a'):
+        raise ValueError('Invalid mode: {!r}'.format(mode))
+
+    if isinstance(filename, (str, bytes, os.PathLike)):
+        if mode == 'a' and not os.path.exists(filename):
+            mode = 'w'
+        fp = builtins.open(filename, {'r': 'rb', 'w': 'wb', 'x': 'xb',
+                                      'a': 'r+b'}[mode])
+        close_fp = True
+    elif hasattr(filename, 'read') or hasattr(filename, 'write'):
+        fp = filename
+        close_fp = False
+    else:
+        raise TypeError(
+            'filename must be a str, bytes, file or PathLike object')
+
+    try:
+        if mode == 'r':
+            result = RecordReader(fp, **kwargs)
+        else:
+            result = RecordWriter(fp, append=mode == 'a', **kwargs)
+    except BaseException:
+        if close_fp:
+            fp.close()
+        raise
+    result._close_fp = close_fp
+    return result
@@ -1,4 +1,6 @@
-from ._stream import _create_context, _compress, _decompress, _get_block
+from ._stream import _create_context, _compress, _decompress, _get_block, _set_compression_level
+from ._stream import _compress_many, _decompress_stream, _create_dictionary
+from ._stream import _save_state, _load_state, _hibernate, _wake, _is_hibernating
 from ._stream import LZ4StreamError, _compress_bound, _input_bound, LZ4_MAX_INPUT_SIZE  # noqa: F401
 
 
@@ -8,6 +10,44 @@ A Python wrapper for the LZ4 stream protocol.
 """
 
 
+class LZ4StreamDictionary:
+    """ A dictionary prepared once, for use by many LZ4 stream contexts.
+
+    """
+    def __init__(self, dictionary, mode="default"):
+        """ Copies and loads a dictionary for stream compression and decompression.
+
+            Passing the same ``LZ4StreamDictionary`` as the ``dictionary`` of many
+            `LZ4StreamCompressor` and `LZ4StreamDecompressor` instances avoids
+            copying the dictionary for each of them. Compressors whose ``mode``
+            matches the one given here also attach the loaded dictionary, rather
+            than hashing it again, which makes creating them much faster,
+            especially in ``high_compression`` mode.
+
+            Args:
+                dictionary (str, bytes or buffer-compatible object): The
+                    dictionary. Only its last 64 kB are used.
+
+            Keyword Args:
+                mode (str): The ``mode`` of the compressors the dictionary is
+                    prepared for: ``default``, ``fast`` or ``high_compression``.
+                    ``default`` and ``fast`` compressors share the same
+                    preparation.
+
+            Raises:
+                ValueError: raised if ``mode`` is invalid.
+                MemoryError: raised if some internal resources cannot be allocated.
+
+        """
+        self._dictionary = _create_dictionary(dictionary, mode=mode)
+
+
+def _split_dictionary(dictionary):
+    if isinstance(dictionary, LZ4StreamDictionary):
+        return "", dictionary._dictionary
+    return dictionary, None
+
+
 class LZ4StreamDecompressor:
     """ LZ4 stream decompression context.
 
@@ -28,8 +68,8 @@ class LZ4StreamDecompressor:
                 store_comp_size (int): Specify the size in bytes of the following
                     compressed block. Can be: ``0`` (meaning out-of-band block size),
                     ``1``, ``2`` or ``4`` (default: ``4``).
-                dictionary (str, bytes or buffer-compatible object): If specified,
-                    perform decompression using this initial dictionary.
+                dictionary (str, bytes, buffer-compatible object or LZ4StreamDictionary):
+                    If specified, perform decompression using this initial dictionary.
 
             Raises:
                 Exceptions occurring during the context initialization.
@@ -42,11 +82,13 @@ class LZ4StreamDecompressor:
 
         """
         return_bytearray = 1 if return_bytearray else 0
+        dictionary, prepared_dictionary = _split_dictionary(dictionary)
 
         self._context = _create_context(strategy, "decompress", buffer_size,
                                         return_bytearray=return_bytearray,
                                         store_comp_size=store_comp_size,
-                                        dictionary=dictionary)
+                                        dictionary=dictionary,
+                                        prepared_dictionary=prepared_dictionary)
 
     def __enter__(self):
         """ Enter the LZ4 stream context.
@@ -110,13 +152,106 @@ class LZ4StreamDecompressor:
         """
         return _get_block(self._context, stream)
 
+    def decompress_stream(self, stream):
+        """ Decompress all the complete blocks at the start of ``stream``.
+
+            This is equivalent to repeatedly calling `get_block()` and
+            `decompress()`, but decompresses all the blocks in a single call.
+
+            Args:
+                stream (str, bytes or buffer-compatible object): LZ4 compressed stream.
+
+            Returns:
+                tuple: A list of the decompressed blocks, as ``bytes`` or
+                ``bytearray`` objects, and the number of bytes of ``stream``
+                consumed. An incomplete block at the end of ``stream`` isn't
+                consumed, and should be passed again with the data following it.
+
+            Raises:
+                Exceptions occurring during decompression.
+
+                LZ4StreamError: raised if the call to the LZ4 library fails, or if
+                    used while in an out-of-band block size record configuration.
+
+        """
+        return _decompress_stream(self._context, stream)
+
+    def hibernate(self):
+        """ Release the memory held by the decompression context while it is idle.
+
+            The LZ4 state and the buffers of the context are freed, and only
+            the last 64 kB of the stream, which later blocks may reference, are
+            kept. The context is rebuilt from them the next time it is used, so
+            the stream carries on as if it had never hibernated. This is meant
+            for applications holding many mostly idle streams, such as one per
+            connection.
+
+        """
+        _hibernate(self._context)
+
+    def wake(self):
+        """ Rebuild the decompression context after `hibernate()`.
+
+            This happens automatically the next time the context is used;
+            calling it explicitly moves the allocation out of the first
+            decompress call. Does nothing if the context isn't hibernating.
+
+        """
+        _wake(self._context)
+
+    @property
+    def hibernating(self):
+        """ bool: Whether the context is hibernating. """
+        return _is_hibernating(self._context)
+
+    def save_state(self):
+        """ Save the state of the decompression context.
+
+            The state holds the configuration of the context, and the last
+            64 kB of the stream, which later blocks may reference. A decompressor
+            restored from it with `from_state()` continues the stream where
+            this one is, so neither side of a stream has to be reset after a
+            restart. Pickling saves the state the same way.
+
+            Returns:
+                bytes: The state of the context.
+
+        """
+        return _save_state(self._context)
+
+    @classmethod
+    def from_state(cls, state):
+        """ Create a decompressor from a state returned by `save_state()`.
+
+            Args:
+                state (bytes or buffer-compatible object): The saved state.
+
+            Returns:
+                LZ4StreamDecompressor: A decompressor continuing the saved stream.
+
+            Raises:
+                ValueError: raised if ``state`` is invalid, or was saved from
+                    a compressor.
+
+        """
+        self = cls.__new__(cls)
+        self.__setstate__(state)
+        return self
+
+    def __getstate__(self):
+        return self.save_state()
+
+    def __setstate__(self, state):
+        self._context = _load_state(state, "decompress")
+
 
 class LZ4StreamCompressor:
     """ LZ4 stream compressing context.
 
     """
     def __init__(self, strategy, buffer_size, mode="default", acceleration=True, compression_level=9,
-                 return_bytearray=False, store_comp_size=4, dictionary=""):
+                 return_bytearray=False, store_comp_size=4, dictionary="",
+                 favor_decompression_speed=False):
         """ Instantiates and initializes a LZ4 stream compression context.
 
             Args:
@@ -146,8 +281,12 @@ class LZ4StreamCompressor:
                 store_comp_size (int): Specify the size in bytes of the following
                     compressed block. Can be: ``0`` (meaning out-of-band block size),
                     ``1``, ``2`` or ``4`` (default: ``4``).
-                dictionary (str, bytes or buffer-compatible object): If specified,
-                    perform compression using this initial dictionary.
+                dictionary (str, bytes, buffer-compatible object or LZ4StreamDictionary):
+                    If specified, perform compression using this initial dictionary.
+                favor_decompression_speed (bool): If ``True``, the high compression
+                    parser favors decompression speed over compression ratio. Only
+                    relevant if ``mode`` is ``high_compression`` and
+                    ``compression_level`` is ``10`` or greater.
 
             Raises:
                 Exceptions occurring during the context initialization.
@@ -160,6 +299,7 @@ class LZ4StreamCompressor:
 
         """
         return_bytearray = 1 if return_bytearray else 0
+        dictionary, prepared_dictionary = _split_dictionary(dictionary)
 
         self._context = _create_context(strategy, "compress", buffer_size,
                                         mode=mode,
@@ -167,7 +307,9 @@ class LZ4StreamCompressor:
                                         compression_level=compression_level,
                                         return_bytearray=return_bytearray,
                                         store_comp_size=store_comp_size,
-                                        dictionary=dictionary)
+                                        dictionary=dictionary,
+                                        favor_decompression_speed=favor_decompression_speed,
+                                        prepared_dictionary=prepared_dictionary)
 
     def __enter__(self):
         """ Enter the LZ4 stream context.
@@ -181,6 +323,24 @@ class LZ4StreamCompressor:
         """
         pass
 
+    def set_compression_level(self, compression_level):
+        """ Change the compression level used for the next blocks.
+
+            The stream history is kept, so the following blocks still benefit
+            from the data compressed so far. Only supported when ``mode`` is
+            ``high_compression``.
+
+            Args:
+                compression_level (int): New compression level.
+
+            Raises:
+                ValueError: raised if the context is not a ``high_compression``
+                    one.
+                RuntimeError: raised if the LZ4 library does not support it.
+
+        """
+        _set_compression_level(self._context, compression_level)
+
     def compress(self, chunk):
         """ Stream compress given ``chunk`` of data.
 
@@ -202,3 +362,95 @@ class LZ4StreamCompressor:
 
         """
         return _compress(self._context, chunk)
+
+    def compress_many(self, chunks):
+        """ Stream compress each chunk in ``chunks`` in turn.
+
+            This returns the same data as joining the results of calling
+            `compress()` for each chunk, but in a single call.
+
+            Args:
+                chunks (list or tuple): Chunks of data to compress, each a
+                    str, bytes or buffer-compatible object.
+
+            Returns:
+                bytes or bytearray: Compressed data.
+
+            Raises:
+                Exceptions occurring during compression.
+
+                OverflowError: raised if a chunk is too large for being compressed
+                    in the given context.
+                LZ4StreamError: raised if the call to the LZ4 library fails, or if
+                    used while in an out-of-band block size record configuration.
+
+        """
+        return _compress_many(self._context, chunks)
+
+    def hibernate(self):
+        """ Release the memory held by the compression context while it is idle.
+
+            The LZ4 state and the buffers of the context are freed, and only
+            the last 64 kB of the stream, which later blocks may reference, are
+            kept. The context is rebuilt from them the next time it is used, so
+            the stream carries on as if it had never hibernated. This is meant
+            for applications holding many mostly idle streams, such as one per
+            connection.
+
+        """
+        _hibernate(self._context)
+
+    def wake(self):
+        """ Rebuild the compression context after `hibernate()`.
+
+            This happens automatically the next time the context is used;
+            calling it explicitly moves the allocation out of the first
+            compress call. Does nothing if the context isn't hibernating.
+
+        """
+        _wake(self._context)
+
+    @property
+    def hibernating(self):
+        """ bool: Whether the context is hibernating. """
+        return _is_hibernating(self._context)
+
+    def save_state(self):
+        """ Save the state of the compression context.
+
+            The state holds the configuration of the context, and the last
+            64 kB of the stream, which later blocks may reference. A compressor
+            restored from it with `from_state()` continues the stream where
+            this one is, so neither side of a stream has to be reset after a
+            restart. Pickling saves the state the same way.
+
+            Returns:
+                bytes: The state of the context.
+
+        """
+        return _save_state(self._context)
+
+    @classmethod
+    def from_state(cls, state):
+        """ Create a compressor from a state returned by `save_state()`.
+
+            Args:
+                state (bytes or buffer-compatible object): The saved state.
+
+            Returns:
+                LZ4StreamCompressor: A compressor continuing the saved stream.
+
+            Raises:
+                ValueError: raised if ``state`` is invalid, or was saved from
+                    a decompressor.
+
+        """
+        self = cls.__new__(cls)
+        self.__setstate__(state)
+        return self
+
+    def __getstate__(self):
+        return self.save_state()
+
+    def __setstate__(self, state):
+        self._context = _load_state(state, "compress")
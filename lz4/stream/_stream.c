@@ -44,6 +44,17 @@
 #include <stddef.h>
 #include <stdio.h>
 
+#include "../_arguments.h"
+#include "../_buffers.h"
+#include "../_trace.h"
+
+/* The level of a context as a tracepoint argument: the compression level in
+ * high compression mode, the acceleration otherwise. */
+#define TRACE_LEVEL(context)                                    \
+  ((context)->config.comp == HIGH_COMPRESSION                   \
+   ? (context)->config.compression_level                        \
+   : (context)->config.acceleration)
+
 #if defined(_WIN32) && defined(_MSC_VER) && _MSC_VER < 1600
 /* MSVC 2008 and earlier lacks stdint.h */
 typedef signed __int8 int8_t;
@@ -79,6 +90,10 @@ typedef unsigned __int64 uint64_t;
 #define LZ4_VERSION_NUMBER_1_9_0 10900
 
 static const char * stream_context_capsule_name = "_stream.LZ4S_ctx";
+static const char * stream_dictionary_capsule_name = "_stream.LZ4S_dict";
+
+/* LZ4 only ever references the last 64 kB of a dictionary. */
+#define DICTIONARY_SIZE_MAX (64 * 1024)
 
 typedef enum {
   DOUBLE_BUFFER,
@@ -174,6 +189,19 @@ typedef struct {
   int  (*update_context_after_process) (stream_context_t * context);
 } strategy_ops_t;
 
+/* A dictionary loaded once, which stream contexts can then attach without
+ * hashing it again. */
+typedef struct {
+  char * buf;
+  int len;
+  compression_type_e comp;
+  union {
+    LZ4_stream_t * fast;
+    LZ4_streamHC_t * hc;
+    void * context;
+  } lz4_state;
+} stream_dictionary_t;
+
 struct stream_context_t {
   /* Buffer strategy resources */
   struct {
@@ -197,6 +225,36 @@ struct stream_context_t {
 
   buffer_t output;
 
+  /* The dictionary, which LZ4 references rather than copies: either a copy
+   * owned by the context, or a prepared dictionary it holds a reference to. */
+  char * dictionary_copy;
+  PyObject * py_dictionary;
+  /* Set while a prepared dictionary is attached to a stream that hasn't
+   * compressed anything yet, as LZ4_saveDict doesn't see it. */
+  int dictionary_attached;
+
+  /* Last 64 kB of the stream, kept by _save_state, _load_state and while
+   * hibernating, and referenced by the lz4 state until further data is
+   * processed. */
+  char * history;
+
+  /* Where the recently decoded data lies, which save_history keeps as the
+   * history of a decompression context: the segment decoding continues, and
+   * the one before it. These follow LZ4_setStreamDecode and
+   * LZ4_decompress_safe_continue as set_stream_decode and decompress_continue
+   * call them, so that the private fields of the lz4 state needn't be read. */
+  struct {
+    const char * prefix_end;
+    size_t prefix_len;
+    const char * external;
+    size_t external_len;
+  } decoded;
+
+  /* Set while the context is hibernating: the lz4 state and the buffers are
+   * released, and only history_len bytes of history are kept. */
+  int hibernating;
+  int history_len;
+
   /* LZ4 state */
   union {
     union {
@@ -209,10 +267,12 @@ struct stream_context_t {
 
   /* LZ4 configuration */
   struct {
+    unsigned int buffer_size;
     int acceleration;
     int compression_level;
     int store_comp_size;
     int return_bytearray;
+    int favor_dec_speed;
     direction_e direction;
     compression_type_e comp;
   } config;
@@ -443,11 +503,92 @@ LZ4_resetStreamHC_fast (LZ4_streamHC_t* streamHCPtr, int compressionLevel);
 __attribute__ ((weak)) void
 LZ4_resetStream_fast (LZ4_stream_t* streamPtr);
 
+/* Function introduced in LZ4 >= 1.8.0 */
+__attribute__ ((weak)) void
+LZ4_setCompressionLevel (LZ4_streamHC_t* LZ4_streamHCPtr, int compressionLevel);
+
+/* Function introduced in LZ4 >= 1.8.2 */
+__attribute__ ((weak)) void
+LZ4_favorDecompressionSpeed (LZ4_streamHC_t* LZ4_streamHCPtr, int favor);
+
+/* Function introduced in LZ4 >= 1.8.2 */
+__attribute__ ((weak)) void
+LZ4_attach_dictionary (LZ4_stream_t* workingStream,
+                       const LZ4_stream_t* dictionaryStream);
+
+/* Function introduced in LZ4 >= 1.9.0 */
+__attribute__ ((weak)) void
+LZ4_attach_HC_dictionary (LZ4_streamHC_t *working_stream,
+                          const LZ4_streamHC_t *dictionary_stream);
+
 #else
 /* Assuming the bundled LZ4 library sources are always used, so meet the
  * LZ4 minimal version requirements.
  */
+
+/* Only declared by lz4hc.h under LZ4_HC_STATIC_LINKING_ONLY. */
+void
+LZ4_setCompressionLevel (LZ4_streamHC_t* LZ4_streamHCPtr, int compressionLevel);
+
+void
+LZ4_favorDecompressionSpeed (LZ4_streamHC_t* LZ4_streamHCPtr, int favor);
+
+void
+LZ4_attach_HC_dictionary (LZ4_streamHC_t *working_stream,
+                          const LZ4_streamHC_t *dictionary_stream);
+
+/* Only declared by lz4.h under LZ4_STATIC_LINKING_ONLY. */
+void
+LZ4_attach_dictionary (LZ4_stream_t* workingStream,
+                       const LZ4_stream_t* dictionaryStream);
+#endif
+
+#define LZ4_VERSION_NUMBER_1_8_0 10800
+#define LZ4_VERSION_NUMBER_1_8_2 10802
+
+static inline int has_set_compression_level (void)
+{
+#if defined (__GNUC__)
+  if (!LZ4_setCompressionLevel)
+    {
+      return 0;
+    }
+#endif
+  return LZ4_versionNumber () >= LZ4_VERSION_NUMBER_1_8_0;
+}
+
+static inline int has_favor_decompression_speed (void)
+{
+#if defined (__GNUC__)
+  if (!LZ4_favorDecompressionSpeed)
+    {
+      return 0;
+    }
+#endif
+  return LZ4_versionNumber () >= LZ4_VERSION_NUMBER_1_8_2;
+}
+
+static inline int has_attach_dictionary (void)
+{
+#if defined (__GNUC__)
+  if (!LZ4_attach_dictionary)
+    {
+      return 0;
+    }
 #endif
+  return LZ4_versionNumber () >= LZ4_VERSION_NUMBER_1_8_2;
+}
+
+static inline int has_attach_hc_dictionary (void)
+{
+#if defined (__GNUC__)
+  if (!LZ4_attach_HC_dictionary)
+    {
+      return 0;
+    }
+#endif
+  return LZ4_versionNumber () >= LZ4_VERSION_NUMBER_1_9_0;
+}
 
 static inline void reset_stream (LZ4_stream_t* streamPtr)
 {
@@ -690,16 +831,13 @@ static strategy_ops_t strategy_ops[BUFFER_STRATEGY_COUNT] = {
 /*******************
  * generic helpers *
  *******************/
+/* Releases the lz4 state and the buffers of a context, keeping its
+ * configuration. */
 static void
-destroy_context (stream_context_t * context)
+release_context_resources (stream_context_t * context)
 {
-  if (context == NULL)
-    {
-      return;
-    }
-
   /* Release lz4 state */
-  Py_BEGIN_ALLOW_THREADS
+  TRACE_BEGIN_ALLOW_THREADS
   if (context->lz4_state.context != NULL)
     {
       if (context->config.direction == COMPRESS)
@@ -718,7 +856,7 @@ destroy_context (stream_context_t * context)
           LZ4_freeStreamDecode (context->lz4_state.decompress);
         }
     }
-  Py_END_ALLOW_THREADS
+  TRACE_END_ALLOW_THREADS
   context->lz4_state.context = NULL;
 
   /* Release strategy resources */
@@ -726,7 +864,6 @@ destroy_context (stream_context_t * context)
     {
       context->strategy.ops->release_resources (context);
     }
-  context->strategy.ops = NULL;
 
   /* Release output buffer */
   if (context->output.buf != NULL)
@@ -735,6 +872,113 @@ destroy_context (stream_context_t * context)
     }
   context->output.buf = NULL;
   context->output.len = 0;
+}
+
+/* Allocates the buffers and the lz4 state of a context from its
+ * configuration. Returns 0, or -1 with an exception set, in which case the
+ * caller releases whatever was allocated. */
+static int
+reserve_context_resources (stream_context_t * context)
+{
+  unsigned int total_size;
+
+  if (context->strategy.ops->reserve_resources (context, context->config.buffer_size) != 0)
+    {
+      /* Python exception already set in the strategy's resource creation helper */
+      return -1;
+    }
+
+  if (context->config.direction == COMPRESS)
+    {
+      context->output.len = get_compress_bound (context->config.buffer_size);
+      total_size = context->output.len + context->config.store_comp_size;
+    }
+  else /* context->config.direction == DECOMPRESS */
+    {
+      context->output.len = context->config.buffer_size;
+      total_size = context->output.len;
+    }
+
+  /* Set output buffer */
+  context->output.buf = PyMem_Malloc (total_size * sizeof (* (context->output.buf)));
+  if (context->output.buf == NULL)
+    {
+      PyErr_Format (PyExc_MemoryError,
+                    "Could not allocate output buffer");
+      return -1;
+    }
+
+  /* Initialize lz4 state */
+  if (context->config.direction == COMPRESS)
+    {
+      if (context->config.comp == HIGH_COMPRESSION)
+        {
+          context->lz4_state.compress.hc = LZ4_createStreamHC ();
+          if (context->lz4_state.compress.hc == NULL)
+            {
+              PyErr_Format (PyExc_MemoryError,
+                            "Could not create LZ4 state");
+              return -1;
+            }
+
+          reset_stream_hc (context->lz4_state.compress.hc, context->config.compression_level);
+
+          if (context->config.favor_dec_speed)
+            {
+              if (!has_favor_decompression_speed ())
+                {
+                  PyErr_SetString (PyExc_RuntimeError,
+                                   "favor_decompression_speed specified but not supported by LZ4 library version");
+                  return -1;
+                }
+              LZ4_favorDecompressionSpeed (context->lz4_state.compress.hc, 1);
+            }
+        }
+      else
+        {
+          context->lz4_state.compress.fast = LZ4_createStream ();
+          if (context->lz4_state.compress.fast == NULL)
+            {
+              PyErr_Format (PyExc_MemoryError,
+                            "Could not create LZ4 state");
+              return -1;
+            }
+
+          reset_stream (context->lz4_state.compress.fast);
+        }
+    }
+  else /* context->config.direction == DECOMPRESS */
+    {
+      context->lz4_state.decompress = LZ4_createStreamDecode ();
+      if (context->lz4_state.decompress == NULL)
+        {
+          PyErr_Format (PyExc_MemoryError,
+                        "Could not create LZ4 state");
+          return -1;
+        }
+      memset (&context->decoded, 0, sizeof context->decoded);
+    }
+
+  return 0;
+}
+
+static void
+destroy_context (stream_context_t * context)
+{
+  if (context == NULL)
+    {
+      return;
+    }
+
+  release_context_resources (context);
+  context->strategy.ops = NULL;
+
+  /* Release the dictionary, now that the lz4 state no longer references it */
+  PyMem_Free (context->dictionary_copy);
+  context->dictionary_copy = NULL;
+  Py_CLEAR (context->py_dictionary);
+  PyMem_Free (context->history);
+  context->history = NULL;
 
   /* Release python memory */
   PyMem_Free (context);
@@ -752,447 +996,1271 @@ destroy_py_context (PyObject * py_context)
 }
 
 
-/**************
- * Python API *
- **************/
-static PyObject *
-_create_context (PyObject * Py_UNUSED (self), PyObject * args, PyObject * kwds)
+/* Loads a dictionary into the HC state. LZ4_loadDictHC reinitializes the
+ * state, keeping only the compression level, so favorDecSpeed is set again. */
+static void
+load_dict_hc (stream_context_t * context, const char * dict, int dict_len)
 {
-  stream_context_t * context = NULL;
-
-  const char * direction = "";
-  const char * strategy_name = "";
-  unsigned int buffer_size;
-
-  buffer_strategy_e strategy = BUFFER_STRATEGY_COUNT;
-  const char * mode = "default";
-  int acceleration = 1;
-  int compression_level = 9;
-  int store_comp_size = 4;
-  int return_bytearray = 0;
-  Py_buffer dict = { NULL, NULL, };
+  LZ4_loadDictHC (context->lz4_state.compress.hc, dict, dict_len);
+  if (context->config.favor_dec_speed)
+    {
+      LZ4_favorDecompressionSpeed (context->lz4_state.compress.hc, 1);
+    }
+}
 
-  int status = 0;
-  unsigned int total_size = 0;
-  uint32_t store_max_size;
+/* Makes the decompression state continue from the dict_len bytes at dict, and
+ * tracks them as the decoded data. */
+static int
+set_stream_decode (stream_context_t * context, const char * dict, int dict_len)
+{
+  context->decoded.prefix_end = dict_len > 0 ? dict + dict_len : NULL;
+  context->decoded.prefix_len = (size_t) dict_len;
+  context->decoded.external = NULL;
+  context->decoded.external_len = 0;
 
-  static char * argnames[] = {
-    "strategy",
-    "direction",
-    "buffer_size",
-    "mode",
-    "acceleration",
-    "compression_level",
-    "return_bytearray",
-    "store_comp_size",
-    "dictionary",
-    NULL
-  };
+  return LZ4_setStreamDecode (context->lz4_state.decompress, dict, dict_len);
+}
 
-  if (!PyArg_ParseTupleAndKeywords (args, kwds, "ssI|sIIpIz*", argnames,
-                                    &strategy_name, &direction, &buffer_size,
-                                    &mode, &acceleration, &compression_level, &return_bytearray,
-                                    &store_comp_size, &dict))
-    {
-      goto abort_now;
-    }
+/* Decompresses a block into dest, continuing the stream, and tracks where the
+ * decoded data lies: decoding into the end of the current segment extends it,
+ * and decoding anywhere else starts a new one. Returns the decompressed size,
+ * or a negative LZ4 error code. Safe to call with the GIL released. */
+static int
+decompress_continue (stream_context_t * context, const char * source,
+                     char * dest, int source_size, int dest_size)
+{
+  int result = LZ4_decompress_safe_continue (context->lz4_state.decompress,
+                                             source, dest, source_size,
+                                             dest_size);
 
-  /* Sanity checks on arguments */
-  if (dict.len > INT_MAX)
+  if (result <= 0)
     {
-      PyErr_Format (PyExc_OverflowError,
-                    "Dictionary too large for LZ4 API");
-      goto abort_now;
+      return result;
     }
 
-  /* Input max length limited to 0x7E000000 (2 113 929 216 bytes < 2GiB).
-   *   https://github.com/lz4/lz4/blob/dev/lib/lz4.h#L161
-   *
-   * So, restrict the block length bitwise to 32 (signed 32 bit integer). */
-  if ((store_comp_size != 0) && (store_comp_size != 1) &&
-      (store_comp_size != 2) && (store_comp_size != 4))
+  if (context->decoded.prefix_len > 0 && context->decoded.prefix_end != dest)
     {
-      PyErr_Format (PyExc_ValueError,
-                    "Invalid store_comp_size, valid values: 0, 1, 2 or 4");
-      goto abort_now;
+      context->decoded.external_len = context->decoded.prefix_len;
+      context->decoded.external =
+        context->decoded.prefix_end - context->decoded.prefix_len;
+      context->decoded.prefix_len = 0;
     }
-
-  context = (stream_context_t *) PyMem_Malloc (sizeof (stream_context_t));
-  if (context == NULL)
+  if (context->decoded.prefix_len == 0)
     {
-      PyErr_NoMemory ();
-      goto abort_now;
+      context->decoded.prefix_end = dest;
     }
+  context->decoded.prefix_end += result;
+  context->decoded.prefix_len += (size_t) result;
 
-  memset (context, 0x00, sizeof (stream_context_t));
+  return result;
+}
 
-  /* Set buffer strategy */
-  if (!strncmp (strategy_name, "double_buffer", sizeof ("double_buffer")))
+/* Makes the lz4 state continue from the history_len bytes of history in the
+ * context's history buffer. */
+static void
+load_history (stream_context_t * context, int history_len)
+{
+  if (context->config.direction == DECOMPRESS)
     {
-      strategy = DOUBLE_BUFFER;
+      set_stream_decode (context, context->history, history_len);
     }
-  else if (!strncmp (strategy_name, "ring_buffer", sizeof ("ring_buffer")))
+  else if (context->config.comp == HIGH_COMPRESSION)
     {
-      strategy = RING_BUFFER;
+      load_dict_hc (context, context->history, history_len);
     }
   else
     {
-      PyErr_Format (PyExc_ValueError,
-                    "Invalid strategy argument: %s. Must be one of: double_buffer, ring_buffer",
-                    strategy_name);
-      goto abort_now;
+      LZ4_loadDict (context->lz4_state.compress.fast,
+                    context->history, history_len);
     }
+}
 
-  /* Set direction */
-  if (!strncmp (direction, "compress", sizeof ("compress")))
-    {
-      context->config.direction = COMPRESS;
-    }
-  else if (!strncmp (direction, "decompress", sizeof ("decompress")))
-    {
-      context->config.direction = DECOMPRESS;
-    }
-  else
+/* Copies the last 64 kB of the stream into the context's history buffer, and
+ * returns its length, or -1 with an exception set. */
+static int
+save_history (stream_context_t * context)
+{
+  int history_len = 0;
+
+  if (context->history == NULL)
     {
-      PyErr_Format (PyExc_ValueError,
-                    "Invalid direction argument: %s. Must be one of: compress, decompress",
-                    direction);
-      goto abort_now;
+      context->history = PyMem_Malloc (DICTIONARY_SIZE_MAX);
+      if (context->history == NULL)
+        {
+          PyErr_NoMemory ();
+          return -1;
+        }
     }
 
-  /* Set compression mode */
-  if (!strncmp (mode, "default", sizeof ("default")))
+  if (context->config.direction == DECOMPRESS)
     {
-      context->config.comp = DEFAULT;
+      /* There's no LZ4_saveDict for decompression, so the history is taken
+       * from the segments of decoded data tracked by the context, which lie
+       * in its pages and dictionary. */
+      size_t prefix_len = context->decoded.prefix_len;
+      size_t external_len = 0;
+
+      if (prefix_len > DICTIONARY_SIZE_MAX)
+        {
+          prefix_len = DICTIONARY_SIZE_MAX;
+        }
+      else if (context->decoded.external != NULL)
+        {
+          external_len = context->decoded.external_len;
+          if (external_len > DICTIONARY_SIZE_MAX - prefix_len)
+            {
+              external_len = DICTIONARY_SIZE_MAX - prefix_len;
+            }
+          memmove (context->history,
+                   context->decoded.external + context->decoded.external_len
+                   - external_len,
+                   external_len);
+        }
+
+      if (prefix_len > 0)
+        {
+          memmove (context->history + external_len,
+                   context->decoded.prefix_end - prefix_len, prefix_len);
+        }
+      history_len = (int) (external_len + prefix_len);
     }
-  else if (!strncmp (mode, "fast", sizeof ("fast")))
+  else if (context->dictionary_attached)
     {
-      context->config.comp = FAST;
+      stream_dictionary_t * prepared = (stream_dictionary_t *)
+        PyCapsule_GetPointer (context->py_dictionary, stream_dictionary_capsule_name);
+
+      memcpy (context->history, prepared->buf, prepared->len);
+      history_len = prepared->len;
     }
-  else if (!strncmp (mode, "high_compression", sizeof ("high_compression")))
+  else if (context->config.comp == HIGH_COMPRESSION)
     {
-      context->config.comp = HIGH_COMPRESSION;
+      /* LZ4_saveDict(HC) moves the history and makes the stream reference it
+       * there, which is why the buffer is kept by the context. */
+      history_len = LZ4_saveDictHC (context->lz4_state.compress.hc,
+                                    context->history, DICTIONARY_SIZE_MAX);
     }
   else
     {
-      PyErr_Format (PyExc_ValueError,
-                    "Invalid mode argument: %s. Must be one of: default, fast, high_compression",
-                    mode);
-      goto abort_now;
+      history_len = LZ4_saveDict (context->lz4_state.compress.fast,
+                                  context->history, DICTIONARY_SIZE_MAX);
     }
 
-  /* Initialize the output buffer
-   *
-   * In out-of-band block size case, use a best-effort strategy for scaling
-   * buffers.
-   */
-  if (store_comp_size == 0)
+  return history_len;
+}
+
+/* Releases the lz4 state and the buffers of a context, keeping only the last
+ * 64 kB of the stream. Returns 0, or -1 with an exception set. */
+static int
+hibernate_context (stream_context_t * context)
+{
+  char * history;
+  int history_len;
+
+  if (context->hibernating)
     {
-      store_max_size = _GET_MAX_UINT32(4);
+      return 0;
     }
-  else
+
+  history_len = save_history (context);
+  if (history_len < 0)
     {
-      store_max_size = _GET_MAX_UINT32(store_comp_size);
+      return -1;
     }
 
-  if (context->config.direction == COMPRESS)
+  release_context_resources (context);
+
+  /* The history now holds everything that's needed from the dictionary. */
+  PyMem_Free (context->dictionary_copy);
+  context->dictionary_copy = NULL;
+  Py_CLEAR (context->py_dictionary);
+  context->dictionary_attached = 0;
+
+  /* Keep the larger buffer if it can't be shrunk. */
+  history = PyMem_Realloc (context->history, history_len > 0 ? history_len : 1);
+  if (history != NULL)
     {
-      context->output.len = get_compress_bound (buffer_size);
-      total_size = context->output.len + store_comp_size;
+      context->history = history;
+    }
 
-      if (context->output.len == 0)
-        {
-          PyErr_Format (PyExc_ValueError,
-                        "Invalid buffer_size argument: %u. Cannot define output buffer size. "
-                        "Must be lesser or equal to %u",
-                        buffer_size, LZ4_MAX_INPUT_SIZE);
-          goto abort_now;
-        }
+  context->history_len = history_len;
+  context->hibernating = 1;
 
-      /* Assert the output buffer size and the store_comp_size values are consistent */
-      if (context->output.len > store_max_size)
-        {
-          /* The maximal/"worst case" compressed data length cannot fit in the
-           * store_comp_size bytes. */
-          PyErr_Format (LZ4StreamError,
-                        "Inconsistent buffer_size/store_comp_size values. "
-                        "Maximal compressed length (%u) cannot fit in a %u byte-long integer",
-                        buffer_size, store_comp_size);
-          goto abort_now;
-        }
+  return 0;
+}
+
+/* Reallocates the lz4 state and the buffers of a hibernating context, and
+ * loads its history. Returns 0, or -1 with an exception set, in which case the
+ * context is still hibernating. */
+static int
+wake_context (stream_context_t * context)
+{
+  char * history;
+
+  if (!context->hibernating)
+    {
+      return 0;
     }
-  else /* context->config.direction == DECOMPRESS */
+
+  history = PyMem_Realloc (context->history, DICTIONARY_SIZE_MAX);
+  if (history == NULL)
     {
-      if (store_max_size > LZ4_MAX_INPUT_SIZE)
-        {
-          store_max_size = LZ4_MAX_INPUT_SIZE;
-        }
+      PyErr_NoMemory ();
+      return -1;
+    }
+  context->history = history;
 
-      context->output.len = buffer_size;
-      total_size = context->output.len;
+  if (reserve_context_resources (context) != 0)
+    {
+      release_context_resources (context);
+      return -1;
+    }
 
-      /* Here we cannot assert the maximal theoretical decompressed chunk length
-       * will fit in one page of the double_buffer, i.e.:
-       *    assert( !(double_buffer.page_size < _LZ4_inputBound(store_max_size)) )
-       *
-       * Doing such a check would require aligning the page_size on the maximal
-       * value of the store_comp_size prefix, i.e.:
-       *    page_size = 256B if store_comp_size == 1
-       *    page_size = 64KB if store_comp_size == 2
-       *    page_size = 4GB if store_comp_size == 4
-       *
-       * This constraint is too strict, so is not implemented.
-       *
-       * On the other hand, the compression logic tells the page size cannot be
-       * larger than the maximal value fitting in store_comp_size bytes.
-       * So here, the check could be checking the page_size is smaller or equal
-       * to the maximal decompressed chunk length, i.e.:
-       *    assert( !(double_buffer.page_size > _LZ4_inputBound(store_max_size)) )
-       *
-       * But this check is not really relevant and could bring other limitations.
-       *
-       * So, on the decompression case, no check regarding the page_size and the
-       * store_comp_size values can reliably be done during the LZ4 context
-       * initialization, they will be deferred in the decompression process.
-       */
+  load_history (context, context->history_len);
+  context->hibernating = 0;
+
+  return 0;
+}
+
+/* Returns the context held by py_context, or NULL with an exception set. A
+ * hibernating context is woken up if wake is set. */
+static stream_context_t *
+get_context (PyObject * py_context, int wake)
+{
+  stream_context_t * context = _PyCapsule_get_context (py_context);
+
+  if ((context == NULL) ||
+      ((context->lz4_state.context == NULL) && !context->hibernating))
+    {
+      PyErr_SetString (PyExc_ValueError, "No valid LZ4 stream context supplied");
+      return NULL;
     }
 
-  /* Set all remaining settings in the context */
-  context->config.store_comp_size = store_comp_size;
-  context->config.acceleration = acceleration;
-  context->config.compression_level = compression_level;
-  context->config.return_bytearray = !!return_bytearray;
+  if (wake && wake_context (context) != 0)
+    {
+      return NULL;
+    }
 
-  /* Set internal resources related to the buffer strategy */
-  context->strategy.ops = &strategy_ops[strategy];
+  return context;
+}
 
-  status = context->strategy.ops->reserve_resources (context, buffer_size);
-  if (status != 0)
+static int
+parse_compression_mode (const char * mode, compression_type_e * comp)
+{
+  if (!strncmp (mode, "default", sizeof ("default")))
     {
-      /* Python exception already set in the strategy's resource creation helper */
-      goto abort_now;
+      *comp = DEFAULT;
+    }
+  else if (!strncmp (mode, "fast", sizeof ("fast")))
+    {
+      *comp = FAST;
+    }
+  else if (!strncmp (mode, "high_compression", sizeof ("high_compression")))
+    {
+      *comp = HIGH_COMPRESSION;
+    }
+  else
+    {
+      PyErr_Format (PyExc_ValueError,
+                    "Invalid mode argument: %s. Must be one of: default, fast, high_compression",
+                    mode);
+      return -1;
     }
 
-  /* Set output buffer */
-  context->output.buf = PyMem_Malloc (total_size * sizeof (* (context->output.buf)));
-  if (context->output.buf == NULL)
+  return 0;
+}
+
+/* Returns a copy of the part of the dictionary LZ4 uses, or NULL with an
+ * exception set. */
+static char *
+copy_dictionary (const Py_buffer * dict, int * len)
+{
+  const char * start = (const char *) dict->buf;
+  char * copy;
+
+  *len = (int) dict->len;
+  if (*len > DICTIONARY_SIZE_MAX)
     {
-      PyErr_Format (PyExc_MemoryError,
-                    "Could not allocate output buffer");
-      goto abort_now;
+      start += *len - DICTIONARY_SIZE_MAX;
+      *len = DICTIONARY_SIZE_MAX;
     }
 
-  /* Initialize lz4 state */
-  if (context->config.direction == COMPRESS)
+  copy = PyMem_Malloc (*len > 0 ? *len : 1);
+  if (copy == NULL)
     {
-      if (context->config.comp == HIGH_COMPRESSION)
-        {
-          context->lz4_state.compress.hc = LZ4_createStreamHC ();
-          if (context->lz4_state.compress.hc == NULL)
-            {
-              PyErr_Format (PyExc_MemoryError,
-                            "Could not create LZ4 state");
-              goto abort_now;
-            }
+      PyErr_NoMemory ();
+      return NULL;
+    }
+  memcpy (copy, start, *len);
 
-            reset_stream_hc (context->lz4_state.compress.hc, context->config.compression_level);
+  return copy;
+}
 
-          if (dict.len > 0)
-            {
-              LZ4_loadDictHC (context->lz4_state.compress.hc, dict.buf, dict.len);
-            }
+static void
+destroy_dictionary (stream_dictionary_t * dictionary)
+{
+  if (dictionary == NULL)
+    {
+      return;
+    }
+
+  if (dictionary->lz4_state.context != NULL)
+    {
+      if (dictionary->comp == HIGH_COMPRESSION)
+        {
+          LZ4_freeStreamHC (dictionary->lz4_state.hc);
         }
       else
         {
-          context->lz4_state.compress.fast = LZ4_createStream ();
-          if (context->lz4_state.compress.fast == NULL)
-            {
-              PyErr_Format (PyExc_MemoryError,
-                            "Could not create LZ4 state");
-              goto abort_now;
-            }
+          LZ4_freeStream (dictionary->lz4_state.fast);
+        }
+    }
 
-          reset_stream (context->lz4_state.compress.fast);
+  PyMem_Free (dictionary->buf);
+  PyMem_Free (dictionary);
+}
 
-          if (dict.len > 0)
-            {
-              LZ4_loadDict (context->lz4_state.compress.fast, dict.buf, dict.len);
-            }
-        }
+static void
+destroy_py_dictionary (PyObject * py_dictionary)
+{
+  destroy_dictionary ((stream_dictionary_t *)
+                      PyCapsule_GetPointer (py_dictionary, stream_dictionary_capsule_name));
+}
+
+
+/**************
+ * Python API *
+ **************/
+static PyObject *
+_create_dictionary (PyObject * Py_UNUSED (self), PyObject * args, PyObject * kwds)
+{
+  stream_dictionary_t * dictionary = NULL;
+  const char * mode = "default";
+  Py_buffer dict = { NULL, NULL, };
+  static char * argnames[] = {
+    "dictionary",
+    "mode",
+    NULL
+  };
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "z*|s", argnames,
+                                    &dict, &mode))
+    {
+      return NULL;
     }
-  else /* context->config.direction == DECOMPRESS */
+
+  dictionary = (stream_dictionary_t *) PyMem_Malloc (sizeof (stream_dictionary_t));
+  if (dictionary == NULL)
     {
-      context->lz4_state.decompress = LZ4_createStreamDecode ();
-      if (context->lz4_state.decompress == NULL)
+      PyErr_NoMemory ();
+      goto abort_now;
+    }
+
+  memset (dictionary, 0x00, sizeof (stream_dictionary_t));
+
+  if (parse_compression_mode (mode, &dictionary->comp) != 0)
+    {
+      goto abort_now;
+    }
+
+  dictionary->buf = copy_dictionary (&dict, &dictionary->len);
+  if (dictionary->buf == NULL)
+    {
+      goto abort_now;
+    }
+
+  /* Hash the dictionary once, for the contexts to attach. */
+  if (dictionary->comp == HIGH_COMPRESSION)
+    {
+      dictionary->lz4_state.hc = LZ4_createStreamHC ();
+      if (dictionary->lz4_state.hc == NULL)
         {
           PyErr_Format (PyExc_MemoryError,
                         "Could not create LZ4 state");
           goto abort_now;
         }
 
-      if (!LZ4_setStreamDecode (context->lz4_state.decompress, dict.buf, dict.len))
+      TRACE_BEGIN_ALLOW_THREADS
+      LZ4_loadDictHC (dictionary->lz4_state.hc, dictionary->buf, dictionary->len);
+      TRACE_END_ALLOW_THREADS
+    }
+  else
+    {
+      dictionary->lz4_state.fast = LZ4_createStream ();
+      if (dictionary->lz4_state.fast == NULL)
         {
-          PyErr_Format (PyExc_RuntimeError,
-                        "Could not initialize LZ4 state");
-          LZ4_freeStreamDecode (context->lz4_state.decompress);
+          PyErr_Format (PyExc_MemoryError,
+                        "Could not create LZ4 state");
           goto abort_now;
         }
+
+      TRACE_BEGIN_ALLOW_THREADS
+      LZ4_loadDict (dictionary->lz4_state.fast, dictionary->buf, dictionary->len);
+      TRACE_END_ALLOW_THREADS
     }
 
   PyBuffer_Release (&dict);
 
-  return PyCapsule_New (context, stream_context_capsule_name, destroy_py_context);
+  return PyCapsule_New (dictionary, stream_dictionary_capsule_name, destroy_py_dictionary);
 
 abort_now:
   if (dict.buf != NULL)
     {
       PyBuffer_Release (&dict);
     }
-  destroy_context (context);
+  destroy_dictionary (dictionary);
 
   return NULL;
 }
 
 static PyObject *
-_compress_bound (PyObject * Py_UNUSED (self), PyObject * args)
+_create_context (PyObject * Py_UNUSED (self), PyObject * args, PyObject * kwds)
 {
-  PyObject * py_dest = NULL;
-  uint32_t input_size;
+  stream_context_t * context = NULL;
+
+  const char * direction = "";
+  const char * strategy_name = "";
+  unsigned int buffer_size;
 
+  buffer_strategy_e strategy = BUFFER_STRATEGY_COUNT;
+  const char * mode = "default";
+  int acceleration = 1;
+  int compression_level = 9;
+  int store_comp_size = 4;
+  int return_bytearray = 0;
+  int favor_dec_speed = 0;
+  Py_buffer dict = { NULL, NULL, };
+  PyObject * py_dictionary = Py_None;
+  stream_dictionary_t * prepared = NULL;
+  const char * dict_buf = NULL;
+  int dict_len = 0;
 
-  /* Positional arguments: input_size
-   * Keyword arguments   : none
-   */
-  if (!PyArg_ParseTuple (args, "OI", &input_size))
+  int status = 0;
+  uint32_t store_max_size;
+
+  static char * argnames[] = {
+    "strategy",
+    "direction",
+    "buffer_size",
+    "mode",
+    "acceleration",
+    "compression_level",
+    "return_bytearray",
+    "store_comp_size",
+    "dictionary",
+    "favor_decompression_speed",
+    "prepared_dictionary",
+    NULL
+  };
+
+  if (!PyArg_ParseTupleAndKeywords (args, kwds, "ssI|sIIpIz*pO", argnames,
+                                    &strategy_name, &direction, &buffer_size,
+                                    &mode, &acceleration, &compression_level, &return_bytearray,
+                                    &store_comp_size, &dict, &favor_dec_speed,
+                                    &py_dictionary))
+    {
+      goto abort_now;
+    }
+
+  if (py_dictionary != Py_None)
+    {
+      prepared = (stream_dictionary_t *)
+        PyCapsule_GetPointer (py_dictionary, stream_dictionary_capsule_name);
+      if (prepared == NULL)
+        {
+          goto abort_now;
+        }
+
+      if (dict.len > 0)
+        {
+          PyErr_SetString (PyExc_ValueError,
+                           "dictionary and prepared_dictionary cannot both be specified");
+          goto abort_now;
+        }
+    }
+
+  /* Sanity checks on arguments */
+  if (dict.len > INT_MAX)
+    {
+      PyErr_Format (PyExc_OverflowError,
+                    "Dictionary too large for LZ4 API");
+      goto abort_now;
+    }
+
+  /* Input max length limited to 0x7E000000 (2 113 929 216 bytes < 2GiB).
+   *   https://github.com/lz4/lz4/blob/dev/lib/lz4.h#L161
+   *
+   * So, restrict the block length bitwise to 32 (signed 32 bit integer). */
+  if ((store_comp_size != 0) && (store_comp_size != 1) &&
+      (store_comp_size != 2) && (store_comp_size != 4))
+    {
+      PyErr_Format (PyExc_ValueError,
+                    "Invalid store_comp_size, valid values: 0, 1, 2 or 4");
+      goto abort_now;
+    }
+
+  context = (stream_context_t *) PyMem_Malloc (sizeof (stream_context_t));
+  if (context == NULL)
+    {
+      PyErr_NoMemory ();
+      goto abort_now;
+    }
+
+  memset (context, 0x00, sizeof (stream_context_t));
+
+  /* Set buffer strategy */
+  if (!strncmp (strategy_name, "double_buffer", sizeof ("double_buffer")))
+    {
+      strategy = DOUBLE_BUFFER;
+    }
+  else if (!strncmp (strategy_name, "ring_buffer", sizeof ("ring_buffer")))
+    {
+      strategy = RING_BUFFER;
+    }
+  else
+    {
+      PyErr_Format (PyExc_ValueError,
+                    "Invalid strategy argument: %s. Must be one of: double_buffer, ring_buffer",
+                    strategy_name);
+      goto abort_now;
+    }
+
+  /* Set direction */
+  if (!strncmp (direction, "compress", sizeof ("compress")))
+    {
+      context->config.direction = COMPRESS;
+    }
+  else if (!strncmp (direction, "decompress", sizeof ("decompress")))
+    {
+      context->config.direction = DECOMPRESS;
+    }
+  else
+    {
+      PyErr_Format (PyExc_ValueError,
+                    "Invalid direction argument: %s. Must be one of: compress, decompress",
+                    direction);
+      goto abort_now;
+    }
+
+  /* Set compression mode */
+  if (parse_compression_mode (mode, &context->config.comp) != 0)
+    {
+      goto abort_now;
+    }
+
+  /* Initialize the output buffer
+   *
+   * In out-of-band block size case, use a best-effort strategy for scaling
+   * buffers.
+   */
+  if (store_comp_size == 0)
+    {
+      store_max_size = _GET_MAX_UINT32(4);
+    }
+  else
+    {
+      store_max_size = _GET_MAX_UINT32(store_comp_size);
+    }
+
+  if (context->config.direction == COMPRESS)
+    {
+      context->output.len = get_compress_bound (buffer_size);
+
+      if (context->output.len == 0)
+        {
+          PyErr_Format (PyExc_ValueError,
+                        "Invalid buffer_size argument: %u. Cannot define output buffer size. "
+                        "Must be lesser or equal to %u",
+                        buffer_size, LZ4_MAX_INPUT_SIZE);
+          goto abort_now;
+        }
+
+      /* Assert the output buffer size and the store_comp_size values are consistent */
+      if (context->output.len > store_max_size)
+        {
+          /* The maximal/"worst case" compressed data length cannot fit in the
+           * store_comp_size bytes. */
+          PyErr_Format (LZ4StreamError,
+                        "Inconsistent buffer_size/store_comp_size values. "
+                        "Maximal compressed length (%u) cannot fit in a %u byte-long integer",
+                        buffer_size, store_comp_size);
+          goto abort_now;
+        }
+    }
+  else /* context->config.direction == DECOMPRESS */
+    {
+      if (store_max_size > LZ4_MAX_INPUT_SIZE)
+        {
+          store_max_size = LZ4_MAX_INPUT_SIZE;
+        }
+
+      context->output.len = buffer_size;
+
+      /* Here we cannot assert the maximal theoretical decompressed chunk length
+       * will fit in one page of the double_buffer, i.e.:
+       *    assert( !(double_buffer.page_size < _LZ4_inputBound(store_max_size)) )
+       *
+       * Doing such a check would require aligning the page_size on the maximal
+       * value of the store_comp_size prefix, i.e.:
+       *    page_size = 256B if store_comp_size == 1
+       *    page_size = 64KB if store_comp_size == 2
+       *    page_size = 4GB if store_comp_size == 4
+       *
+       * This constraint is too strict, so is not implemented.
+       *
+       * On the other hand, the compression logic tells the page size cannot be
+       * larger than the maximal value fitting in store_comp_size bytes.
+       * So here, the check could be checking the page_size is smaller or equal
+       * to the maximal decompressed chunk length, i.e.:
+       *    assert( !(double_buffer.page_size > _LZ4_inputBound(store_max_size)) )
+       *
+       * But this check is not really relevant and could bring other limitations.
+       *
+       * So, on the decompression case, no check regarding the page_size and the
+       * store_comp_size values can reliably be done during the LZ4 context
+       * initialization, they will be deferred in the decompression process.
+       */
+    }
+
+  /* Set all remaining settings in the context */
+  context->config.buffer_size = buffer_size;
+  context->config.store_comp_size = store_comp_size;
+  context->config.acceleration = acceleration;
+  context->config.compression_level = compression_level;
+  context->config.return_bytearray = !!return_bytearray;
+  context->config.favor_dec_speed = !!favor_dec_speed;
+
+  /* LZ4 references the dictionary for as long as the stream uses it, so the
+   * context keeps either its own copy or the prepared dictionary. */
+  if (prepared != NULL)
+    {
+      Py_INCREF (py_dictionary);
+      context->py_dictionary = py_dictionary;
+      dict_buf = prepared->buf;
+      dict_len = prepared->len;
+    }
+  else if (dict.len > 0)
+    {
+      context->dictionary_copy = copy_dictionary (&dict, &dict_len);
+      if (context->dictionary_copy == NULL)
+        {
+          goto abort_now;
+        }
+      dict_buf = context->dictionary_copy;
+    }
+
+  /* Set internal resources related to the buffer strategy */
+  context->strategy.ops = &strategy_ops[strategy];
+
+  status = reserve_context_resources (context);
+  if (status != 0)
+    {
+      goto abort_now;
+    }
+
+  /* Load the dictionary */
+  if (context->config.direction == COMPRESS)
+    {
+      if (context->config.comp == HIGH_COMPRESSION)
+        {
+          if (prepared != NULL && prepared->comp == HIGH_COMPRESSION &&
+              has_attach_hc_dictionary ())
+            {
+              LZ4_attach_HC_dictionary (context->lz4_state.compress.hc,
+                                        prepared->lz4_state.hc);
+              context->dictionary_attached = 1;
+            }
+          else if (dict_len > 0)
+            {
+              load_dict_hc (context, dict_buf, dict_len);
+            }
+        }
+      else
+        {
+          if (prepared != NULL && prepared->comp != HIGH_COMPRESSION &&
+              has_attach_dictionary ())
+            {
+              LZ4_attach_dictionary (context->lz4_state.compress.fast,
+                                     prepared->lz4_state.fast);
+              context->dictionary_attached = 1;
+            }
+          else if (dict_len > 0)
+            {
+              LZ4_loadDict (context->lz4_state.compress.fast, dict_buf, dict_len);
+            }
+        }
+    }
+  else /* context->config.direction == DECOMPRESS */
+    {
+      if (!set_stream_decode (context, dict_buf, dict_len))
+        {
+          PyErr_Format (PyExc_RuntimeError,
+                        "Could not initialize LZ4 state");
+          goto abort_now;
+        }
+    }
+
+  PyBuffer_Release (&dict);
+
+  return PyCapsule_New (context, stream_context_capsule_name, destroy_py_context);
+
+abort_now:
+  if (dict.buf != NULL)
+    {
+      PyBuffer_Release (&dict);
+    }
+  destroy_context (context);
+
+  return NULL;
+}
+
+static PyObject *
+_set_compression_level (PyObject * Py_UNUSED (self), PyObject * args)
+{
+  stream_context_t * context = NULL;
+  PyObject * py_context = NULL;
+  int compression_level;
+
+  /* Positional arguments: capsule_context, compression_level
+   * Keyword arguments   : none
+   */
+  if (!PyArg_ParseTuple (args, "Oi", &py_context, &compression_level))
+    {
+      return NULL;
+    }
+
+  context = get_context (py_context, 1);
+  if (context == NULL)
+    {
+      return NULL;
+    }
+
+  if ((context->config.direction != COMPRESS) ||
+      (context->config.comp != HIGH_COMPRESSION))
+    {
+      PyErr_SetString (PyExc_ValueError,
+                       "Compression level can only be changed on a high_compression compression context");
+      return NULL;
+    }
+
+  if (!has_set_compression_level ())
+    {
+      PyErr_SetString (PyExc_RuntimeError,
+                       "Changing the compression level not supported by LZ4 library version");
+      return NULL;
+    }
+
+  /* The stream history is kept, so subsequent blocks may still reference
+   * data compressed with the previous level. */
+  LZ4_setCompressionLevel (context->lz4_state.compress.hc, compression_level);
+  context->config.compression_level = compression_level;
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *
+_compress_bound (PyObject * Py_UNUSED (self), PyObject * args)
+{
+  PyObject * py_dest = NULL;
+  uint32_t input_size;
+
+
+  /* Positional arguments: input_size
+   * Keyword arguments   : none
+   */
+  if (!PyArg_ParseTuple (args, "OI", &input_size))
+    {
+      goto exit_now;
+    }
+
+  py_dest = PyLong_FromUnsignedLong (get_compress_bound (input_size));
+
+  if (py_dest == NULL)
+    {
+      PyErr_NoMemory ();
+    }
+
+exit_now:
+  return py_dest;
+}
+
+static PyObject *
+_input_bound (PyObject * Py_UNUSED (self), PyObject * args)
+{
+  PyObject * py_dest = NULL;
+  uint32_t compress_max_size;
+
+  /* Positional arguments: compress_max_size
+   * Keyword arguments   : none
+   */
+  if (!PyArg_ParseTuple (args, "I", &compress_max_size))
+    {
+      goto exit_now;
+    }
+
+  py_dest = PyLong_FromUnsignedLong (get_input_bound (compress_max_size));
+
+  if (py_dest == NULL)
+    {
+      PyErr_NoMemory ();
+    }
+
+exit_now:
+  return py_dest;
+}
+
+static inline int
+_compress_generic (stream_context_t * lz4_ctxt, char * source, int source_size,
+                  char * dest, int dest_size)
+{
+  int comp_len;
+
+  if (lz4_ctxt->config.comp == HIGH_COMPRESSION)
+    {
+      LZ4_streamHC_t * lz4_state = lz4_ctxt->lz4_state.compress.hc;
+
+      comp_len = LZ4_compress_HC_continue (lz4_state, source, dest, source_size, dest_size);
+    }
+  else
+    {
+      LZ4_stream_t * lz4_state = lz4_ctxt->lz4_state.compress.fast;
+      int acceleration = (lz4_ctxt->config.comp != FAST)
+                          ? 1 /* defaults */
+                          : lz4_ctxt->config.acceleration;
+
+      comp_len = LZ4_compress_fast_continue (lz4_state, source, dest, source_size, dest_size,
+                                             acceleration);
+    }
+
+  return comp_len;
+}
+
+#ifdef inline
+#undef inline
+#endif
+
+static PyObject *
+_compress (PyObject * Py_UNUSED (self), PyObject * const * args,
+           Py_ssize_t nargs)
+{
+  stream_context_t * context = NULL;
+  PyObject * py_context = NULL;
+  PyObject * py_dest = NULL;
+  int output_size;
+  Py_buffer source = { NULL, NULL, };
+  static char * argnames[] = { "context", "source", NULL };
+
+  /* Positional arguments: capsule_context, source
+   * Keyword arguments   : none
+   */
+  if (!parse_fastcall_args (args, nargs, NULL, "_compress", "Oy*", argnames,
+                            &py_context, &source))
+    {
+      goto exit_now;
+    }
+
+  context = get_context (py_context, 1);
+  if (context == NULL)
+    {
+      goto exit_now;
+    }
+
+  if (source.len > context->strategy.ops->get_work_buffer_size (context))
+    {
+      PyErr_SetString (PyExc_OverflowError,
+                       "Input too large for LZ4 API");
+      goto exit_now;
+    }
+
+  memcpy (context->strategy.ops->get_work_buffer (context), source.buf, source.len);
+
+  TRACE3 (stream__compress__entry, source.len, (int) context->config.comp,
+          TRACE_LEVEL (context));
+  TRACE_BEGIN_ALLOW_THREADS
+
+  output_size = _compress_generic (context,
+                                   context->strategy.ops->get_work_buffer (context),
+                                   source.len,
+                                   context->output.buf + context->config.store_comp_size,
+                                   context->output.len);
+
+  TRACE_END_ALLOW_THREADS
+  TRACE1 (stream__compress__return, output_size > 0 ? output_size : -1);
+
+  context->dictionary_attached = 0;
+
+  if (output_size <= 0)
+    {
+      /* No error code set in output_size! */
+      PyErr_SetString (LZ4StreamError,
+                       "Compression failed");
+      goto exit_now;
+    }
+
+  if (!store_block_length (output_size, context->config.store_comp_size, context->output.buf))
+    {
+      PyErr_SetString (LZ4StreamError,
+                       "Compressed stream size too large");
+      goto exit_now;
+    }
+
+  output_size += context->config.store_comp_size;
+
+  if (context->config.return_bytearray)
+    {
+      py_dest = PyByteArray_FromStringAndSize (context->output.buf, (Py_ssize_t) output_size);
+    }
+  else
+    {
+      py_dest = PyBytes_FromStringAndSize (context->output.buf, (Py_ssize_t) output_size);
+    }
+
+  if (py_dest == NULL)
+    {
+      PyErr_NoMemory ();
+      goto exit_now;
+    }
+
+  if (context->strategy.ops->update_context_after_process (context) != 0)
+    {
+      PyErr_Format (PyExc_RuntimeError, "Internal error");
+      goto exit_now;
+    }
+
+exit_now:
+  if (source.buf != NULL)
+    {
+      PyBuffer_Release (&source);
+    }
+
+  return py_dest;
+}
+
+static PyObject *
+_compress_many (PyObject * Py_UNUSED (self), PyObject * const * args,
+                Py_ssize_t nargs)
+{
+  stream_context_t * context = NULL;
+  PyObject * py_context = NULL;
+  PyObject * py_sources = NULL;
+  PyObject * py_dest = NULL;
+  struct buffer_list sources = { NULL, 0, 0, };
+  char * dest;
+  size_t dest_size = 0;
+  size_t offset = 0;
+  Py_ssize_t i;
+  int output_size = 0;
+  int failed = 0;
+  static char * argnames[] = { "context", "sources", NULL };
+
+  /* Positional arguments: capsule_context, sources
+   * Keyword arguments   : none
+   */
+  if (!parse_fastcall_args (args, nargs, NULL, "_compress_many", "OO", argnames,
+                            &py_context, &py_sources))
+    {
+      goto exit_now;
+    }
+
+  context = get_context (py_context, 1);
+  if (context == NULL)
+    {
+      goto exit_now;
+    }
+
+  /* Without in-band block sizes, the blocks couldn't be told apart. */
+  if (context->config.store_comp_size == 0)
+    {
+      PyErr_Format (LZ4StreamError,
+                    "LZ4 context is configured for storing block size out-of-band");
+      goto exit_now;
+    }
+
+  if (get_buffer_list (py_sources, PyBUF_SIMPLE, "_compress_many", "sources",
+                       &sources) < 0)
+    {
+      goto exit_now;
+    }
+
+  for (i = 0; i < sources.count; i++)
+    {
+      if (sources.views[i].len > context->strategy.ops->get_work_buffer_size (context))
+        {
+          PyErr_SetString (PyExc_OverflowError,
+                           "Input too large for LZ4 API");
+          goto exit_now;
+        }
+      dest_size += context->config.store_comp_size +
+        get_compress_bound ((uint32_t) sources.views[i].len);
+    }
+
+  if (dest_size > PY_SSIZE_T_MAX)
+    {
+      PyErr_SetString (PyExc_OverflowError,
+                       "Input too large for LZ4 API");
+      goto exit_now;
+    }
+
+  if (context->config.return_bytearray)
+    {
+      py_dest = PyByteArray_FromStringAndSize (NULL, (Py_ssize_t) dest_size);
+    }
+  else
+    {
+      py_dest = PyBytes_FromStringAndSize (NULL, (Py_ssize_t) dest_size);
+    }
+
+  if (py_dest == NULL)
+    {
+      PyErr_NoMemory ();
+      goto exit_now;
+    }
+
+  dest = context->config.return_bytearray ?
+    PyByteArray_AS_STRING (py_dest) : PyBytes_AS_STRING (py_dest);
+
+  /* All the chunks are compressed straight into the returned object, with
+   * the GIL released once. */
+  TRACE3 (stream__compress_many__entry, sources.total, (int) sources.count,
+          TRACE_LEVEL (context));
+  TRACE_BEGIN_ALLOW_THREADS
+
+  for (i = 0; i < sources.count; i++)
+    {
+      int source_size = (int) sources.views[i].len;
+      char * work_buffer = context->strategy.ops->get_work_buffer (context);
+
+      memcpy (work_buffer, sources.views[i].buf, source_size);
+
+      output_size = _compress_generic (context, work_buffer, source_size,
+                                       dest + offset + context->config.store_comp_size,
+                                       (int) get_compress_bound ((uint32_t) source_size));
+
+      if (output_size <= 0 ||
+          !store_block_length (output_size, context->config.store_comp_size, dest + offset))
+        {
+          failed = 1;
+          break;
+        }
+
+      offset += context->config.store_comp_size + output_size;
+      context->strategy.ops->update_context_after_process (context);
+    }
+
+  TRACE_END_ALLOW_THREADS
+  TRACE1 (stream__compress_many__return,
+          failed ? (long long) -1 : (long long) offset);
+
+  if (sources.count > 0)
+    {
+      context->dictionary_attached = 0;
+    }
+
+  if (failed)
     {
+      /* Not expected: each chunk is given room for its bound, which the
+       * context's configuration ensures fits in store_comp_size bytes. */
+      PyErr_SetString (LZ4StreamError,
+                       output_size <= 0 ? "Compression failed"
+                       : "Compressed stream size too large");
+      Py_CLEAR (py_dest);
       goto exit_now;
     }
 
-  py_dest = PyLong_FromUnsignedLong (get_compress_bound (input_size));
-
-  if (py_dest == NULL)
+  if (context->config.return_bytearray)
     {
-      PyErr_NoMemory ();
+      if (PyByteArray_Resize (py_dest, (Py_ssize_t) offset) != 0)
+        {
+          Py_CLEAR (py_dest);
+        }
+    }
+  else
+    {
+      _PyBytes_Resize (&py_dest, (Py_ssize_t) offset);
     }
 
 exit_now:
+  release_buffer_list (&sources);
+
   return py_dest;
 }
 
 static PyObject *
-_input_bound (PyObject * Py_UNUSED (self), PyObject * args)
+_get_block (PyObject * Py_UNUSED (self), PyObject * const * args,
+            Py_ssize_t nargs)
 {
+  stream_context_t * context = NULL;
+  PyObject * py_context = NULL;
   PyObject * py_dest = NULL;
-  uint32_t compress_max_size;
+  Py_buffer source = { NULL, NULL, };
+  static char * argnames[] = { "context", "source", NULL };
+  buffer_t block = { NULL, 0, };
 
-  /* Positional arguments: compress_max_size
+  /* Positional arguments: capsule_context, source
    * Keyword arguments   : none
    */
-  if (!PyArg_ParseTuple (args, "I", &compress_max_size))
+
+  if (!parse_fastcall_args (args, nargs, NULL, "_get_block", "Oy*", argnames,
+                            &py_context, &source))
     {
       goto exit_now;
     }
 
-  py_dest = PyLong_FromUnsignedLong (get_input_bound (compress_max_size));
+  context = get_context (py_context, 0);
+  if (context == NULL)
+    {
+      goto exit_now;
+    }
 
-  if (py_dest == NULL)
+  if (source.len > INT_MAX)
     {
-      PyErr_NoMemory ();
+      PyErr_Format (PyExc_OverflowError,
+                    "Input too large for LZ4 API");
+      goto exit_now;
     }
 
-exit_now:
-  return py_dest;
-}
+  if (context->config.store_comp_size == 0)
+    {
+      PyErr_Format (LZ4StreamError,
+                    "LZ4 context is configured for storing block size out-of-band");
+      goto exit_now;
+    }
 
-static inline int
-_compress_generic (stream_context_t * lz4_ctxt, char * source, int source_size,
-                  char * dest, int dest_size)
-{
-  int comp_len;
+  if (source.len < context->config.store_comp_size)
+    {
+      PyErr_Format (LZ4StreamError,
+                    "Invalid source, too small for holding any block");
+      goto exit_now;
+    }
 
-  if (lz4_ctxt->config.comp == HIGH_COMPRESSION)
+  block.buf = (char *) source.buf + context->config.store_comp_size;
+  block.len = load_block_length (context->config.store_comp_size, source.buf);
+
+  if ((source.len - context->config.store_comp_size) < block.len)
     {
-      LZ4_streamHC_t * lz4_state = lz4_ctxt->lz4_state.compress.hc;
+      PyErr_Format (LZ4StreamError,
+                    "Requested input size (%d) larger than source size (%ld)",
+                    block.len, (source.len - context->config.store_comp_size));
+      goto exit_now;
+    }
 
-      comp_len = LZ4_compress_HC_continue (lz4_state, source, dest, source_size, dest_size);
+  if (context->config.return_bytearray)
+    {
+      py_dest = PyByteArray_FromStringAndSize (block.buf, (Py_ssize_t) block.len);
     }
   else
     {
-      LZ4_stream_t * lz4_state = lz4_ctxt->lz4_state.compress.fast;
-      int acceleration = (lz4_ctxt->config.comp != FAST)
-                          ? 1 /* defaults */
-                          : lz4_ctxt->config.acceleration;
+      py_dest = PyBytes_FromStringAndSize (block.buf, (Py_ssize_t) block.len);
+    }
 
-      comp_len = LZ4_compress_fast_continue (lz4_state, source, dest, source_size, dest_size,
-                                             acceleration);
+  if (py_dest == NULL)
+    {
+      PyErr_NoMemory ();
     }
 
-  return comp_len;
-}
+exit_now:
+  if (source.buf != NULL)
+    {
+      PyBuffer_Release (&source);
+    }
 
-#ifdef inline
-#undef inline
-#endif
+  return py_dest;
+}
 
 static PyObject *
-_compress (PyObject * Py_UNUSED (self), PyObject * args)
+_decompress (PyObject * Py_UNUSED (self), PyObject * const * args,
+             Py_ssize_t nargs)
 {
   stream_context_t * context = NULL;
   PyObject * py_context = NULL;
   PyObject * py_dest = NULL;
-  int output_size;
+  int output_size = 0;
+  uint32_t source_size_max = 0;
   Py_buffer source = { NULL, NULL, };
+  static char * argnames[] = { "context", "source", NULL };
 
   /* Positional arguments: capsule_context, source
    * Keyword arguments   : none
    */
-  if (!PyArg_ParseTuple (args, "Oy*", &py_context, &source))
+  if (!parse_fastcall_args (args, nargs, NULL, "_decompress", "Oy*", argnames,
+                            &py_context, &source))
     {
       goto exit_now;
     }
 
-  context = _PyCapsule_get_context (py_context);
-  if ((context == NULL) || (context->lz4_state.context == NULL))
+  context = get_context (py_context, 1);
+  if (context == NULL)
     {
-      PyErr_SetString (PyExc_ValueError, "No valid LZ4 stream context supplied");
       goto exit_now;
     }
 
-  if (source.len > context->strategy.ops->get_work_buffer_size (context))
+  /* In out-of-band block size case, use a best-effort strategy for scaling
+   * buffers.
+   */
+  if (context->config.store_comp_size == 0)
     {
-      PyErr_SetString (PyExc_OverflowError,
-                       "Input too large for LZ4 API");
+      source_size_max = _GET_MAX_UINT32(4);
+    }
+  else
+    {
+      source_size_max = _GET_MAX_UINT32(context->config.store_comp_size);
+    }
+
+  if (source.len > source_size_max)
+    {
+      PyErr_Format (PyExc_OverflowError,
+                    "Source length (%ld) too large for LZ4 store_comp_size (%d) value",
+                    source.len, context->config.store_comp_size);
       goto exit_now;
     }
 
-  memcpy (context->strategy.ops->get_work_buffer (context), source.buf, source.len);
+  if ((get_input_bound (source.len) == 0) ||
+      (get_input_bound (source.len) > context->strategy.ops->get_dest_buffer_size (context)))
+    {
+      PyErr_Format (LZ4StreamError,
+                    "Maximal decompressed data (%d) cannot fit in LZ4 internal buffer (%u)",
+                    get_input_bound (source.len),
+                    context->strategy.ops->get_dest_buffer_size (context));
+      goto exit_now;
+    }
 
-  Py_BEGIN_ALLOW_THREADS
+  TRACE1 (stream__decompress__entry, source.len);
+  TRACE_BEGIN_ALLOW_THREADS
 
-  output_size = _compress_generic (context,
-                                   context->strategy.ops->get_work_buffer (context),
-                                   source.len,
-                                   context->output.buf + context->config.store_comp_size,
-                                   context->output.len);
+  output_size = decompress_continue (context,
+                                     (const char *) source.buf,
+                                     context->strategy.ops->get_work_buffer (context),
+                                     source.len,
+                                     context->strategy.ops->get_dest_buffer_size (context));
 
-  Py_END_ALLOW_THREADS
+  TRACE_END_ALLOW_THREADS
+  TRACE1 (stream__decompress__return, output_size);
 
-  if (output_size <= 0)
+  if (output_size < 0)
     {
-      /* No error code set in output_size! */
-      PyErr_SetString (LZ4StreamError,
-                       "Compression failed");
+      /* In case of LZ4 decompression error, output_size holds the error code */
+      PyErr_Format (LZ4StreamError,
+                    "Decompression failed. error: %d",
+                    -output_size);
       goto exit_now;
     }
 
-  if (!store_block_length (output_size, context->config.store_comp_size, context->output.buf))
+  if ((unsigned int) output_size > context->output.len)
     {
-      PyErr_SetString (LZ4StreamError,
-                       "Compressed stream size too large");
+      output_size = -1;
+      PyErr_Format (PyExc_OverflowError,
+                    "Decompressed stream too large for LZ4 API");
       goto exit_now;
     }
 
-  output_size += context->config.store_comp_size;
+  memcpy (context->output.buf,
+          context->strategy.ops->get_work_buffer (context),
+          output_size);
+
+  if ( context->strategy.ops->update_context_after_process (context) != 0)
+    {
+      PyErr_Format (PyExc_RuntimeError, "Internal error");
+      goto exit_now;
+    }
 
   if (context->config.return_bytearray)
     {
@@ -1206,220 +2274,370 @@ _compress (PyObject * Py_UNUSED (self), PyObject * args)
   if (py_dest == NULL)
     {
       PyErr_NoMemory ();
+    }
+
+exit_now:
+  if (source.buf != NULL)
+    {
+      PyBuffer_Release (&source);
+    }
+
+  return py_dest;
+}
+
+static PyObject *
+_decompress_stream (PyObject * Py_UNUSED (self), PyObject * const * args,
+                    Py_ssize_t nargs)
+{
+  stream_context_t * context = NULL;
+  PyObject * py_context = NULL;
+  PyObject * py_blocks = NULL;
+  PyObject * py_block;
+  PyObject * py_result = NULL;
+  int output_size = 0;
+  Py_ssize_t offset = 0;
+  Py_buffer source = { NULL, NULL, };
+  static char * argnames[] = { "context", "source", NULL };
+
+  /* Positional arguments: capsule_context, source
+   * Keyword arguments   : none
+   */
+  if (!parse_fastcall_args (args, nargs, NULL, "_decompress_stream", "Oy*", argnames,
+                            &py_context, &source))
+    {
       goto exit_now;
     }
 
-  if (context->strategy.ops->update_context_after_process (context) != 0)
+  context = get_context (py_context, 1);
+  if (context == NULL)
+    {
+      goto exit_now;
+    }
+
+  if (context->config.store_comp_size == 0)
+    {
+      PyErr_Format (LZ4StreamError,
+                    "LZ4 context is configured for storing block size out-of-band");
+      goto exit_now;
+    }
+
+  py_blocks = PyList_New (0);
+  if (py_blocks == NULL)
     {
-      PyErr_Format (PyExc_RuntimeError, "Internal error");
       goto exit_now;
     }
 
+  /* Decompress every complete block; an incomplete one at the end is left
+   * for the next call. */
+  while (source.len - offset >= context->config.store_comp_size)
+    {
+      const char * block = (const char *) source.buf + offset;
+      int block_size = load_block_length (context->config.store_comp_size, block);
+      char * work_buffer;
+
+      if (block_size < 0 ||
+          (source.len - offset - context->config.store_comp_size) < block_size)
+        {
+          break;
+        }
+
+      work_buffer = context->strategy.ops->get_work_buffer (context);
+
+      TRACE1 (stream__decompress_stream__entry, block_size);
+      TRACE_BEGIN_ALLOW_THREADS
+
+      output_size = decompress_continue (context,
+                                         block + context->config.store_comp_size,
+                                         work_buffer,
+                                         block_size,
+                                         context->strategy.ops->get_dest_buffer_size (context));
+
+      TRACE_END_ALLOW_THREADS
+      TRACE1 (stream__decompress_stream__return, output_size);
+
+      if (output_size < 0)
+        {
+          /* In case of LZ4 decompression error, output_size holds the error code */
+          PyErr_Format (LZ4StreamError,
+                        "Decompression failed. error: %d",
+                        -output_size);
+          goto exit_now;
+        }
+
+      if (context->config.return_bytearray)
+        {
+          py_block = PyByteArray_FromStringAndSize (work_buffer, (Py_ssize_t) output_size);
+        }
+      else
+        {
+          py_block = PyBytes_FromStringAndSize (work_buffer, (Py_ssize_t) output_size);
+        }
+
+      if (py_block == NULL)
+        {
+          PyErr_NoMemory ();
+          goto exit_now;
+        }
+
+      if (PyList_Append (py_blocks, py_block) != 0)
+        {
+          Py_DECREF (py_block);
+          goto exit_now;
+        }
+      Py_DECREF (py_block);
+
+      if (context->strategy.ops->update_context_after_process (context) != 0)
+        {
+          PyErr_Format (PyExc_RuntimeError, "Internal error");
+          goto exit_now;
+        }
+
+      offset += context->config.store_comp_size + block_size;
+    }
+
+  py_result = Py_BuildValue ("(On)", py_blocks, offset);
+
 exit_now:
+  Py_XDECREF (py_blocks);
   if (source.buf != NULL)
     {
       PyBuffer_Release (&source);
     }
 
-  return py_dest;
+  return py_result;
+}
+
+/* Serialized state: a header of STATE_HEADER_SIZE bytes, followed by the
+ * history. All integers are little-endian. */
+#define STATE_MAGIC "LZ4S"
+#define STATE_VERSION 1
+#define STATE_HEADER_SIZE 24
+
+static PyObject *
+_save_state (PyObject * Py_UNUSED (self), PyObject * args)
+{
+  stream_context_t * context = NULL;
+  PyObject * py_context = NULL;
+  PyObject * py_state = NULL;
+  char * state;
+  int history_len;
+
+  /* Positional arguments: capsule_context
+   * Keyword arguments   : none
+   */
+  if (!PyArg_ParseTuple (args, "O", &py_context))
+    {
+      return NULL;
+    }
+
+  context = get_context (py_context, 0);
+  if (context == NULL)
+    {
+      return NULL;
+    }
+
+  if (context->strategy.ops != &strategy_ops[DOUBLE_BUFFER])
+    {
+      PyErr_SetString (PyExc_ValueError,
+                       "Only double_buffer stream contexts can be saved");
+      return NULL;
+    }
+
+  /* A hibernating context already holds its history. */
+  history_len = context->hibernating ? context->history_len : save_history (context);
+  if (history_len < 0)
+    {
+      return NULL;
+    }
+
+  py_state = PyBytes_FromStringAndSize (NULL, STATE_HEADER_SIZE + history_len);
+  if (py_state == NULL)
+    {
+      return NULL;
+    }
+
+  state = PyBytes_AS_STRING (py_state);
+  memcpy (state, STATE_MAGIC, 4);
+  store_le8 (state + 4, STATE_VERSION);
+  store_le8 (state + 5, (uint8_t) context->config.direction);
+  store_le8 (state + 6, (uint8_t) context->config.comp);
+  store_le8 (state + 7, (uint8_t) context->config.store_comp_size);
+  store_le8 (state + 8, (uint8_t) context->config.return_bytearray);
+  store_le8 (state + 9, (uint8_t) context->config.favor_dec_speed);
+  store_le16 (state + 10, 0);
+  store_le32 (state + 12, context->config.buffer_size);
+  store_le32 (state + 16, (uint32_t) context->config.acceleration);
+  store_le32 (state + 20, (uint32_t) context->config.compression_level);
+  memcpy (state + STATE_HEADER_SIZE, context->history, history_len);
+
+  return py_state;
 }
 
 static PyObject *
-_get_block (PyObject * Py_UNUSED (self), PyObject * args)
+_load_state (PyObject * Py_UNUSED (self), PyObject * args)
 {
+  static const char * directions[] = { "compress", "decompress" };
+  static const char * modes[] = { "default", "fast", "high_compression" };
   stream_context_t * context = NULL;
   PyObject * py_context = NULL;
-  PyObject * py_dest = NULL;
-  Py_buffer source = { NULL, NULL, };
-  buffer_t block = { NULL, 0, };
-
-  /* Positional arguments: capsule_context, source
+  PyObject * py_args = NULL;
+  PyObject * py_kwds = NULL;
+  const char * direction = NULL;
+  Py_buffer state = { NULL, NULL, };
+  const char * buf;
+  int history_len;
+
+  /* Positional arguments: state, direction
    * Keyword arguments   : none
    */
-
-  if (!PyArg_ParseTuple (args, "Oy*", &py_context, &source))
-    {
-      goto exit_now;
-    }
-
-  context = _PyCapsule_get_context (py_context);
-  if ((context == NULL) || (context->lz4_state.context == NULL))
+  if (!PyArg_ParseTuple (args, "y*s", &state, &direction))
     {
-      PyErr_SetString (PyExc_ValueError, "No valid LZ4 stream context supplied");
-      goto exit_now;
+      return NULL;
     }
 
-  if (source.len > INT_MAX)
+  buf = (const char *) state.buf;
+  if (state.len < STATE_HEADER_SIZE ||
+      state.len > STATE_HEADER_SIZE + DICTIONARY_SIZE_MAX ||
+      memcmp (buf, STATE_MAGIC, 4) != 0 ||
+      load_le8 (buf + 4) != STATE_VERSION ||
+      load_le8 (buf + 5) > DECOMPRESS ||
+      load_le8 (buf + 6) > HIGH_COMPRESSION)
     {
-      PyErr_Format (PyExc_OverflowError,
-                    "Input too large for LZ4 API");
+      PyErr_SetString (PyExc_ValueError, "Invalid LZ4 stream state");
       goto exit_now;
     }
 
-  if (context->config.store_comp_size == 0)
+  if (strcmp (direction, directions[load_le8 (buf + 5)]) != 0)
     {
-      PyErr_Format (LZ4StreamError,
-                    "LZ4 context is configured for storing block size out-of-band");
+      PyErr_Format (PyExc_ValueError,
+                    "LZ4 stream state is for %s, not %s",
+                    directions[load_le8 (buf + 5)], direction);
       goto exit_now;
     }
 
-  if (source.len < context->config.store_comp_size)
+  /* Create the context as it was configured, so that the usual validation
+   * applies. */
+  py_args = Py_BuildValue ("(ssI)", "double_buffer", direction,
+                           (unsigned int) load_le32 (buf + 12));
+  py_kwds = Py_BuildValue ("{s:s,s:I,s:I,s:i,s:I,s:i}",
+                           "mode", modes[load_le8 (buf + 6)],
+                           "acceleration", (unsigned int) load_le32 (buf + 16),
+                           "compression_level", (unsigned int) load_le32 (buf + 20),
+                           "return_bytearray", (int) load_le8 (buf + 8),
+                           "store_comp_size", (unsigned int) load_le8 (buf + 7),
+                           "favor_decompression_speed", (int) load_le8 (buf + 9));
+  if (py_args == NULL || py_kwds == NULL)
     {
-      PyErr_Format (LZ4StreamError,
-                    "Invalid source, too small for holding any block");
       goto exit_now;
     }
 
-  block.buf = (char *) source.buf + context->config.store_comp_size;
-  block.len = load_block_length (context->config.store_comp_size, source.buf);
-
-  if ((source.len - context->config.store_comp_size) < block.len)
+  py_context = _create_context (NULL, py_args, py_kwds);
+  if (py_context == NULL)
     {
-      PyErr_Format (LZ4StreamError,
-                    "Requested input size (%d) larger than source size (%ld)",
-                    block.len, (source.len - context->config.store_comp_size));
       goto exit_now;
     }
 
-  if (context->config.return_bytearray)
-    {
-      py_dest = PyByteArray_FromStringAndSize (block.buf, (Py_ssize_t) block.len);
-    }
-  else
-    {
-      py_dest = PyBytes_FromStringAndSize (block.buf, (Py_ssize_t) block.len);
-    }
+  context = _PyCapsule_get_context (py_context);
+  history_len = (int) (state.len - STATE_HEADER_SIZE);
 
-  if (py_dest == NULL)
+  context->history = PyMem_Malloc (DICTIONARY_SIZE_MAX);
+  if (context->history == NULL)
     {
       PyErr_NoMemory ();
+      Py_CLEAR (py_context);
+      goto exit_now;
     }
+  memcpy (context->history, buf + STATE_HEADER_SIZE, history_len);
+  load_history (context, history_len);
 
 exit_now:
-  if (source.buf != NULL)
-    {
-      PyBuffer_Release (&source);
-    }
+  Py_XDECREF (py_args);
+  Py_XDECREF (py_kwds);
+  PyBuffer_Release (&state);
 
-  return py_dest;
+  return py_context;
 }
 
+
 static PyObject *
-_decompress (PyObject * Py_UNUSED (self), PyObject * args)
+_hibernate (PyObject * Py_UNUSED (self), PyObject * args)
 {
   stream_context_t * context = NULL;
   PyObject * py_context = NULL;
-  PyObject * py_dest = NULL;
-  int output_size = 0;
-  uint32_t source_size_max = 0;
-  Py_buffer source = { NULL, NULL, };
 
-  /* Positional arguments: capsule_context, source
+  /* Positional arguments: capsule_context
    * Keyword arguments   : none
    */
-  if (!PyArg_ParseTuple (args, "Oy*", &py_context, &source))
-    {
-      goto exit_now;
-    }
-
-  context = _PyCapsule_get_context (py_context);
-  if ((context == NULL) || (context->lz4_state.context == NULL))
+  if (!PyArg_ParseTuple (args, "O", &py_context))
     {
-      PyErr_SetString (PyExc_ValueError, "No valid LZ4 stream context supplied");
-      goto exit_now;
+      return NULL;
     }
 
-  /* In out-of-band block size case, use a best-effort strategy for scaling
-   * buffers.
-   */
-  if (context->config.store_comp_size == 0)
-    {
-      source_size_max = _GET_MAX_UINT32(4);
-    }
-  else
+  context = get_context (py_context, 0);
+  if (context == NULL)
     {
-      source_size_max = _GET_MAX_UINT32(context->config.store_comp_size);
+      return NULL;
     }
 
-  if (source.len > source_size_max)
+  if (context->strategy.ops != &strategy_ops[DOUBLE_BUFFER])
     {
-      PyErr_Format (PyExc_OverflowError,
-                    "Source length (%ld) too large for LZ4 store_comp_size (%d) value",
-                    source.len, context->config.store_comp_size);
-      goto exit_now;
+      PyErr_SetString (PyExc_ValueError,
+                       "Only double_buffer stream contexts can hibernate");
+      return NULL;
     }
 
-  if ((get_input_bound (source.len) == 0) ||
-      (get_input_bound (source.len) > context->strategy.ops->get_dest_buffer_size (context)))
+  if (hibernate_context (context) != 0)
     {
-      PyErr_Format (LZ4StreamError,
-                    "Maximal decompressed data (%d) cannot fit in LZ4 internal buffer (%u)",
-                    get_input_bound (source.len),
-                    context->strategy.ops->get_dest_buffer_size (context));
-      goto exit_now;
+      return NULL;
     }
 
-  Py_BEGIN_ALLOW_THREADS
-
-  output_size = LZ4_decompress_safe_continue (context->lz4_state.decompress,
-                                              (const char *) source.buf,
-                                              context->strategy.ops->get_work_buffer (context),
-                                              source.len,
-                                              context->strategy.ops->get_dest_buffer_size (context));
+  Py_RETURN_NONE;
+}
 
-  Py_END_ALLOW_THREADS
+static PyObject *
+_wake (PyObject * Py_UNUSED (self), PyObject * args)
+{
+  PyObject * py_context = NULL;
 
-  if (output_size < 0)
+  /* Positional arguments: capsule_context
+   * Keyword arguments   : none
+   */
+  if (!PyArg_ParseTuple (args, "O", &py_context))
     {
-      /* In case of LZ4 decompression error, output_size holds the error code */
-      PyErr_Format (LZ4StreamError,
-                    "Decompression failed. error: %d",
-                    -output_size);
-      goto exit_now;
+      return NULL;
     }
 
-  if ((unsigned int) output_size > context->output.len)
+  if (get_context (py_context, 1) == NULL)
     {
-      output_size = -1;
-      PyErr_Format (PyExc_OverflowError,
-                    "Decompressed stream too large for LZ4 API");
-      goto exit_now;
+      return NULL;
     }
 
-  memcpy (context->output.buf,
-          context->strategy.ops->get_work_buffer (context),
-          output_size);
-
-  if ( context->strategy.ops->update_context_after_process (context) != 0)
-    {
-      PyErr_Format (PyExc_RuntimeError, "Internal error");
-      goto exit_now;
-    }
+  Py_RETURN_NONE;
+}
 
-  if (context->config.return_bytearray)
-    {
-      py_dest = PyByteArray_FromStringAndSize (context->output.buf, (Py_ssize_t) output_size);
-    }
-  else
-    {
-      py_dest = PyBytes_FromStringAndSize (context->output.buf, (Py_ssize_t) output_size);
-    }
+static PyObject *
+_is_hibernating (PyObject * Py_UNUSED (self), PyObject * args)
+{
+  stream_context_t * context = NULL;
+  PyObject * py_context = NULL;
 
-  if (py_dest == NULL)
+  /* Positional arguments: capsule_context
+   * Keyword arguments   : none
+   */
+  if (!PyArg_ParseTuple (args, "O", &py_context))
     {
-      PyErr_NoMemory ();
+      return NULL;
     }
 
-exit_now:
-  if (source.buf != NULL)
+  context = get_context (py_context, 0);
+  if (context == NULL)
     {
-      PyBuffer_Release (&source);
+      return NULL;
     }
 
-  return py_dest;
+  return PyBool_FromLong (context->hibernating);
 }
 
-
 PyDoc_STRVAR (_compress_bound__doc,
               "_compress_bound(input_size)\n"                                                     \
               "\n"                                                                                \
@@ -1472,6 +2690,29 @@ PyDoc_STRVAR (_compress__doc,
               "    RuntimeError: raised if some internal resources cannot be updated.\n"          \
               "    LZ4StreamError: raised if the call to the LZ4 library fails.\n");
 
+PyDoc_STRVAR (_compress_many__doc,
+              "_compress_many(context, sources)\n"                                                \
+              "\n"                                                                                \
+              "Compress each chunk in sources in turn, using the given LZ4 stream context,\n"     \
+              "returning the compressed blocks, each preceded by its size, as a single\n"         \
+              "bytearray or bytes object. This gives the same result as joining the outputs of\n" \
+              "``_compress`` for each chunk.\n"                                                   \
+              "Raises an exception if any error occurs.\n"                                        \
+              "\n"                                                                                \
+              "Args:\n"                                                                           \
+              "    context (ctx): LZ4 stream context.\n"                                          \
+              "    sources (list or tuple): Chunks of data to compress, each a str, bytes or\n"   \
+              "        buffer-compatible object.\n"                                               \
+              "\n"                                                                                \
+              "Returns:\n"                                                                        \
+              "    bytes or bytearray: Compressed data.\n"                                        \
+              "\n"                                                                                \
+              "Raises:\n"                                                                         \
+              "    OverflowError: raised if a chunk is too large for being compressed in\n"       \
+              "        the given context.\n"                                                      \
+              "    LZ4StreamError: raised if the call to the LZ4 library fails, or if the\n"      \
+              "        context stores block sizes out-of-band.\n");
+
 PyDoc_STRVAR (_get_block__doc,
               "_get_block(context, source)\n"                                                     \
               "\n"                                                                                \
@@ -1512,10 +2753,49 @@ PyDoc_STRVAR (_decompress__doc,
               "    RuntimeError: raised if some internal resources cannot be updated.\n"          \
               "    LZ4StreamError: raised if the call to the LZ4 library fails.\n");
 
+PyDoc_STRVAR (_decompress_stream__doc,
+              "_decompress_stream(context, source)\n"                                             \
+              "\n"                                                                                \
+              "Decompress all the complete blocks, each preceded by its size, at the start of\n"  \
+              "source, using the given LZ4 stream context.\n"                                     \
+              "Raises an exception if any error occurs.\n"                                        \
+              "\n"                                                                                \
+              "Args:\n"                                                                           \
+              "    context (obj): LZ4 stream context.\n"                                          \
+              "    source (str, bytes or buffer-compatible object): LZ4 compressed stream.\n"     \
+              "\n"                                                                                \
+              "Returns:\n"                                                                        \
+              "    tuple: A list of the uncompressed blocks, as bytearray or bytes objects, and\n" \
+              "        the number of bytes of source consumed. Any incomplete block at the end\n" \
+              "        of source isn't consumed.\n"                                               \
+              "\n"                                                                                \
+              "Raises:\n"                                                                         \
+              "    RuntimeError: raised if some internal resources cannot be updated.\n"          \
+              "    LZ4StreamError: raised if the call to the LZ4 library fails, or if the\n"      \
+              "        context stores block sizes out-of-band.\n");
+
+PyDoc_STRVAR (_set_compression_level__doc,
+              "_set_compression_level(context, compression_level)\n"                              \
+              "\n"                                                                                \
+              "Change the compression level of a high compression LZ4 stream context,\n"          \
+              "without discarding the history of the stream.\n"                                   \
+              "Raises an exception if any error occurs.\n"                                        \
+              "\n"                                                                                \
+              "Args:\n"                                                                           \
+              "    context (ctx): LZ4 stream context.\n"                                          \
+              "    compression_level (int): New compression level, used for the next\n"           \
+              "        compressed blocks.\n"                                                      \
+              "\n"                                                                                \
+              "Raises:\n"                                                                         \
+              "    ValueError: raised if the context is not a ``'high_compression'``\n"           \
+              "        compression context.\n"                                                    \
+              "    RuntimeError: raised if the LZ4 library does not support it.\n");
+
 PyDoc_STRVAR (_create_context__doc,
               "_create_context(strategy, direction, buffer_size,\n"                               \
               "                mode='default', acceleration=1, compression_level=9,\n"            \
-              "                return_bytearray=0, store_comp_size=4, dict=None)\n"               \
+              "                return_bytearray=0, store_comp_size=4, dict=None,\n"               \
+              "                favor_decompression_speed=False, prepared_dictionary=None)\n"      \
               "\n"                                                                                \
               "Instantiates and initializes a LZ4 stream context.\n"                              \
               "Raises an exception if any error occurs.\n"                                        \
@@ -1553,6 +2833,13 @@ PyDoc_STRVAR (_create_context__doc,
               "        compressed block. Can be: ``1``, ``2`` or ``4`` (default: ``4``).\n"       \
               "    dict (str, bytes or buffer-compatible object): If specified, perform\n"        \
               "        compression using this initial dictionary.\n"                              \
+              "    favor_decompression_speed (bool): If ``True``, the high compression\n"         \
+              "        parser favors decompression speed over compression ratio. Only\n"          \
+              "        relevant if ``'mode'`` is ``'high_compression'`` and\n"                    \
+              "        ``'compression_level'`` is ``10`` or greater.\n"                           \
+              "    prepared_dictionary (lz4_dict): If specified, a dictionary created by\n"       \
+              "        ``_create_dictionary`` to use instead of ``dict``. A compression\n"        \
+              "        context of the same mode attaches it without hashing it again.\n"          \
               "\n"                                                                                \
               "Returns:\n"                                                                        \
               "    lz4_ctx: A LZ4 stream context.\n"                                              \
@@ -1564,6 +2851,103 @@ PyDoc_STRVAR (_create_context__doc,
               "    MemoryError: raised if some internal resources cannot be allocated.\n"         \
               "    RuntimeError: raised if some internal resources cannot be initialized.\n");
 
+PyDoc_STRVAR (_create_dictionary__doc,
+              "_create_dictionary(dictionary, mode='default')\n"                                  \
+              "\n"                                                                                \
+              "Loads a dictionary once, for use by many LZ4 stream contexts.\n"                   \
+              "Raises an exception if any error occurs.\n"                                        \
+              "\n"                                                                                \
+              "Args:\n"                                                                           \
+              "    dictionary (str, bytes or buffer-compatible object): The dictionary. Only\n"   \
+              "        its last 64 kB are used.\n"                                                \
+              "\n"                                                                                \
+              "Keyword Args:\n"                                                                   \
+              "    mode (str): The mode of the compression contexts the dictionary is\n"          \
+              "        prepared for: ``'default'``, ``'fast'`` or ``'high_compression'``.\n"      \
+              "        ``'default'`` and ``'fast'`` contexts share the same preparation.\n"       \
+              "\n"                                                                                \
+              "Returns:\n"                                                                        \
+              "    lz4_dict: A prepared dictionary, to pass to ``_create_context``.\n"            \
+              "\n"                                                                                \
+              "Raises:\n"                                                                         \
+              "    ValueError: raised if the mode is invalid.\n"                                  \
+              "    MemoryError: raised if some internal resources cannot be allocated.\n");
+
+PyDoc_STRVAR (_save_state__doc,
+              "_save_state(context)\n"                                                            \
+              "\n"                                                                                \
+              "Serializes the configuration and the last 64 kB of history of a LZ4 stream\n"      \
+              "context, so that it can be recreated with ``_load_state``.\n"                      \
+              "Raises an exception if any error occurs.\n"                                        \
+              "\n"                                                                                \
+              "Args:\n"                                                                           \
+              "    context (ctx): LZ4 stream context.\n"                                          \
+              "\n"                                                                                \
+              "Returns:\n"                                                                        \
+              "    bytes: The state of the context.\n"                                            \
+              "\n"                                                                                \
+              "Raises:\n"                                                                         \
+              "    ValueError: raised if the context's buffer strategy cannot be saved.\n"        \
+              "    MemoryError: raised if the history buffer cannot be allocated.\n");
+
+PyDoc_STRVAR (_load_state__doc,
+              "_load_state(state, direction)\n"                                                   \
+              "\n"                                                                                \
+              "Creates a LZ4 stream context from a state returned by ``_save_state``,\n"          \
+              "which continues the stream where the saved context was.\n"                         \
+              "Raises an exception if any error occurs.\n"                                        \
+              "\n"                                                                                \
+              "Args:\n"                                                                           \
+              "    state (bytes or buffer-compatible object): The saved state.\n"                 \
+              "    direction (str): The direction the state must be for: ``'compress'`` or\n"     \
+              "        ``'decompress'``.\n"                                                       \
+              "\n"                                                                                \
+              "Returns:\n"                                                                        \
+              "    lz4_ctx: A LZ4 stream context.\n"                                              \
+              "\n"                                                                                \
+              "Raises:\n"                                                                         \
+              "    ValueError: raised if the state is invalid or for the other direction.\n"      \
+              "    MemoryError: raised if some internal resources cannot be allocated.\n");
+
+PyDoc_STRVAR (_hibernate__doc,
+              "_hibernate(context)\n"                                                             \
+              "\n"                                                                                \
+              "Releases the LZ4 state and the buffers of a LZ4 stream context, keeping only\n"    \
+              "its configuration and the last 64 kB of history. The context is woken up\n"        \
+              "automatically the next time it's used, or by ``_wake``.\n"                         \
+              "Raises an exception if any error occurs.\n"                                        \
+              "\n"                                                                                \
+              "Args:\n"                                                                           \
+              "    context (ctx): LZ4 stream context.\n"                                          \
+              "\n"                                                                                \
+              "Raises:\n"                                                                         \
+              "    ValueError: raised if the context's buffer strategy cannot hibernate.\n"       \
+              "    MemoryError: raised if the history buffer cannot be allocated.\n");
+
+PyDoc_STRVAR (_wake__doc,
+              "_wake(context)\n"                                                                  \
+              "\n"                                                                                \
+              "Reallocates the LZ4 state and the buffers of a hibernating LZ4 stream\n"           \
+              "context. Does nothing if the context isn't hibernating.\n"                         \
+              "Raises an exception if any error occurs.\n"                                        \
+              "\n"                                                                                \
+              "Args:\n"                                                                           \
+              "    context (ctx): LZ4 stream context.\n"                                          \
+              "\n"                                                                                \
+              "Raises:\n"                                                                         \
+              "    MemoryError: raised if some internal resources cannot be allocated.\n");
+
+PyDoc_STRVAR (_is_hibernating__doc,
+              "_is_hibernating(context)\n"                                                        \
+              "\n"                                                                                \
+              "Tells whether a LZ4 stream context is hibernating.\n"                              \
+              "\n"                                                                                \
+              "Args:\n"                                                                           \
+              "    context (ctx): LZ4 stream context.\n"                                          \
+              "\n"                                                                                \
+              "Returns:\n"                                                                        \
+              "    bool: ``True`` if the context is hibernating.\n");
+
 PyDoc_STRVAR (lz4stream__doc,
               "A Python wrapper for the LZ4 stream protocol"
               );
@@ -1574,25 +2958,78 @@ static PyMethodDef module_methods[] = {
     METH_VARARGS | METH_KEYWORDS,
     _create_context__doc
   },
+  {
+    "_create_dictionary", (PyCFunction) _create_dictionary,
+    METH_VARARGS | METH_KEYWORDS,
+    _create_dictionary__doc
+  },
 
   {
     "_compress",
-    (PyCFunction) _compress,
-    METH_VARARGS,
+    FASTCALL_FUNCTION (_compress),
+    METH_FASTCALL,
     _compress__doc
   },
   {
     "_decompress",
-    (PyCFunction) _decompress,
-    METH_VARARGS,
+    FASTCALL_FUNCTION (_decompress),
+    METH_FASTCALL,
     _decompress__doc
   },
+  {
+    "_compress_many",
+    FASTCALL_FUNCTION (_compress_many),
+    METH_FASTCALL,
+    _compress_many__doc
+  },
+  {
+    "_decompress_stream",
+    FASTCALL_FUNCTION (_decompress_stream),
+    METH_FASTCALL,
+    _decompress_stream__doc
+  },
   {
     "_get_block",
-    (PyCFunction) _get_block,
-    METH_VARARGS,
+    FASTCALL_FUNCTION (_get_block),
+    METH_FASTCALL,
     _get_block__doc
   },
+  {
+    "_set_compression_level",
+    (PyCFunction) _set_compression_level,
+    METH_VARARGS,
+    _set_compression_level__doc
+  },
+  {
+    "_save_state",
+    (PyCFunction) _save_state,
+    METH_VARARGS,
+    _save_state__doc
+  },
+  {
+    "_load_state",
+    (PyCFunction) _load_state,
+    METH_VARARGS,
+    _load_state__doc
+  },
+  {
+    "_hibernate",
+    (PyCFunction) _hibernate,
+    METH_VARARGS,
+    _hibernate__doc
+  },
+  {
+    "_wake",
+    (PyCFunction) _wake,
+    METH_VARARGS,
+    _wake__doc
+  },
+  {
+    "_is_hibernating",
+    (PyCFunction) _is_hibernating,
+    METH_VARARGS,
+    _is_hibernating__doc
+  },
   {
     "_compress_bound",
     (PyCFunction) _compress_bound,
@@ -0,0 +1,113 @@
+from ._xxhash import (  # noqa: F401
+    xxh32,
+    xxh64,
+    xxh32_batch,
+    xxh64_batch,
+    create_state,
+    copy_state,
+    reset_state,
+    update_state,
+    digest_state,
+    XXH_VERSION_NUMBER,
+    __doc__ as _doc
+)
+
+__doc__ = _doc
+
+
+class _XXHBase(object):
+    _bits = None
+
+    def __init__(self, data=None, seed=0):
+        self.seed = seed
+        self._state = create_state(bits=self._bits, seed=seed)
+        if data is not None:
+            self.update(data)
+
+    def update(self, data):
+        """Feed ``data`` into the hash.
+
+        Args:
+            data (str, bytes or buffer-compatible object): data to hash
+
+        """
+        update_state(self._state, data)
+
+    def intdigest(self):
+        """Return the hash of the data fed in so far as an integer.
+
+        Returns:
+            int: hash value
+
+        """
+        return digest_state(self._state)
+
+    def digest(self):
+        """Return the hash of the data fed in so far as bytes.
+
+        The hash is returned in the canonical (big-endian) representation.
+
+        Returns:
+            bytes: hash value
+
+        """
+        return self.intdigest().to_bytes(self.digest_size, 'big')
+
+    def hexdigest(self):
+        """Return the hash of the data fed in so far as a hexadecimal string.
+
+        Returns:
+            str: hash value
+
+        """
+        return self.digest().hex()
+
+    def copy(self):
+        """Return a copy of the hasher.
+
+        Returns:
+            A new hasher object with the same state.
+
+        """
+        other = self.__class__.__new__(self.__class__)
+        other.seed = self.seed
+        other._state = copy_state(self._state)
+        return other
+
+    def reset(self):
+        """Reset the hasher, discarding any data fed in so far."""
+        reset_state(self._state, seed=self.seed)
+
+
+class XXH32(_XXHBase):
+    """Incremental 32-bit xxHash hasher.
+
+    Args:
+        data (str, bytes or buffer-compatible object): Optional initial data
+            to hash.
+
+    Keyword Args:
+        seed (int): 32-bit seed for the hash. Default is ``0``.
+
+    """
+    name = 'xxh32'
+    digest_size = 4
+    block_size = 16
+    _bits = 32
+
+
+class XXH64(_XXHBase):
+    """Incremental 64-bit xxHash hasher.
+
+    Args:
+        data (str, bytes or buffer-compatible object): Optional initial data
+            to hash.
+
+    Keyword Args:
+        seed (int): 64-bit seed for the hash. Default is ``0``.
+
+    """
+    name = 'xxh64'
+    digest_size = 8
+    block_size = 32
+    _bits = 64
@@ -0,0 +1,760 @@
+/*
+ * Copyright (c) 2024, the python-lz4 developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holders nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+#if defined(_WIN32) && defined(_MSC_VER)
+#define inline __inline
+#elif defined(__SUNPRO_C) || defined(__hpux) || defined(_AIX)
+#define inline
+#endif
+
+#include <Python.h>
+
+#include <stdlib.h>
+#include <xxhash.h>
+
+static const char * xxhash_state_capsule_name = "_xxhash.XXH_state";
+
+struct xxhash_state
+{
+  int bits;
+  union
+  {
+    XXH32_state_t * xxh32;
+    XXH64_state_t * xxh64;
+  } state;
+};
+
+/* Acquire a buffer for each item of a sequence. On success, returns the
+   number of buffers acquired, and sets *buffers to a newly allocated array
+   which must be released with release_buffers. On failure, returns -1 with
+   an exception set. */
+static Py_ssize_t
+acquire_buffers (PyObject * sequence, Py_buffer ** buffers)
+{
+  PyObject * fast;
+  Py_ssize_t count;
+  Py_ssize_t i;
+
+  fast = PySequence_Fast (sequence, "buffers must be a sequence");
+  if (fast == NULL)
+    {
+      return -1;
+    }
+
+  count = PySequence_Fast_GET_SIZE (fast);
+
+  *buffers = PyMem_Malloc ((count > 0 ? count : 1) * sizeof (Py_buffer));
+  if (*buffers == NULL)
+    {
+      Py_DECREF (fast);
+      PyErr_NoMemory ();
+      return -1;
+    }
+
+  for (i = 0; i < count; i++)
+    {
+      if (PyObject_GetBuffer (PySequence_Fast_GET_ITEM (fast, i),
+                              &(*buffers)[i], PyBUF_SIMPLE))
+        {
+          while (--i >= 0)
+            {
+              PyBuffer_Release (&(*buffers)[i]);
+            }
+          PyMem_Free (*buffers);
+          Py_DECREF (fast);
+          return -1;
+        }
+    }
+
+  Py_DECREF (fast);
+
+  return count;
+}
+
+static void
+release_buffers (Py_buffer * buffers, Py_ssize_t count)
+{
+  Py_ssize_t i;
+
+  for (i = 0; i < count; i++)
+    {
+      PyBuffer_Release (&buffers[i]);
+    }
+
+  PyMem_Free (buffers);
+}
+
+/*********
+ * xxh32 *
+ *********/
+static PyObject *
+xxh32 (PyObject * Py_UNUSED (self), PyObject * args, PyObject * keywds)
+{
+  Py_buffer source;
+  unsigned int seed = 0;
+  XXH32_hash_t hash;
+  static char *kwlist[] = { "data",
+                            "seed",
+                            NULL
+                          };
+
+  if (!PyArg_ParseTupleAndKeywords (args, keywds, "y*|I", kwlist,
+                                    &source, &seed))
+    {
+      return NULL;
+    }
+
+  Py_BEGIN_ALLOW_THREADS
+  hash = XXH32 (source.buf, (size_t) source.len, seed);
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release (&source);
+
+  return PyLong_FromUnsignedLong (hash);
+}
+
+/*********
+ * xxh64 *
+ *********/
+static PyObject *
+xxh64 (PyObject * Py_UNUSED (self), PyObject * args, PyObject * keywds)
+{
+  Py_buffer source;
+  unsigned long long seed = 0;
+  XXH64_hash_t hash;
+  static char *kwlist[] = { "data",
+                            "seed",
+                            NULL
+                          };
+
+  if (!PyArg_ParseTupleAndKeywords (args, keywds, "y*|K", kwlist,
+                                    &source, &seed))
+    {
+      return NULL;
+    }
+
+  Py_BEGIN_ALLOW_THREADS
+  hash = XXH64 (source.buf, (size_t) source.len, seed);
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release (&source);
+
+  return PyLong_FromUnsignedLongLong (hash);
+}
+
+/*********************************
+ * xxh32_batch and xxh64_batch *
+ *********************************/
+static PyObject *
+hash_batch (PyObject * sequence, int bits, unsigned long long seed)
+{
+  Py_buffer * buffers;
+  unsigned long long * hashes;
+  Py_ssize_t count;
+  Py_ssize_t i;
+  PyObject * py_hashes;
+
+  count = acquire_buffers (sequence, &buffers);
+  if (count < 0)
+    {
+      return NULL;
+    }
+
+  hashes = PyMem_Malloc ((count > 0 ? count : 1) * sizeof * hashes);
+  if (hashes == NULL)
+    {
+      release_buffers (buffers, count);
+      return PyErr_NoMemory ();
+    }
+
+  Py_BEGIN_ALLOW_THREADS
+  for (i = 0; i < count; i++)
+    {
+      if (bits == 32)
+        {
+          hashes[i] = XXH32 (buffers[i].buf, (size_t) buffers[i].len,
+                             (unsigned int) seed);
+        }
+      else
+        {
+          hashes[i] = XXH64 (buffers[i].buf, (size_t) buffers[i].len, seed);
+        }
+    }
+  Py_END_ALLOW_THREADS
+
+  release_buffers (buffers, count);
+
+  py_hashes = PyList_New (count);
+  if (py_hashes == NULL)
+    {
+      PyMem_Free (hashes);
+      return NULL;
+    }
+
+  for (i = 0; i < count; i++)
+    {
+      PyObject * py_hash = PyLong_FromUnsignedLongLong (hashes[i]);
+      if (py_hash == NULL)
+        {
+          Py_DECREF (py_hashes);
+          PyMem_Free (hashes);
+          return NULL;
+        }
+      PyList_SET_ITEM (py_hashes, i, py_hash);
+    }
+
+  PyMem_Free (hashes);
+
+  return py_hashes;
+}
+
+static PyObject *
+xxh32_batch (PyObject * Py_UNUSED (self), PyObject * args, PyObject * keywds)
+{
+  PyObject * sequence;
+  unsigned int seed = 0;
+  static char *kwlist[] = { "buffers",
+                            "seed",
+                            NULL
+                          };
+
+  if (!PyArg_ParseTupleAndKeywords (args, keywds, "O|I", kwlist,
+                                    &sequence, &seed))
+    {
+      return NULL;
+    }
+
+  return hash_batch (sequence, 32, seed);
+}
+
+static PyObject *
+xxh64_batch (PyObject * Py_UNUSED (self), PyObject * args, PyObject * keywds)
+{
+  PyObject * sequence;
+  unsigned long long seed = 0;
+  static char *kwlist[] = { "buffers",
+                            "seed",
+                            NULL
+                          };
+
+  if (!PyArg_ParseTupleAndKeywords (args, keywds, "O|K", kwlist,
+                                    &sequence, &seed))
+    {
+      return NULL;
+    }
+
+  return hash_batch (sequence, 64, seed);
+}
+
+/****************
+ * create_state *
+ ****************/
+static void
+free_state (struct xxhash_state * state)
+{
+  if (state->bits == 32)
+    {
+      XXH32_freeState (state->state.xxh32);
+    }
+  else
+    {
+      XXH64_freeState (state->state.xxh64);
+    }
+
+  PyMem_Free (state);
+}
+
+static void
+destroy_state (PyObject * py_state)
+{
+  struct xxhash_state *state =
+    PyCapsule_GetPointer (py_state, xxhash_state_capsule_name);
+
+  if (state != NULL)
+    {
+      free_state (state);
+    }
+}
+
+static struct xxhash_state *
+new_state (int bits)
+{
+  struct xxhash_state * state;
+
+  if (bits != 32 && bits != 64)
+    {
+      PyErr_Format (PyExc_ValueError,
+                    "Invalid bits argument: %d. Must be one of: 32, 64",
+                    bits);
+      return NULL;
+    }
+
+  state = (struct xxhash_state *) PyMem_Malloc (sizeof (struct xxhash_state));
+  if (state == NULL)
+    {
+      PyErr_NoMemory ();
+      return NULL;
+    }
+
+  state->bits = bits;
+
+  if (bits == 32)
+    {
+      state->state.xxh32 = XXH32_createState ();
+    }
+  else
+    {
+      state->state.xxh64 = XXH64_createState ();
+    }
+
+  if (state->state.xxh32 == NULL)
+    {
+      PyMem_Free (state);
+      PyErr_NoMemory ();
+      return NULL;
+    }
+
+  return state;
+}
+
+static struct xxhash_state *
+get_state (PyObject * py_state)
+{
+  struct xxhash_state * state =
+    (struct xxhash_state *) PyCapsule_GetPointer (py_state, xxhash_state_capsule_name);
+
+  if (state == NULL)
+    {
+      PyErr_Clear ();
+      PyErr_SetString (PyExc_ValueError, "No valid xxHash state supplied");
+    }
+
+  return state;
+}
+
+static PyObject *
+create_state (PyObject * Py_UNUSED (self), PyObject * args, PyObject * keywds)
+{
+  struct xxhash_state * state;
+  int bits = 32;
+  unsigned long long seed = 0;
+  PyObject * py_state;
+  static char *kwlist[] = { "bits",
+                            "seed",
+                            NULL
+                          };
+
+  if (!PyArg_ParseTupleAndKeywords (args, keywds, "|iK", kwlist,
+                                    &bits, &seed))
+    {
+      return NULL;
+    }
+
+  state = new_state (bits);
+  if (state == NULL)
+    {
+      return NULL;
+    }
+
+  if (bits == 32)
+    {
+      XXH32_reset (state->state.xxh32, (unsigned int) seed);
+    }
+  else
+    {
+      XXH64_reset (state->state.xxh64, seed);
+    }
+
+  py_state = PyCapsule_New (state, xxhash_state_capsule_name, destroy_state);
+  if (py_state == NULL)
+    {
+      free_state (state);
+    }
+
+  return py_state;
+}
+
+/**************
+ * copy_state *
+ **************/
+static PyObject *
+copy_state (PyObject * Py_UNUSED (self), PyObject * py_source)
+{
+  struct xxhash_state * source;
+  struct xxhash_state * state;
+  PyObject * py_state;
+
+  source = get_state (py_source);
+  if (source == NULL)
+    {
+      return NULL;
+    }
+
+  state = new_state (source->bits);
+  if (state == NULL)
+    {
+      return NULL;
+    }
+
+  if (state->bits == 32)
+    {
+      XXH32_copyState (state->state.xxh32, source->state.xxh32);
+    }
+  else
+    {
+      XXH64_copyState (state->state.xxh64, source->state.xxh64);
+    }
+
+  py_state = PyCapsule_New (state, xxhash_state_capsule_name, destroy_state);
+  if (py_state == NULL)
+    {
+      free_state (state);
+    }
+
+  return py_state;
+}
+
+/***************
+ * reset_state *
+ ***************/
+static PyObject *
+reset_state (PyObject * Py_UNUSED (self), PyObject * args, PyObject * keywds)
+{
+  PyObject * py_state;
+  struct xxhash_state * state;
+  unsigned long long seed = 0;
+  static char *kwlist[] = { "state",
+                            "seed",
+                            NULL
+                          };
+
+  if (!PyArg_ParseTupleAndKeywords (args, keywds, "O|K", kwlist,
+                                    &py_state, &seed))
+    {
+      return NULL;
+    }
+
+  state = get_state (py_state);
+  if (state == NULL)
+    {
+      return NULL;
+    }
+
+  if (state->bits == 32)
+    {
+      XXH32_reset (state->state.xxh32, (unsigned int) seed);
+    }
+  else
+    {
+      XXH64_reset (state->state.xxh64, seed);
+    }
+
+  Py_RETURN_NONE;
+}
+
+/****************
+ * update_state *
+ ****************/
+static PyObject *
+update_state (PyObject * Py_UNUSED (self), PyObject * args)
+{
+  PyObject * py_state;
+  struct xxhash_state * state;
+  Py_buffer source;
+
+  if (!PyArg_ParseTuple (args, "Oy*", &py_state, &source))
+    {
+      return NULL;
+    }
+
+  state = get_state (py_state);
+  if (state == NULL)
+    {
+      PyBuffer_Release (&source);
+      return NULL;
+    }
+
+  Py_BEGIN_ALLOW_THREADS
+  if (state->bits == 32)
+    {
+      XXH32_update (state->state.xxh32, source.buf, (size_t) source.len);
+    }
+  else
+    {
+      XXH64_update (state->state.xxh64, source.buf, (size_t) source.len);
+    }
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release (&source);
+
+  Py_RETURN_NONE;
+}
+
+/****************
+ * digest_state *
+ ****************/
+static PyObject *
+digest_state (PyObject * Py_UNUSED (self), PyObject * py_state)
+{
+  struct xxhash_state * state;
+
+  state = get_state (py_state);
+  if (state == NULL)
+    {
+      return NULL;
+    }
+
+  if (state->bits == 32)
+    {
+      return PyLong_FromUnsignedLong (XXH32_digest (state->state.xxh32));
+    }
+  else
+    {
+      return PyLong_FromUnsignedLongLong (XXH64_digest (state->state.xxh64));
+    }
+}
+
+PyDoc_STRVAR
+(
+ xxh32__doc,
+ "xxh32(data, seed=0)\n"                                                \
+ "\n"                                                                   \
+ "Computes the 32-bit xxHash of ``data``.\n"                            \
+ "\n"                                                                   \
+ "Args:\n"                                                              \
+ "    data (str, bytes or buffer-compatible object): data to hash\n"   \
+ "\n"                                                                   \
+ "Keyword Args:\n"                                                      \
+ "    seed (int): 32-bit seed for the hash. Default is ``0``.\n"        \
+ "\n"                                                                   \
+ "Returns:\n"                                                           \
+ "    int: hash value\n"
+ );
+
+PyDoc_STRVAR
+(
+ xxh64__doc,
+ "xxh64(data, seed=0)\n"                                                \
+ "\n"                                                                   \
+ "Computes the 64-bit xxHash of ``data``.\n"                            \
+ "\n"                                                                   \
+ "Args:\n"                                                              \
+ "    data (str, bytes or buffer-compatible object): data to hash\n"   \
+ "\n"                                                                   \
+ "Keyword Args:\n"                                                      \
+ "    seed (int): 64-bit seed for the hash. Default is ``0``.\n"        \
+ "\n"                                                                   \
+ "Returns:\n"                                                           \
+ "    int: hash value\n"
+ );
+
+PyDoc_STRVAR
+(
+ xxh32_batch__doc,
+ "xxh32_batch(buffers, seed=0)\n"                                       \
+ "\n"                                                                   \
+ "Computes the 32-bit xxHash of each buffer in ``buffers``.\n"          \
+ "\n"                                                                   \
+ "All of the buffers are hashed in a single call which does not hold\n" \
+ "the GIL.\n"                                                           \
+ "\n"                                                                   \
+ "Args:\n"                                                              \
+ "    buffers (sequence): sequence of bytes or buffer-compatible objects\n" \
+ "\n"                                                                   \
+ "Keyword Args:\n"                                                      \
+ "    seed (int): 32-bit seed for the hashes. Default is ``0``.\n"      \
+ "\n"                                                                   \
+ "Returns:\n"                                                           \
+ "    list: hash values, in the same order as ``buffers``\n"
+ );
+
+PyDoc_STRVAR
+(
+ xxh64_batch__doc,
+ "xxh64_batch(buffers, seed=0)\n"                                       \
+ "\n"                                                                   \
+ "Computes the 64-bit xxHash of each buffer in ``buffers``.\n"          \
+ "\n"                                                                   \
+ "All of the buffers are hashed in a single call which does not hold\n" \
+ "the GIL.\n"                                                           \
+ "\n"                                                                   \
+ "Args:\n"                                                              \
+ "    buffers (sequence): sequence of bytes or buffer-compatible objects\n" \
+ "\n"                                                                   \
+ "Keyword Args:\n"                                                      \
+ "    seed (int): 64-bit seed for the hashes. Default is ``0``.\n"      \
+ "\n"                                                                   \
+ "Returns:\n"                                                           \
+ "    list: hash values, in the same order as ``buffers``\n"
+ );
+
+PyDoc_STRVAR
+(
+ create_state__doc,
+ "create_state(bits=32, seed=0)\n"                                      \
+ "\n"                                                                   \
+ "Creates an xxHash state for incremental hashing.\n"                   \
+ "\n"                                                                   \
+ "Keyword Args:\n"                                                      \
+ "    bits (int): ``32`` for XXH32 or ``64`` for XXH64. Default is ``32``.\n" \
+ "    seed (int): seed for the hash. Default is ``0``.\n"               \
+ "\n"                                                                   \
+ "Returns:\n"                                                           \
+ "    xxhState: An xxHash state\n"
+ );
+
+PyDoc_STRVAR
+(
+ copy_state__doc,
+ "copy_state(state)\n"                                                  \
+ "\n"                                                                   \
+ "Returns a copy of an xxHash state.\n"                                 \
+ "\n"                                                                   \
+ "Args:\n"                                                              \
+ "    state (xxhState): An xxHash state\n"                              \
+ "\n"                                                                   \
+ "Returns:\n"                                                           \
+ "    xxhState: A new xxHash state\n"
+ );
+
+PyDoc_STRVAR
+(
+ reset_state__doc,
+ "reset_state(state, seed=0)\n"                                         \
+ "\n"                                                                   \
+ "Resets an xxHash state, discarding any data hashed so far.\n"         \
+ "\n"                                                                   \
+ "Args:\n"                                                              \
+ "    state (xxhState): An xxHash state\n"                              \
+ "\n"                                                                   \
+ "Keyword Args:\n"                                                      \
+ "    seed (int): seed for the hash. Default is ``0``.\n"
+ );
+
+PyDoc_STRVAR
+(
+ update_state__doc,
+ "update_state(state, data)\n"                                          \
+ "\n"                                                                   \
+ "Feeds ``data`` into an xxHash state.\n"                               \
+ "\n"                                                                   \
+ "Args:\n"                                                              \
+ "    state (xxhState): An xxHash state\n"                              \
+ "    data (str, bytes or buffer-compatible object): data to hash\n"
+ );
+
+PyDoc_STRVAR
+(
+ digest_state__doc,
+ "digest_state(state)\n"                                                \
+ "\n"                                                                   \
+ "Returns the hash of all data fed into an xxHash state so far.\n"     \
+ "\n"                                                                   \
+ "The state is not modified, and more data may be fed into it\n"        \
+ "afterwards.\n"                                                        \
+ "\n"                                                                   \
+ "Args:\n"                                                              \
+ "    state (xxhState): An xxHash state\n"                              \
+ "\n"                                                                   \
+ "Returns:\n"                                                           \
+ "    int: hash value\n"
+ );
+
+static PyMethodDef module_methods[] =
+{
+  {
+    "xxh32", (PyCFunction) xxh32,
+    METH_VARARGS | METH_KEYWORDS, xxh32__doc
+  },
+  {
+    "xxh64", (PyCFunction) xxh64,
+    METH_VARARGS | METH_KEYWORDS, xxh64__doc
+  },
+  {
+    "xxh32_batch", (PyCFunction) xxh32_batch,
+    METH_VARARGS | METH_KEYWORDS, xxh32_batch__doc
+  },
+  {
+    "xxh64_batch", (PyCFunction) xxh64_batch,
+    METH_VARARGS | METH_KEYWORDS, xxh64_batch__doc
+  },
+  {
+    "create_state", (PyCFunction) create_state,
+    METH_VARARGS | METH_KEYWORDS, create_state__doc
+  },
+  {
+    "copy_state", (PyCFunction) copy_state,
+    METH_O, copy_state__doc
+  },
+  {
+    "reset_state", (PyCFunction) reset_state,
+    METH_VARARGS | METH_KEYWORDS, reset_state__doc
+  },
+  {
+    "update_state", (PyCFunction) update_state,
+    METH_VARARGS, update_state__doc
+  },
+  {
+    "digest_state", (PyCFunction) digest_state,
+    METH_O, digest_state__doc
+  },
+  {NULL, NULL, 0, NULL}		/* Sentinel */
+};
+
+PyDoc_STRVAR(lz4xxhash__doc,
+             "A Python wrapper for the xxHash functions bundled with LZ4"
+             );
+
+static struct PyModuleDef moduledef =
+{
+  PyModuleDef_HEAD_INIT,
+  "_xxhash",
+  lz4xxhash__doc,
+  -1,
+  module_methods
+};
+
+PyMODINIT_FUNC
+PyInit__xxhash(void)
+{
+  PyObject *module = PyModule_Create (&moduledef);
+
+  if (module == NULL)
+    return NULL;
+
+  PyModule_AddIntConstant (module, "XXH_VERSION_NUMBER", XXH_versionNumber ());
+
+  #ifdef Py_GIL_DISABLED
+    PyUnstable_Module_SetGIL(module, Py_MOD_GIL_NOT_USED);
+  #endif
+
+  return module;
+}
@@ -1,8 +1,13 @@
 #!/usr/bin/env python
 import os
+import platform
+import shutil
+import subprocess
 from setuptools import setup, find_packages, Extension
-from setuptools.command.build_ext import new_compiler
+from setuptools.command.build_ext import build_ext, customize_compiler, new_compiler
+from setuptools.errors import CompileError, LinkError
 import sys
+import tempfile
 
 
 # Note: if updating LZ4_REQUIRED_VERSION you need to update docs/install.rst as
@@ -35,6 +40,25 @@ else:
         return installed
     liblz4_found = pkgconfig_installed_check('liblz4', LZ4_REQUIRED_VERSION, default=False)
 
+
+def compiler_accepts(args, code='int main(void) { return 0; }\n'):
+    # Check that code compiles and links with the given compiler arguments.
+    compiler = new_compiler()
+    customize_compiler(compiler)
+    with tempfile.TemporaryDirectory() as tmp:
+        source = os.path.join(tmp, 'check.c')
+        with open(source, 'w') as f:
+            f.write(code)
+        try:
+            objects = compiler.compile([source], output_dir=tmp,
+                                       extra_postargs=args)
+            compiler.link_executable(objects, 'check', output_dir=tmp,
+                                     extra_postargs=args)
+        except (CompileError, LinkError):
+            return False
+    return True
+
+
 # Establish if we want to build experimental functionality or not.
 experimental_env = os.environ.get("PYLZ4_EXPERIMENTAL", "False")
 if experimental_env.upper() in ("1", "TRUE"):
@@ -42,6 +66,22 @@ if experimental_env.upper() in ("1", "TRUE"):
 else:
     experimental = False
 
+# Establish if we want an optimized build of the bundled LZ4 library. The
+# library is then compiled once, into static libraries shared by all the
+# extension modules, with link-time optimization and, on x86-64, clones of the
+# library functions for x86-64-v2 and x86-64-v3 CPUs. Profile-guided
+# optimization (PYLZ4_PGO) implies an optimized build: the extension modules
+# are built instrumented, trained by running tools/pgo_train.py, and rebuilt
+# using the recorded profile.
+optimize_env = os.environ.get("PYLZ4_OPTIMIZE", "False")
+pgo_env = os.environ.get("PYLZ4_PGO", "False")
+if pgo_env.upper() in ("1", "TRUE"):
+    pgo = True
+    optimize = True
+else:
+    pgo = False
+    optimize = optimize_env.upper() in ("1", "TRUE")
+
 # Set up the extension modules. If a system wide lz4 library is found, and is
 # recent enough, we'll use that. Otherwise we'll build with the bundled one. If
 # we're building against the system lz4 library we don't set the compiler
@@ -67,6 +107,21 @@ lz4stream_sources = [
     'lz4/stream/_stream.c'
 ]
 
+lz4cache_sources = [
+    'lz4/cache/_cache.c'
+]
+
+# The xxHash functions are not part of the public liblz4 API, so the xxhash
+# extension is always built against the bundled sources.
+lz4xxhash_sources = [
+    'lz4/xxhash/_xxhash.c',
+    'lz4libs/xxhash.c',
+]
+
+lz4xxhash_kwargs = {
+    'include_dirs': ['lz4libs'],
+}
+
 use_system_liblz4_env = os.environ.get("PYLZ4_USE_SYSTEM_LZ4", "True")
 if use_system_liblz4_env.upper() in ("1", "TRUE"):
     use_system_liblz4 = True
@@ -102,6 +157,11 @@ else:
             'lz4libs/lz4hc.c',
         ]
     )
+    lz4cache_sources.extend(
+        [
+            'lz4libs/lz4.c',
+        ]
+    )
 
 compiler = new_compiler().compiler_type
 
@@ -112,7 +172,14 @@ if compiler == 'msvc':
         '/wd4711',
         '/wd4820',
     ]
+    lz4xxhash_kwargs['extra_compile_args'] = extension_kwargs['extra_compile_args']
 elif compiler in ('unix', 'mingw32'):
+    lz4xxhash_kwargs['extra_compile_args'] = [
+        '-O3',
+        '-Wall',
+        '-Wundef'
+    ]
+    lz4xxhash_kwargs['extra_link_args'] = ['-s']
     if liblz4_found is True and use_system_liblz4 is True:
         extension_kwargs = pkgconfig_parse('liblz4')
     else:
@@ -127,6 +194,157 @@ else:
     print('Unrecognized compiler: {0}'.format(compiler))
     sys.exit(1)
 
+# The optimized build moves the bundled library sources out of the extension
+# modules into two static libraries: lz4core, built from lz4.c, and lz4hc
+# with the rest.
+libraries = []
+if optimize is True:
+    if (liblz4_found is True and use_system_liblz4 is True) or \
+       compiler not in ('unix', 'mingw32'):
+        print('PYLZ4_OPTIMIZE ignored: it requires the bundled LZ4 library '
+              'and a GCC compatible compiler')
+        optimize = pgo = False
+
+if optimize is True:
+    lz4core_sources = [
+        'lz4libs/lz4.c',
+    ]
+    lz4hc_sources = [
+        'lz4libs/lz4hc.c',
+        'lz4libs/lz4frame.c',
+        'lz4libs/xxhash.c',
+    ]
+    for sources in (lz4version_sources, lz4block_sources, lz4frame_sources,
+                    lz4stream_sources, lz4cache_sources, lz4xxhash_sources):
+        sources[:] = [s for s in sources
+                      if s not in lz4core_sources + lz4hc_sources]
+
+    lto_args = []
+    for args in (['-flto=auto', '-ffat-lto-objects'], ['-flto']):
+        if compiler_accepts(args):
+            lto_args = args
+            break
+    extension_kwargs['extra_compile_args'] = \
+        extension_kwargs['extra_compile_args'] + lto_args
+    extension_kwargs['extra_link_args'] = \
+        extension_kwargs['extra_link_args'] + lto_args
+    lz4xxhash_kwargs['extra_compile_args'] = \
+        lz4xxhash_kwargs['extra_compile_args'] + lto_args
+    lz4xxhash_kwargs['extra_link_args'] = \
+        lz4xxhash_kwargs['extra_link_args'] + lto_args
+
+    # The public functions of lz4.c, into which the hot copy and match loops
+    # are inlined, are built for each target and dispatched on the CPU at
+    # load time. This is limited to lz4.c because GCC fails to resolve the
+    # clones under LTO from other files that declare them through lz4.h, such
+    # as lz4hc.c, which is why it is a library of its own.
+    lz4core_macros = []
+    target_clones = '__attribute__ ((visibility ("default"), ' \
+        'target_clones ("default", "arch=x86-64-v2", "arch=x86-64-v3")))'
+    if platform.machine().lower() in ('x86_64', 'amd64') and \
+       compiler_accepts([], target_clones + ' int f(void) { return 0; }\n'
+                        'int main(void) { return f(); }\n'):
+        lz4core_macros.append(('LZ4LIB_VISIBILITY', target_clones))
+
+    # lz4hc uses lz4core, so it is listed, and linked, first.
+    libraries.extend([
+        ('lz4hc', {
+            'sources': lz4hc_sources,
+            'include_dirs': ['lz4libs'],
+            'cflags': ['-O3', '-Wall', '-Wundef'] + lto_args,
+        }),
+        ('lz4core', {
+            'sources': lz4core_sources,
+            'include_dirs': ['lz4libs'],
+            'macros': lz4core_macros,
+            'cflags': ['-O3', '-Wall', '-Wundef'] + lto_args,
+        }),
+    ])
+
+    if pgo is True and not compiler_accepts(
+            [], '#if !defined(__GNUC__) || defined(__clang__)\n'
+            '#error not GCC\n#endif\nint main(void) { return 0; }\n'):
+        print('PYLZ4_PGO ignored: profile-guided optimization requires GCC')
+        pgo = False
+
+# Establish if we want the USDT tracepoints of lz4/_trace.h compiled in, which
+# requires the <sys/sdt.h> header from SystemTap.
+usdt_env = os.environ.get("PYLZ4_USDT", "False")
+if usdt_env.upper() in ("1", "TRUE"):
+    if compiler_accepts(
+            [], '#include <sys/sdt.h>\n'
+            'int main(void) { DTRACE_PROBE (python_lz4, check); return 0; }\n'):
+        extension_kwargs['define_macros'] = \
+            extension_kwargs.get('define_macros', []) + [('PYLZ4_USDT', '1')]
+    else:
+        print('PYLZ4_USDT ignored: <sys/sdt.h> was not found')
+
+
+class BuildExt(build_ext):
+    """Build the extension modules, building the bundled libraries first if
+    there are any, and twice with profile-guided optimization.
+
+    """
+
+    def run(self):
+        if not self.distribution.has_c_libraries():
+            build_ext.run(self)
+            return
+        if pgo is False:
+            self.run_command('build_clib')
+            build_ext.run(self)
+            return
+
+        build_clib = self.get_finalized_command('build_clib')
+        libraries = [(info, dict(info)) for _, info in build_clib.libraries]
+        extensions = [(ext, ext.extra_compile_args, ext.extra_link_args)
+                      for ext in self.extensions]
+        # Both commands replace their compiler option with the compiler
+        # object they create.
+        compilers = (build_clib.compiler, self.compiler)
+
+        def rebuild(args, clones):
+            # Rebuild the libraries and the extension modules from scratch
+            # with the extra compiler and linker arguments.
+            for info, base in libraries:
+                info['cflags'] = base['cflags'] + args
+                info['macros'] = base.get('macros', []) if clones else []
+                # build_clib only rebuilds objects older than their sources.
+                for source in info['sources']:
+                    obj = os.path.splitext(source)[0] + '.o'
+                    obj = os.path.join(build_clib.build_temp, obj)
+                    if os.path.exists(obj):
+                        os.remove(obj)
+            build_clib.compiler, self.compiler = compilers
+            build_clib.run()
+            for ext, compile_args, link_args in extensions:
+                ext.extra_compile_args = compile_args + args
+                ext.extra_link_args = link_args + args
+            self.force = True
+            build_ext.run(self)
+
+        # Instrumented CPU dispatch functions crash when the extension modules
+        # are loaded, so the training build is made without the clones. The
+        # profile of each function applies to all of its clones.
+        profile_dir = os.path.abspath(os.path.join(self.build_temp, 'pgo'))
+        shutil.rmtree(profile_dir, ignore_errors=True)
+        rebuild(['-fprofile-generate=' + profile_dir,
+                 '-fprofile-update=atomic'], clones=False)
+
+        env = dict(os.environ)
+        path = os.path.abspath('.' if self.inplace else self.build_lib)
+        env['PYTHONPATH'] = os.pathsep.join(
+            [path] + [p for p in env.get('PYTHONPATH', '').split(os.pathsep)
+                      if p]
+        )
+        subprocess.check_call(
+            [sys.executable, os.path.join('tools', 'pgo_train.py')], env=env
+        )
+
+        rebuild(['-fprofile-use=' + profile_dir, '-fprofile-correction',
+                 '-Wno-missing-profile'], clones=True)
+
+
 lz4version = Extension('lz4._version',
                        lz4version_sources,
                        **extension_kwargs)
@@ -143,7 +361,15 @@ lz4stream = Extension('lz4.stream._stream',
                       lz4stream_sources,
                       **extension_kwargs)
 
-ext_modules = [lz4version, lz4block, lz4frame]
+lz4cache = Extension('lz4.cache._cache',
+                     lz4cache_sources,
+                     **extension_kwargs)
+
+lz4xxhash = Extension('lz4.xxhash._xxhash',
+                      lz4xxhash_sources,
+                      **lz4xxhash_kwargs)
+
+ext_modules = [lz4version, lz4block, lz4frame, lz4cache, lz4xxhash]
 
 if experimental is True:
     ext_modules.append(lz4stream)
@@ -186,6 +412,8 @@ setup(
     url='https://github.com/python-lz4/python-lz4',
     packages=packages,
     ext_modules=ext_modules,
+    libraries=libraries,
+    cmdclass={'build_ext': BuildExt},
     tests_require=tests_require,
     extras_require={
         'tests': tests_require,
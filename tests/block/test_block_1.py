@@ -1,5 +1,6 @@
 import lz4.block
 import pytest
+import random
 import sys
 import os
 
@@ -147,3 +148,66 @@ def test_known_decompress_4():
     input = b'\xb0\xb3\x00\x00\xff\x1fExcepteur sint occaecat cupidatat non proident.\x00' + (b'\xff' * 180) + b'\x1ePident'
     output = b'Excepteur sint occaecat cupidatat non proident' * 1000
     assert lz4.block.decompress(input) == output
+
+
+def test_decompress_max_length():
+    input_data = b"2099023098234882923049823094823094898239230982349081231290381209380981203981209381238901283098908123109238098123" * 24
+    compressed = lz4.block.compress(input_data)
+    for n in [0, 1, 10, 256, len(input_data) - 1]:
+        assert lz4.block.decompress(compressed, max_length=n) == input_data[:n]
+    assert lz4.block.decompress(compressed, max_length=len(input_data)) == input_data
+    assert lz4.block.decompress(compressed, max_length=len(input_data) + 1) == input_data
+    assert lz4.block.decompress(compressed, max_length=-1) == input_data
+    b = lz4.block.decompress(compressed, max_length=10, return_bytearray=True)
+    assert isinstance(b, bytearray)
+    assert b == input_data[:10]
+
+
+def test_decompress_max_length_without_stored_size():
+    input_data = b'Lorem ipsum dolor sit amet' * 100
+    compressed = lz4.block.compress(input_data, store_size=False)
+    assert lz4.block.decompress(
+        compressed, uncompressed_size=len(input_data), max_length=26) == input_data[:26]
+    assert lz4.block.decompress(
+        compressed, uncompressed_size=4 * len(input_data), max_length=2 * len(input_data)) == input_data
+
+
+def test_decompress_max_length_with_dict():
+    input_data = b"2099023098234882923049823094823094898239230982349081231290381209380981203981209381238901283098908123109238098123" * 24
+    dict1 = input_data[10:30]
+    compressed = lz4.block.compress(input_data, dict=dict1)
+    if lz4.library_version_number() >= 10904:
+        assert lz4.block.decompress(compressed, dict=dict1, max_length=100) == input_data[:100]
+    else:
+        with pytest.raises(RuntimeError):
+            lz4.block.decompress(compressed, dict=dict1, max_length=100)
+
+
+def test_favor_decompression_speed():
+    input_data = b"2099023098234882923049823094823094898239230982349081231290381209380981203981209381238901283098908123109238098123" * 24
+    for compression in (9, 10, 12):
+        compressed = lz4.block.compress(
+            input_data, mode='high_compression', compression=compression,
+            favor_decompression_speed=True)
+        assert lz4.block.decompress(compressed) == input_data
+    # Ignored outside of the high compression mode
+    assert lz4.block.compress(input_data, favor_decompression_speed=True) == \
+        lz4.block.compress(input_data)
+
+
+def test_favor_decompression_speed_with_dict():
+    # Seeded text-like data, on which favoring decompression speed changes
+    # the output of the optimal parser
+    _random = random.Random(28)
+    words = [bytes(_random.choice(b'abcdefgh') for _ in range(_random.randint(2, 9)))
+             for _ in range(300)]
+    data = b' '.join(_random.choice(words) for _ in range(10000))
+    dict1, input_data = data[:30000], data[30000:]
+    for compression in (10, 12):
+        favored = lz4.block.compress(
+            input_data, mode='high_compression', compression=compression,
+            dict=dict1, favor_decompression_speed=True)
+        assert favored != lz4.block.compress(
+            input_data, mode='high_compression', compression=compression,
+            dict=dict1)
+        assert lz4.block.decompress(favored, dict=dict1) == input_data
@@ -0,0 +1,54 @@
+import lz4.block
+import pytest
+
+
+data = b'Lorem ipsum dolor sit amet' * 4
+
+
+def test_positional_and_keyword_arguments():
+    compressed = lz4.block.compress(data, 'high_compression', True, 1, 12)
+    assert compressed == lz4.block.compress(
+        data, mode='high_compression', compression=12)
+    assert lz4.block.decompress(compressed, -1, True) == bytearray(data)
+    assert lz4.block.decompress(
+        source=compressed, return_bytearray=True) == bytearray(data)
+
+
+@pytest.mark.parametrize(
+    'mode',
+    ['default', 'fast', 'high_compression', ''.join(['f', 'a', 's', 't'])]
+)
+def test_mode(mode):
+    assert lz4.block.decompress(lz4.block.compress(data, mode=mode)) == data
+
+
+def test_invalid_mode():
+    with pytest.raises(ValueError, match='Invalid mode argument: slow'):
+        lz4.block.compress(data, mode='slow')
+    with pytest.raises(TypeError):
+        lz4.block.compress(data, mode=b'fast')
+
+
+def test_invalid_arguments():
+    with pytest.raises(TypeError, match='takes at most'):
+        lz4.block.compress(data, 'default', True, 1, 9, False, None, False,
+                           0, False, None, 0, 1)
+    with pytest.raises(TypeError, match='invalid keyword argument'):
+        lz4.block.compress(data, level=9)
+    with pytest.raises(TypeError, match='given by name'):
+        lz4.block.compress(data, 'fast', mode='fast')
+    with pytest.raises(TypeError, match='missing required argument'):
+        lz4.block.compress()
+    with pytest.raises(TypeError):
+        lz4.block.compress(u'str is not bytes-like')
+    with pytest.raises(TypeError):
+        lz4.block.compress(data, acceleration=1.0)
+    with pytest.raises(OverflowError):
+        lz4.block.compress(data, acceleration=1 << 40)
+    with pytest.raises(TypeError):
+        lz4.block.decompress(data, dict=1)
+
+
+def test_dict_as_str():
+    compressed = lz4.block.compress(data, dict=u'Lorem ipsum')
+    assert lz4.block.decompress(compressed, dict=b'Lorem ipsum') == data
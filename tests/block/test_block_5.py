@@ -0,0 +1,82 @@
+import os
+import lz4.block
+import pytest
+
+
+data = os.urandom(1000) * 20 + b'Lorem ipsum dolor sit amet' * 100
+fragments = [data[:10], memoryview(data)[10:5000], b'', bytearray(data[5000:])]
+
+
+@pytest.mark.parametrize('mode', ['default', 'fast', 'high_compression'])
+@pytest.mark.parametrize('store_size', [True, False])
+def test_compress_buffer_list(mode, store_size):
+    assert lz4.block.compress(fragments, mode=mode, store_size=store_size) == \
+        lz4.block.compress(data, mode=mode, store_size=store_size)
+    assert lz4.block.compress(tuple(fragments), mode=mode) == \
+        lz4.block.compress(data, mode=mode)
+
+
+def test_compress_buffer_list_with_dict():
+    dictionary = data[:500]
+    compressed = lz4.block.compress(fragments, dict=dictionary)
+    assert lz4.block.decompress(compressed, dict=dictionary) == data
+
+
+def test_compress_empty_list():
+    assert lz4.block.compress([]) == lz4.block.compress(b'')
+
+
+def test_compress_invalid_source():
+    with pytest.raises(TypeError):
+        lz4.block.compress(1)
+    with pytest.raises(TypeError):
+        lz4.block.compress([b'abc', 'abc'])
+
+
+@pytest.mark.parametrize(
+    'sizes',
+    [
+        [len(data)],
+        [len(data) + 100],
+        [10, 0, 5000, len(data)],
+        [1] * 100 + [len(data)],
+    ]
+)
+def test_decompress_into(sizes):
+    compressed = lz4.block.compress(data)
+    destination = [bytearray(size) for size in sizes]
+    written = lz4.block.decompress_into(compressed, destination)
+    assert written == len(data)
+    assert b''.join(destination)[:written] == data
+
+
+def test_decompress_into_single_buffer():
+    compressed = lz4.block.compress(data, store_size=False)
+    destination = bytearray(len(data) * 2)
+    written = lz4.block.decompress_into(
+        compressed, destination, uncompressed_size=len(destination))
+    assert destination[:written] == data
+
+
+def test_decompress_into_with_dict():
+    dictionary = data[:500]
+    compressed = lz4.block.compress(data, dict=dictionary)
+    destination = [bytearray(100), bytearray(len(data))]
+    written = lz4.block.decompress_into(compressed, destination,
+                                        dict=dictionary)
+    assert b''.join(destination)[:written] == data
+
+
+def test_decompress_into_too_small():
+    compressed = lz4.block.compress(data)
+    with pytest.raises(ValueError):
+        lz4.block.decompress_into(compressed, [bytearray(10), bytearray(10)])
+    with pytest.raises(lz4.block.LZ4BlockError):
+        lz4.block.decompress_into(
+            compressed[4:], bytearray(10), uncompressed_size=len(data))
+
+
+def test_decompress_into_read_only():
+    compressed = lz4.block.compress(data)
+    with pytest.raises(BufferError):
+        lz4.block.decompress_into(compressed, bytes(len(data)))
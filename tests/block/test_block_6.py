@@ -0,0 +1,103 @@
+import os
+import struct
+import lz4.block
+import pytest
+
+
+def _shuffled(data, itemsize):
+    count = len(data) // itemsize
+    return bytes(
+        data[i * itemsize + j] for j in range(itemsize) for i in range(count)
+    ) + data[count * itemsize:]
+
+
+integers = struct.pack('<%di' % 100000, *range(100000))
+
+
+@pytest.mark.parametrize('itemsize', [0, 1, 2, 3, 4, 8, 16, 256])
+@pytest.mark.parametrize('bitshuffle', [False, True])
+@pytest.mark.parametrize('size', [0, 7, 16, 100, 4099])
+def test_round_trip(itemsize, bitshuffle, size):
+    data = os.urandom(size)
+    compressed = lz4.block.compress(data, shuffle=itemsize, bitshuffle=bitshuffle)
+    assert lz4.block.decompress(
+        compressed, shuffle=itemsize, bitshuffle=bitshuffle) == data
+
+
+@pytest.mark.parametrize('itemsize', [2, 3, 4, 8, 16])
+def test_layout(itemsize):
+    data = os.urandom(1001)
+    compressed = lz4.block.compress(data, shuffle=itemsize, store_size=False)
+    assert lz4.block.decompress(
+        compressed, uncompressed_size=len(data)) == _shuffled(data, itemsize)
+
+
+def test_bitshuffle_layout():
+    data = bytes([1, 2, 4, 8, 16, 32, 64, 128]) * 2 + b'x'
+    compressed = lz4.block.compress(data, bitshuffle=True, store_size=False)
+    assert lz4.block.decompress(
+        compressed, uncompressed_size=len(data)) == bytes([1, 1, 2, 2, 4, 4,
+                                                           8, 8, 16, 16, 32,
+                                                           32, 64, 64, 128,
+                                                           128]) + b'x'
+
+
+@pytest.mark.parametrize('bitshuffle', [False, True])
+def test_recorded(bitshuffle):
+    # With the size stored, the shuffle is recorded and undone without the
+    # arguments, and other arguments are refused.
+    compressed = lz4.block.compress(integers, shuffle=4, bitshuffle=bitshuffle)
+    assert lz4.block.decompress(compressed) == integers
+    assert lz4.block.decompress(
+        compressed, shuffle=4, bitshuffle=bitshuffle) == integers
+    with pytest.raises(ValueError):
+        lz4.block.decompress(compressed, shuffle=8, bitshuffle=bitshuffle)
+    with pytest.raises(ValueError):
+        lz4.block.decompress(compressed, shuffle=4,
+                             bitshuffle=not bitshuffle)
+    with pytest.raises(ValueError):
+        lz4.block.decompress(lz4.block.compress(integers), shuffle=4)
+    with pytest.raises(ValueError):
+        lz4.block.decompress_into(compressed, bytearray(len(integers)))
+    # The size has its top bit set, so other decoders fail on the block.
+    assert compressed[3] & 0x80
+
+
+def test_shuffle_itemsize():
+    # shuffle=True takes the item size from itemsize, like the delta filter
+    compressed = lz4.block.compress(integers, shuffle=True, itemsize=4)
+    assert compressed == lz4.block.compress(integers, shuffle=4)
+    compressed = lz4.block.compress(integers, shuffle=True, itemsize=4,
+                                    store_size=False)
+    assert lz4.block.decompress(compressed, uncompressed_size=len(integers),
+                                shuffle=True, itemsize=4) == integers
+    with pytest.raises(ValueError):
+        lz4.block.compress(integers, shuffle=4, itemsize=8)
+
+
+def test_ratio():
+    plain = lz4.block.compress(integers)
+    shuffled = lz4.block.compress(integers, shuffle=4)
+    assert len(shuffled) * 10 < len(plain)
+
+
+def test_options():
+    compressed = lz4.block.compress([integers[:1000], integers[1000:]], shuffle=4,
+                                    mode='high_compression', store_size=False,
+                                    return_bytearray=True)
+    assert isinstance(compressed, bytearray)
+    decompressed = lz4.block.decompress(
+        compressed, uncompressed_size=len(integers), shuffle=4,
+        return_bytearray=True)
+    assert decompressed == integers
+    assert isinstance(decompressed, bytearray)
+
+
+def test_invalid():
+    with pytest.raises(ValueError):
+        lz4.block.compress(integers, shuffle=-1)
+    with pytest.raises(ValueError):
+        lz4.block.compress(integers, shuffle=257)
+    compressed = lz4.block.compress(integers, shuffle=4)
+    with pytest.raises(ValueError):
+        lz4.block.decompress(compressed, shuffle=4, max_length=10)
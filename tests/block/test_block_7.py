@@ -0,0 +1,115 @@
+import os
+import struct
+import lz4.block
+import pytest
+
+
+def _encode(data, kind, itemsize):
+    # Reference encoding. A trailing partial item is encoded as if padded
+    # with zero bytes, and truncated again.
+    mask = (1 << (8 * itemsize)) - 1
+    count = -(-len(data) // itemsize)
+    items = [int.from_bytes(data[i * itemsize:(i + 1) * itemsize], 'little')
+             for i in range(count)]
+    out = []
+    previous = previous_delta = 0
+    for x in items:
+        if kind == 'xor':
+            out.append(x ^ previous)
+        elif kind == 'delta':
+            out.append((x - previous) & mask)
+        else:
+            delta = (x - previous) & mask
+            out.append((delta - previous_delta) & mask)
+            previous_delta = delta
+        previous = x
+    return b''.join(y.to_bytes(itemsize, 'little') for y in out)[:len(data)]
+
+
+timestamps = struct.pack('<%dq' % 20000,
+                         *(1700000000000 + 1000 * i + i % 3 for i in range(20000)))
+
+
+@pytest.mark.parametrize('kind', ['delta', 'delta_of_delta', 'xor'])
+@pytest.mark.parametrize('itemsize', [1, 2, 4, 8])
+@pytest.mark.parametrize('size', [0, 5, 64, 1001])
+def test_round_trip(kind, itemsize, size):
+    data = os.urandom(size)
+    compressed = lz4.block.compress(data, filter=kind, itemsize=itemsize)
+    assert lz4.block.decompress(compressed) == data
+    assert lz4.block.decompress(
+        compressed, filter=kind, itemsize=itemsize) == data
+    # Without the size nothing is recorded, and the filter isn't undone
+    # unless it is passed.
+    compressed = lz4.block.compress(data, filter=kind, itemsize=itemsize,
+                                    store_size=False)
+    assert lz4.block.decompress(
+        compressed, uncompressed_size=size) == _encode(data, kind, itemsize)
+    assert lz4.block.decompress(
+        compressed, uncompressed_size=size, filter=kind,
+        itemsize=itemsize) == data
+
+
+def test_recorded():
+    # With the size stored, the filter is recorded and undone without the
+    # arguments, and other arguments are refused.
+    compressed = lz4.block.compress(timestamps, filter='delta', itemsize=8)
+    with pytest.raises(ValueError):
+        lz4.block.decompress(compressed, filter='xor', itemsize=8)
+    with pytest.raises(ValueError):
+        lz4.block.decompress(compressed, filter='delta', itemsize=4)
+    with pytest.raises(ValueError):
+        lz4.block.decompress(lz4.block.compress(timestamps), filter='delta',
+                             itemsize=8)
+    with pytest.raises(ValueError):
+        lz4.block.decompress_into(compressed, bytearray(len(timestamps)))
+    # The size has its top bit set, so other decoders fail on the block.
+    assert compressed[3] & 0x80
+
+
+@pytest.mark.parametrize('kind', ['delta', 'delta_of_delta', 'xor'])
+def test_buffer_list(kind):
+    # Items split between buffers
+    pieces = [timestamps[:3], timestamps[3:20], timestamps[20:]]
+    compressed = lz4.block.compress(pieces, filter=kind, itemsize=8)
+    assert lz4.block.decompress(
+        compressed, filter=kind, itemsize=8) == timestamps
+
+
+def test_ratio():
+    plain = lz4.block.compress(timestamps)
+    encoded = lz4.block.compress(timestamps, filter='delta_of_delta', itemsize=8)
+    assert len(encoded) * 20 < len(plain)
+
+
+def test_max_length():
+    compressed = lz4.block.compress(timestamps, filter='delta', itemsize=8)
+    assert lz4.block.decompress(
+        compressed, filter='delta', itemsize=8, max_length=1003) == \
+        timestamps[:1003]
+
+
+@pytest.mark.parametrize('bitshuffle', [False, True])
+def test_with_shuffle(bitshuffle):
+    compressed = lz4.block.compress(timestamps, filter='xor', itemsize=8,
+                                    shuffle=8, bitshuffle=bitshuffle,
+                                    return_bytearray=True)
+    decompressed = lz4.block.decompress(compressed, filter='xor', itemsize=8,
+                                        shuffle=8, bitshuffle=bitshuffle,
+                                        return_bytearray=True)
+    assert decompressed == timestamps
+    assert isinstance(decompressed, bytearray)
+
+
+def test_invalid():
+    with pytest.raises(ValueError):
+        lz4.block.compress(timestamps, filter='delta', itemsize=3)
+    with pytest.raises(ValueError):
+        lz4.block.compress(timestamps, filter='delta')
+    with pytest.raises(ValueError):
+        lz4.block.compress(timestamps, filter='zigzag', itemsize=8)
+    with pytest.raises(TypeError):
+        lz4.block.compress(timestamps, filter=8)
+    compressed = lz4.block.compress(timestamps)
+    with pytest.raises(ValueError):
+        lz4.block.decompress(compressed, filter='xor', itemsize=0)
@@ -0,0 +1,212 @@
+import os
+import threading
+import lz4.cache
+import pytest
+
+
+values = [b'value %d %s' % (i, b'abc' * (i % 50)) for i in range(2000)]
+values[10] = b''
+values[11] = os.urandom(5000)
+values[12] = os.urandom(300000)
+values[13] = b'\0' * 3000000
+
+
+@pytest.mark.parametrize('policy', ['lru', 'clock'])
+@pytest.mark.parametrize('key', [int, str, lambda i: str(i).encode()])
+def test_roundtrip(policy, key):
+    cache = lz4.cache.CompressedCache(64 << 20, policy=policy)
+    for i, value in enumerate(values):
+        assert cache.put(key(i), value) is True
+    assert len(cache) == len(values)
+    for i, value in enumerate(values):
+        assert key(i) in cache
+        assert cache[key(i)] == value
+        assert cache.get(key(i)) == value
+    assert cache.hits == 2 * len(values)
+    assert cache.misses == 0
+    assert cache.nbytes == sum(len(v) for v in values)
+    assert cache.compressed_nbytes < cache.nbytes
+    assert cache.compression_ratio > 1
+    assert cache.evictions == 0
+
+
+def test_keys_are_distinct():
+    cache = lz4.cache.CompressedCache(1 << 20)
+    cache[1] = b'int'
+    cache['1'] = b'str'
+    cache[b'1'] = b'bytes'
+    cache[-1] = b'negative'
+    cache[1 << 62] = b'large'
+    cache['été'] = b'unicode'
+    assert [cache[k] for k in [1, '1', b'1', -1, 1 << 62, 'été']] == \
+        [b'int', b'str', b'bytes', b'negative', b'large', b'unicode']
+    assert 2 not in cache
+
+
+@pytest.mark.parametrize(
+    'key', [1.0, (1,), None, True, 1 << 64, bytearray(b'1')])
+def test_invalid_keys(key):
+    cache = lz4.cache.CompressedCache(1 << 20)
+    with pytest.raises((TypeError, OverflowError)):
+        cache[key] = b'value'
+    with pytest.raises((TypeError, OverflowError)):
+        cache.get(key)
+
+
+def test_missing():
+    cache = lz4.cache.CompressedCache(1 << 20)
+    assert cache.get('missing') is None
+    assert cache.get('missing', b'default') == b'default'
+    assert cache.get_into('missing', bytearray(10)) is None
+    with pytest.raises(KeyError):
+        cache['missing']
+    with pytest.raises(KeyError):
+        del cache['missing']
+    assert cache.misses == 4
+    assert cache.hits == 0
+    assert cache.hit_ratio == 0.0
+    cache['present'] = b'x'
+    cache.get('present')
+    assert cache.hit_ratio == 0.2
+
+
+def test_replace_and_delete():
+    cache = lz4.cache.CompressedCache(1 << 20)
+    cache['key'] = os.urandom(1000)
+    used = cache.used
+    cache['key'] = b'b' * 10
+    assert len(cache) == 1
+    assert cache['key'] == b'b' * 10
+    assert cache.nbytes == 10
+    assert cache.used < used
+    del cache['key']
+    assert len(cache) == 0
+    assert 'key' not in cache
+    assert cache.used == 0
+    assert cache.nbytes == cache.compressed_nbytes == 0
+
+
+def test_get_into():
+    cache = lz4.cache.CompressedCache(16 << 20)
+    for i, value in enumerate(values):
+        cache[i] = value
+    destination = bytearray(len(values[13]) + 10)
+    for i, value in enumerate(values):
+        assert cache.get_into(i, destination) == len(value)
+        assert destination[:len(value)] == value
+    view = memoryview(destination)[100:200]
+    assert cache.get_into(0, view) == len(values[0])
+    assert destination[100:100 + len(values[0])] == values[0]
+    with pytest.raises(ValueError):
+        cache.get_into(13, bytearray(100))
+    with pytest.raises(BufferError):
+        cache.get_into(0, b'read only')
+
+
+@pytest.mark.parametrize('policy', ['lru', 'clock'])
+def test_eviction(policy):
+    capacity = 200000
+    cache = lz4.cache.CompressedCache(capacity, policy=policy)
+    for i in range(10000):
+        cache[i] = os.urandom(100)
+        # Keep the first key in use.
+        assert cache.get(0) is not None
+        assert cache.used <= capacity
+    assert 0 < len(cache) < 10000
+    assert cache.evictions == 10000 - len(cache)
+    assert 0 in cache
+    assert 1 not in cache
+    assert 9999 in cache
+
+
+def test_lru_order():
+    cache = lz4.cache.CompressedCache(1 << 20)
+    cache[0] = os.urandom(1000)
+    cache = lz4.cache.CompressedCache(3 * cache.used)
+    for i in range(3):
+        cache[i] = os.urandom(1000)
+    cache.get(0)
+    cache[3] = os.urandom(1000)
+    assert sorted(k for k in range(4) if k in cache) == [0, 2, 3]
+
+
+def test_too_large():
+    cache = lz4.cache.CompressedCache(10000)
+    cache['key'] = b'small'
+    assert cache.put('key', os.urandom(20000)) is False
+    assert 'key' not in cache
+    # Compressible values are limited by their compressed size.
+    assert cache.put('key', b'\0' * 20000) is True
+    assert cache['key'] == b'\0' * 20000
+
+
+def test_clear():
+    cache = lz4.cache.CompressedCache(64 << 20)
+    for i, value in enumerate(values):
+        cache[i] = value
+    cache.get(0)
+    memory = cache.memory
+    cache.clear()
+    assert len(cache) == 0
+    assert cache.used == 0
+    assert cache.memory < memory
+    assert cache.hits == 1
+    assert 0 not in cache
+    cache[0] = values[0]
+    assert cache[0] == values[0]
+
+
+def test_dictionary():
+    records = [b'{"id": %d, "name": "user %d", "email": "user%d@example.com"}'
+               % (i, i, i) for i in range(1000)]
+    dictionary = b''.join(records[:100])
+    plain = lz4.cache.CompressedCache(1 << 20)
+    with_dict = lz4.cache.CompressedCache(1 << 20, dict=dictionary)
+    for i, record in enumerate(records):
+        plain[i] = record
+        with_dict[i] = record
+    assert with_dict.compressed_nbytes < plain.compressed_nbytes // 2
+    for i, record in enumerate(records):
+        assert with_dict[i] == record
+    # Only the last 64 kB of a large dictionary are used.
+    large = lz4.cache.CompressedCache(1 << 20, dict=os.urandom(1 << 20))
+    large[0] = records[0]
+    assert large[0] == records[0]
+
+
+def test_invalid_arguments():
+    with pytest.raises(ValueError):
+        lz4.cache.CompressedCache(0)
+    with pytest.raises(ValueError):
+        lz4.cache.CompressedCache(1000, policy='fifo')
+    with pytest.raises(TypeError):
+        lz4.cache.CompressedCache()
+    cache = lz4.cache.CompressedCache(1000)
+    assert cache.capacity == 1000
+    with pytest.raises(TypeError):
+        cache.put('key', 'not a buffer')
+
+
+def test_threads():
+    cache = lz4.cache.CompressedCache(1 << 20)
+    errors = []
+
+    def worker(offset):
+        try:
+            for i in range(2000):
+                key = (offset * 1000 + i) % 3000
+                cache[key] = values[key % len(values)][:1000]
+                value = cache.get((key * 7) % 3000)
+                if value is not None:
+                    assert value == values[((key * 7) % 3000) %
+                                           len(values)][:1000]
+        except Exception as e:
+            errors.append(e)
+
+    threads = [threading.Thread(target=worker, args=(n,)) for n in range(4)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    assert not errors
+    assert cache.used <= cache.capacity
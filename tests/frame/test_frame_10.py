@@ -0,0 +1,47 @@
+import lz4.frame as lz4frame
+import pytest
+import os
+
+test_data = [
+    (os.urandom(32) * 256),
+]
+
+
+@pytest.fixture(
+    params=test_data,
+    ids=[
+        'data' + str(i) for i in range(len(test_data))
+    ]
+)
+def data(request):
+    return request.param
+
+
+@pytest.mark.parametrize('compression_level', [0, 9, 10, 12])
+def test_favor_decompression_speed_1(data, compression_level):
+    compressed = lz4frame.compress(
+        data,
+        compression_level=compression_level,
+        favor_decompression_speed=True
+    )
+    assert lz4frame.decompress(compressed) == data
+
+
+@pytest.mark.parametrize('compression_level', [0, 9, 10, 12])
+def test_favor_decompression_speed_2(data, compression_level):
+    with lz4frame.LZ4FrameCompressor(
+            compression_level=compression_level,
+            favor_decompression_speed=True) as compressor:
+        compressed = compressor.begin()
+        compressed += compressor.compress(data)
+        compressed += compressor.flush()
+    assert lz4frame.decompress(compressed) == data
+
+
+def test_favor_decompression_speed_3(tmp_path, data):
+    filename = tmp_path / 'testfile'
+    with lz4frame.open(filename, 'wb', compression_level=12,
+                       favor_decompression_speed=True) as fp:
+        fp.write(data)
+    with lz4frame.open(filename, 'rb') as fp:
+        assert fp.read() == data
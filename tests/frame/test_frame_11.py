@@ -0,0 +1,67 @@
+import lz4
+import lz4.frame as lz4frame
+import os
+import pytest
+import tracemalloc
+
+
+pytestmark = pytest.mark.skipif(
+    lz4.library_version_number() < 10904,
+    reason='Custom allocators require LZ4 library version >= 1.9.4'
+)
+
+
+@pytest.fixture
+def python_allocator():
+    lz4frame.set_allocator('python')
+    yield
+    lz4frame.set_allocator('default')
+
+
+def test_get_set_allocator():
+    assert lz4frame.get_allocator() == 'default'
+    lz4frame.set_allocator('python')
+    try:
+        assert lz4frame.get_allocator() == 'python'
+    finally:
+        lz4frame.set_allocator('default')
+    assert lz4frame.get_allocator() == 'default'
+
+
+def test_invalid_allocator():
+    with pytest.raises(ValueError):
+        lz4frame.set_allocator('malloc')
+    assert lz4frame.get_allocator() == 'default'
+
+
+@pytest.mark.parametrize('compression_level', [0, 9])
+def test_roundtrip_python_allocator(python_allocator, compression_level):
+    data = os.urandom(1024) * 128
+    compressed = lz4frame.compress(data, compression_level=compression_level)
+    lz4frame.set_allocator('default')
+    assert compressed == lz4frame.compress(
+        data, compression_level=compression_level)
+    lz4frame.set_allocator('python')
+    assert lz4frame.decompress(compressed) == data
+
+    with lz4frame.LZ4FrameCompressor(
+            compression_level=compression_level) as compressor:
+        compressed = compressor.begin()
+        compressed += compressor.compress(data)
+        compressed += compressor.flush()
+    with lz4frame.LZ4FrameDecompressor() as decompressor:
+        assert decompressor.decompress(compressed) == data
+
+
+def test_python_allocator_traced(python_allocator):
+    tracemalloc.start()
+    try:
+        before = tracemalloc.get_traced_memory()[0]
+        context = lz4frame.create_compression_context()
+        lz4frame.compress_begin(context, compression_level=9)
+        after = tracemalloc.get_traced_memory()[0]
+    finally:
+        tracemalloc.stop()
+    # The HC state alone is well above 64 kB
+    assert after - before > 64 * 1024
+    del context
@@ -0,0 +1,59 @@
+import lz4.frame as lz4frame
+import os
+import pytest
+
+
+test_data = [
+    (b''),
+    (os.urandom(8 * 1024)),
+    (b'0' * 8 * 1024 * 1024),
+    (os.urandom(64 * 1024) * 64),
+]
+
+
+@pytest.fixture(
+    params=test_data,
+    ids=[
+        'data' + str(i) for i in range(len(test_data))
+    ]
+)
+def data(request):
+    return request.param
+
+
+@pytest.fixture(
+    params=[True, False],
+    ids=['store_size', 'no_store_size']
+)
+def store_size(request):
+    return request.param
+
+
+@pytest.mark.parametrize('return_bytearray', [True, False])
+def test_decompress_segments(data, store_size, return_bytearray):
+    compressed = lz4frame.compress(data, store_size=store_size)
+    decompressed = lz4frame.decompress(
+        compressed, return_bytearray=return_bytearray)
+    assert decompressed == data
+    assert isinstance(decompressed, bytearray if return_bytearray else bytes)
+
+
+def test_decompress_max_output_size(data, store_size):
+    compressed = lz4frame.compress(data, store_size=store_size)
+    assert lz4frame.decompress(compressed, max_output_size=len(data)) == data
+    assert lz4frame.decompress(
+        compressed, max_output_size=len(data) + 1) == data
+    if len(data) > 0:
+        with pytest.raises(RuntimeError, match='max_output_size'):
+            lz4frame.decompress(compressed, max_output_size=len(data) - 1)
+        with pytest.raises(RuntimeError, match='max_output_size'):
+            lz4frame.decompress(compressed, max_output_size=0)
+
+
+def test_decompress_max_output_size_return_bytes_read(data):
+    compressed = lz4frame.compress(data, store_size=False)
+    decompressed, bytes_read = lz4frame.decompress(
+        compressed + b'trailing', max_output_size=len(data),
+        return_bytes_read=True)
+    assert decompressed == data
+    assert bytes_read == len(compressed)
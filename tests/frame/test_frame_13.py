@@ -0,0 +1,32 @@
+import lz4.frame as lz4frame
+import pytest
+
+
+data = b'Lorem ipsum dolor sit amet' * 4
+
+
+def test_positional_arguments():
+    context = lz4frame.create_compression_context()
+    compressed = lz4frame.compress_begin(context, 0, 9)
+    compressed += lz4frame.compress_chunk(context, data, True)
+    compressed += lz4frame.compress_flush(context, True, False)
+
+    context = lz4frame.create_decompression_context()
+    decompressed, bytes_read, end_of_frame = lz4frame.decompress_chunk(
+        context, compressed, -1, True)
+    assert decompressed == bytearray(data)
+    assert isinstance(decompressed, bytearray)
+    assert bytes_read == len(compressed)
+    assert end_of_frame is True
+
+
+def test_invalid_arguments():
+    context = lz4frame.create_compression_context()
+    with pytest.raises(TypeError, match='missing required argument'):
+        lz4frame.compress_chunk(context)
+    with pytest.raises(TypeError, match='invalid keyword argument'):
+        lz4frame.compress(data, level=9)
+    with pytest.raises(TypeError, match='given by name'):
+        lz4frame.decompress(lz4frame.compress(data), False, return_bytearray=True)
+    with pytest.raises(TypeError):
+        lz4frame.decompress_chunk(context, data, max_length=1.5)
@@ -0,0 +1,149 @@
+import os
+import sys
+import lz4.frame as lz4frame
+import pytest
+
+
+chunks = [os.urandom(128) * 256 + bytes(range(256)) * (i + 1) for i in range(8)]
+
+
+def _compress_chunks(chunks, stable_src, **kwargs):
+    compressor = lz4frame.LZ4FrameCompressor(**kwargs)
+    compressed = compressor.begin()
+    for chunk in chunks:
+        compressed += compressor.compress(chunk, stable_src=stable_src)
+    compressed += compressor.flush()
+    return compressed
+
+
+@pytest.mark.parametrize('stable_src', [False, True])
+@pytest.mark.parametrize('auto_flush', [False, True])
+@pytest.mark.parametrize('block_linked', [False, True])
+@pytest.mark.parametrize(
+    'block_size',
+    [lz4frame.BLOCKSIZE_MAX64KB, lz4frame.BLOCKSIZE_MAX4MB]
+)
+def test_roundtrip(stable_src, auto_flush, block_linked, block_size):
+    compressed = _compress_chunks(
+        chunks,
+        stable_src,
+        auto_flush=auto_flush,
+        block_linked=block_linked,
+        block_size=block_size,
+    )
+    assert lz4frame.decompress(compressed) == b''.join(chunks)
+
+
+def test_stable_src_matches_copy():
+    # Skipping the internal copy mustn't change the compressed output
+    assert _compress_chunks(chunks, True) == _compress_chunks(chunks, False)
+
+
+def test_chunk_larger_than_block():
+    data = os.urandom(1 << 10) * (1 << 9)
+    context = lz4frame.create_compression_context()
+    compressed = lz4frame.compress_begin(
+        context, block_size=lz4frame.BLOCKSIZE_MAX64KB)
+    compressed += lz4frame.compress_chunk(context, b'x' * 10)
+    compressed += lz4frame.compress_chunk(context, data)
+    compressed += lz4frame.compress_chunk(context, b'y' * 10)
+    compressed += lz4frame.compress_flush(context)
+    assert lz4frame.decompress(compressed) == b'x' * 10 + data + b'y' * 10
+
+
+def test_context_reused_for_several_frames():
+    context = lz4frame.create_compression_context()
+    for chunk in chunks:
+        compressed = lz4frame.compress_begin(context)
+        compressed += lz4frame.compress_chunk(context, chunk, stable_src=True)
+        compressed += lz4frame.compress_flush(context)
+        assert lz4frame.decompress(compressed) == chunk
+
+
+def test_stable_src_holds_reference():
+    context = lz4frame.create_compression_context()
+    data = bytearray(chunks[0])
+    lz4frame.compress_begin(context)
+    lz4frame.compress_chunk(context, data, stable_src=True)
+    # The context keeps the buffer exported, so it can't be resized
+    with pytest.raises(BufferError):
+        data.extend(b'x')
+    # LZ4F only collects these bytes into its buffer, and may still use the
+    # buffer as the dictionary of the block holding them
+    lz4frame.compress_chunk(context, b'more', stable_src=False)
+    with pytest.raises(BufferError):
+        data.extend(b'x')
+    # Released once the blocks holding the next 64 kB are compressed
+    lz4frame.compress_chunk(context, os.urandom(1 << 17), stable_src=False)
+    data.extend(b'x')
+
+    data = bytearray(chunks[0])
+    lz4frame.compress_chunk(context, data, stable_src=True)
+    lz4frame.compress_flush(context)
+    data.extend(b'x')
+
+
+def test_stable_src_released_with_context():
+    context = lz4frame.create_compression_context()
+    data = bytearray(chunks[0])
+    lz4frame.compress_begin(context)
+    lz4frame.compress_chunk(context, data, stable_src=True)
+    refcount = sys.getrefcount(data)
+    del context
+    assert sys.getrefcount(data) < refcount
+
+
+def _held(buffer):
+    # A buffer held by a compression context can't be resized
+    try:
+        buffer.append(0)
+    except BufferError:
+        return True
+    buffer.pop()
+    return False
+
+
+@pytest.mark.parametrize('compression_level', [0, 9])
+@pytest.mark.parametrize('auto_flush', [False, True])
+@pytest.mark.parametrize('block_linked', [False, True])
+@pytest.mark.parametrize(
+    'block_size',
+    [lz4frame.BLOCKSIZE_MAX64KB, lz4frame.BLOCKSIZE_MAX256KB]
+)
+def test_stable_src_mutated_once_released(compression_level, auto_flush,
+                                          block_linked, block_size):
+    # Once the context releases a stable source, it is overwritten with a
+    # slightly changed copy of data compressed next. Any match still taken
+    # from it would then decode to the original bytes instead.
+    original = os.urandom(1 << 16)
+    changed = bytearray(original)
+    changed[::1000] = bytes(len(changed[::1000]))
+    sizes = [65536, 10, 0, 1000, 30000, 65536, 100, 200000, 5, 70000]
+    for seed in range(4):
+        context = lz4frame.create_compression_context()
+        compressed = lz4frame.compress_begin(
+            context, compression_level=compression_level,
+            auto_flush=auto_flush, block_linked=block_linked,
+            block_size=block_size)
+        expected = []
+        held = []
+        for i, size in enumerate(sizes[seed:] + sizes[:seed]):
+            stable = (i + seed) % 3 != 1
+            chunk = bytearray(original[-size:] if size else b'')
+            if i % 2:
+                chunk = bytearray(changed[-size:] if size else b'')
+            expected.append(bytes(chunk))
+            compressed += lz4frame.compress_chunk(context, chunk,
+                                                  stable_src=stable)
+            if stable:
+                held.append(chunk)
+            for buffer in held:
+                if buffer and not _held(buffer):
+                    buffer[:] = changed[-len(buffer):] \
+                        if buffer == original[-len(buffer):] \
+                        else original[-len(buffer):]
+            held = [buffer for buffer in held if buffer and _held(buffer)]
+        compressed += lz4frame.compress_flush(context)
+        assert lz4frame.decompress(compressed) == b''.join(expected)
+        for buffer in held:
+            assert not _held(buffer)
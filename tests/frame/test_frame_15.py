@@ -0,0 +1,155 @@
+import os
+import lz4.frame as lz4frame
+import pytest
+
+
+lines = [
+    b'2024-01-01T00:00:%02d host app[%d]: request %d handled\n' % (i % 60, i, i)
+    for i in range(5000)
+]
+data = b''.join(lines)
+fragments = [data[:7], memoryview(data)[7:70000], b'', bytearray(data[70000:])]
+
+
+@pytest.mark.parametrize('compression_level', [0, 9])
+@pytest.mark.parametrize('block_linked', [True, False])
+@pytest.mark.parametrize('content_checksum', [True, False])
+@pytest.mark.parametrize(
+    'block_size',
+    [lz4frame.BLOCKSIZE_DEFAULT, lz4frame.BLOCKSIZE_MAX4MB]
+)
+def test_compress_buffer_list(compression_level, block_linked,
+                              content_checksum, block_size):
+    kwargs = dict(
+        compression_level=compression_level,
+        block_linked=block_linked,
+        content_checksum=content_checksum,
+        block_size=block_size,
+    )
+    compressed = lz4frame.compress(fragments, **kwargs)
+    assert compressed == lz4frame.compress(data, **kwargs)
+    assert lz4frame.decompress(compressed) == data
+
+
+def test_compress_buffer_list_random():
+    chunks = [os.urandom(100) * 1000, os.urandom(70000), b'x' * 100]
+    compressed = lz4frame.compress(tuple(chunks))
+    assert lz4frame.decompress(compressed) == b''.join(chunks)
+
+
+@pytest.mark.parametrize('compression_level', [0, 9, 12])
+@pytest.mark.parametrize('block_linked', [True, False])
+@pytest.mark.parametrize('piece_size', [1000, 65536, 100003, 300000])
+def test_compress_large_buffer_list(compression_level, block_linked,
+                                   piece_size):
+    # Large lists are compressed with a series of updates instead of being
+    # gathered first, with the buffers ending in the middle of blocks, and
+    # the output is still the same as for the joined buffers.
+    joined = data * 5 + os.urandom(100000) + data * 3
+    chunks = [joined[i:i + piece_size]
+              for i in range(0, len(joined), piece_size)]
+    compressed = lz4frame.compress(
+        chunks,
+        compression_level=compression_level,
+        block_linked=block_linked,
+    )
+    assert compressed == lz4frame.compress(
+        joined,
+        compression_level=compression_level,
+        block_linked=block_linked,
+    )
+
+
+def test_compress_empty_list():
+    assert lz4frame.decompress(lz4frame.compress([])) == b''
+
+
+@pytest.mark.parametrize('auto_flush', [True, False])
+@pytest.mark.parametrize('stable_src', [True, False])
+def test_compressor_buffer_list(auto_flush, stable_src):
+    compressor = lz4frame.LZ4FrameCompressor(auto_flush=auto_flush)
+    compressed = compressor.begin()
+    for i in range(0, len(lines), 100):
+        compressed += compressor.compress(lines[i:i + 100],
+                                          stable_src=stable_src)
+    compressed += compressor.flush()
+    assert lz4frame.decompress(compressed) == data
+
+
+@pytest.mark.parametrize('auto_flush', [True, False])
+@pytest.mark.parametrize('compression_level', [0, 9])
+def test_compressor_large_buffer_list(auto_flush, compression_level):
+    # Each call gives the same output for a list as for the joined buffers,
+    # including when the context already holds part of a block.
+    calls = [data[:5000], data * 3, data[5000:] * 2]
+    outputs = []
+    for split in (False, True):
+        compressor = lz4frame.LZ4FrameCompressor(
+            auto_flush=auto_flush, compression_level=compression_level)
+        output = [compressor.begin()]
+        for call in calls:
+            if split:
+                call = [call[i:i + 100003]
+                        for i in range(0, len(call), 100003)]
+            output.append(compressor.compress(call))
+        output.append(compressor.flush())
+        outputs.append(output)
+    assert outputs[0] == outputs[1]
+    assert lz4frame.decompress(b''.join(outputs[1])) == b''.join(calls)
+
+
+def test_compress_invalid_source():
+    with pytest.raises(TypeError):
+        lz4frame.compress(1)
+    context = lz4frame.create_compression_context()
+    lz4frame.compress_begin(context)
+    with pytest.raises(TypeError):
+        lz4frame.compress_chunk(context, [b'abc', None])
+
+
+@pytest.mark.parametrize(
+    'sizes',
+    [
+        [len(data)],
+        [len(data) + 100],
+        [10, 0, 70000, len(data)],
+        [1] * 100 + [len(data)],
+    ]
+)
+@pytest.mark.parametrize('block_linked', [True, False])
+def test_decompress_into(sizes, block_linked):
+    compressed = lz4frame.compress(data, block_linked=block_linked)
+    destination = [bytearray(size) for size in sizes]
+    written = lz4frame.decompress_into(compressed, destination)
+    assert written == len(data)
+    assert b''.join(destination)[:written] == data
+
+
+def test_decompress_into_bytes_read():
+    compressed = lz4frame.compress(data)
+    destination = bytearray(len(data))
+    written, bytes_read = lz4frame.decompress_into(
+        compressed + b'trailing', destination, return_bytes_read=True)
+    assert written == len(data)
+    assert bytes_read == len(compressed)
+    assert destination == data
+
+
+def test_decompress_into_too_small():
+    compressed = lz4frame.compress(data)
+    with pytest.raises(ValueError):
+        lz4frame.decompress_into(compressed, bytearray(len(data) - 1))
+    with pytest.raises(ValueError):
+        lz4frame.decompress_into(compressed, [])
+
+
+def test_decompress_into_incomplete():
+    compressed = lz4frame.compress(data)
+    with pytest.raises(RuntimeError):
+        lz4frame.decompress_into(compressed[:-10], bytearray(len(data)))
+
+
+def test_decompress_into_read_only():
+    compressed = lz4frame.compress(data)
+    with pytest.raises(BufferError):
+        lz4frame.decompress_into(compressed, bytes(len(data)))
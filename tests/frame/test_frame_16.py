@@ -0,0 +1,154 @@
+import os
+import lz4.frame as lz4frame
+import pytest
+
+
+chunks = [
+    b'2024-01-01T00:00:%02d host app[%d]: request handled\n' % (i % 60, i)
+    for i in range(20000)
+]
+data = b''.join(chunks)
+
+
+def _compress_to_sink(sink, **kwargs):
+    compressor = lz4frame.LZ4FrameCompressor(sink=sink, **kwargs)
+    produced = compressor.begin()
+    for chunk in chunks:
+        produced += compressor.compress(chunk)
+    produced += compressor.flush()
+    return produced
+
+
+@pytest.mark.parametrize('auto_flush', [False, True])
+@pytest.mark.parametrize('sink_buffer_size', [1, 4096, 1 << 20])
+def test_callable_sink(auto_flush, sink_buffer_size):
+    written = []
+    produced = _compress_to_sink(
+        written.append,
+        auto_flush=auto_flush,
+        sink_buffer_size=sink_buffer_size,
+    )
+    compressed = b''.join(written)
+    assert produced == len(compressed)
+    assert lz4frame.decompress(compressed) == data
+    if sink_buffer_size > 1 and not auto_flush:
+        # Output is passed on in large pieces, not per chunk
+        assert len(written) <= len(compressed) // sink_buffer_size + 1
+
+
+def test_callable_sink_auto_flush():
+    # With auto flush, the output of each call is passed on straight away
+    written = []
+    compressor = lz4frame.LZ4FrameCompressor(sink=written.append,
+                                             auto_flush=True)
+    produced = compressor.begin()
+    assert b''.join(written) and len(b''.join(written)) == produced
+    for chunk in chunks[:100]:
+        produced += compressor.compress(chunk)
+        assert len(b''.join(written)) == produced
+
+
+@pytest.mark.parametrize('auto_flush', [False, True])
+def test_file_auto_flush(tmp_path, auto_flush):
+    path = str(tmp_path / 'test.lz4')
+    payload = os.urandom(100 * 1024)
+    with open(path, 'wb', buffering=0) as raw:
+        with lz4frame.open(raw, 'wb', auto_flush=auto_flush) as f:
+            f.write(payload)
+            size = os.path.getsize(path)
+            if auto_flush:
+                # The compressed data is on disk after each write
+                assert size > len(payload)
+                with open(path, 'rb') as written:
+                    assert lz4frame.LZ4FrameDecompressor().decompress(
+                        written.read()) == payload
+            else:
+                assert size < len(payload)
+    with lz4frame.open(path) as f:
+        assert f.read() == payload
+
+
+def test_callable_sink_partial_writes():
+    written = []
+
+    def write(data):
+        written.append(data[:1000])
+        return min(len(data), 1000)
+
+    _compress_to_sink(write)
+    assert lz4frame.decompress(b''.join(written)) == data
+
+
+def test_callable_sink_error():
+    def write(data):
+        raise IOError('disk full')
+
+    compressor = lz4frame.LZ4FrameCompressor(sink=write)
+    compressor.begin()
+    compressor.compress(data)
+    with pytest.raises(IOError):
+        compressor.flush()
+
+
+def test_fd_sink(tmp_path):
+    path = str(tmp_path / 'test.lz4')
+    fd = os.open(path, os.O_WRONLY | os.O_CREAT | os.O_TRUNC)
+    try:
+        produced = _compress_to_sink(fd)
+    finally:
+        os.close(fd)
+    assert os.path.getsize(path) == produced
+    with lz4frame.open(path) as f:
+        assert f.read() == data
+
+
+def test_buffer_sink():
+    destination = bytearray(len(data))
+    produced = _compress_to_sink(destination)
+    assert lz4frame.decompress(destination[:produced]) == data
+
+
+def test_buffer_sink_too_small():
+    compressor = lz4frame.LZ4FrameCompressor(sink=bytearray(100))
+    compressor.begin()
+    # The data is held by LZ4F until the block is flushed
+    assert compressor.compress(os.urandom(1000)) == 0
+    with pytest.raises(ValueError):
+        compressor.flush()
+
+
+def test_set_sink():
+    context = lz4frame.create_compression_context()
+    written = []
+    compressed = lz4frame.compress_begin(context, auto_flush=True)
+    lz4frame.set_sink(context, written.append)
+    lz4frame.compress_chunk(context, data[:1000])
+    # Changing the sink writes out the output held for the previous one
+    lz4frame.set_sink(context, None)
+    assert written
+    compressed += b''.join(written)
+    compressed += lz4frame.compress_chunk(context, data[1000:])
+    compressed += lz4frame.compress_flush(context)
+    assert lz4frame.decompress(compressed) == data
+
+
+def test_set_sink_invalid():
+    context = lz4frame.create_compression_context()
+    with pytest.raises(TypeError):
+        lz4frame.set_sink(context, 'abc')
+    with pytest.raises(ValueError):
+        lz4frame.set_sink(context, None, 0)
+    with pytest.raises(BufferError):
+        lz4frame.set_sink(context, b'read only')
+
+
+def test_sink_reentry():
+    context = lz4frame.create_compression_context()
+
+    def write(data):
+        lz4frame.compress_chunk(context, b'x')
+
+    lz4frame.set_sink(context, write)
+    lz4frame.compress_begin(context)
+    with pytest.raises(RuntimeError):
+        lz4frame.compress_flush(context)
@@ -0,0 +1,199 @@
+import asyncio
+import os
+import socket
+import threading
+import lz4.frame as lz4frame
+import lz4.frame.aio as lz4aio
+import pytest
+
+
+data = os.urandom(1000) * 1000 + os.urandom(100000)
+
+
+class _Writer(object):
+    def __init__(self):
+        self.chunks = []
+        self.drained = 0
+
+    def write(self, data):
+        self.chunks.append(bytes(data))
+
+    async def drain(self):
+        self.drained += 1
+
+
+def _reader(compressed):
+    reader = asyncio.StreamReader()
+    reader.feed_data(compressed)
+    reader.feed_eof()
+    return reader
+
+
+def _worker_used(coroutine_function):
+    threads = []
+    original = lz4aio._run
+
+    async def _run(size, threshold, function, *args, **kwargs):
+        result = await original(size, threshold, function, *args, **kwargs)
+        threads.append(size >= threshold)
+        return result
+
+    lz4aio._run = _run
+    try:
+        asyncio.run(coroutine_function())
+    finally:
+        lz4aio._run = original
+    return threads
+
+
+@pytest.mark.parametrize('compression_level', [0, 9])
+@pytest.mark.parametrize('size', [10, 1 << 20])
+def test_compress_async(compression_level, size):
+    async def run():
+        compressed = await lz4aio.compress_async(
+            data[:size], compression_level=compression_level)
+        assert compressed == lz4frame.compress(
+            data[:size], compression_level=compression_level)
+        assert await lz4aio.decompress_async(compressed) == data[:size]
+
+    asyncio.run(run())
+
+
+def test_small_inputs_stay_inline():
+    async def run():
+        compressed = await lz4aio.compress_async(b'abc')
+        await lz4aio.decompress_async(compressed)
+        await lz4aio.compress_async(data)
+
+    assert _worker_used(run) == [False, False, True]
+
+
+def test_offload_threshold():
+    async def run():
+        await lz4aio.compress_async(b'abc', offload_threshold=0)
+        await lz4aio.compress_async(data, offload_threshold=len(data) + 1)
+
+    assert _worker_used(run) == [True, False]
+
+
+@pytest.mark.parametrize('chunk_size', [7, 1000, 1 << 20])
+def test_writer(chunk_size):
+    async def run():
+        writer = _Writer()
+        async with lz4aio.AsyncLZ4FrameWriter(writer, auto_flush=True) as compressor:
+            for i in range(0, 300000, chunk_size):
+                await compressor.write(data[i:min(i + chunk_size, 300000)])
+            await compressor.write(data[300000:])
+        assert compressor.closed
+        assert writer.drained == len(range(0, 300000, chunk_size)) + 2
+        return b''.join(writer.chunks)
+
+    assert lz4frame.decompress(asyncio.run(run())) == data
+
+
+def test_writer_flush():
+    async def run():
+        writer = _Writer()
+        compressor = lz4aio.AsyncLZ4FrameWriter(writer)
+        await compressor.write(data[:1000])
+        await compressor.flush()
+        decompressor = lz4frame.LZ4FrameDecompressor()
+        assert decompressor.decompress(b''.join(writer.chunks)) == data[:1000]
+        await compressor.close()
+        await compressor.close()
+        with pytest.raises(ValueError):
+            await compressor.write(b'x')
+
+    asyncio.run(run())
+
+
+@pytest.mark.parametrize('read_size', [100, 1 << 16])
+@pytest.mark.parametrize('size', [-1, 0, 7, 5000, 1 << 20])
+def test_reader(read_size, size):
+    compressed = lz4frame.compress(data[:300000]) + lz4frame.compress(data[300000:])
+
+    async def run():
+        reader = lz4aio.AsyncLZ4FrameReader(
+            _reader(compressed), read_size=read_size, chunk_size=100000)
+        chunks = []
+        while True:
+            chunk = await reader.read(size)
+            if not chunk:
+                break
+            assert size < 0 or len(chunk) <= size
+            chunks.append(chunk)
+        return b''.join(chunks)
+
+    if size == 0:
+        assert asyncio.run(run()) == b''
+    else:
+        assert asyncio.run(run()) == data
+
+
+def test_reader_iteration():
+    compressed = lz4frame.compress(data)
+
+    async def run():
+        chunks = []
+        async for chunk in lz4aio.AsyncLZ4FrameReader(
+                _reader(compressed), chunk_size=50000):
+            assert len(chunk) <= 50000
+            chunks.append(chunk)
+        return b''.join(chunks)
+
+    assert asyncio.run(run()) == data
+
+
+def test_reader_truncated():
+    compressed = lz4frame.compress(data)
+
+    async def run():
+        reader = lz4aio.AsyncLZ4FrameReader(_reader(compressed[:-10]))
+        with pytest.raises(EOFError):
+            await reader.read()
+
+    asyncio.run(run())
+
+
+def test_socket_round_trip():
+    left, right = socket.socketpair()
+
+    async def run():
+        # Both writers are kept, as dropping one closes its transport
+        reader, left_writer = await asyncio.open_connection(sock=left)
+        right_reader, writer = await asyncio.open_connection(sock=right)
+
+        async def produce():
+            async with lz4aio.AsyncLZ4FrameWriter(writer) as compressor:
+                for i in range(0, len(data), 65536):
+                    await compressor.write(data[i:i + 65536])
+            writer.close()
+
+        producer = asyncio.ensure_future(produce())
+        received = await lz4aio.AsyncLZ4FrameReader(reader).read()
+        await producer
+        left_writer.close()
+        return received
+
+    try:
+        assert asyncio.run(run()) == data
+    finally:
+        left.close()
+        right.close()
+
+
+def test_worker_thread():
+    threads = set()
+    original = lz4aio.compress
+
+    def compress(*args, **kwargs):
+        threads.add(threading.current_thread().name)
+        return original(*args, **kwargs)
+
+    lz4aio.compress = compress
+    try:
+        asyncio.run(lz4aio.compress_async(data))
+    finally:
+        lz4aio.compress = original
+    assert len(threads) == 1
+    assert threads.pop().startswith('lz4.frame.aio')
@@ -0,0 +1,189 @@
+import io
+import os
+import threading
+import lz4.frame as lz4frame
+import pytest
+
+
+lines = [
+    b'line %d %s\n' % (i, b'x' * (i % 300)) for i in range(5000)
+] + [b'y' * 300000 + b'\n', b'no newline at the end']
+data = b''.join(lines)
+
+
+def _compressed(**kwargs):
+    return lz4frame.compress(data, **kwargs)
+
+
+class _ReadOnly(object):
+    # A file object without readinto() or seek()
+    def __init__(self, data):
+        self._fp = io.BytesIO(data)
+
+    def read(self, size=-1):
+        return self._fp.read(size)
+
+
+@pytest.mark.parametrize('block_size', [lz4frame.BLOCKSIZE_MAX64KB,
+                                        lz4frame.BLOCKSIZE_MAX4MB])
+def test_lines(block_size):
+    compressed = _compressed(block_size=block_size)
+    with lz4frame.open(io.BytesIO(compressed)) as f:
+        assert list(f) == lines
+    with lz4frame.open(io.BytesIO(compressed)) as f:
+        assert iter(f) is f
+        assert next(f) == lines[0]
+        assert next(iter(f)) == lines[1]
+    with lz4frame.open(io.BytesIO(compressed)) as f:
+        assert [f.readline() for _ in lines] == lines
+        assert f.readline() == b''
+    with lz4frame.open(io.BytesIO(compressed)) as f:
+        assert f.readlines() == lines
+
+
+def test_readline_size():
+    with lz4frame.open(io.BytesIO(_compressed())) as f:
+        assert f.readline(3) == b'lin'
+        assert f.readline(0) == b''
+        assert f.readline(100) == b'e 0 \n'
+        assert f.readline(-1) == lines[1]
+
+
+@pytest.mark.parametrize('size', [1, 7, 4096, 100000, 1 << 20])
+def test_read_sizes(size):
+    with lz4frame.open(io.BytesIO(_compressed())) as f:
+        chunks = []
+        while True:
+            chunk = f.read(size)
+            if not chunk:
+                break
+            assert len(chunk) <= size
+            chunks.append(chunk)
+    assert b''.join(chunks) == data
+
+
+@pytest.mark.parametrize('size', [10, 1 << 20])
+def test_readinto(size):
+    buffer = bytearray(size)
+    chunks = []
+    with lz4frame.open(io.BytesIO(_compressed())) as f:
+        while True:
+            n = f.readinto(buffer)
+            if n == 0:
+                break
+            chunks.append(bytes(buffer[:n]))
+    assert b''.join(chunks) == data
+
+
+def test_peek_read1():
+    with lz4frame.open(io.BytesIO(_compressed())) as f:
+        assert data.startswith(f.peek())
+        assert f.read1(5) == data[:5]
+        chunk = f.read1()
+        assert len(chunk) > 0
+        assert data[5:].startswith(chunk)
+        assert f.tell() == 5 + len(chunk)
+
+
+def test_seek_tell():
+    with lz4frame.open(io.BytesIO(_compressed())) as f:
+        assert f.seekable()
+        assert f.seek(200000) == 200000
+        assert f.read(10) == data[200000:200010]
+        assert f.seek(1000) == 1000
+        assert f.read(10) == data[1000:1010]
+        assert f.seek(-10, io.SEEK_CUR) == 1000
+        assert f.seek(-5, io.SEEK_END) == len(data) - 5
+        assert f.read() == data[-5:]
+        assert f.seek(-10) == 0
+        assert f.tell() == 0
+        assert f.seek(len(data) + 10) == len(data)
+        assert f.read() == b''
+
+
+def test_multiple_frames():
+    compressed = lz4frame.compress(data[:1000]) + lz4frame.compress(data[1000:])
+    with lz4frame.open(io.BytesIO(compressed)) as f:
+        assert f.read() == data
+        f.seek(995)
+        assert f.read(10) == data[995:1005]
+
+
+def test_truncated():
+    with lz4frame.open(io.BytesIO(_compressed()[:-10])) as f:
+        with pytest.raises(EOFError):
+            f.read()
+
+
+def test_empty():
+    # An empty file isn't a valid stream, and raises on every read.
+    with lz4frame.open(io.BytesIO(b'')) as f:
+        with pytest.raises(EOFError):
+            f.read()
+        with pytest.raises(EOFError):
+            f.readline()
+        with pytest.raises(EOFError):
+            f.read1()
+
+
+def test_read_only_file_object():
+    with lz4frame.open(_ReadOnly(_compressed())) as f:
+        assert list(f) == lines
+
+
+def test_closed():
+    f = lz4frame.open(io.BytesIO(_compressed()))
+    f.close()
+    assert f.closed
+    with pytest.raises(ValueError):
+        f.read()
+    with pytest.raises(ValueError):
+        f.readline()
+
+
+def test_text_mode():
+    with lz4frame.open(io.BytesIO(_compressed()), 'rt') as f:
+        assert f.read() == data.decode()
+
+
+def test_threads():
+    results = []
+    with lz4frame.open(io.BytesIO(_compressed())) as f:
+        def reader():
+            while True:
+                chunk = f.read(1000)
+                if not chunk:
+                    break
+                results.append(chunk)
+
+        threads = [threading.Thread(target=reader) for _ in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+    assert sum(len(chunk) for chunk in results) == len(data)
+
+
+@pytest.mark.parametrize('auto_flush', [False, True])
+def test_small_writes(tmp_path, auto_flush):
+    filename = str(tmp_path / 'small.lz4')
+    with lz4frame.open(filename, 'wb', auto_flush=auto_flush) as f:
+        for line in lines:
+            f.write(line)
+    with lz4frame.open(filename) as f:
+        assert f.read() == data
+
+
+def test_small_chunks_flushed():
+    compressor = lz4frame.LZ4FrameCompressor()
+    chunks = [os.urandom(100) for _ in range(10)]
+    compressed = compressor.begin()
+    for chunk in chunks:
+        compressed += compressor.compress(chunk)
+    compressed += lz4frame.compress_flush(
+        compressor._context, end_frame=False)
+    decompressor = lz4frame.LZ4FrameDecompressor()
+    assert decompressor.decompress(compressed) == b''.join(chunks)
+    compressed += compressor.compress(b'x' * 100000)
+    compressed += compressor.flush()
+    assert lz4frame.decompress(compressed) == b''.join(chunks) + b'x' * 100000
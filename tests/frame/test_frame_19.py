@@ -0,0 +1,113 @@
+import io
+import os
+import struct
+import lz4.frame as lz4frame
+import pytest
+
+
+integers = struct.pack('<%di' % 300000, *range(300000))
+
+
+@pytest.mark.parametrize('itemsize', [0, 2, 4, 8, 12])
+@pytest.mark.parametrize('bitshuffle', [False, True])
+@pytest.mark.parametrize('block_size', [lz4frame.BLOCKSIZE_DEFAULT,
+                                        lz4frame.BLOCKSIZE_MAX1MB])
+def test_round_trip(itemsize, bitshuffle, block_size):
+    data = os.urandom(100003) + integers
+    for source in (data, [data[:5000], data[5000:]]):
+        compressed = lz4frame.compress(source, shuffle=itemsize,
+                                       bitshuffle=bitshuffle,
+                                       block_size=block_size)
+        assert lz4frame.decompress(compressed) == data
+
+
+def test_ratio():
+    plain = lz4frame.compress(integers)
+    shuffled = lz4frame.compress(integers, shuffle=4)
+    assert len(shuffled) * 10 < len(plain)
+
+
+def test_bytes_read():
+    compressed = lz4frame.compress(integers, shuffle=4)
+    data, read = lz4frame.decompress(compressed + b'extra',
+                                     return_bytes_read=True,
+                                     return_bytearray=True)
+    assert data == integers
+    assert isinstance(data, bytearray)
+    assert read == len(compressed)
+
+
+class _SmallReads(io.RawIOBase):
+    # Returns the data a few bytes at a time, splitting the headers
+    def __init__(self, data):
+        self._data = io.BytesIO(data)
+
+    def readable(self):
+        return True
+
+    def readinto(self, buffer):
+        data = self._data.read(min(len(buffer), 7))
+        buffer[:len(data)] = data
+        return len(data)
+
+
+@pytest.mark.parametrize('options', [{}, {'filter': 'delta', 'itemsize': 4}])
+def test_streaming_decoders_raise(options):
+    # Only lz4.frame.decompress undoes the shuffle filter, and the streaming
+    # decoders raise rather than returning the shuffled data.
+    compressed = lz4frame.compress(integers[:4000], shuffle=4, **options)
+    with pytest.raises(RuntimeError, match='shuffle filter'):
+        lz4frame.LZ4FrameDecompressor().decompress(compressed)
+    with pytest.raises(RuntimeError, match='shuffle filter'):
+        decompressor = lz4frame.LZ4FrameDecompressor()
+        for i in range(0, len(compressed), 7):
+            decompressor.decompress(compressed[i:i + 7])
+    for fp in (io.BytesIO(compressed), _SmallReads(compressed)):
+        with lz4frame.open(fp) as f:
+            with pytest.raises(RuntimeError, match='shuffle filter'):
+                f.read()
+
+
+def test_other_decoders_skip_header():
+    # Other decoders skip the skippable frame, and see the shuffled data
+    compressed = lz4frame.compress(integers[:4000], shuffle=4)
+    shuffled = lz4frame.decompress(compressed[20:])
+    assert len(shuffled) == 4000
+    assert shuffled != integers[:4000]
+    assert sorted(shuffled) == sorted(integers[:4000])
+
+
+@pytest.mark.parametrize('bitshuffle', [False, True])
+def test_frame_info(bitshuffle):
+    # The information is for the LZ4 frame after the filter headers
+    compressed = lz4frame.compress(integers, shuffle=4, bitshuffle=bitshuffle,
+                                   filter='xor', itemsize=4)
+    info = lz4frame.get_frame_info(compressed)
+    assert not info['skippable']
+    assert info['content_size'] == len(integers)
+    assert info['shuffle'] == 4
+    assert info['bitshuffle'] == bitshuffle
+    info = lz4frame.get_frame_info(lz4frame.compress(integers))
+    assert info['shuffle'] == 0
+    assert not info['bitshuffle']
+
+
+def test_shuffle_itemsize():
+    # shuffle=True takes the item size from itemsize, like the delta filter
+    compressed = lz4frame.compress(integers, shuffle=True, itemsize=4)
+    assert compressed == lz4frame.compress(integers, shuffle=4)
+    assert lz4frame.get_frame_info(compressed)['shuffle'] == 4
+    compressed = lz4frame.compress(integers, bitshuffle=True, itemsize=4)
+    assert lz4frame.get_frame_info(compressed)['shuffle'] == 4
+    assert lz4frame.decompress(compressed) == integers
+    with pytest.raises(ValueError):
+        lz4frame.compress(integers, shuffle=4, itemsize=8)
+
+
+def test_invalid_header():
+    compressed = bytearray(lz4frame.compress(integers, shuffle=4))
+    compressed[12] = 3
+    with pytest.raises(RuntimeError):
+        lz4frame.decompress(bytes(compressed))
+    with pytest.raises(ValueError):
+        lz4frame.compress(integers, shuffle=1000)
@@ -0,0 +1,163 @@
+import io
+import os
+import struct
+import lz4.frame as lz4frame
+import pytest
+
+
+timestamps = struct.pack('<%dq' % 50000,
+                         *(1700000000000 + 1000 * i + i % 7 for i in range(50000)))
+kinds = ['delta', 'delta_of_delta', 'xor']
+
+
+@pytest.mark.parametrize('kind', kinds)
+@pytest.mark.parametrize('itemsize', [1, 2, 4, 8])
+@pytest.mark.parametrize('size', [0, 5, 100001])
+def test_round_trip(kind, itemsize, size):
+    data = os.urandom(size)
+    compressed = lz4frame.compress(data, filter=kind, itemsize=itemsize)
+    assert lz4frame.decompress(compressed) == data
+
+
+def test_ratio():
+    plain = lz4frame.compress(timestamps)
+    encoded = lz4frame.compress(timestamps, filter='delta', itemsize=8)
+    assert len(encoded) * 20 < len(plain)
+
+
+@pytest.mark.parametrize('shuffle', [0, 8])
+def test_options(shuffle):
+    compressed = lz4frame.compress(
+        [timestamps[:3], timestamps[3:]], filter='xor', itemsize=8,
+        shuffle=shuffle, content_checksum=True, return_bytearray=True)
+    decompressed, bytes_read = lz4frame.decompress(
+        compressed + b'extra', return_bytearray=True, return_bytes_read=True)
+    assert decompressed == timestamps
+    assert isinstance(decompressed, bytearray)
+    assert bytes_read == len(compressed)
+
+
+def test_skippable_header():
+    # Other decoders skip the header and return the encoded data.
+    compressed = lz4frame.compress(timestamps, filter='delta', itemsize=8)
+    encoded = lz4frame.decompress(compressed[20:])
+    assert len(encoded) == len(timestamps)
+    assert encoded[8:16] == struct.pack('<q', 1001)
+
+
+@pytest.mark.parametrize('kind', kinds)
+def test_frame_info(kind):
+    info = lz4frame.get_frame_info(
+        lz4frame.compress(timestamps, filter=kind, itemsize=8))
+    assert info['filter'] == kind
+    assert info['itemsize'] == 8
+    info = lz4frame.get_frame_info(lz4frame.compress(timestamps))
+    assert info['filter'] is None
+    assert info['itemsize'] == 0
+
+
+@pytest.mark.parametrize('kind', kinds)
+@pytest.mark.parametrize('auto_flush', [False, True])
+@pytest.mark.parametrize('chunk_size', [5, 1000, 70001])
+def test_compressor(kind, auto_flush, chunk_size):
+    with lz4frame.LZ4FrameCompressor(filter=kind, itemsize=8,
+                                     auto_flush=auto_flush) as compressor:
+        compressed = compressor.begin()
+        for i in range(0, len(timestamps), chunk_size):
+            compressed += compressor.compress(timestamps[i:i + chunk_size])
+        compressed += compressor.flush()
+    assert lz4frame.decompress(compressed) == timestamps
+
+
+def test_compressor_buffer_list():
+    pieces = [timestamps[:100], timestamps[100:101], b'', timestamps[101:]]
+    with lz4frame.LZ4FrameCompressor(filter='delta', itemsize=8,
+                                     auto_flush=True) as compressor:
+        compressed = compressor.begin()
+        compressed += compressor.compress(pieces)
+        compressed += compressor.flush()
+    assert lz4frame.decompress(compressed) == timestamps
+
+
+@pytest.mark.parametrize('piece_size', [1, 7, 4096])
+def test_decompressor(piece_size):
+    compressed = lz4frame.compress(timestamps, filter='delta_of_delta',
+                                   itemsize=8)
+    decompressor = lz4frame.LZ4FrameDecompressor()
+    decompressed = b''
+    for i in range(0, len(compressed), piece_size):
+        decompressed += decompressor.decompress(compressed[i:i + piece_size])
+    assert decompressor.eof
+    assert decompressed == timestamps
+
+
+def test_decompressor_max_length():
+    compressed = lz4frame.compress(timestamps, filter='xor', itemsize=8)
+    with lz4frame.LZ4FrameDecompressor() as decompressor:
+        decompressed = decompressor.decompress(compressed, max_length=1003)
+        while not decompressor.eof:
+            decompressed += decompressor.decompress(b'', max_length=1003)
+    assert decompressed == timestamps
+
+
+def test_decompressor_frames():
+    # A filtered frame followed by a plain one
+    second = os.urandom(1000)
+    compressed = (lz4frame.compress(timestamps, filter='delta', itemsize=8) +
+                  lz4frame.compress(second))
+    decompressor = lz4frame.LZ4FrameDecompressor()
+    assert decompressor.decompress(compressed) == timestamps
+    assert decompressor.eof
+    assert decompressor.decompress(decompressor.unused_data) == second
+
+
+class _SmallReads(io.RawIOBase):
+    # Returns the data a few bytes at a time, splitting the headers
+    def __init__(self, data):
+        self._data = io.BytesIO(data)
+
+    def readable(self):
+        return True
+
+    def readinto(self, buffer):
+        data = self._data.read(min(len(buffer), 7))
+        buffer[:len(data)] = data
+        return len(data)
+
+
+@pytest.mark.parametrize('small_reads', [False, True])
+def test_file(small_reads):
+    second = os.urandom(1000)
+    compressor = lz4frame.LZ4FrameCompressor(filter='delta_of_delta',
+                                             itemsize=4)
+    compressed = (lz4frame.compress(timestamps, filter='delta', itemsize=8) +
+                  lz4frame.compress(second) +
+                  compressor.begin() + compressor.compress(timestamps) +
+                  compressor.flush())
+    fp = _SmallReads(compressed) if small_reads else io.BytesIO(compressed)
+    with lz4frame.open(fp) as f:
+        assert f.read() == timestamps + second + timestamps
+        if not small_reads:
+            f.seek(0)
+            assert f.read(100) == timestamps[:100]
+
+
+def test_file_truncated():
+    compressed = lz4frame.compress(timestamps, filter='delta', itemsize=8)
+    with lz4frame.open(io.BytesIO(compressed[:20])) as f:
+        with pytest.raises(EOFError):
+            f.read()
+
+
+def test_invalid():
+    with pytest.raises(ValueError):
+        lz4frame.compress(timestamps, filter='delta', itemsize=16)
+    with pytest.raises(ValueError):
+        lz4frame.compress(timestamps, filter='rle', itemsize=8)
+    with pytest.raises(ValueError):
+        lz4frame.LZ4FrameCompressor(filter='delta').begin()
+    compressed = bytearray(lz4frame.compress(timestamps, filter='delta',
+                                             itemsize=8))
+    compressed[12] = 9
+    with pytest.raises(RuntimeError):
+        lz4frame.decompress(bytes(compressed))
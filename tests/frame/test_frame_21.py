@@ -0,0 +1,248 @@
+import os
+import threading
+import time
+import lz4.frame as lz4frame
+from lz4.frame.tail import LZ4FrameTail
+import pytest
+
+
+lines = [b'line %d %s\n' % (i, os.urandom(i % 50).hex().encode())
+         for i in range(20000)]
+
+
+class _Writer(object):
+    def __init__(self, filename, **kwargs):
+        self._fp = open(filename, 'wb')
+        self._compressor = lz4frame.LZ4FrameCompressor(auto_flush=True,
+                                                       **kwargs)
+        self._fp.write(self._compressor.begin())
+        self._fp.flush()
+
+    def write(self, data):
+        self._fp.write(self._compressor.compress(data))
+        self._fp.flush()
+
+    def write_raw(self, data):
+        self._fp.write(data)
+        self._fp.flush()
+
+    def close(self):
+        self._fp.write(self._compressor.flush())
+        self._fp.close()
+
+
+def _read_all(tail):
+    data = b''
+    while True:
+        chunk = tail.read()
+        if not chunk:
+            return data
+        data += chunk
+
+
+@pytest.mark.parametrize('options', [
+    {},
+    {'block_linked': False},
+    {'content_checksum': True, 'block_checksum': True},
+    {'block_size': lz4frame.BLOCKSIZE_MAX4MB},
+])
+def test_follow(tmp_path, options):
+    filename = str(tmp_path / 'log.lz4')
+    writer = _Writer(filename, **options)
+    data = b''
+    with LZ4FrameTail(filename) as tail:
+        for i in range(0, len(lines), 1000):
+            chunk = b''.join(lines[i:i + 1000])
+            writer.write(chunk)
+            assert _read_all(tail) == chunk
+            data += chunk
+        writer.close()
+        assert tail.read() == b''
+        assert tail.position == len(data)
+        assert tail.offset == os.path.getsize(filename)
+
+
+def test_partial_blocks(tmp_path):
+    filename = str(tmp_path / 'log.lz4')
+    writer = _Writer(filename)
+    # Blocks of another frame, which don't refer to earlier data
+    compressor = lz4frame.LZ4FrameCompressor(auto_flush=True)
+    compressor.begin()
+    compressed = compressor.compress(b''.join(lines[:100]))
+    with LZ4FrameTail(filename) as tail:
+        assert tail.read() == b''
+        offset = tail.offset
+        for i in range(0, len(compressed), 7):
+            writer.write_raw(compressed[i:i + 7])
+            if i + 7 < len(compressed):
+                assert tail.read() == b''
+                assert tail.offset == offset
+        assert tail.read() == b''.join(lines[:100])
+
+
+def test_read_size(tmp_path):
+    filename = str(tmp_path / 'log.lz4')
+    writer = _Writer(filename)
+    writer.write(b''.join(lines[:10]))
+    with LZ4FrameTail(filename) as tail:
+        assert tail.read(5) == lines[0][:5]
+        assert tail.read(len(lines[0]) - 5) == lines[0][5:]
+        assert tail.read() == b''.join(lines[1:10])
+
+
+def test_frames(tmp_path):
+    filename = str(tmp_path / 'log.lz4')
+    with open(filename, 'wb') as f:
+        f.write(lz4frame.compress(b'first\n', content_checksum=True))
+        f.write(b'\x50\x2a\x4d\x18\x03\x00\x00\x00abc')
+        f.write(lz4frame.compress(b'second\n', block_checksum=True))
+    with LZ4FrameTail(filename) as tail:
+        assert tail.read() == b'first\nsecond\n'
+
+
+@pytest.mark.parametrize('options', [
+    {},
+    {'block_linked': False},
+    {'content_checksum': True, 'block_checksum': True},
+])
+def test_checkpoint(tmp_path, options):
+    filename = str(tmp_path / 'log.lz4')
+    writer = _Writer(filename, **options)
+    first = b''.join(lines[:15000])
+    writer.write(first)
+    with LZ4FrameTail(filename) as tail:
+        assert tail.read(len(first) - 10) == first[:-10]
+        checkpoint = tail.checkpoint()
+
+    # The rest refers back to the data written before the checkpoint.
+    rest = b''.join(lines[14000:])
+    writer.write(rest)
+    writer.close()
+    with LZ4FrameTail(filename, checkpoint=checkpoint) as tail:
+        assert tail.position == len(first) - 10
+        assert _read_all(tail) == first[-10:] + rest
+    with open(filename, 'ab') as f:
+        f.write(lz4frame.compress(b'next frame'))
+    with LZ4FrameTail(filename, checkpoint=checkpoint) as tail:
+        assert _read_all(tail) == first[-10:] + rest + b'next frame'
+
+
+@pytest.mark.parametrize('size', [5000, 1 << 20])
+def test_compressible_block(tmp_path, size):
+    # The block decompresses to much more than twice its size.
+    filename = str(tmp_path / 'log.lz4')
+    writer = _Writer(filename)
+    data = b'a' * size
+    writer.write(data)
+    with LZ4FrameTail(filename) as tail:
+        assert _read_all(tail) == data
+        checkpoint = tail.checkpoint()
+    writer.write(data)
+    writer.close()
+    with LZ4FrameTail(filename, checkpoint=checkpoint) as tail:
+        assert _read_all(tail) == data
+
+
+def test_checkpoint_mid_stream(tmp_path):
+    filename = str(tmp_path / 'log.lz4')
+    writer = _Writer(filename)
+    data = b''
+    checkpoint = None
+    for i in range(10):
+        chunk = b''.join(lines[:100]) + b'%d\n' % i * 2000
+        writer.write(chunk)
+        data += chunk
+        with LZ4FrameTail(filename, checkpoint=checkpoint) as tail:
+            position = tail.position
+            assert _read_all(tail) == data[position:]
+            checkpoint = tail.checkpoint()
+    writer.close()
+    with LZ4FrameTail(filename, checkpoint=checkpoint) as tail:
+        assert tail.read() == b''
+        assert tail.position == len(data)
+
+
+def test_checkpoint_between_frames(tmp_path):
+    filename = str(tmp_path / 'log.lz4')
+    with open(filename, 'wb') as f:
+        f.write(lz4frame.compress(b'first'))
+    with LZ4FrameTail(filename) as tail:
+        assert tail.read() == b'first'
+        checkpoint = tail.checkpoint()
+    with open(filename, 'ab') as f:
+        f.write(lz4frame.compress(b'second'))
+    with LZ4FrameTail(filename, checkpoint=checkpoint) as tail:
+        assert tail.read() == b'second'
+
+
+@pytest.mark.parametrize('block_linked', [True, False])
+def test_delta_filter(tmp_path, block_linked):
+    filename = str(tmp_path / 'log.lz4')
+    writer = _Writer(filename, filter='delta_of_delta', itemsize=4,
+                     block_linked=block_linked)
+    data = b''.join((1000000 + i * 7 + i % 3).to_bytes(4, 'little')
+                    for i in range(20000))
+    checkpoint = None
+    # Writes that split items between blocks, with a checkpoint after each.
+    for start in range(0, len(data), 9999):
+        writer.write(data[start:start + 9999])
+        with LZ4FrameTail(filename, checkpoint=checkpoint) as tail:
+            position = tail.position
+            assert _read_all(tail) == data[position:start + 9999]
+            checkpoint = tail.checkpoint()
+    writer.close()
+    with open(filename, 'ab') as f:
+        f.write(lz4frame.compress(data[:1000], filter='delta', itemsize=8))
+    with LZ4FrameTail(filename, checkpoint=checkpoint) as tail:
+        assert _read_all(tail) == data[:1000]
+    with LZ4FrameTail(filename) as tail:
+        assert _read_all(tail) == data + data[:1000]
+
+
+def test_shuffle_filter(tmp_path):
+    filename = str(tmp_path / 'log.lz4')
+    with open(filename, 'wb') as f:
+        f.write(lz4frame.compress(b''.join(lines[:100]), shuffle=4))
+    with LZ4FrameTail(filename) as tail:
+        with pytest.raises(RuntimeError):
+            tail.read()
+
+
+@pytest.mark.parametrize('use_inotify', [True, False])
+def test_wait(tmp_path, use_inotify):
+    filename = str(tmp_path / 'log.lz4')
+    writer = _Writer(filename)
+    with LZ4FrameTail(filename, use_inotify=use_inotify,
+                      poll_interval=0.01) as tail:
+        assert tail.read() == b''
+        assert not tail.wait(0.05)
+
+        def write():
+            for line in lines[:50]:
+                time.sleep(0.001)
+                writer.write(line)
+            writer.close()
+
+        thread = threading.Thread(target=write)
+        thread.start()
+        data = b''.join(tail.follow(timeout=1))
+        thread.join()
+    assert data == b''.join(lines[:50])
+
+
+def test_invalid(tmp_path):
+    filename = str(tmp_path / 'log.lz4')
+    with open(filename, 'wb') as f:
+        f.write(b'not an lz4 frame')
+    with LZ4FrameTail(filename) as tail:
+        with pytest.raises(RuntimeError):
+            tail.read()
+    with pytest.raises(ValueError):
+        LZ4FrameTail(filename, checkpoint=b'LZ4T')
+    with pytest.raises(ValueError):
+        LZ4FrameTail(filename, checkpoint=b'x' * 40)
+    tail = LZ4FrameTail(filename)
+    tail.close()
+    assert tail.closed
+    with pytest.raises(ValueError):
+        tail.read()
@@ -0,0 +1,175 @@
+import os
+import subprocess
+import sys
+import lz4
+import lz4.frame
+import pytest
+from lz4.__main__ import main
+
+
+data = b''.join(
+    b'line %d of the input, %s\n' % (i, b'abc' * (i % 13))
+    for i in range(100000)
+) + os.urandom(100000)
+
+
+@pytest.fixture
+def source(tmp_path):
+    filename = tmp_path / 'data'
+    filename.write_bytes(data)
+    return filename
+
+
+@pytest.fixture
+def dictionary(tmp_path):
+    filename = tmp_path / 'dict'
+    filename.write_bytes(data[:32768])
+    return filename
+
+
+options = [
+    [],
+    ['-9'],
+    ['-l', '3', '--independent', '-B', '4MB'],
+    ['--content-checksum', '--block-checksum', '-B', '5'],
+    ['--favor-decompression-speed', '-12'],
+    ['--filter', 'xor', '--itemsize', '8'],
+    ['-T', '4'],
+    ['-T', '0', '-9', '--content-checksum', '--block-checksum'],
+]
+
+
+@pytest.mark.parametrize('opts', options)
+@pytest.mark.parametrize('threads', ['1', '3'])
+def test_roundtrip(source, opts, threads):
+    assert main(opts + [str(source)]) == 0
+    compressed = source.with_name('data.lz4')
+    if '--filter' not in opts:
+        assert lz4.frame.decompress(compressed.read_bytes()) == data
+    os.remove(str(source))
+    assert main(['-d', '-T', threads, str(compressed)]) == 0
+    assert source.read_bytes() == data
+
+
+@pytest.mark.parametrize('opts', [
+    [],
+    ['-T', '3', '--content-checksum', '--block-checksum'],
+    ['-9', '-B', '6'],
+])
+def test_dictionary(source, dictionary, opts):
+    output = source.with_name('out.lz4')
+    assert main(opts + ['-D', str(dictionary), '-o', str(output),
+                        str(source)]) == 0
+    assert main(['-d', '-D', str(dictionary), '-f', '-o', str(source),
+                 str(output)]) == 0
+    assert source.read_bytes() == data
+    # Input repeating the dictionary compresses to almost nothing.
+    source.write_bytes(dictionary.read_bytes())
+    assert main(opts + ['-f', '-o', str(output), str(source)]) == 0
+    without_dict = output.stat().st_size
+    assert main(opts + ['-D', str(dictionary), '-f', '-o', str(output),
+                        str(source)]) == 0
+    assert output.stat().st_size < without_dict // 10
+
+
+def test_dictionary_linked_frame(source, dictionary):
+    # Frames with linked blocks, written elsewhere, decompress with a
+    # dictionary too.
+    compressed = source.with_name('data.lz4')
+    compressed.write_bytes(lz4.frame.compress(data, content_checksum=True))
+    os.remove(str(source))
+    assert main(['-d', '-D', str(dictionary), str(compressed)]) == 0
+    assert source.read_bytes() == data
+
+
+@pytest.mark.parametrize('threads', ['1', '4'])
+def test_concatenated_frames(tmp_path, threads):
+    parts = [data[:1000], b'', data[1000:50000], data]
+    compressed = tmp_path / 'all.lz4'
+    compressed.write_bytes(
+        lz4.frame.compress(parts[0]) +
+        b'\x50\x2a\x4d\x18\x03\x00\x00\x00abc' +
+        lz4.frame.compress(parts[1]) +
+        lz4.frame.compress(parts[2], filter='delta', itemsize=4) +
+        lz4.frame.compress(parts[3], block_checksum=True)
+    )
+    assert main(['-d', '-T', threads, str(compressed)]) == 0
+    assert (tmp_path / 'all').read_bytes() == b''.join(parts)
+
+
+def test_truncated(tmp_path, capsys):
+    compressed = tmp_path / 'data.lz4'
+    compressed.write_bytes(lz4.frame.compress(data)[:-100])
+    for threads in ['1', '2']:
+        assert main(['-d', '-f', '-T', threads, str(compressed)]) == 1
+        assert 'error' in capsys.readouterr().err
+
+
+def test_existing_output(source, capsys):
+    source.with_name('data.lz4').write_bytes(b'')
+    assert main([str(source)]) == 1
+    assert 'already exists' in capsys.readouterr().err
+    assert main(['-f', str(source)]) == 0
+    assert main(['--rm', '-f', str(source)]) == 0
+    assert not source.exists()
+
+
+def test_unknown_suffix(source, capsys):
+    assert main(['-d', str(source)]) == 1
+    assert 'unknown suffix' in capsys.readouterr().err
+
+
+def test_invalid_arguments(source, capsys):
+    with pytest.raises(SystemExit):
+        main(['-B', '3', str(source)])
+    with pytest.raises(SystemExit):
+        main(['--filter', 'delta', str(source)])
+    with pytest.raises(SystemExit):
+        main(['-o', 'x', str(source), str(source)])
+    assert main(['-T', '2', '--filter', 'delta', '--itemsize', '4',
+                 str(source)]) == 1
+
+
+def test_benchmark(source, dictionary, capsys):
+    assert main(['-b', '-1', '-e', '3', '--bench-time', '0',
+                 str(source)]) == 0
+    lines = capsys.readouterr().out.splitlines()
+    assert len(lines) == 4
+    assert lines[0].split()[:3] == ['file', 'level', 'compressed']
+    for level, line in zip(range(1, 4), lines[1:]):
+        fields = line.split()
+        assert fields[:2] == ['data', str(level)]
+        assert float(fields[3]) > 1
+    assert main(['-b', '-T', '2', '-D', str(dictionary), '--bench-time', '0',
+                 str(source)]) == 0
+    assert len(capsys.readouterr().out.splitlines()) == 2
+
+
+def test_pipe(tmp_path):
+    env = dict(os.environ)
+    root = os.path.dirname(os.path.dirname(lz4.__file__))
+    env['PYTHONPATH'] = os.pathsep.join(
+        [root] + env.get('PYTHONPATH', '').split(os.pathsep))
+    compressed = subprocess.run(
+        [sys.executable, '-m', 'lz4', '-T', '2'], input=data,
+        stdout=subprocess.PIPE, check=True, env=env,
+    ).stdout
+    assert lz4.frame.decompress(compressed) == data
+    decompressed = subprocess.run(
+        [sys.executable, '-m', 'lz4', '-d'], input=compressed,
+        stdout=subprocess.PIPE, check=True, env=env,
+    ).stdout
+    assert decompressed == data
+
+
+def test_version(capsys):
+    with pytest.raises(SystemExit):
+        main(['-V'])
+    assert lz4.library_version_string() in capsys.readouterr().out
+
+
+def test_stdout(source, capsysbinary):
+    assert main(['-c', '-f', str(source)]) == 0
+    compressed = capsysbinary.readouterr().out
+    assert lz4.frame.decompress(compressed) == data
+    assert not source.with_name('data.lz4').exists()
@@ -0,0 +1,95 @@
+import io
+import os
+import lz4.frame
+import lz4.parallel
+import pytest
+
+
+data = b''.join(
+    b'line %d of the input, %s\n' % (i, b'abc' * (i % 13))
+    for i in range(50000)
+) + os.urandom(100000)
+
+
+@pytest.fixture(scope='module')
+def pool():
+    with lz4.parallel.ProcessPool(2) as pool:
+        yield pool
+
+
+@pytest.mark.parametrize('options', [
+    {},
+    {'chunk_size': 100000},
+    {'chunk_size': 1 << 20, 'compression_level': 9},
+    {'content_checksum': True, 'block_checksum': True},
+    {'block_linked': False, 'block_size': lz4.frame.BLOCKSIZE_MAX4MB},
+])
+def test_roundtrip(pool, options):
+    compressed = pool.compress(data, **options)
+    assert len(compressed) < len(data)
+    assert pool.decompress(compressed) == data
+    # The frames are read as a single stream.
+    with lz4.frame.open(io.BytesIO(compressed)) as f:
+        assert f.read() == data
+
+
+def test_chunks_are_frames(pool):
+    chunk_size = len(data) // 3 + 1
+    compressed = pool.compress(data, chunk_size=chunk_size)
+    frames = lz4.parallel._frames(compressed)
+    assert len(frames) == 3
+    for i, (start, end, content_size) in enumerate(frames):
+        chunk = data[i * chunk_size:(i + 1) * chunk_size]
+        assert content_size == len(chunk)
+        assert lz4.frame.decompress(compressed[start:end]) == chunk
+
+
+@pytest.mark.parametrize('size', [0, 1, 1000])
+def test_small(pool, size):
+    compressed = pool.compress(data[:size])
+    assert lz4.frame.decompress(compressed) == data[:size]
+    assert pool.decompress(compressed) == data[:size]
+    assert pool.decompress(b'') == b''
+
+
+def test_buffers(pool):
+    assert pool.decompress(pool.compress(bytearray(data))) == data
+    view = memoryview(data)[1000:200000]
+    compressed = pool.compress(view)
+    assert pool.decompress(memoryview(compressed)) == bytes(view)
+
+
+def test_foreign_frames(pool):
+    parts = [data[:1000], data[1000:50000], data[50000:60000], data]
+    compressed = (
+        lz4.frame.compress(parts[0], store_size=False) +
+        b'\x50\x2a\x4d\x18\x03\x00\x00\x00abc' +
+        lz4.frame.compress(parts[1]) +
+        lz4.frame.compress(parts[2], filter='delta', itemsize=4) +
+        pool.compress(parts[3], chunk_size=300000)
+    )
+    assert pool.decompress(compressed) == b''.join(parts)
+
+
+def test_invalid_data(pool):
+    compressed = pool.compress(data)
+    with pytest.raises(ValueError):
+        pool.decompress(compressed[:-100])
+    with pytest.raises(ValueError):
+        pool.decompress(b'not an lz4 frame')
+    corrupt = bytearray(pool.compress(data, content_checksum=True))
+    corrupt[len(corrupt) // 2] ^= 0xff
+    with pytest.raises(RuntimeError):
+        pool.decompress(corrupt)
+    with pytest.raises(ValueError):
+        pool.compress(data, chunk_size=0)
+
+
+def test_closed():
+    pool = lz4.parallel.ProcessPool(1)
+    assert pool.decompress(pool.compress(data)) == data
+    pool.close()
+    with pytest.raises(ValueError):
+        pool.compress(data)
+    with pytest.raises(ValueError):
+        lz4.parallel.ProcessPool(0)
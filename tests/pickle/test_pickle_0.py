@@ -0,0 +1,153 @@
+import io
+import os
+import pickle
+import struct
+import lz4.frame
+import lz4.pickle
+import pytest
+
+
+class Buffer(object):
+    # Exposes its data as an out-of-band buffer, like a numpy array does.
+
+    def __init__(self, data):
+        self.data = data
+
+    def __reduce_ex__(self, protocol):
+        if protocol >= 5:
+            return Buffer._reconstruct, (pickle.PickleBuffer(self.data),)
+        return Buffer, (bytes(self.data),)
+
+    @staticmethod
+    def _reconstruct(data):
+        buffer = Buffer(data)
+        buffer.loaded_from = data
+        return buffer
+
+    def __eq__(self, other):
+        return bytes(self.data) == bytes(other.data)
+
+
+def _sample():
+    return {
+        'text': 'some text' * 100,
+        'small': Buffer(bytearray(b'small')),
+        'random': Buffer(bytearray(os.urandom(300000))),
+        'repeated': [Buffer(bytearray(b'%d' % i) * 200000) for i in range(3)],
+        'empty': Buffer(bytearray()),
+        'readonly': Buffer(b'abc' * 100000),
+    }
+
+
+def _header(data):
+    return struct.unpack_from('<4sB3xII', data)
+
+
+@pytest.mark.parametrize('threads', [1, 4])
+@pytest.mark.parametrize('chunk_size', [1000, 65536, None])
+def test_roundtrip(threads, chunk_size):
+    obj = _sample()
+    kwargs = {'threads': threads}
+    if chunk_size is not None:
+        kwargs['chunk_size'] = chunk_size
+    data = lz4.pickle.dumps(obj, **kwargs)
+    magic, version, count, stored_chunk_size = _header(data)
+    assert (magic, version, count) == (b'LZ4P', 1, 5)
+    assert stored_chunk_size == (chunk_size or lz4.pickle.CHUNK_SIZE_DEFAULT)
+    assert len(data) < 600000
+    loaded = lz4.pickle.loads(data, threads=threads)
+    assert loaded == obj
+
+
+def test_out_of_band_destinations():
+    loaded = lz4.pickle.loads(lz4.pickle.dumps(_sample()))
+    # Out-of-band buffers are views of the destinations decompressed into,
+    # and keep read-only buffers read-only.
+    random = loaded['random'].loaded_from
+    assert isinstance(random, memoryview)
+    assert isinstance(random.obj, bytearray)
+    assert not random.readonly
+    readonly = loaded['readonly'].loaded_from
+    assert isinstance(readonly, memoryview)
+    assert readonly.readonly
+    # Small buffers are pickled in band.
+    assert not isinstance(loaded['small'].loaded_from, memoryview)
+
+
+def test_non_contiguous():
+    data = bytearray(os.urandom(400000))
+    obj = Buffer(memoryview(data)[::2])
+    with pytest.raises(pickle.PicklingError):
+        pickle.dumps(obj, protocol=5)
+    with pytest.raises(pickle.PicklingError):
+        lz4.pickle.dumps(obj)
+
+
+def test_plain_objects():
+    obj = [1, 2.5, 'three', {'four': (5,)}, b'x' * 1000000]
+    data = lz4.pickle.dumps(obj, compression_level=9, content_checksum=True)
+    assert _header(data)[2] == 0
+    assert len(data) < 10000
+    assert lz4.pickle.loads(data) == obj
+    assert lz4.pickle.loads(bytearray(data)) == obj
+
+
+@pytest.mark.parametrize('threads', [1, 3])
+def test_file(tmp_path, threads):
+    obj = _sample()
+    filename = tmp_path / 'obj.lz4p'
+    with open(str(filename), 'wb') as f:
+        lz4.pickle.dump(obj, f, threads=threads, chunk_size=50000)
+        lz4.pickle.dump('second', f)
+    assert filename.read_bytes().startswith(b'LZ4P')
+    with open(str(filename), 'rb') as f:
+        assert lz4.pickle.load(f, threads=threads) == obj
+        assert lz4.pickle.load(f) == 'second'
+
+
+def test_invalid_arguments():
+    with pytest.raises(ValueError):
+        lz4.pickle.dumps(1, protocol=4)
+    with pytest.raises(ValueError):
+        lz4.pickle.dumps(1, chunk_size=0)
+    with pytest.raises(ValueError):
+        lz4.pickle.dumps(1, threads=0)
+
+
+def test_invalid_data():
+    data = lz4.pickle.dumps(_sample(), chunk_size=65536)
+    with pytest.raises(ValueError):
+        lz4.pickle.loads(b'LZ4X' + data[4:])
+    with pytest.raises(ValueError):
+        lz4.pickle.loads(data[:4] + b'\x02' + data[5:])
+    for size in [10, 100, len(data) // 2, len(data) - 1]:
+        with pytest.raises(ValueError):
+            lz4.pickle.loads(data[:size])
+        with pytest.raises(ValueError):
+            lz4.pickle.load(io.BytesIO(data[:size]))
+    # A chunk that decompresses to fewer bytes than expected.
+    stream = pickle.dumps(None, protocol=5)
+    frame = lz4.frame.compress(stream[:-1])
+    corrupt = (struct.pack('<4sB3xII', b'LZ4P', 1, 0, 65536) +
+               struct.pack('<QB', len(stream), 0) +
+               struct.pack('<I', len(frame)) + frame)
+    with pytest.raises(ValueError):
+        lz4.pickle.loads(corrupt)
+
+
+def test_numpy():
+    numpy = pytest.importorskip('numpy')
+    obj = {
+        'ints': numpy.arange(1000000, dtype=numpy.int64),
+        'floats': numpy.linspace(0, 1, 300000).reshape(1000, 300),
+        'fortran': numpy.asfortranarray(numpy.ones((500, 400))),
+        'strided': numpy.arange(400000)[::3],
+    }
+    obj['readonly'] = numpy.arange(100000)
+    obj['readonly'].flags.writeable = False
+    loaded = lz4.pickle.loads(lz4.pickle.dumps(obj, chunk_size=100000))
+    for key, value in obj.items():
+        numpy.testing.assert_array_equal(loaded[key], value)
+        assert loaded[key].dtype == value.dtype
+    assert loaded['ints'].flags.writeable
+    assert not loaded['readonly'].flags.writeable
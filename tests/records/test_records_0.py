@@ -0,0 +1,160 @@
+import bisect
+import io
+import os
+import threading
+import lz4.records
+import pytest
+
+
+records = [b'record %d %s' % (i, b'x' * (i % 97)) for i in range(20000)]
+records[100] = b''
+records[101] = os.urandom(200000)
+
+
+def _write(filename, **kwargs):
+    with lz4.records.open(filename, 'w', **kwargs) as writer:
+        for i, record in enumerate(records):
+            assert writer.append(record) == i
+        assert len(writer) == len(records)
+
+
+@pytest.mark.parametrize('use_mmap', [True, False])
+@pytest.mark.parametrize('block_size', [1, 4096, 1 << 20])
+def test_get(tmp_path, use_mmap, block_size):
+    filename = str(tmp_path / 'records.lz4r')
+    _write(filename, block_size=block_size)
+    with lz4.records.open(filename, use_mmap=use_mmap) as reader:
+        assert len(reader) == len(records)
+        for i in [0, 99, 100, 101, 102, 7777, len(records) - 1]:
+            assert reader.get(i) == records[i]
+        assert reader[-1] == records[-1]
+        assert list(reader) == records
+        with pytest.raises(IndexError):
+            reader.get(len(records))
+        with pytest.raises(IndexError):
+            reader[-len(records) - 1]
+
+
+def test_dictionary(tmp_path):
+    filename = str(tmp_path / 'records.lz4r')
+    dictionary = b''.join(records[:50])
+    _write(filename, block_size=256)
+    plain_size = os.path.getsize(filename)
+    _write(filename, block_size=256, dict=dictionary)
+    assert os.path.getsize(filename) < plain_size
+    with lz4.records.open(filename) as reader:
+        assert reader[5000] == records[5000]
+        assert list(reader) == records
+
+
+def test_append(tmp_path):
+    filename = str(tmp_path / 'records.lz4r')
+    with lz4.records.open(filename, 'a', dict=b'record 1') as writer:
+        writer.extend(records[:1000])
+    with lz4.records.open(filename, 'a') as writer:
+        assert writer.append(records[1000]) == 1000
+        writer.extend(records[1001:])
+    with lz4.records.open(filename) as reader:
+        assert list(reader) == records
+    with pytest.raises(ValueError):
+        lz4.records.open(filename, 'a', dict=b'other')
+
+
+def test_append_keeps_contents(tmp_path):
+    filename = str(tmp_path / 'records.lz4r')
+    _write(filename, block_size=4096)
+    with open(filename, 'rb') as f:
+        original = f.read()
+    with lz4.records.open(filename, 'a'):
+        pass
+    with open(filename, 'rb') as f:
+        assert f.read() == original
+    writer = lz4.records.open(filename, 'a', block_size=1)
+    writer.extend(records[:10])
+    with open(filename, 'rb') as f:
+        assert f.read(len(original)) == original
+    writer.close()
+    with lz4.records.open(filename, use_mmap=False) as reader:
+        assert len(reader) == len(records) + 10
+        assert reader[len(records) - 1] == records[-1]
+        assert reader[len(records)] == records[0]
+        assert list(reader) == records + records[:10]
+
+
+def test_file_object():
+    fp = io.BytesIO()
+    with lz4.records.open(fp, 'w', block_size=1000) as writer:
+        writer.extend(records[:3000])
+    assert not fp.closed
+    with lz4.records.open(io.BytesIO(fp.getvalue()), cache_size=1) as reader:
+        assert reader.get(2999) == records[2999]
+        assert reader.get(0) == records[0]
+        assert len(reader._cache) == 1
+
+
+def test_empty(tmp_path):
+    filename = str(tmp_path / 'records.lz4r')
+    with lz4.records.open(filename, 'w'):
+        pass
+    with lz4.records.open(filename) as reader:
+        assert len(reader) == 0
+        assert list(reader) == []
+        with pytest.raises(IndexError):
+            reader.get(0)
+
+
+def test_cache(tmp_path):
+    filename = str(tmp_path / 'records.lz4r')
+    _write(filename, block_size=4096)
+    with lz4.records.open(filename, cache_size=2) as reader:
+        reader.get(0)
+        reader.get(10000)
+        reader.get(1)
+        reader.get(19000)
+        assert list(reader._cache) == [
+            bisect.bisect_right(reader._firsts, i) - 1 for i in (1, 19000)]
+
+
+def test_threads(tmp_path):
+    filename = str(tmp_path / 'records.lz4r')
+    _write(filename, block_size=4096)
+    errors = []
+    with lz4.records.open(filename, cache_size=4) as reader:
+        def worker(start):
+            for i in range(start, len(records), 7):
+                if reader.get(i) != records[i]:
+                    errors.append(i)
+
+        threads = [threading.Thread(target=worker, args=(i,))
+                   for i in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+    assert errors == []
+
+
+def test_closed(tmp_path):
+    filename = str(tmp_path / 'records.lz4r')
+    _write(filename)
+    reader = lz4.records.open(filename)
+    reader.close()
+    assert reader.closed
+    with pytest.raises(ValueError):
+        reader.get(0)
+    writer = lz4.records.open(filename, 'w')
+    writer.close()
+    with pytest.raises(ValueError):
+        writer.append(b'x')
+
+
+def test_invalid(tmp_path):
+    filename = str(tmp_path / 'records.lz4r')
+    with open(filename, 'wb') as f:
+        f.write(b'not a record file' * 10)
+    with pytest.raises(ValueError):
+        lz4.records.open(filename)
+    with pytest.raises(ValueError):
+        lz4.records.open(filename, 'rw')
+    with pytest.raises(TypeError):
+        lz4.records.open(42)
@@ -1,5 +1,6 @@
 import lz4.stream
 import pytest
+import random
 import sys
 import os
 
@@ -553,3 +554,57 @@ def test_known_decompress_4():
     input = b'%\x00\x00\x00\xff\x0bLorem ipsum dolor sit amet\x1a\x00NPit am\n\x00\x00\x00\x0fh\x00hP sit \x05\x00\x00\x00@amet'
     output = b'Lorem ipsum dolor sit amet' * 10
     assert decompress(input, d_kwargs) == output
+
+
+def test_favor_decompression_speed():
+    c_kwargs = {'strategy': "double_buffer", 'buffer_size': 128, 'store_comp_size': 4,
+                'mode': 'high_compression', 'compression_level': 12,
+                'favor_decompression_speed': True}
+    d_kwargs = {'strategy': "double_buffer", 'buffer_size': 128, 'store_comp_size': 4}
+
+    data = b'Lorem ipsum dolor sit amet' * 100
+    assert decompress(compress(data, c_kwargs), d_kwargs) == data
+
+
+@pytest.mark.parametrize('reload', ['dictionary', 'hibernate', 'state'])
+def test_favor_decompression_speed_after_reload(reload):
+    # Loading a dictionary or history into the HC state resets it, so the
+    # flag has to survive each way the history gets (re)loaded.
+    _random = random.Random(28)
+    words = [bytes(_random.choice(b'abcdefgh') for _ in range(_random.randint(2, 9)))
+             for _ in range(300)]
+    data = b' '.join(_random.choice(words) for _ in range(10000))
+    dictionary, data = data[:30000], data[30000:34000]
+
+    def compress_after_reload(favor):
+        kwargs = {'strategy': "double_buffer", 'buffer_size': 4096,
+                  'mode': 'high_compression', 'compression_level': 12,
+                  'favor_decompression_speed': favor}
+        if reload == 'dictionary':
+            proc = lz4.stream.LZ4StreamCompressor(dictionary=dictionary, **kwargs)
+        else:
+            proc = lz4.stream.LZ4StreamCompressor(**kwargs)
+            proc.compress(dictionary[-4096:])
+            if reload == 'hibernate':
+                proc.hibernate()
+            else:
+                proc = lz4.stream.LZ4StreamCompressor.from_state(proc.save_state())
+        return proc.compress(data)
+
+    assert compress_after_reload(True) != compress_after_reload(False)
+
+
+def test_set_compression_level():
+    kwargs = {'strategy': "double_buffer", 'buffer_size': 128, 'store_comp_size': 4}
+
+    data = b'Lorem ipsum dolor sit amet' * 100
+    c = bytes()
+    with lz4.stream.LZ4StreamCompressor(mode='high_compression', **kwargs) as proc:
+        for i, start in enumerate(range(0, len(data), kwargs['buffer_size'])):
+            proc.set_compression_level((i % 12) + 1)
+            c += proc.compress(data[start:start + kwargs['buffer_size']])
+    assert decompress(c, kwargs) == data
+
+    with lz4.stream.LZ4StreamCompressor(**kwargs) as proc:
+        with pytest.raises(ValueError):
+            proc.set_compression_level(9)
@@ -0,0 +1,76 @@
+import os
+import lz4.stream
+import pytest
+
+
+chunks = [os.urandom(100) * (i % 7 + 1) + b'x' * i for i in range(200)]
+
+
+@pytest.mark.parametrize('store_comp_size', [2, 4])
+@pytest.mark.parametrize('mode', ['default', 'fast', 'high_compression'])
+@pytest.mark.parametrize('return_bytearray', [False, True])
+def test_compress_many(store_comp_size, mode, return_bytearray):
+    kwargs = dict(strategy='double_buffer', buffer_size=1024,
+                  store_comp_size=store_comp_size,
+                  return_bytearray=return_bytearray)
+    compressor = lz4.stream.LZ4StreamCompressor(mode=mode, **kwargs)
+    compressed = compressor.compress_many(chunks[:100])
+    # Compressing in one call or chunk by chunk must give the same stream
+    compressed += compressor.compress_many(tuple(chunks[100:150]))
+    for chunk in chunks[150:]:
+        compressed += compressor.compress(chunk)
+
+    expected = lz4.stream.LZ4StreamCompressor(mode=mode, **kwargs)
+    assert compressed == b''.join(expected.compress(chunk) for chunk in chunks)
+    assert isinstance(compressed, bytearray if return_bytearray else bytes)
+
+    decompressor = lz4.stream.LZ4StreamDecompressor(**kwargs)
+    blocks, consumed = decompressor.decompress_stream(compressed)
+    assert blocks == chunks
+    assert consumed == len(compressed)
+
+
+def test_decompress_stream_incomplete():
+    kwargs = dict(strategy='double_buffer', buffer_size=1024)
+    compressed = lz4.stream.LZ4StreamCompressor(**kwargs).compress_many(chunks)
+    decompressor = lz4.stream.LZ4StreamDecompressor(**kwargs)
+
+    blocks = []
+    position = 0
+    for end in range(0, len(compressed) + 1000, 1000):
+        new_blocks, consumed = decompressor.decompress_stream(
+            compressed[position:end])
+        blocks += new_blocks
+        position += consumed
+    assert position == len(compressed)
+    assert blocks == chunks
+
+
+def test_compress_many_empty():
+    compressor = lz4.stream.LZ4StreamCompressor('double_buffer', 1024)
+    assert compressor.compress_many([]) == b''
+    decompressor = lz4.stream.LZ4StreamDecompressor('double_buffer', 1024)
+    assert decompressor.decompress_stream(b'') == ([], 0)
+
+
+def test_compress_many_too_large():
+    compressor = lz4.stream.LZ4StreamCompressor('double_buffer', 1024)
+    with pytest.raises(OverflowError):
+        compressor.compress_many([b'x', b'x' * 1025])
+
+
+def test_out_of_band_block_size():
+    kwargs = dict(strategy='double_buffer', buffer_size=1024,
+                  store_comp_size=0)
+    compressor = lz4.stream.LZ4StreamCompressor(**kwargs)
+    with pytest.raises(lz4.stream.LZ4StreamError):
+        compressor.compress_many(chunks)
+    decompressor = lz4.stream.LZ4StreamDecompressor(**kwargs)
+    with pytest.raises(lz4.stream.LZ4StreamError):
+        decompressor.decompress_stream(b'')
+
+
+def test_decompress_stream_corrupt():
+    decompressor = lz4.stream.LZ4StreamDecompressor('double_buffer', 1024)
+    with pytest.raises(lz4.stream.LZ4StreamError):
+        decompressor.decompress_stream(b'\x04\x00\x00\x00\xff\xff\xff\xff')
@@ -0,0 +1,71 @@
+import gc
+import os
+import random
+import lz4.stream
+import pytest
+
+
+# Seeded, so that the sizes compared by test_prepared_dictionary don't depend
+# on whether LZ4's hash table happens to find a match in random data.
+_random = random.Random(36)
+dictionary = bytes(_random.getrandbits(8) for _ in range(1000)) * 100
+chunks = [dictionary[i * 1000:i * 1000 + 500] +
+          bytes(_random.getrandbits(8) for _ in range(100))
+          for i in range(20)]
+
+
+def _round_trip(compressor_dictionary, decompressor_dictionary, **kwargs):
+    compressor = lz4.stream.LZ4StreamCompressor(
+        'double_buffer', 4096, dictionary=compressor_dictionary, **kwargs)
+    compressed = compressor.compress_many(chunks)
+    decompressor = lz4.stream.LZ4StreamDecompressor(
+        'double_buffer', 4096, dictionary=decompressor_dictionary)
+    blocks, _ = decompressor.decompress_stream(compressed)
+    assert blocks == chunks
+    return compressed
+
+
+@pytest.mark.parametrize('mode', ['default', 'fast', 'high_compression'])
+@pytest.mark.parametrize('prepared_mode',
+                         ['default', 'fast', 'high_compression'])
+def test_prepared_dictionary(mode, prepared_mode):
+    prepared = lz4.stream.LZ4StreamDictionary(dictionary, mode=prepared_mode)
+    without = _round_trip(None, None, mode=mode)
+    # Streams compressed with a prepared dictionary can be decompressed with
+    # the raw dictionary, and the other way round
+    compressed = _round_trip(prepared, dictionary, mode=mode)
+    _round_trip(dictionary, prepared, mode=mode)
+    assert len(compressed) < len(without)
+
+
+def test_prepared_dictionary_shared():
+    prepared = lz4.stream.LZ4StreamDictionary(dictionary)
+    compressors = [
+        lz4.stream.LZ4StreamCompressor('double_buffer', 4096,
+                                       dictionary=prepared)
+        for _ in range(10)
+    ]
+    del prepared
+    gc.collect()
+    for compressor in compressors:
+        compressed = compressor.compress_many(chunks)
+        decompressor = lz4.stream.LZ4StreamDecompressor(
+            'double_buffer', 4096, dictionary=dictionary)
+        assert decompressor.decompress_stream(compressed)[0] == chunks
+
+
+def test_dictionary_copied():
+    # The context must keep working once the caller's dictionary is gone
+    raw = bytearray(dictionary)
+    compressor = lz4.stream.LZ4StreamCompressor('double_buffer', 4096,
+                                                dictionary=raw)
+    raw[:] = os.urandom(len(raw))
+    compressed = compressor.compress_many(chunks)
+    decompressor = lz4.stream.LZ4StreamDecompressor('double_buffer', 4096,
+                                                    dictionary=dictionary)
+    assert decompressor.decompress_stream(compressed)[0] == chunks
+
+
+def test_invalid_mode():
+    with pytest.raises(ValueError):
+        lz4.stream.LZ4StreamDictionary(dictionary, mode='invalid')
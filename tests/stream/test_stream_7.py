@@ -0,0 +1,115 @@
+import os
+import pickle
+import lz4.stream
+import pytest
+
+
+chunks = [os.urandom(64) * (i % 20 + 1) for i in range(50)]
+
+
+@pytest.mark.parametrize('mode', ['default', 'fast', 'high_compression'])
+@pytest.mark.parametrize('split', [0, 1, 25, 50])
+@pytest.mark.parametrize('use_pickle', [False, True])
+def test_resume(mode, split, use_pickle):
+    kwargs = dict(strategy='double_buffer', buffer_size=4096)
+    compressor = lz4.stream.LZ4StreamCompressor(mode=mode, **kwargs)
+    decompressor = lz4.stream.LZ4StreamDecompressor(**kwargs)
+
+    compressed = compressor.compress_many(chunks[:split])
+    blocks, _ = decompressor.decompress_stream(compressed)
+
+    # Both sides restart, and continue from their saved states
+    if use_pickle:
+        compressor = pickle.loads(pickle.dumps(compressor))
+        decompressor = pickle.loads(pickle.dumps(decompressor))
+    else:
+        compressor = lz4.stream.LZ4StreamCompressor.from_state(
+            compressor.save_state())
+        decompressor = lz4.stream.LZ4StreamDecompressor.from_state(
+            decompressor.save_state())
+
+    for chunk in chunks[split:]:
+        compressed = compressor.compress(chunk)
+        blocks.append(decompressor.decompress(decompressor.get_block(compressed)))
+    assert blocks == chunks
+
+
+@pytest.mark.parametrize('split', [1, 2, 3])
+def test_resume_full_pages(split):
+    # Blocks that fill a page make the decoded data run on into the next page
+    kwargs = dict(strategy='double_buffer', buffer_size=1024)
+    pages = [os.urandom(100) * 10 + os.urandom(24) for _ in range(4)]
+    pages[2] = pages[0]
+    compressor = lz4.stream.LZ4StreamCompressor(**kwargs)
+    decompressor = lz4.stream.LZ4StreamDecompressor(**kwargs)
+    blocks = [compressor.compress(page) for page in pages]
+    for block in blocks[:split]:
+        decompressor.decompress(decompressor.get_block(block))
+    decompressor = lz4.stream.LZ4StreamDecompressor.from_state(
+        decompressor.save_state())
+    assert [decompressor.decompress(decompressor.get_block(block))
+            for block in blocks[split:]] == pages[split:]
+
+
+def test_history_kept():
+    # Data repeating what was compressed before the restart still compresses
+    # well after it
+    data = os.urandom(2000)
+    compressor = lz4.stream.LZ4StreamCompressor('double_buffer', 4096)
+    compressor.compress(data)
+    restored = lz4.stream.LZ4StreamCompressor.from_state(
+        compressor.save_state())
+    assert len(restored.compress(data)) < 100
+
+
+def test_state_keeps_dictionary():
+    dictionary = os.urandom(10000)
+    prepared = lz4.stream.LZ4StreamDictionary(dictionary)
+    compressor = lz4.stream.LZ4StreamCompressor('double_buffer', 4096,
+                                                dictionary=prepared)
+    decompressor = lz4.stream.LZ4StreamDecompressor('double_buffer', 4096,
+                                                    dictionary=dictionary)
+    compressor = pickle.loads(pickle.dumps(compressor))
+    decompressor = pickle.loads(pickle.dumps(decompressor))
+    compressed = compressor.compress(dictionary[-2000:])
+    assert len(compressed) < 100
+    assert decompressor.decompress(compressed[4:]) == dictionary[-2000:]
+
+
+def test_save_state_keeps_context_usable():
+    compressor = lz4.stream.LZ4StreamCompressor('double_buffer', 4096)
+    decompressor = lz4.stream.LZ4StreamDecompressor('double_buffer', 4096)
+    blocks = []
+    for chunk in chunks:
+        state = compressor.save_state()
+        assert compressor.save_state() == state
+        decompressor.save_state()
+        compressed = compressor.compress(chunk)
+        blocks.append(decompressor.decompress(compressed[4:]))
+    assert blocks == chunks
+
+
+def test_configuration_kept():
+    compressor = lz4.stream.LZ4StreamCompressor(
+        'double_buffer', 1024, store_comp_size=2, return_bytearray=True)
+    restored = lz4.stream.LZ4StreamCompressor.from_state(
+        compressor.save_state())
+    compressed = restored.compress(b'abc' * 100)
+    assert isinstance(compressed, bytearray)
+    with pytest.raises(OverflowError):
+        restored.compress(b'x' * 1025)
+    decompressor = lz4.stream.LZ4StreamDecompressor(
+        'double_buffer', 1024, store_comp_size=2)
+    assert decompressor.decompress(decompressor.get_block(compressed)) == \
+        b'abc' * 100
+
+
+def test_invalid_state():
+    compressor = lz4.stream.LZ4StreamCompressor('double_buffer', 4096)
+    state = compressor.save_state()
+    with pytest.raises(ValueError):
+        lz4.stream.LZ4StreamDecompressor.from_state(state)
+    with pytest.raises(ValueError):
+        lz4.stream.LZ4StreamCompressor.from_state(state[:10])
+    with pytest.raises(ValueError):
+        lz4.stream.LZ4StreamCompressor.from_state(b'x' + state[1:])
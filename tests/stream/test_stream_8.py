@@ -0,0 +1,104 @@
+import os
+import pickle
+import tracemalloc
+import lz4.stream
+import pytest
+
+
+chunks = [os.urandom(64) * (i % 20 + 1) for i in range(50)]
+
+
+@pytest.mark.parametrize('mode', ['default', 'fast', 'high_compression'])
+@pytest.mark.parametrize('every', [1, 3, 50])
+def test_hibernate_between_messages(mode, every):
+    kwargs = dict(strategy='double_buffer', buffer_size=4096)
+    compressor = lz4.stream.LZ4StreamCompressor(mode=mode, **kwargs)
+    decompressor = lz4.stream.LZ4StreamDecompressor(**kwargs)
+
+    blocks = []
+    for i, chunk in enumerate(chunks):
+        if i % every == 0:
+            compressor.hibernate()
+            decompressor.hibernate()
+            assert compressor.hibernating and decompressor.hibernating
+        compressed = compressor.compress(chunk)
+        blocks.append(decompressor.decompress(decompressor.get_block(compressed)))
+        assert not compressor.hibernating and not decompressor.hibernating
+    assert blocks == chunks
+
+
+def test_hibernate_batches():
+    kwargs = dict(strategy='double_buffer', buffer_size=4096)
+    compressor = lz4.stream.LZ4StreamCompressor(**kwargs)
+    decompressor = lz4.stream.LZ4StreamDecompressor(**kwargs)
+    compressed = compressor.compress_many(chunks[:25])
+    compressor.hibernate()
+    compressed += compressor.compress_many(chunks[25:])
+    decompressor.hibernate()
+    blocks, consumed = decompressor.decompress_stream(compressed)
+    assert blocks == chunks
+    assert consumed == len(compressed)
+
+
+def test_history_kept():
+    data = os.urandom(2000)
+    compressor = lz4.stream.LZ4StreamCompressor('double_buffer', 4096)
+    compressor.compress(data)
+    compressor.hibernate()
+    compressor.hibernate()
+    assert len(compressor.compress(data)) < 100
+
+
+def test_hibernate_keeps_dictionary():
+    dictionary = os.urandom(10000)
+    prepared = lz4.stream.LZ4StreamDictionary(dictionary)
+    compressor = lz4.stream.LZ4StreamCompressor('double_buffer', 4096,
+                                                dictionary=prepared)
+    decompressor = lz4.stream.LZ4StreamDecompressor('double_buffer', 4096,
+                                                    dictionary=dictionary)
+    compressor.hibernate()
+    decompressor.hibernate()
+    compressed = compressor.compress(dictionary[-2000:])
+    assert len(compressed) < 100
+    assert decompressor.decompress(compressed[4:]) == dictionary[-2000:]
+
+
+def test_wake():
+    compressor = lz4.stream.LZ4StreamCompressor('double_buffer', 4096)
+    compressor.wake()
+    compressor.hibernate()
+    compressor.wake()
+    assert not compressor.hibernating
+    decompressor = lz4.stream.LZ4StreamDecompressor('double_buffer', 4096)
+    assert decompressor.decompress(compressor.compress(chunks[0])[4:]) == chunks[0]
+
+
+def test_save_hibernating():
+    compressor = lz4.stream.LZ4StreamCompressor('double_buffer', 4096)
+    compressor.compress(chunks[0])
+    state = compressor.save_state()
+    compressor.hibernate()
+    assert compressor.save_state() == state
+    assert compressor.hibernating
+    restored = pickle.loads(pickle.dumps(compressor))
+    assert restored.compress(chunks[1]) == compressor.compress(chunks[1])
+
+
+def test_hibernate_releases_memory():
+    buffer_size = 1 << 20
+    tracemalloc.start()
+    try:
+        compressors = [
+            lz4.stream.LZ4StreamCompressor('double_buffer', buffer_size)
+            for _ in range(4)
+        ]
+        for compressor in compressors:
+            compressor.compress(b'x' * 1000)
+        before, _ = tracemalloc.get_traced_memory()
+        for compressor in compressors:
+            compressor.hibernate()
+        after, _ = tracemalloc.get_traced_memory()
+    finally:
+        tracemalloc.stop()
+    # Each context held two pages and an output buffer of about buffer_size
+    assert before - after > 4 * 2 * buffer_size
@@ -0,0 +1,58 @@
+import lz4.xxhash
+import os
+import pytest
+
+
+# Reference values from the xxHash specification test vectors
+known_values = [
+    (b'', 0, 0x02cc5d05, 0xef46db3751d8e999),
+    (b'', 1, 0x0b2cb792, 0xd5afba1336a3be4b),
+    (b'a', 0, 0x550d7456, 0xd24ec4f1a98c6e5b),
+    (b'abc', 0, 0x32d153ff, 0x44bc2cf5ad770999),
+]
+
+
+@pytest.mark.parametrize('data, seed, h32, h64', known_values)
+def test_known_values(data, seed, h32, h64):
+    assert lz4.xxhash.xxh32(data, seed=seed) == h32
+    assert lz4.xxhash.xxh64(data, seed=seed) == h64
+    assert lz4.xxhash.XXH32(data, seed=seed).intdigest() == h32
+    assert lz4.xxhash.XXH64(data, seed=seed).intdigest() == h64
+
+
+@pytest.mark.parametrize('cls, oneshot', [
+    (lz4.xxhash.XXH32, lz4.xxhash.xxh32),
+    (lz4.xxhash.XXH64, lz4.xxhash.xxh64),
+])
+def test_incremental(cls, oneshot):
+    data = os.urandom(256 * 1024 + 7)
+    h = cls(seed=42)
+    for start in range(0, len(data), 1000):
+        h.update(memoryview(data)[start:start + 1000])
+    assert h.intdigest() == oneshot(data, seed=42)
+    assert h.digest() == oneshot(data, seed=42).to_bytes(h.digest_size, 'big')
+    assert h.hexdigest() == h.digest().hex()
+
+    c = h.copy()
+    c.update(b'more')
+    assert h.intdigest() == oneshot(data, seed=42)
+    assert c.intdigest() == oneshot(data + b'more', seed=42)
+
+    h.reset()
+    assert h.intdigest() == oneshot(b'', seed=42)
+
+
+def test_batch():
+    buffers = [os.urandom(n) for n in (0, 1, 31, 32, 1024, 100000)]
+    buffers.append(bytearray(b'abc'))
+    buffers.append(memoryview(b'abc'))
+    assert lz4.xxhash.xxh32_batch(buffers) == [lz4.xxhash.xxh32(b) for b in buffers]
+    assert lz4.xxhash.xxh64_batch(buffers, seed=7) == [lz4.xxhash.xxh64(b, seed=7) for b in buffers]
+    assert lz4.xxhash.xxh32_batch(()) == []
+
+
+def test_batch_invalid():
+    with pytest.raises(TypeError):
+        lz4.xxhash.xxh32_batch(1)
+    with pytest.raises(TypeError):
+        lz4.xxhash.xxh64_batch([b'a', u'b'])
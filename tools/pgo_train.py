@@ -0,0 +1,84 @@
+#!/usr/bin/env python
+"""Training run for profile-guided optimization builds, see PYLZ4_PGO in
+setup.py.
+
+Compresses and decompresses a corpus built from the files shipped with the
+package, with the mix of text, source code and binary data that it has, at a
+range of compression levels and through each of the APIs. Decompression is
+run more often than compression, so that its code paths weigh more in the
+profile.
+
+"""
+
+import os
+import struct
+import sys
+
+import lz4.block
+import lz4.frame
+
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+CORPUS_DIRS = ['lz4libs', 'lz4', 'docs', 'tests']
+
+CORPUS_SUFFIXES = ('.c', '.h', '.py', '.rst', '.txt', '.toml', '.cfg')
+
+
+def corpus():
+    samples = []
+    for directory in CORPUS_DIRS:
+        for dirpath, _, filenames in sorted(os.walk(os.path.join(ROOT,
+                                                                 directory))):
+            for filename in sorted(filenames):
+                if filename.endswith(CORPUS_SUFFIXES):
+                    with open(os.path.join(dirpath, filename), 'rb') as f:
+                        samples.append(f.read())
+    text = b''.join(samples)
+    # Numeric records, as written by applications, and incompressible data.
+    records = b''.join(
+        struct.pack('<QdI', i * 1000 + i % 7, i * 0.25, i % 251)
+        for i in range(50000)
+    )
+    noise = os.urandom(256 * 1024)
+    return [text, records, noise, text[:4096], records[:65536]]
+
+
+def main():
+    data = corpus()
+    for sample in data:
+        for mode, levels in (('default', [1]), ('fast', [1, 8]),
+                             ('high_compression', [3, 9])):
+            for level in levels:
+                compressed = lz4.block.compress(
+                    sample, mode=mode, acceleration=level, compression=level
+                )
+                for _ in range(8):
+                    assert lz4.block.decompress(compressed) == sample
+
+        for level in (0, 3, 9):
+            for block_size in (lz4.frame.BLOCKSIZE_MAX64KB,
+                               lz4.frame.BLOCKSIZE_MAX4MB):
+                compressed = lz4.frame.compress(
+                    sample, compression_level=level, block_size=block_size,
+                    content_checksum=True,
+                )
+                for _ in range(8):
+                    assert lz4.frame.decompress(compressed) == sample
+
+        compressor = lz4.frame.LZ4FrameCompressor(block_linked=True)
+        chunks = [compressor.begin()]
+        for i in range(0, len(sample), 16384):
+            chunks.append(compressor.compress(sample[i:i + 16384]))
+        chunks.append(compressor.flush())
+        compressed = b''.join(chunks)
+        for _ in range(4):
+            decompressor = lz4.frame.LZ4FrameDecompressor()
+            out = [decompressor.decompress(compressed[i:i + 8192])
+                   for i in range(0, len(compressed), 8192)]
+            assert b''.join(out) == sample
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())